@@ -0,0 +1,47 @@
+# Times Gumath::Graphs on random graphs of growing size against the
+# single_source_shortest_paths kernel of Gumath::Examples:
+#
+#   ruby -Ilib benchmark/graphs.rb [nodes] [degree]
+#
+# Every node gets `degree` out-edges to uniformly random nodes with weights
+# in [0, 10). The example kernel is only run on the smaller graphs.
+
+require 'gumath'
+
+NODES = (ARGV[0] || 1_000_000).to_i
+DEGREE = (ARGV[1] || 8).to_i
+EXAMPLE_LIMIT = 10_000
+
+def time
+  t = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  yield
+  Process.clock_gettime(Process::CLOCK_MONOTONIC) - t
+end
+
+def random_graph n, degree
+  rng = Random.new(42)
+  Array.new(n) { Array.new(degree) { [rng.rand(n), rng.rand * 10] } }
+end
+
+puts format("%10s %10s %12s %12s %14s %12s", "nodes", "edges", "bfs (s)",
+            "dijkstra (s)", "8 sources (s)", "example (s)")
+
+n = 1_000
+while n <= NODES
+  data = random_graph n, DEGREE
+  graph = XND.new data, typedef: "graph"
+  sources = Array.new(8) { |i| i * n / 8 }
+
+  bfs = time { Gumath::Graphs.bfs graph, 0 }
+  dijkstra = time { Gumath::Graphs.dijkstra graph, 0 }
+  many = time { Gumath::Graphs.dijkstra graph, sources }
+  example = if n <= EXAMPLE_LIMIT
+              format("%12.4f", time { Gumath::Examples.single_source_shortest_paths graph, XND.new(0, type: "node") })
+            else
+              format("%12s", "-")
+            end
+
+  puts format("%10d %10d %12.4f %12.4f %14.4f %s", n, n * DEGREE, bfs,
+              dijkstra, many, example)
+  n *= 10
+end
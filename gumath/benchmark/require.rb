@@ -0,0 +1,55 @@
+# Measures the time and resident memory that `require 'gumath'` costs, and
+# what touching each kernel module adds on top of that.
+#
+# Kernel groups are loaded lazily, so the first line is what a program that
+# never calls a kernel pays. To compare with the commit before the lazy
+# registry (there everything is loaded by require), pass the load path of
+# each build; entries of one load path are separated like in $RUBYLIB, and
+# every build gets its own columns:
+#
+#   ruby -Ilib benchmark/require.rb [runs]
+#   ruby benchmark/require.rb [runs] OLD_TREE/lib:... NEW_TREE/lib:...
+
+require 'rbconfig'
+
+runs = (ARGV[0] || 10).to_i
+paths = ARGV[1..].map { |p| p.split(File::PATH_SEPARATOR) }
+paths = [$LOAD_PATH] if paths.empty?
+
+STEPS = {
+  "require"               => "",
+  "+ Gumath::Functions"   => "Gumath::Functions",
+  "+ Gumath::Examples"    => "Gumath::Functions; Gumath::Examples",
+}
+
+# Child script: prints wall time of the step in ms and VmRSS in kB.
+def measure(code, path)
+  script = <<~RUBY
+    t = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    require 'gumath'
+    #{code}
+    t = Process.clock_gettime(Process::CLOCK_MONOTONIC) - t
+    rss = File.read("/proc/self/status")[/VmRSS:\\s+(\\d+)/, 1].to_i
+    puts "\#{t * 1000} \#{rss}"
+  RUBY
+  includes = path.flat_map { |p| ["-I", p] }
+  out = IO.popen([RbConfig.ruby, *includes, "-e", script], &:read)
+  out.split.map(&:to_f)
+end
+
+base_rss = IO.popen([RbConfig.ruby, "-e",
+                     'puts File.read("/proc/self/status")[/VmRSS:\s+(\d+)/, 1]'],
+                    &:read).to_i
+
+header = paths.size > 1 ? paths.each_index.map { |i| "##{i + 1} " } : [""]
+puts format("%-22s", "") +
+     header.map { |h| format("%12s %14s", "#{h}time (ms)", "#{h}+RSS (MB)") }.join(" ")
+STEPS.each do |label, code|
+  cells = paths.map do |path|
+    samples = Array.new(runs) { measure(code, path) }
+    time = samples.map(&:first).sort[runs / 2]
+    rss = samples.map(&:last).sort[runs / 2]
+    format("%12.2f %14.2f", time, (rss - base_rss) / 1024.0)
+  end
+  puts format("%-22s", label) + cells.join(" ")
+end
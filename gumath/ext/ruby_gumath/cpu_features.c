@@ -0,0 +1,186 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+   CPU feature detection. CPUID is read once at load time; a feature only
+   counts if the operating system also saves the registers it uses (XCR0),
+   so that AVX on a kernel without XSAVE support is reported as missing.
+*/
+
+#include "ruby_gumath_internal.h"
+#include "cpu_features.h"
+
+#ifdef GM_CPU_X86
+#include <cpuid.h>
+#endif
+
+enum {
+  F_SSE2, F_SSE4_2, F_AVX, F_FMA, F_AVX2, F_BMI2,
+  F_AVX512F, F_AVX512DQ, F_AVX512BW, F_AVX512VL,
+  F_NFEATURES
+};
+
+static gm_cpu_feature_t features[F_NFEATURES + 1] = {
+  [F_SSE2] = { "sse2", 0 },
+  [F_SSE4_2] = { "sse4_2", 0 },
+  [F_AVX] = { "avx", 0 },
+  [F_FMA] = { "fma", 0 },
+  [F_AVX2] = { "avx2", 0 },
+  [F_BMI2] = { "bmi2", 0 },
+  [F_AVX512F] = { "avx512f", 0 },
+  [F_AVX512DQ] = { "avx512dq", 0 },
+  [F_AVX512BW] = { "avx512bw", 0 },
+  [F_AVX512VL] = { "avx512vl", 0 },
+  [F_NFEATURES] = { NULL, 0 }
+};
+
+static const char *tier_names[GM_CPU_NTIERS] = {
+  [GM_CPU_BASE] = "base",
+  [GM_CPU_AVX2] = "avx2",
+  [GM_CPU_AVX512] = "avx512"
+};
+
+static gm_cpu_tier_t max_tier = GM_CPU_BASE;
+static gm_cpu_tier_t tier = GM_CPU_BASE;
+static int probed = 0;
+
+#ifdef GM_CPU_X86
+static uint64_t
+xgetbv0(void)
+{
+  uint32_t lo, hi;
+
+  __asm__ volatile ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static void
+probe(void)
+{
+  unsigned int a, b, c, d;
+  uint64_t xcr0 = 0;
+  int ymm, zmm;
+
+  if (!__get_cpuid(1, &a, &b, &c, &d)) {
+    return;
+  }
+
+  features[F_SSE2].supported = (d >> 26) & 1;
+  features[F_SSE4_2].supported = (c >> 20) & 1;
+
+  /* OSXSAVE: the OS manages the extended register state. */
+  if ((c >> 27) & 1) {
+    xcr0 = xgetbv0();
+  }
+  ymm = (xcr0 & 0x6) == 0x6;
+  zmm = (xcr0 & 0xe6) == 0xe6;
+
+  features[F_AVX].supported = ymm && ((c >> 28) & 1);
+  features[F_FMA].supported = ymm && ((c >> 12) & 1);
+
+  if (__get_cpuid_max(0, NULL) >= 7) {
+    __cpuid_count(7, 0, a, b, c, d);
+    features[F_AVX2].supported = ymm && ((b >> 5) & 1);
+    features[F_BMI2].supported = (b >> 8) & 1;
+    features[F_AVX512F].supported = zmm && ((b >> 16) & 1);
+    features[F_AVX512DQ].supported = zmm && ((b >> 17) & 1);
+    features[F_AVX512BW].supported = zmm && ((b >> 30) & 1);
+    features[F_AVX512VL].supported = zmm && ((b >> 31) & 1);
+  }
+
+  if (features[F_AVX2].supported && features[F_FMA].supported) {
+    max_tier = GM_CPU_AVX2;
+    if (features[F_AVX512F].supported) {
+      max_tier = GM_CPU_AVX512;
+    }
+  }
+}
+#else
+static void
+probe(void)
+{
+}
+#endif
+
+void
+rb_gumath_cpu_init(void)
+{
+  const char *env;
+  int i;
+
+  if (probed) {
+    return;
+  }
+  probed = 1;
+
+  probe();
+  tier = max_tier;
+
+  env = getenv("GUMATH_CPU_TIER");
+  if (env == NULL || *env == '\0') {
+    return;
+  }
+
+  for (i = 0; i < GM_CPU_NTIERS; i++) {
+    if (strcmp(env, tier_names[i]) == 0) {
+      if ((gm_cpu_tier_t)i < tier) {
+        tier = (gm_cpu_tier_t)i;
+      }
+      return;
+    }
+  }
+
+  rb_warn("gumath: ignoring unknown GUMATH_CPU_TIER '%s' (expected base, avx2 or avx512)", env);
+}
+
+gm_cpu_tier_t
+rb_gumath_cpu_tier(void)
+{
+  return tier;
+}
+
+gm_cpu_tier_t
+rb_gumath_cpu_max_tier(void)
+{
+  return max_tier;
+}
+
+const char *
+rb_gumath_cpu_tier_name(gm_cpu_tier_t t)
+{
+  return tier_names[t];
+}
+
+const gm_cpu_feature_t *
+rb_gumath_cpu_features(void)
+{
+  return features;
+}
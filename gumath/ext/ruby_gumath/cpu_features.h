@@ -0,0 +1,86 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Runtime CPU feature detection for multi-versioned kernels. */
+
+#ifndef GUMATH_CPU_FEATURES_H
+#define GUMATH_CPU_FEATURES_H
+
+/* Kernels have AVX2 and AVX-512 variants only when built for x86 by a
+   compiler with GNU extensions. */
+#if defined(__GNUC__) && !defined(_MSC_VER) && (defined(__x86_64__) || defined(__i386__))
+#define GM_CPU_X86
+#endif
+
+/* Compile the functions between GM_TARGET_PUSH("avx2,fma") and
+   GM_TARGET_POP for that instruction set, whatever the flags of the file. */
+#ifdef GM_CPU_X86
+#define GM_PRAGMA(x) _Pragma(#x)
+#if defined(__clang__)
+#define GM_TARGET_PUSH(isa) \
+  GM_PRAGMA(clang attribute push (__attribute__((target(isa))), apply_to = function))
+#define GM_TARGET_POP GM_PRAGMA(clang attribute pop)
+#else
+#define GM_TARGET_PUSH(isa) GM_PRAGMA(GCC push_options) GM_PRAGMA(GCC target(isa))
+#define GM_TARGET_POP GM_PRAGMA(GCC pop_options)
+#endif
+#endif
+
+/* Instruction set tiers, lowest first. */
+typedef enum {
+  GM_CPU_BASE,
+  GM_CPU_AVX2,      /* AVX2 + FMA */
+  GM_CPU_AVX512,    /* AVX-512F */
+  GM_CPU_NTIERS
+} gm_cpu_tier_t;
+
+typedef struct {
+  const char *name;
+  int supported;
+} gm_cpu_feature_t;
+
+/* Probe the CPU once. The environment variable GUMATH_CPU_TIER=base|avx2|
+   avx512 lowers the tier kernels are registered for; it cannot raise it
+   above what the CPU supports. Called at load time. */
+void rb_gumath_cpu_init(void);
+
+/* Tier that kernels registered from now on use. */
+gm_cpu_tier_t rb_gumath_cpu_tier(void);
+
+/* Best tier of the CPU, ignoring GUMATH_CPU_TIER. */
+gm_cpu_tier_t rb_gumath_cpu_max_tier(void);
+
+const char *rb_gumath_cpu_tier_name(gm_cpu_tier_t tier);
+
+/* Probed features, terminated by an entry with a NULL name. */
+const gm_cpu_feature_t *rb_gumath_cpu_features(void);
+
+#endif  /* GUMATH_CPU_FEATURES_H */
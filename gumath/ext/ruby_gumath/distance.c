@@ -0,0 +1,713 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+   Distances between the rows of matrices: pdist (condensed, every pair of
+   rows of one matrix), cdist (every row of a against every row of b) and
+   knn (the k nearest rows of b for every row of a), with the euclidean,
+   sqeuclidean, cosine and manhattan metrics on float32 and float64.
+
+   Like the reductions these are direct entry points in Gumath::Distances:
+   the condensed output length N*(N-1)/2 and the k of knn do not fit a
+   gufunc signature.
+
+   Rows of a are split into blocks of about DIST_BLOCK_BYTES, one pool task
+   each. A task walks b in tiles of about DIST_TILE_BYTES and computes the
+   distances of every row of its block to the tile, so each tile is loaded
+   from memory once per block and then read from L1. The distance of a pair
+   of rows is computed by the vector kernels of distance_impl.h for the CPU
+   tier. knn keeps a bounded max-heap of k entries per row of the block
+   and never stores more than one tile of distances.
+
+   Every distance is computed the same way whatever the tiling, so results
+   do not depend on the number of threads.
+*/
+
+#include <math.h>
+#include "ruby_gumath_internal.h"
+#include "thread_pool.h"
+#include "cpu_features.h"
+
+enum { DIST_EUCLIDEAN, DIST_SQEUCLIDEAN, DIST_COSINE, DIST_MANHATTAN, DIST_NMETRICS };
+enum { DIST_FLOAT32, DIST_FLOAT64, DIST_NTYPES };
+enum dist_op { D_PDIST, D_CDIST, D_KNN };
+
+/* Distances from row a to the nb rows starting at b, b_stride bytes apart. */
+typedef void (*dist_rows_t)(int metric, const char *a, const char *b, int64_t nb,
+                            int64_t b_stride, int64_t m, double *out);
+
+/****************************************************************************/
+/*                                Parameters                                */
+/****************************************************************************/
+
+/* Bytes of b per tile, which should stay in L1. */
+#define DIST_TILE_BYTES (1 << 15)
+
+/* Upper bound on the rows of a tile (the distances of a tile are kept on
+   the stack). */
+#define DIST_MAX_TILE 512
+
+/* Bytes of a per task, which should stay in L2. */
+#define DIST_BLOCK_BYTES (1 << 18)
+
+/* Bytes of knn heaps per task. */
+#define DIST_HEAP_BYTES (1 << 20)
+
+/* Calls with less work than this (pairs times columns) keep the GVL. */
+#define DIST_GVL_CUTOFF (1 << 16)
+
+/****************************************************************************/
+/*                                  Kernels                                 */
+/****************************************************************************/
+
+#if defined(__GNUC__) && !defined(_MSC_VER)
+
+#define SIMD_CAT_(a, b) a##_##b
+#define SIMD_CAT(a, b) SIMD_CAT_(a, b)
+
+#define SIMD_TIER base
+#define SIMD_BYTES 16
+#include "distance_impl.h"
+#undef SIMD_BYTES
+#undef SIMD_TIER
+
+#ifdef GM_CPU_X86
+GM_TARGET_PUSH("avx2,fma")
+#define SIMD_TIER avx2
+#define SIMD_BYTES 32
+#include "distance_impl.h"
+#undef SIMD_BYTES
+#undef SIMD_TIER
+GM_TARGET_POP
+
+GM_TARGET_PUSH("avx512f")
+#define SIMD_TIER avx512
+#define SIMD_BYTES 64
+#include "distance_impl.h"
+#undef SIMD_BYTES
+#undef SIMD_TIER
+GM_TARGET_POP
+#endif  /* GM_CPU_X86 */
+
+static const dist_rows_t *
+dist_kernels(void)
+{
+  switch (rb_gumath_cpu_tier()) {
+#ifdef GM_CPU_X86
+  case GM_CPU_AVX512: return dist_rows_avx512;
+  case GM_CPU_AVX2: return dist_rows_avx2;
+#endif
+  default: return dist_rows_base;
+  }
+}
+
+#else  /* no vector extensions */
+
+#define SCALAR_ROWS(NAME, T)                                            \
+static void                                                             \
+rows_##NAME(int metric, const char *a, const char *b, int64_t nb,       \
+            int64_t b_stride, int64_t m, double *out)                   \
+{                                                                       \
+  const T *x = (const T *)a;                                            \
+  int64_t i, j;                                                         \
+                                                                        \
+  for (j = 0; j < nb; j++, b += b_stride) {                             \
+    const T *y = (const T *)b;                                          \
+    T s = 0, aa = 0, bb = 0;                                            \
+    for (i = 0; i < m; i++) {                                           \
+      switch (metric) {                                                 \
+      case DIST_EUCLIDEAN: case DIST_SQEUCLIDEAN:                       \
+        s += (x[i] - y[i]) * (x[i] - y[i]);                             \
+        break;                                                          \
+      case DIST_COSINE:                                                 \
+        s += x[i] * y[i];                                               \
+        aa += x[i] * x[i];                                              \
+        bb += y[i] * y[i];                                              \
+        break;                                                          \
+      default:                                                          \
+        s += x[i] > y[i] ? x[i] - y[i] : y[i] - x[i];                   \
+        break;                                                          \
+      }                                                                 \
+    }                                                                   \
+    out[j] = metric == DIST_EUCLIDEAN ? sqrt((double)s)                 \
+           : metric == DIST_COSINE ? 1.0 - s / sqrt((double)aa * bb)    \
+           : s;                                                         \
+  }                                                                     \
+}
+
+SCALAR_ROWS(float32, float)
+SCALAR_ROWS(float64, double)
+
+static const dist_rows_t scalar_rows[DIST_NTYPES] = {
+  [DIST_FLOAT32] = rows_float32,
+  [DIST_FLOAT64] = rows_float64
+};
+
+static const dist_rows_t *
+dist_kernels(void)
+{
+  return scalar_rows;
+}
+
+#endif
+
+/****************************************************************************/
+/*                                  Driver                                  */
+/****************************************************************************/
+
+typedef struct {
+  enum dist_op op;
+  dist_rows_t rows;
+  int metric;
+  int type;
+  int64_t itemsize;
+  const char *a;              /* first row of a */
+  const char *b;              /* first row of b; a for pdist */
+  int64_t a_stride;           /* bytes between rows */
+  int64_t b_stride;
+  int64_t na, nb, m;
+  int64_t block;              /* rows of a per task */
+  int64_t tile;               /* rows of b per tile */
+  char *out;                  /* distances */
+  int64_t *idx;               /* knn: indices */
+  int64_t k;
+  int64_t nthreads;
+  int nogvl;                  /* run without the GVL */
+  volatile int stop;          /* set by the unblocking function */
+  uint8_t *done;              /* finished blocks, skipped after a restart */
+  int ret;
+  ndt_context_t ctx;
+} dist_t;
+
+typedef struct {
+  double d;
+  int64_t i;
+} knn_entry_t;
+
+static inline void
+store(const dist_t *d, int64_t i, double v)
+{
+  if (d->type == DIST_FLOAT32) {
+    ((float *)d->out)[i] = (float)v;
+  }
+  else {
+    ((double *)d->out)[i] = v;
+  }
+}
+
+/* Rows [r0, r1) of a against every later row, into the condensed output. */
+static void
+pdist_block(const dist_t *d, int64_t r0, int64_t r1, double *buf)
+{
+  int64_t t0, t1, r, j, j0, base;
+
+  for (t0 = r0 + 1; t0 < d->na; t0 += d->tile) {
+    t1 = t0 + d->tile < d->na ? t0 + d->tile : d->na;
+    for (r = r0; r < r1 && r + 1 < t1; r++) {
+      j0 = t0 > r + 1 ? t0 : r + 1;
+      d->rows(d->metric, d->a + r * d->a_stride, d->a + j0 * d->a_stride,
+              t1 - j0, d->a_stride, d->m, buf);
+
+      /* Pair (r, j), j > r, is at r*n - r*(r+1)/2 + j - r - 1. */
+      base = r * d->na - r * (r + 1) / 2 - r - 1;
+      for (j = j0; j < t1; j++) {
+        store(d, base + j, buf[j - j0]);
+      }
+    }
+  }
+}
+
+static void
+cdist_block(const dist_t *d, int64_t r0, int64_t r1, double *buf)
+{
+  int64_t t0, t1, r, j;
+
+  for (t0 = 0; t0 < d->nb; t0 += d->tile) {
+    t1 = t0 + d->tile < d->nb ? t0 + d->tile : d->nb;
+    for (r = r0; r < r1; r++) {
+      d->rows(d->metric, d->a + r * d->a_stride, d->b + t0 * d->b_stride,
+              t1 - t0, d->b_stride, d->m, buf);
+      for (j = t0; j < t1; j++) {
+        store(d, r * d->nb + j, buf[j - t0]);
+      }
+    }
+  }
+}
+
+/* NaN distances rank after all others; equal distances by index. */
+static inline int
+knn_worse(const knn_entry_t *x, const knn_entry_t *y)
+{
+  const int nx = isnan(x->d), ny = isnan(y->d);
+
+  if (nx != ny) {
+    return nx;
+  }
+  if (!nx && x->d != y->d) {
+    return x->d > y->d;
+  }
+  return x->i > y->i;
+}
+
+static void
+knn_sift_down(knn_entry_t *h, int64_t n, int64_t pos)
+{
+  const knn_entry_t e = h[pos];
+  int64_t child;
+
+  while ((child = 2 * pos + 1) < n) {
+    if (child + 1 < n && knn_worse(&h[child + 1], &h[child])) {
+      child++;
+    }
+    if (!knn_worse(&h[child], &e)) {
+      break;
+    }
+    h[pos] = h[child];
+    pos = child;
+  }
+  h[pos] = e;
+}
+
+static void
+knn_sift_up(knn_entry_t *h, int64_t pos)
+{
+  const knn_entry_t e = h[pos];
+
+  while (pos > 0) {
+    const int64_t parent = (pos - 1) / 2;
+    if (!knn_worse(&e, &h[parent])) {
+      break;
+    }
+    h[pos] = h[parent];
+    pos = parent;
+  }
+  h[pos] = e;
+}
+
+static int
+knn_block(const dist_t *d, int64_t r0, int64_t r1, double *buf, ndt_context_t *ctx)
+{
+  const int64_t k = d->k;
+  knn_entry_t *heaps, *h, e;
+  int64_t t0, t1, r, j, n;
+
+  heaps = ndt_alloc(r1 - r0, k * sizeof(knn_entry_t));
+  if (heaps == NULL) {
+    (void)ndt_memory_error(ctx);
+    return -1;
+  }
+
+  for (t0 = 0; t0 < d->nb; t0 += d->tile) {
+    t1 = t0 + d->tile < d->nb ? t0 + d->tile : d->nb;
+    for (r = r0; r < r1; r++) {
+      d->rows(d->metric, d->a + r * d->a_stride, d->b + t0 * d->b_stride,
+              t1 - t0, d->b_stride, d->m, buf);
+
+      /* Every row of the block has seen the same t0 rows of b. */
+      h = heaps + (r - r0) * k;
+      n = t0 < k ? t0 : k;
+      for (j = t0; j < t1; j++) {
+        e.d = buf[j - t0];
+        e.i = j;
+        if (n < k) {
+          h[n] = e;
+          knn_sift_up(h, n++);
+        }
+        else if (knn_worse(&h[0], &e)) {
+          h[0] = e;
+          knn_sift_down(h, k, 0);
+        }
+      }
+    }
+  }
+
+  /* Heap sort each row into ascending order. */
+  for (r = r0; r < r1; r++) {
+    h = heaps + (r - r0) * k;
+    for (n = k - 1; n > 0; n--) {
+      e = h[0];
+      h[0] = h[n];
+      h[n] = e;
+      knn_sift_down(h, n, 0);
+    }
+    for (j = 0; j < k; j++) {
+      store(d, r * k + j, h[j].d);
+      d->idx[r * k + j] = h[j].i;
+    }
+  }
+
+  ndt_free(heaps);
+  return 0;
+}
+
+static int
+dist_task(void *job, int64_t i, ndt_context_t *ctx)
+{
+  const dist_t *d = (const dist_t *)job;
+  const int64_t r0 = i * d->block;
+  const int64_t r1 = r0 + d->block < d->na ? r0 + d->block : d->na;
+  double buf[DIST_MAX_TILE];
+  int ret;
+
+  if (d->stop || (d->done != NULL && d->done[i])) {
+    return 0;
+  }
+
+  switch (d->op) {
+  case D_PDIST: pdist_block(d, r0, r1, buf); ret = 0; break;
+  case D_CDIST: cdist_block(d, r0, r1, buf); ret = 0; break;
+  default: ret = knn_block(d, r0, r1, buf, ctx); break;
+  }
+
+  if (ret == 0 && d->done != NULL) {
+    d->done[i] = 1;
+  }
+  return ret;
+}
+
+static void *
+run_dist(void *job)
+{
+  dist_t *d = (dist_t *)job;
+  const int64_t ntasks = (d->na + d->block - 1) / d->block;
+
+  d->ret = rb_gumath_pool_run(d->nthreads, ntasks, dist_task, d, &d->ctx);
+  return NULL;
+}
+
+/* Unblocking function: the remaining tasks return at once. */
+static void
+dist_ubf(void *job)
+{
+  ((dist_t *)job)->stop = 1;
+}
+
+/****************************************************************************/
+/*                                 Setup                                    */
+/****************************************************************************/
+
+typedef struct {
+  const char *ptr;            /* first row */
+  int64_t rows, cols;
+  int64_t stride;             /* bytes between rows */
+  int64_t col_step;           /* bytes between columns */
+  int type;
+  int64_t itemsize;
+  char *packed;               /* contiguous copy, if one was needed */
+} matrix_t;
+
+static void
+matrix_arg(VALUE x, const char *fn, matrix_t *mx)
+{
+  const xnd_t *xnd;
+  const ndt_t *t, *u, *dtype;
+
+  if (!rb_xnd_check_type(x)) {
+    rb_raise(rb_eTypeError, "%s: arguments must be XND.", fn);
+  }
+  xnd = rb_xnd_const_xnd(x);
+  t = xnd->type;
+
+  if (t->tag != FixedDim || t->FixedDim.type->tag != FixedDim ||
+      t->FixedDim.type->FixedDim.type->ndim != 0) {
+    rb_raise(rb_eTypeError, "%s: need an N * M * float32 or float64 array.", fn);
+  }
+  u = t->FixedDim.type;
+  dtype = u->FixedDim.type;
+  if ((dtype->tag != Float32 && dtype->tag != Float64) || ndt_is_optional(dtype)) {
+    rb_raise(rb_eTypeError, "%s: need an N * M * float32 or float64 array.", fn);
+  }
+
+  mx->type = dtype->tag == Float32 ? DIST_FLOAT32 : DIST_FLOAT64;
+  mx->itemsize = dtype->datasize;
+  mx->rows = t->FixedDim.shape;
+  mx->cols = u->FixedDim.shape;
+  mx->ptr = xnd->ptr + xnd->index * mx->itemsize;
+  mx->stride = t->Concrete.FixedDim.step * mx->itemsize;
+  mx->col_step = u->Concrete.FixedDim.step * mx->itemsize;
+  mx->packed = NULL;
+}
+
+/* The kernels read rows as contiguous runs. */
+static void
+matrix_pack(matrix_t *mx)
+{
+  int64_t i, j;
+
+  if (mx->col_step == mx->itemsize || mx->cols <= 1) {
+    return;
+  }
+
+  mx->packed = ALLOC_N(char, mx->rows * mx->cols * mx->itemsize);
+  for (i = 0; i < mx->rows; i++) {
+    for (j = 0; j < mx->cols; j++) {
+      memcpy(mx->packed + (i * mx->cols + j) * mx->itemsize,
+             mx->ptr + i * mx->stride + j * mx->col_step, mx->itemsize);
+    }
+  }
+  mx->ptr = mx->packed;
+  mx->stride = mx->cols * mx->itemsize;
+}
+
+static int
+parse_metric(VALUE metric, const char *fn)
+{
+  static const char *const names[DIST_NMETRICS] = {
+    "euclidean", "sqeuclidean", "cosine", "manhattan"
+  };
+  const char *name;
+  int i;
+
+  if (metric == Qundef || NIL_P(metric)) {
+    return DIST_EUCLIDEAN;
+  }
+  if (SYMBOL_P(metric)) {
+    metric = rb_sym2str(metric);
+  }
+  name = StringValueCStr(metric);
+
+  for (i = 0; i < DIST_NMETRICS; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      return i;
+    }
+  }
+
+  rb_raise(rb_eArgError, "%s: unknown metric %s, expected euclidean, "
+           "sqeuclidean, cosine or manhattan.", fn, name);
+}
+
+static VALUE
+empty_xnd(const char *type)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  ndt_t *t = ndt_from_string(type, &ctx);
+
+  if (t == NULL) {
+    rb_ndtypes_set_error(&ctx);
+    raise_error();
+  }
+
+  return rb_xnd_empty_from_type(t);
+}
+
+/* What dist_body and dist_cleanup work on. */
+typedef struct {
+  dist_t *d;
+  matrix_t *ma, *mb;
+} dist_call_t;
+
+/* Pack the arrays and run. Large calls release the GVL; if an interrupt
+   stops them and its handler does not raise, they go on with the blocks
+   that were not finished yet. */
+static VALUE
+dist_body(VALUE arg)
+{
+  dist_call_t *c = (dist_call_t *)arg;
+  dist_t *d = c->d;
+
+  matrix_pack(c->ma);
+  if (d->op != D_PDIST) {
+    matrix_pack(c->mb);
+  }
+  d->a = c->ma->ptr;
+  d->a_stride = c->ma->stride;
+  d->b = d->op == D_PDIST ? c->ma->ptr : c->mb->ptr;
+  d->b_stride = d->op == D_PDIST ? c->ma->stride : c->mb->stride;
+
+  if (!d->nogvl) {
+    run_dist(d);
+    return Qnil;
+  }
+
+  d->done = ZALLOC_N(uint8_t, (d->na + d->block - 1) / d->block);
+  do {
+    d->stop = 0;
+    rb_thread_call_without_gvl(run_dist, d, dist_ubf, d);
+  } while (d->stop && d->ret == 0);
+
+  return Qnil;
+}
+
+static VALUE
+dist_cleanup(VALUE arg)
+{
+  dist_call_t *c = (dist_call_t *)arg;
+
+  xfree(c->ma->packed);
+  xfree(c->mb->packed);
+  xfree(c->d->done);
+  c->d->done = NULL;
+  return Qnil;
+}
+
+static VALUE
+distance(int argc, VALUE *argv, enum dist_op op)
+{
+  static const char *const names[] = {"pdist", "cdist", "knn"};
+  static const char *const dtypes[] = {"float32", "float64"};
+  const char *fn = names[op];
+  VALUE a, b = Qnil, k = Qnil, opts, metric = Qundef, result, indices = Qnil;
+  matrix_t ma, mb;
+  dist_t d;
+  dist_call_t call = {&d, &ma, &mb};
+  char type[128];
+  ID kw[1];
+  int64_t rows, tile;
+
+  switch (op) {
+  case D_PDIST: rb_scan_args(argc, argv, "1:", &a, &opts); break;
+  case D_CDIST: rb_scan_args(argc, argv, "2:", &a, &b, &opts); break;
+  default: rb_scan_args(argc, argv, "3:", &a, &b, &k, &opts); break;
+  }
+  if (!NIL_P(opts)) {
+    kw[0] = rb_intern("metric");
+    rb_get_kwargs(opts, kw, 0, 1, &metric);
+  }
+
+  memset(&d, 0, sizeof d);
+  d.op = op;
+  d.metric = parse_metric(metric, fn);
+  d.nthreads = rb_gumath_call_threads();
+
+  matrix_arg(a, fn, &ma);
+  mb = ma;
+  if (op != D_PDIST) {
+    matrix_arg(b, fn, &mb);
+    if (mb.type != ma.type) {
+      rb_raise(rb_eTypeError, "%s: both arrays must have the same dtype.", fn);
+    }
+    if (mb.cols != ma.cols) {
+      rb_raise(rb_eArgError, "%s: rows of length %" PRIi64 " and %" PRIi64 ".",
+               fn, ma.cols, mb.cols);
+    }
+  }
+
+  d.type = ma.type;
+  d.itemsize = ma.itemsize;
+  d.na = ma.rows;
+  d.nb = mb.rows;
+  d.m = ma.cols;
+
+  switch (op) {
+  case D_PDIST:
+    snprintf(type, sizeof type, "%" PRIi64 " * %s", d.na * (d.na - 1) / 2, dtypes[d.type]);
+    break;
+  case D_CDIST:
+    snprintf(type, sizeof type, "%" PRIi64 " * %" PRIi64 " * %s", d.na, d.nb, dtypes[d.type]);
+    break;
+  default:
+    d.k = NUM2LL(k);
+    if (d.k < 1 || d.k > d.nb) {
+      rb_raise(rb_eArgError, "%s: k must be between 1 and the rows of b "
+               "(%" PRIi64 ").", fn, d.nb);
+    }
+    snprintf(type, sizeof type, "%" PRIi64 " * %" PRIi64 " * %s", d.na, d.k, dtypes[d.type]);
+    break;
+  }
+  result = empty_xnd(type);
+  d.out = rb_xnd_const_xnd(result)->ptr;
+  if (op == D_KNN) {
+    snprintf(type, sizeof type, "%" PRIi64 " * %" PRIi64 " * int64", d.na, d.k);
+    indices = empty_xnd(type);
+    d.idx = (int64_t *)rb_xnd_const_xnd(indices)->ptr;
+  }
+
+  if (d.na == 0 || d.nb == 0) {
+    return op == D_KNN ? rb_assoc_new(result, indices) : result;
+  }
+
+  d.rows = dist_kernels()[d.type];
+
+  /* Tiles of b for L1, blocks of a for L2, and at least four blocks per
+     thread so that the pool can balance them. */
+  tile = DIST_TILE_BYTES / (d.m * d.itemsize + 1);
+  d.tile = tile < 1 ? 1 : tile > DIST_MAX_TILE ? DIST_MAX_TILE : tile;
+
+  rows = DIST_BLOCK_BYTES / (d.m * d.itemsize + 1);
+  if (op == D_KNN && rows > DIST_HEAP_BYTES / (d.k * (int64_t)sizeof(knn_entry_t))) {
+    rows = DIST_HEAP_BYTES / (d.k * (int64_t)sizeof(knn_entry_t));
+  }
+  if (rows > (d.na + 4 * d.nthreads - 1) / (4 * d.nthreads)) {
+    rows = (d.na + 4 * d.nthreads - 1) / (4 * d.nthreads);
+  }
+  d.block = rows < 1 ? 1 : rows;
+
+  d.nogvl = (double)d.na * d.nb * (d.m + 1) >= DIST_GVL_CUTOFF;
+  rb_ensure(dist_body, (VALUE)&call, dist_cleanup, (VALUE)&call);
+
+  if (d.ret < 0) {
+    rb_ndtypes_set_error(&d.ctx);
+    raise_error();
+  }
+
+  RB_GC_GUARD(a);
+  RB_GC_GUARD(b);
+  return op == D_KNN ? rb_assoc_new(result, indices) : result;
+}
+
+/****************************************************************************/
+/*                               Ruby methods                               */
+/****************************************************************************/
+
+/* Gumath::Distances.pdist(x, metric: :euclidean): distances between all
+   pairs of rows of an N * M array, in the condensed order (0,1), (0,2), ...,
+   (1,2), ... of length N*(N-1)/2. */
+static VALUE
+mGumath_Distances_s_pdist(int argc, VALUE *argv, VALUE module)
+{
+  return distance(argc, argv, D_PDIST);
+}
+
+/* cdist(a, b, metric: :euclidean): NA * NB distances. */
+static VALUE
+mGumath_Distances_s_cdist(int argc, VALUE *argv, VALUE module)
+{
+  return distance(argc, argv, D_CDIST);
+}
+
+/* knn(a, b, k, metric: :euclidean): [distances, indices], both NA * k, of
+   the k rows of b nearest to each row of a, nearest first. Ties go to the
+   lower index and NaN distances come last. */
+static VALUE
+mGumath_Distances_s_knn(int argc, VALUE *argv, VALUE module)
+{
+  return distance(argc, argv, D_KNN);
+}
+
+void
+Init_gumath_distances(void)
+{
+  VALUE mGumath_Distances = rb_define_module_under(cGumath, "Distances");
+
+  rb_define_singleton_method(mGumath_Distances, "pdist", mGumath_Distances_s_pdist, -1);
+  rb_define_singleton_method(mGumath_Distances, "cdist", mGumath_Distances_s_cdist, -1);
+  rb_define_singleton_method(mGumath_Distances, "knn", mGumath_Distances_s_knn, -1);
+}
@@ -0,0 +1,203 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+   Vector bodies of the distance kernels. Like simd_math_impl.h this file
+   has no include guard: distance.c includes it once per instruction set
+   tier, with SIMD_TIER naming the tier and SIMD_BYTES giving its vector
+   width.
+
+   Each distance is accumulated in the precision of the input with two
+   vector accumulators per quantity; the elements that do not fill a
+   vector are added in scalar code.
+*/
+
+#define SIMD_FN(name) SIMD_CAT(name, SIMD_TIER)
+
+#define VD SIMD_FN(vd)
+#define VL SIMD_FN(vl)
+#define VF SIMD_FN(vf)
+#define VI SIMD_FN(vi)
+
+typedef double VD __attribute__((vector_size(SIMD_BYTES)));
+typedef int64_t VL __attribute__((vector_size(SIMD_BYTES)));
+typedef float VF __attribute__((vector_size(SIMD_BYTES)));
+typedef int32_t VI __attribute__((vector_size(SIMD_BYTES)));
+
+#define DIST_KERNELS(NAME, T, V, VINT, ABS_MASK)                              \
+static inline T                                                             \
+SIMD_FN(hsum_##NAME)(V v)                                                   \
+{                                                                           \
+  typedef T Q __attribute__((vector_size(16)));                             \
+  Q q = {0}, t;                                                             \
+  T s = 0;                                                                  \
+  size_t k;                                                                 \
+                                                                            \
+  /* 16-byte quarters first, then lanes: a short dependency chain. */       \
+  for (k = 0; k < sizeof(V); k += 16) {                                     \
+    memcpy(&t, (char *)&v + k, 16);                                         \
+    q += t;                                                                 \
+  }                                                                         \
+  for (k = 0; k < 16 / sizeof(T); k++) {                                    \
+    s += q[k];                                                              \
+  }                                                                         \
+                                                                            \
+  return s;                                                                 \
+}                                                                           \
+                                                                            \
+static inline double                                                        \
+SIMD_FN(sqeuclidean_##NAME)(const T *a, const T *b, int64_t m)              \
+{                                                                           \
+  const int64_t lanes = sizeof(V) / sizeof(T);                              \
+  V s0 = {0}, s1 = {0}, x, y, d;                                            \
+  int64_t i;                                                                \
+  T s;                                                                      \
+                                                                            \
+  for (i = 0; i + 2 * lanes <= m; i += 2 * lanes) {                         \
+    memcpy(&x, a + i, sizeof x);                                            \
+    memcpy(&y, b + i, sizeof y);                                            \
+    d = x - y;                                                              \
+    s0 += d * d;                                                            \
+    memcpy(&x, a + i + lanes, sizeof x);                                    \
+    memcpy(&y, b + i + lanes, sizeof y);                                    \
+    d = x - y;                                                              \
+    s1 += d * d;                                                            \
+  }                                                                         \
+                                                                            \
+  s = SIMD_FN(hsum_##NAME)(s0 + s1);                                        \
+  for (; i < m; i++) {                                                      \
+    const T e = a[i] - b[i];                                                \
+    s += e * e;                                                             \
+  }                                                                         \
+                                                                            \
+  return s;                                                                 \
+}                                                                           \
+                                                                            \
+static inline double                                                        \
+SIMD_FN(manhattan_##NAME)(const T *a, const T *b, int64_t m)                \
+{                                                                           \
+  const int64_t lanes = sizeof(V) / sizeof(T);                              \
+  V s0 = {0}, s1 = {0}, x, y;                                               \
+  int64_t i;                                                                \
+  T s;                                                                      \
+                                                                            \
+  for (i = 0; i + 2 * lanes <= m; i += 2 * lanes) {                         \
+    memcpy(&x, a + i, sizeof x);                                            \
+    memcpy(&y, b + i, sizeof y);                                            \
+    s0 += (V)((VINT)(x - y) & ABS_MASK);                                    \
+    memcpy(&x, a + i + lanes, sizeof x);                                    \
+    memcpy(&y, b + i + lanes, sizeof y);                                    \
+    s1 += (V)((VINT)(x - y) & ABS_MASK);                                    \
+  }                                                                         \
+                                                                            \
+  s = SIMD_FN(hsum_##NAME)(s0 + s1);                                        \
+  for (; i < m; i++) {                                                      \
+    s += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];                           \
+  }                                                                         \
+                                                                            \
+  return s;                                                                 \
+}                                                                           \
+                                                                            \
+/* 1 - a.b / (|a| |b|); NaN if either row is zero. */                       \
+static inline double                                                        \
+SIMD_FN(cosine_##NAME)(const T *a, const T *b, int64_t m)                   \
+{                                                                           \
+  const int64_t lanes = sizeof(V) / sizeof(T);                              \
+  V ab = {0}, aa = {0}, bb = {0}, x, y;                                     \
+  int64_t i;                                                                \
+  T sab, saa, sbb;                                                          \
+                                                                            \
+  for (i = 0; i + lanes <= m; i += lanes) {                                 \
+    memcpy(&x, a + i, sizeof x);                                            \
+    memcpy(&y, b + i, sizeof y);                                            \
+    ab += x * y;                                                            \
+    aa += x * x;                                                            \
+    bb += y * y;                                                            \
+  }                                                                         \
+                                                                            \
+  sab = SIMD_FN(hsum_##NAME)(ab);                                           \
+  saa = SIMD_FN(hsum_##NAME)(aa);                                           \
+  sbb = SIMD_FN(hsum_##NAME)(bb);                                           \
+  for (; i < m; i++) {                                                      \
+    sab += a[i] * b[i];                                                     \
+    saa += a[i] * a[i];                                                     \
+    sbb += b[i] * b[i];                                                     \
+  }                                                                         \
+                                                                            \
+  return 1.0 - sab / sqrt((double)saa * (double)sbb);                       \
+}                                                                           \
+                                                                            \
+/* Distances from row a to the nb rows starting at b. */                    \
+static void                                                                 \
+SIMD_FN(rows_##NAME)(int metric, const char *a, const char *b, int64_t nb,  \
+                     int64_t b_stride, int64_t m, double *out)              \
+{                                                                           \
+  const T *x = (const T *)a;                                                \
+  int64_t j;                                                                \
+                                                                            \
+  switch (metric) {                                                         \
+  case DIST_EUCLIDEAN:                                                      \
+    for (j = 0; j < nb; j++, b += b_stride) {                               \
+      out[j] = sqrt(SIMD_FN(sqeuclidean_##NAME)(x, (const T *)b, m));       \
+    }                                                                       \
+    break;                                                                  \
+  case DIST_SQEUCLIDEAN:                                                    \
+    for (j = 0; j < nb; j++, b += b_stride) {                               \
+      out[j] = SIMD_FN(sqeuclidean_##NAME)(x, (const T *)b, m);             \
+    }                                                                       \
+    break;                                                                  \
+  case DIST_COSINE:                                                         \
+    for (j = 0; j < nb; j++, b += b_stride) {                               \
+      out[j] = SIMD_FN(cosine_##NAME)(x, (const T *)b, m);                  \
+    }                                                                       \
+    break;                                                                  \
+  default:                                                                  \
+    for (j = 0; j < nb; j++, b += b_stride) {                               \
+      out[j] = SIMD_FN(manhattan_##NAME)(x, (const T *)b, m);               \
+    }                                                                       \
+    break;                                                                  \
+  }                                                                         \
+}
+
+DIST_KERNELS(float32, float, VF, VI, 0x7fffffff)
+DIST_KERNELS(float64, double, VD, VL, 0x7fffffffffffffffLL)
+
+static const dist_rows_t SIMD_FN(dist_rows)[DIST_NTYPES] = {
+  [DIST_FLOAT32] = SIMD_FN(rows_float32),
+  [DIST_FLOAT64] = SIMD_FN(rows_float64)
+};
+
+#undef DIST_KERNELS
+#undef VI
+#undef VF
+#undef VL
+#undef VD
+#undef SIMD_FN
@@ -13,11 +13,19 @@ end
   have_header(header)
 end
 
-basenames = %w{util gufunc_object examples functions ruby_gumath}
+if have_header("pthread.h")
+  have_library("pthread")
+end
+
+if have_header("dlfcn.h")
+  have_library("dl")
+end
+
+basenames = %w{util cpu_features profile gufunc_object thread_pool future sort simd_math reduce distance graphs quaternion examples functions ruby_gumath}
 $objs = basenames.map { |b| "#{b}.o"   }
 $srcs = basenames.map { |b| "#{b}.c" }
 
-$CFLAGS += " -Wall -O0 -fPIC -g "
+$CFLAGS += " -Wall -O2 -fPIC -g "
 # FIXME: This is jugaad. Remove on deploy.
 $libs += " -lndtypes -lxnd -lgumath "
 create_makefile("ruby_gumath/ruby_gumath")
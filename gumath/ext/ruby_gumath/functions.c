@@ -29,78 +29,17 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "ruby_gumath_internal.h"
+#include "sort.h"
+#include "simd_math.h"
 
-/****************************************************************************/
-/*                              Static globals                              */
-/****************************************************************************/
-
-/* Function table */
-static gm_tbl_t *table = NULL;
-static VALUE mGumath_Functions;
-static int initialized = 0;
-
-/****************************************************************************/
-/*                              Singleton methods                           */
-/****************************************************************************/
-static VALUE
-mGumath_Functions_s_method_missing(int argc, VALUE *argv, VALUE module)
-{
-  VALUE method_name = argv[0];
-  VALUE method_hash = rb_ivar_get(module, GUMATH_FUNCTION_HASH);
-  VALUE gumath_method = rb_hash_aref(method_hash, method_name);
-  int is_present = RTEST(gumath_method);
-  
-  if (is_present) {
-    rb_funcall2(gumath_method, rb_intern("call"), argc-1, &argv[1]);
-  }
-  else {
-    VALUE str = rb_funcall(method_name, rb_intern("to_s"), 0, NULL);
-    rb_raise(rb_eNoMethodError, "Method %s not present in this gumath module.",
-             StringValueCStr(str));
-  }
-}
-
+/* Kernels of Gumath::Functions. They are registered into the kernel table
+   of the module the first time the module is referenced. The vectorized kernels
+   come before libgumath's scalar ones so that they win kernel selection
+   for the signatures both provide. */
 void Init_gumath_functions(void)
 {
-  /* Initialize gumath built-in function table. */
-  NDT_STATIC_CONTEXT(ctx);
-
-  if (!initialized) {
-    if (!xnd_exists()) {
-      rb_raise(rb_eLoadError, "XND is needed for making gumath work.");
-    }
-    if (!ndt_exists()) {
-      rb_raise(rb_eLoadError, "NDT is needed for maing gumath work.");
-    }
-
-    table = gm_tbl_new(&ctx);
-    if (table == NULL) {
-      rb_ndtypes_set_error(&ctx);
-      raise_error();
-    }
-
-    if (gm_init_unary_kernels(table, &ctx) < 0) {
-      rb_ndtypes_set_error(&ctx);
-      raise_error();
-    }
-
-    if (gm_init_binary_kernels(table, &ctx) < 0) {
-      rb_ndtypes_set_error(&ctx);
-      raise_error();
-    }
-
-    initialized = 1;
-  }
-
-  mGumath_Functions = rb_define_module_under(cGumath, "Functions");
-  rb_ivar_set(mGumath_Functions, GUMATH_FUNCTION_HASH, rb_hash_new());
-
-  if (rb_gumath_add_functions(mGumath_Functions, table) < 0) {
-    mGumath_Functions = Qundef;
-    rb_raise(rb_eLoadError, "failed to load functions into module Gumath::Functions.");
-  }
-
-  /* Singleton methods */
-  rb_define_singleton_method(mGumath_Functions, "method_missing",
-                             mGumath_Functions_s_method_missing, -1);
+  rb_gumath_register_group("Functions", "simd", rb_gumath_init_simd_kernels);
+  rb_gumath_register_group("Functions", "unary", gm_init_unary_kernels);
+  rb_gumath_register_group("Functions", "binary", gm_init_binary_kernels);
+  rb_gumath_register_group("Functions", "sort", rb_gumath_init_sort_kernels);
 }
@@ -0,0 +1,555 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+   Gumath::Future.
+
+   GufuncObject#call_async selects the kernel and allocates the outputs on
+   the calling thread like #call, then queues the kernel for an executor
+   thread and returns a future. Executors are started on demand, up to the
+   number of threads set with Gumath.set_max_threads, and take jobs in FIFO
+   order, so independent calls run concurrently.
+
+   Waiting on a future that has not finished creates a pipe that the
+   executor writes to when the job is done, and waits for its read end with
+   IO#wait_readable. Under a fiber scheduler that suspends only the current
+   fiber; otherwise the thread sleeps without the GVL.
+
+   Queued and running jobs are on a list that a GC root marks, so arguments
+   and outputs stay alive while a kernel uses them even if the future itself
+   is dropped. A job is freed by whichever of the executor and the future
+   lets go of it last.
+*/
+
+#include <fcntl.h>
+#include "ruby_gumath_internal.h"
+#include "future.h"
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+
+/****************************************************************************/
+/*                                   Jobs                                   */
+/****************************************************************************/
+
+/* Upper bound on executor threads. */
+#define FUTURE_MAX_EXECUTORS 64
+
+typedef struct future_job {
+  rb_gumath_async_run_t run;
+  rb_gumath_async_free_t free_data;
+  void *data;
+  VALUE keep;                 /* objects used by the kernel */
+  int done;
+  int failed;                 /* ctx holds the error */
+  ndt_context_t ctx;
+  int wfd;                    /* write end of the wake-up pipe, or -1 */
+  int refs;                   /* held by the future and by the executor */
+  struct future_job *next;    /* queue order */
+  struct future_job *prev_live, *next_live; /* queued or running */
+} future_job_t;
+
+static void
+job_free(future_job_t *j)
+{
+  j->free_data(j->data);
+  if (j->failed) {
+    ndt_context_del(&j->ctx);
+  }
+  ndt_free(j);
+}
+
+static int
+job_run(future_job_t *j)
+{
+  NDT_STATIC_CONTEXT(ctx);
+
+  if (j->run(j->data, &ctx) < 0) {
+    j->ctx = ctx;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/****************************************************************************/
+/*                                 Executors                                */
+/****************************************************************************/
+
+#ifdef HAVE_PTHREAD_H
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work;        /* a job was queued */
+  int nthreads;               /* started executors */
+  int idle;                   /* executors waiting for a job */
+  future_job_t *head, *tail;  /* queue */
+  future_job_t *live;         /* queued and running jobs */
+} executor = {
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
+/* Called with executor.lock held. Returns whether the job must be freed. */
+static int
+job_release(future_job_t *j)
+{
+  return --j->refs == 0;
+}
+
+static void
+finish_job(future_job_t *j, int failed)
+{
+  int free_job;
+
+  pthread_mutex_lock(&executor.lock);
+  j->done = 1;
+  j->failed = failed;
+  if (j->wfd >= 0) {
+    const char byte = 1;
+    if (write(j->wfd, &byte, 1) < 0) {
+      /* The waiter also checks done, and close() wakes it up anyway. */
+    }
+    close(j->wfd);
+    j->wfd = -1;
+  }
+
+  if (j->prev_live != NULL) {
+    j->prev_live->next_live = j->next_live;
+  }
+  else {
+    executor.live = j->next_live;
+  }
+  if (j->next_live != NULL) {
+    j->next_live->prev_live = j->prev_live;
+  }
+
+  free_job = job_release(j);
+  pthread_mutex_unlock(&executor.lock);
+
+  if (free_job) {
+    job_free(j);
+  }
+}
+
+static void *
+executor_main(void *arg)
+{
+  future_job_t *j;
+
+  pthread_mutex_lock(&executor.lock);
+  for (;;) {
+    while (executor.head == NULL) {
+      executor.idle++;
+      pthread_cond_wait(&executor.work, &executor.lock);
+      executor.idle--;
+    }
+
+    j = executor.head;
+    executor.head = j->next;
+    if (executor.head == NULL) {
+      executor.tail = NULL;
+    }
+    pthread_mutex_unlock(&executor.lock);
+
+    finish_job(j, job_run(j) < 0);
+
+    pthread_mutex_lock(&executor.lock);
+  }
+
+  return NULL;
+}
+
+/* Queue a job, starting an executor if none is idle. Returns -1 if no
+   executor could be started at all. */
+static int
+submit(future_job_t *j)
+{
+  int64_t limit = rb_gumath_max_threads();
+  pthread_t thread;
+
+  if (limit > FUTURE_MAX_EXECUTORS) {
+    limit = FUTURE_MAX_EXECUTORS;
+  }
+
+  pthread_mutex_lock(&executor.lock);
+  if (executor.idle == 0 && (executor.nthreads < limit || executor.nthreads == 0)) {
+    if (pthread_create(&thread, NULL, executor_main, NULL) == 0) {
+      pthread_detach(thread);
+      executor.nthreads++;
+    }
+    else if (executor.nthreads == 0) {
+      pthread_mutex_unlock(&executor.lock);
+      return -1;
+    }
+  }
+
+  j->refs = 2;
+  j->next = NULL;
+  if (executor.tail != NULL) {
+    executor.tail->next = j;
+  }
+  else {
+    executor.head = j;
+  }
+  executor.tail = j;
+
+  j->prev_live = NULL;
+  j->next_live = executor.live;
+  if (executor.live != NULL) {
+    executor.live->prev_live = j;
+  }
+  executor.live = j;
+
+  pthread_cond_signal(&executor.work);
+  pthread_mutex_unlock(&executor.lock);
+
+  return 0;
+}
+
+static void
+executor_prefork(void)
+{
+  pthread_mutex_lock(&executor.lock);
+}
+
+static void
+executor_postfork_parent(void)
+{
+  pthread_mutex_unlock(&executor.lock);
+}
+
+/* The executors do not exist in the child. Jobs that were queued or running
+   there fail; their futures report it instead of waiting forever. Jobs
+   whose future is gone already are freed. */
+static void
+executor_postfork_child(void)
+{
+  future_job_t *j, *next;
+
+  pthread_mutex_init(&executor.lock, NULL);
+  pthread_cond_init(&executor.work, NULL);
+
+  for (j = executor.live; j != NULL; j = next) {
+    next = j->next_live;
+    j->ctx = (ndt_context_t){ .err = NDT_RuntimeError, .msg = ConstMsg,
+                              .ConstMsg = "gumath: job was lost in fork()." };
+    j->done = 1;
+    j->failed = 1;
+    if (j->wfd >= 0) {
+      close(j->wfd);
+      j->wfd = -1;
+    }
+    if (job_release(j)) {
+      job_free(j);
+    }
+  }
+
+  executor.nthreads = 0;
+  executor.idle = 0;
+  executor.head = executor.tail = NULL;
+  executor.live = NULL;
+}
+
+#define LOCK() pthread_mutex_lock(&executor.lock)
+#define UNLOCK() pthread_mutex_unlock(&executor.lock)
+#else
+static int
+job_release(future_job_t *j)
+{
+  return --j->refs == 0;
+}
+
+#define LOCK()
+#define UNLOCK()
+#endif
+
+
+/****************************************************************************/
+/*                                 GC root                                  */
+/****************************************************************************/
+
+static void
+live_jobs_mark(void *self)
+{
+#ifdef HAVE_PTHREAD_H
+  future_job_t *j;
+
+  LOCK();
+  for (j = executor.live; j != NULL; j = j->next_live) {
+    rb_gc_mark(j->keep);
+  }
+  UNLOCK();
+#endif
+}
+
+static const rb_data_type_t live_jobs_type = {
+  .wrap_struct_name = "GumathLiveJobs",
+  .function = {
+    .dmark = live_jobs_mark,
+    .dfree = NULL,
+    .dsize = NULL,
+  },
+  .parent = 0,
+  .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+static VALUE live_jobs = Qnil;
+
+
+/****************************************************************************/
+/*                               Future object                              */
+/****************************************************************************/
+
+typedef struct {
+  future_job_t *job;
+  VALUE result;
+  VALUE error;                /* the exception, once raised */
+  VALUE io;                   /* read end of the wake-up pipe, or nil */
+} FutureObject;
+
+static VALUE cGumath_Future;
+
+static void
+FutureObject_dmark(void *self)
+{
+  FutureObject *f = (FutureObject *)self;
+
+  rb_gc_mark(f->result);
+  rb_gc_mark(f->error);
+  rb_gc_mark(f->io);
+  if (f->job != NULL) {
+    rb_gc_mark(f->job->keep);
+  }
+}
+
+static void
+FutureObject_dfree(void *self)
+{
+  FutureObject *f = (FutureObject *)self;
+  int free_job = 0;
+
+  if (f->job != NULL) {
+    LOCK();
+    free_job = job_release(f->job);
+    UNLOCK();
+    if (free_job) {
+      job_free(f->job);
+    }
+  }
+  xfree(f);
+}
+
+static size_t
+FutureObject_dsize(const void *self)
+{
+  return sizeof(FutureObject);
+}
+
+static const rb_data_type_t FutureObject_type = {
+  .wrap_struct_name = "GumathFuture",
+  .function = {
+    .dmark = FutureObject_dmark,
+    .dfree = FutureObject_dfree,
+    .dsize = FutureObject_dsize,
+  },
+  .parent = 0,
+  .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+};
+
+#define GET_FUTURE(obj, f_p) TypedData_Get_Struct((obj), FutureObject, \
+                                                  &FutureObject_type, f_p)
+
+VALUE
+rb_gumath_future_new(rb_gumath_async_run_t run,
+                     rb_gumath_async_free_t free_data, void *data,
+                     VALUE result, VALUE keep)
+{
+  FutureObject *f;
+  future_job_t *j;
+  VALUE future;
+
+  future = TypedData_Make_Struct(cGumath_Future, FutureObject, &FutureObject_type, f);
+  f->result = result;
+  f->error = Qnil;
+  f->io = Qnil;
+
+  j = ndt_calloc(1, sizeof *j);
+  if (j == NULL) {
+    free_data(data);
+    rb_raise(rb_eNoMemError, "could not allocate gumath job.");
+  }
+  j->run = run;
+  j->free_data = free_data;
+  j->data = data;
+  j->keep = keep;
+  j->wfd = -1;
+  j->refs = 1;
+  f->job = j;
+
+#ifdef HAVE_PTHREAD_H
+  if (submit(j) == 0) {
+    RB_GC_GUARD(keep);
+    return future;
+  }
+#endif
+
+  /* No executor: run the job here. */
+  j->failed = job_run(j) < 0;
+  j->done = 1;
+
+  RB_GC_GUARD(keep);
+  return future;
+}
+
+static int
+future_done(FutureObject *f)
+{
+  int done;
+
+  LOCK();
+  done = f->job->done;
+  UNLOCK();
+
+  return done;
+}
+
+/* Wait until the job is done or timeout (nil: forever) has passed. */
+static int
+future_wait(FutureObject *f, VALUE timeout)
+{
+#ifdef HAVE_PTHREAD_H
+  int fds[2];
+
+  if (future_done(f)) {
+    return 1;
+  }
+
+  if (NIL_P(f->io)) {
+    if (rb_pipe(fds) < 0) {
+      rb_sys_fail("pipe");
+    }
+
+    LOCK();
+    if (f->job->done) {
+      UNLOCK();
+      close(fds[0]);
+      close(fds[1]);
+      return 1;
+    }
+    f->job->wfd = fds[1];
+    UNLOCK();
+
+    f->io = rb_io_fdopen(fds[0], O_RDONLY, NULL);
+  }
+
+  rb_funcall(f->io, rb_intern("wait_readable"), 1, timeout);
+#endif
+
+  return future_done(f);
+}
+
+/* Gumath::Future#wait(timeout = nil): true once the kernel has finished,
+   false if timeout seconds passed first. Yields to the fiber scheduler
+   if there is one. */
+static VALUE
+Gumath_Future_wait(int argc, VALUE *argv, VALUE self)
+{
+  FutureObject *f;
+  VALUE timeout;
+
+  rb_scan_args(argc, argv, "01", &timeout);
+  GET_FUTURE(self, f);
+
+  return future_wait(f, timeout) ? Qtrue : Qfalse;
+}
+
+static VALUE
+Gumath_Future_ready_p(VALUE self)
+{
+  FutureObject *f;
+
+  GET_FUTURE(self, f);
+  return future_done(f) ? Qtrue : Qfalse;
+}
+
+/* Gumath::Future#value: wait for the kernel and return its result, or
+   raise its error. */
+static VALUE
+Gumath_Future_value(VALUE self)
+{
+  FutureObject *f;
+
+  GET_FUTURE(self, f);
+  while (!future_wait(f, Qnil)) {
+    /* spurious wake-up */
+  }
+
+  if (NIL_P(f->error) && f->job->failed) {
+    ndt_context_t ctx = f->job->ctx;
+    f->job->failed = 0;
+    rb_ndtypes_set_error(&ctx);
+    f->error = rb_errinfo();
+    rb_set_errinfo(Qnil);
+  }
+  if (!NIL_P(f->error)) {
+    rb_exc_raise(f->error);
+  }
+
+  return f->result;
+}
+
+void
+Init_gumath_future(void)
+{
+#ifdef HAVE_PTHREAD_H
+  static int initialized = 0;
+
+  if (!initialized) {
+    pthread_atfork(executor_prefork, executor_postfork_parent,
+                   executor_postfork_child);
+    initialized = 1;
+  }
+#endif
+
+  rb_gc_register_address(&live_jobs);
+  live_jobs = TypedData_Wrap_Struct(0, &live_jobs_type, NULL);
+
+  cGumath_Future = rb_define_class_under(cGumath, "Future", rb_cObject);
+  rb_undef_alloc_func(cGumath_Future);
+
+  rb_define_method(cGumath_Future, "value", Gumath_Future_value, 0);
+  rb_define_method(cGumath_Future, "wait", Gumath_Future_wait, -1);
+  rb_define_method(cGumath_Future, "ready?", Gumath_Future_ready_p, 0);
+}
@@ -0,0 +1,56 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* Background execution of kernels: Gumath::Future. */
+
+#ifndef GUMATH_FUTURE_H
+#define GUMATH_FUTURE_H
+
+/* Runs the work of an async call without the GVL. Returns 0 on success,
+   -1 with ctx set. */
+typedef int (*rb_gumath_async_run_t)(void *data, ndt_context_t *ctx);
+
+/* Frees the data of an async call. May run without the GVL. */
+typedef void (*rb_gumath_async_free_t)(void *data);
+
+/* Start run(data) on a background thread and return a Gumath::Future whose
+   value is result. The objects in keep (usually the arguments and outputs)
+   are kept alive until the work has finished. free_data(data) is called
+   once the work has finished and the future is gone. Without thread support
+   the work runs before this returns. */
+VALUE rb_gumath_future_new(rb_gumath_async_run_t run,
+                           rb_gumath_async_free_t free_data, void *data,
+                           VALUE result, VALUE keep);
+
+void Init_gumath_future(void);
+
+#endif  /* GUMATH_FUTURE_H */
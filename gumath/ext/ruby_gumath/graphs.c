@@ -0,0 +1,711 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+/*
+   Graph kernels on adjacency lists in CSR form: a graph of N nodes is a
+   var * var * edge array whose row i lists the edges leaving node i. An
+   edge is a (target, weight) tuple or record, or just a target for
+   unweighted graphs; targets are int32 or int64 and weights float32 or
+   float64. The "graph" type of Gumath::Examples is such an array.
+
+   The inner var dimension already stores CSR offsets, so the edges are
+   read in place; only the start, length and step of each row are copied.
+
+   dijkstra uses a radix heap keyed on the bits of the distance (for
+   non-negative doubles the order of the bits is the order of the values),
+   which suits the monotone extraction of Dijkstra: every key is moved
+   between buckets at most 64 times. bfs uses a plain FIFO queue.
+
+   Both take a single source or a list of sources. Sources run as
+   independent pool tasks, so many-source calls use every thread; large
+   calls release the GVL.
+*/
+
+#include <math.h>
+#include "ruby_gumath_internal.h"
+#include "thread_pool.h"
+
+
+/****************************************************************************/
+/*                                Parameters                                */
+/****************************************************************************/
+
+/* Calls that visit fewer edges than this (edges times sources) keep the
+   GVL. */
+#define GRAPH_GVL_CUTOFF (1 << 16)
+
+/* Initial capacity of a radix heap bucket. */
+#define RADIX_BUCKET_INIT 16
+
+/* Searches check whether they were interrupted every this many + 1
+   nodes. */
+#define GRAPH_POLL_MASK 0xfff
+
+
+/****************************************************************************/
+/*                                   Types                                  */
+/****************************************************************************/
+
+enum graph_op { G_BFS, G_DIJKSTRA };
+
+typedef struct {
+  int64_t n;                  /* nodes */
+  int64_t nedges;
+  const char *base;           /* edge records */
+  int64_t edge_size;          /* bytes per record */
+  int64_t *first;             /* first edge of every node */
+  int64_t *count;             /* edges of every node */
+  int64_t *step;              /* edge step of every node; NULL if all are 1 */
+  int64_t target_offset;
+  enum ndt target_tag;        /* Int32 or Int64 */
+  int64_t weight_offset;
+  enum ndt weight_tag;        /* Float32, Float64, or AnyKind if unweighted */
+  volatile int stop;          /* set by the unblocking function */
+} graph_t;
+
+typedef struct {
+  enum graph_op op;
+  graph_t *graph;
+  const int64_t *sources;
+  int64_t nsources;
+  int64_t nthreads;
+  const xnd_t *x;             /* the graph */
+  void *dist;                 /* float64 distances or int64 levels */
+  int64_t *pred;
+  uint8_t *done;              /* finished sources, skipped after a restart */
+  int ret;
+  ndt_context_t ctx;
+} graph_job_t;
+
+typedef struct {
+  uint64_t key;
+  int64_t node;
+} radix_item_t;
+
+typedef struct {
+  radix_item_t *items;
+  int64_t size;
+  int64_t cap;
+} radix_bucket_t;
+
+/* Bucket 0 holds keys equal to last; bucket b > 0 holds keys whose highest
+   bit differing from last is bit b-1. */
+typedef struct {
+  radix_bucket_t buckets[65];
+  uint64_t last;
+  int64_t size;
+} radix_heap_t;
+
+
+/****************************************************************************/
+/*                                   Edges                                  */
+/****************************************************************************/
+
+static inline int64_t
+edge_index(const graph_t *g, int64_t node, int64_t i)
+{
+  return g->first[node] + (g->step ? i * g->step[node] : i);
+}
+
+static inline int64_t
+edge_target(const graph_t *g, int64_t e)
+{
+  const char *p = g->base + e * g->edge_size + g->target_offset;
+
+  return g->target_tag == Int32 ? *(const int32_t *)p : *(const int64_t *)p;
+}
+
+static inline double
+edge_weight(const graph_t *g, int64_t e)
+{
+  const char *p = g->base + e * g->edge_size + g->weight_offset;
+
+  return g->weight_tag == Float32 ? *(const float *)p : *(const double *)p;
+}
+
+
+/****************************************************************************/
+/*                                Radix heap                                */
+/****************************************************************************/
+
+static inline int
+bit_length(uint64_t x)
+{
+#if defined(__GNUC__)
+  return x == 0 ? 0 : 64 - __builtin_clzll(x);
+#else
+  int n = 0;
+  while (x != 0) {
+    x >>= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+static inline uint64_t
+distance_key(double d)
+{
+  uint64_t key;
+
+  memcpy(&key, &d, sizeof key);
+  return key;
+}
+
+static int
+radix_append(radix_bucket_t *b, uint64_t key, int64_t node, ndt_context_t *ctx)
+{
+  if (b->size == b->cap) {
+    const int64_t cap = b->cap == 0 ? RADIX_BUCKET_INIT : 2 * b->cap;
+    radix_item_t *items = ndt_realloc(b->items, cap, sizeof *items);
+    if (items == NULL) {
+      (void)ndt_memory_error(ctx);
+      return -1;
+    }
+    b->items = items;
+    b->cap = cap;
+  }
+
+  b->items[b->size].key = key;
+  b->items[b->size].node = node;
+  b->size++;
+  return 0;
+}
+
+static inline int
+radix_push(radix_heap_t *h, uint64_t key, int64_t node, ndt_context_t *ctx)
+{
+  h->size++;
+  return radix_append(&h->buckets[bit_length(key ^ h->last)], key, node, ctx);
+}
+
+/* Removes an item with the smallest key. The heap must not be empty. */
+static int
+radix_pop(radix_heap_t *h, radix_item_t *item, ndt_context_t *ctx)
+{
+  radix_bucket_t *b = &h->buckets[0];
+  int64_t i;
+
+  if (b->size == 0) {
+    int k = 1;
+    while (h->buckets[k].size == 0) {
+      k++;
+    }
+
+    /* The new minimum splits bucket k into lower buckets. */
+    b = &h->buckets[k];
+    h->last = b->items[0].key;
+    for (i = 1; i < b->size; i++) {
+      if (b->items[i].key < h->last) {
+        h->last = b->items[i].key;
+      }
+    }
+    for (i = 0; i < b->size; i++) {
+      const radix_item_t *x = &b->items[i];
+      if (radix_append(&h->buckets[bit_length(x->key ^ h->last)], x->key, x->node, ctx) < 0) {
+        return -1;
+      }
+    }
+    b->size = 0;
+    b = &h->buckets[0];
+  }
+
+  *item = b->items[--b->size];
+  h->size--;
+  return 0;
+}
+
+static void
+radix_free(radix_heap_t *h)
+{
+  int k;
+
+  for (k = 0; k < 65; k++) {
+    ndt_free(h->buckets[k].items);
+  }
+}
+
+
+/****************************************************************************/
+/*                                  Kernels                                 */
+/****************************************************************************/
+
+static int
+target_error(const graph_t *g, int64_t node, int64_t target, ndt_context_t *ctx)
+{
+  ndt_err_format(ctx, NDT_ValueError,
+                 "edge from node %" PRIi64 " to node %" PRIi64 " is out of "
+                 "range for a graph of %" PRIi64 " nodes", node, target, g->n);
+  return -1;
+}
+
+static int
+dijkstra(const graph_t *g, int64_t source, double *dist, int64_t *pred,
+         ndt_context_t *ctx)
+{
+  radix_heap_t h;
+  radix_item_t item;
+  int64_t u, v, e, i, pops = 0;
+  double w, d;
+  int ret = -1;
+
+  memset(&h, 0, sizeof h);
+  for (u = 0; u < g->n; u++) {
+    dist[u] = INFINITY;
+    pred[u] = -1;
+  }
+
+  dist[source] = 0.0;
+  if (radix_push(&h, distance_key(0.0), source, ctx) < 0) {
+    goto out;
+  }
+
+  while (h.size > 0) {
+    if ((++pops & GRAPH_POLL_MASK) == 0 && g->stop) {
+      break;  /* the results are discarded */
+    }
+    if (radix_pop(&h, &item, ctx) < 0) {
+      goto out;
+    }
+    u = item.node;
+    if (item.key != distance_key(dist[u])) {
+      continue;  /* superseded by a shorter distance */
+    }
+
+    for (i = 0; i < g->count[u]; i++) {
+      e = edge_index(g, u, i);
+      v = edge_target(g, e);
+      w = edge_weight(g, e);
+      if (v < 0 || v >= g->n) {
+        target_error(g, u, v, ctx);
+        goto out;
+      }
+      if (!(w >= 0)) {
+        ndt_err_format(ctx, NDT_ValueError,
+                       "edge from node %" PRIi64 " to node %" PRIi64 " has "
+                       "weight %g, weights must be non-negative", u, v, w);
+        goto out;
+      }
+
+      /* + 0.0 turns -0.0 into 0.0, whose key is the smallest. */
+      d = dist[u] + w + 0.0;
+      if (d < dist[v]) {
+        dist[v] = d;
+        pred[v] = u;
+        if (radix_push(&h, distance_key(d), v, ctx) < 0) {
+          goto out;
+        }
+      }
+    }
+  }
+  ret = 0;
+
+out:
+  radix_free(&h);
+  return ret;
+}
+
+static int
+bfs(const graph_t *g, int64_t source, int64_t *level, int64_t *pred,
+    ndt_context_t *ctx)
+{
+  int64_t *queue;
+  int64_t head = 0, tail = 0;
+  int64_t u, v, i;
+
+  queue = ndt_alloc(g->n, sizeof *queue);
+  if (queue == NULL) {
+    (void)ndt_memory_error(ctx);
+    return -1;
+  }
+
+  for (u = 0; u < g->n; u++) {
+    level[u] = -1;
+    pred[u] = -1;
+  }
+
+  level[source] = 0;
+  queue[tail++] = source;
+  while (head < tail) {
+    if ((head & GRAPH_POLL_MASK) == 0 && g->stop) {
+      break;  /* the results are discarded */
+    }
+    u = queue[head++];
+    for (i = 0; i < g->count[u]; i++) {
+      v = edge_target(g, edge_index(g, u, i));
+      if (v < 0 || v >= g->n) {
+        ndt_free(queue);
+        return target_error(g, u, v, ctx);
+      }
+      if (level[v] < 0) {
+        level[v] = level[u] + 1;
+        pred[v] = u;
+        queue[tail++] = v;
+      }
+    }
+  }
+
+  ndt_free(queue);
+  return 0;
+}
+
+static int
+graph_task(void *job, int64_t i, ndt_context_t *ctx)
+{
+  const graph_job_t *j = (const graph_job_t *)job;
+  const graph_t *g = j->graph;
+  int64_t *pred = j->pred + i * g->n;
+  int ret;
+
+  if (g->stop || (j->done != NULL && j->done[i])) {
+    return 0;
+  }
+  if (j->op == G_DIJKSTRA) {
+    ret = dijkstra(g, j->sources[i], (double *)j->dist + i * g->n, pred, ctx);
+  }
+  else {
+    ret = bfs(g, j->sources[i], (int64_t *)j->dist + i * g->n, pred, ctx);
+  }
+
+  /* A search cut short by stop is done again after a restart. */
+  if (ret == 0 && !g->stop && j->done != NULL) {
+    j->done[i] = 1;
+  }
+  return ret;
+}
+
+static void *
+run_graph(void *job)
+{
+  graph_job_t *j = (graph_job_t *)job;
+
+  j->ret = rb_gumath_pool_run(j->nthreads, j->nsources, graph_task, j, &j->ctx);
+  return NULL;
+}
+
+/* Unblocking function: the searches stop at their next check. */
+static void
+graph_ubf(void *job)
+{
+  ((graph_job_t *)job)->graph->stop = 1;
+}
+
+
+/****************************************************************************/
+/*                                   Setup                                  */
+/****************************************************************************/
+
+static const ndt_t *
+unwrap(const ndt_t *t)
+{
+  while (t->tag == Nominal) {
+    t = t->Nominal.type;
+  }
+  return t;
+}
+
+/* Checks the type of the graph, finds its edge fields and counts its nodes.
+   The rows are read by graph_rows. */
+static void
+graph_arg(VALUE graph, const char *fn, int weighted, xnd_t *x, graph_t *g)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  const ndt_t *t, *edge, *target, *weight = NULL;
+  int64_t start, step;
+
+  if (!rb_xnd_check_type(graph)) {
+    rb_raise(rb_eTypeError, "%s: the graph must be XND.", fn);
+  }
+
+  *x = *rb_xnd_const_xnd(graph);
+  while (x->type->tag == Nominal) {
+    *x = xnd_nominal_next(x, &ctx);
+    if (x->ptr == NULL) {
+      rb_ndtypes_set_error(&ctx);
+      raise_error();
+    }
+  }
+
+  t = x->type;
+  if (t->tag != VarDim || t->VarDim.type->tag != VarDim) {
+    rb_raise(rb_eTypeError, "%s: need a var * var * (node, weight) graph.", fn);
+  }
+
+  memset(g, 0, sizeof *g);
+  g->n = ndt_var_indices(&start, &step, t, x->index, &ctx);
+  if (g->n < 0) {
+    rb_ndtypes_set_error(&ctx);
+    raise_error();
+  }
+
+  edge = unwrap(t->VarDim.type->VarDim.type);
+  g->base = x->ptr;
+  g->edge_size = edge->datasize;
+
+  switch (edge->tag) {
+  case Tuple: case Record: {
+    const int64_t shape = edge->tag == Tuple ? edge->Tuple.shape : edge->Record.shape;
+    ndt_t **types = edge->tag == Tuple ? edge->Tuple.types : edge->Record.types;
+    const int64_t *offset = edge->tag == Tuple ? edge->Concrete.Tuple.offset
+                                               : edge->Concrete.Record.offset;
+    if (shape < 1 || shape > 2) {
+      rb_raise(rb_eTypeError, "%s: edges must be (node, weight) pairs.", fn);
+    }
+    target = unwrap(types[0]);
+    g->target_offset = offset[0];
+    if (shape == 2) {
+      weight = unwrap(types[1]);
+      g->weight_offset = offset[1];
+    }
+    break;
+  }
+  default:
+    target = edge;
+    break;
+  }
+
+  if ((target->tag != Int32 && target->tag != Int64) || ndt_is_optional(target)) {
+    rb_raise(rb_eTypeError, "%s: nodes must be int32 or int64.", fn);
+  }
+  g->target_tag = target->tag;
+
+  g->weight_tag = AnyKind;
+  if (weight != NULL) {
+    if ((weight->tag != Float32 && weight->tag != Float64) || ndt_is_optional(weight)) {
+      rb_raise(rb_eTypeError, "%s: weights must be float32 or float64.", fn);
+    }
+    g->weight_tag = weight->tag;
+  }
+  else if (weighted) {
+    rb_raise(rb_eTypeError, "%s: the graph has no edge weights.", fn);
+  }
+}
+
+/* Copies the start, length and step of every row. Returns -1 with ctx set
+   on error. */
+static int
+graph_rows(const xnd_t *x, graph_t *g, ndt_context_t *ctx)
+{
+  int64_t start, step, shape, s, t, i;
+  int unit = 1;
+
+  if (ndt_var_indices(&start, &step, x->type, x->index, ctx) < 0) {
+    return -1;
+  }
+
+  g->first = ndt_alloc(g->n + 1, sizeof(int64_t));
+  g->count = ndt_alloc(g->n + 1, sizeof(int64_t));
+  g->step = ndt_alloc(g->n + 1, sizeof(int64_t));
+  if (g->first == NULL || g->count == NULL || g->step == NULL) {
+    (void)ndt_memory_error(ctx);
+    return -1;
+  }
+
+  for (i = 0; i < g->n; i++) {
+    const xnd_t row = xnd_var_dim_next(x, start, step, i);
+
+    shape = ndt_var_indices(&s, &t, row.type, row.index, ctx);
+    if (shape < 0) {
+      return -1;
+    }
+    g->first[i] = s;
+    g->count[i] = shape;
+    g->step[i] = t;
+    g->nedges += shape;
+    unit &= t == 1;
+  }
+
+  if (unit) {
+    ndt_free(g->step);
+    g->step = NULL;
+  }
+  return 0;
+}
+
+static void
+graph_free(graph_t *g)
+{
+  ndt_free(g->first);
+  ndt_free(g->count);
+  ndt_free(g->step);
+}
+
+static VALUE
+empty_xnd(const char *type)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  ndt_t *t = ndt_from_string(type, &ctx);
+
+  if (t == NULL) {
+    rb_ndtypes_set_error(&ctx);
+    raise_error();
+  }
+
+  return rb_xnd_empty_from_type(t);
+}
+
+/* Copy the rows and run the searches. Large calls release the GVL; if an
+   interrupt stops them and its handler does not raise, they go on with the
+   sources whose search was not finished yet. */
+static VALUE
+search_body(VALUE arg)
+{
+  graph_job_t *job = (graph_job_t *)arg;
+  graph_t *g = job->graph;
+
+  if (graph_rows(job->x, g, &job->ctx) < 0) {
+    job->ret = -1;
+    return Qnil;
+  }
+
+  if ((double)(g->nedges + g->n) * job->nsources < GRAPH_GVL_CUTOFF) {
+    run_graph(job);
+    return Qnil;
+  }
+
+  job->done = ZALLOC_N(uint8_t, job->nsources);
+  do {
+    g->stop = 0;
+    rb_thread_call_without_gvl(run_graph, job, graph_ubf, job);
+  } while (g->stop && job->ret == 0);
+
+  return Qnil;
+}
+
+static VALUE
+search_cleanup(VALUE arg)
+{
+  graph_job_t *job = (graph_job_t *)arg;
+
+  graph_free(job->graph);
+  xfree(job->done);
+  job->done = NULL;
+  return Qnil;
+}
+
+static VALUE
+search(VALUE graph, VALUE source, enum graph_op op)
+{
+  static const char *const names[] = {"bfs", "dijkstra"};
+  const char *fn = names[op];
+  VALUE sources, dist, pred, tmp = 0;
+  graph_job_t job;
+  graph_t g;
+  xnd_t x;
+  char shape[64], type[96];
+  int64_t *src, i;
+  int single;
+
+  graph_arg(graph, fn, op == G_DIJKSTRA, &x, &g);
+
+  if (rb_xnd_check_type(source)) {
+    source = rb_funcall(source, rb_intern("value"), 0);
+  }
+  single = !RB_TYPE_P(source, T_ARRAY);
+  sources = single ? rb_ary_new_from_args(1, source) : source;
+
+  memset(&job, 0, sizeof job);
+  job.op = op;
+  job.graph = &g;
+  job.x = &x;
+  job.nsources = RARRAY_LEN(sources);
+  job.nthreads = rb_gumath_call_threads();
+
+  src = ALLOCV_N(int64_t, tmp, job.nsources + 1);
+  for (i = 0; i < job.nsources; i++) {
+    src[i] = NUM2LL(rb_ary_entry(sources, i));
+    if (src[i] < 0 || src[i] >= g.n) {
+      rb_raise(rb_eIndexError, "%s: source node %" PRIi64 " is out of range "
+               "for a graph of %" PRIi64 " nodes.", fn, src[i], g.n);
+    }
+  }
+  job.sources = src;
+
+  if (single) {
+    snprintf(shape, sizeof shape, "%" PRIi64, g.n);
+  }
+  else {
+    snprintf(shape, sizeof shape, "%" PRIi64 " * %" PRIi64, job.nsources, g.n);
+  }
+  snprintf(type, sizeof type, "%s * %s", shape, op == G_DIJKSTRA ? "float64" : "int64");
+  dist = empty_xnd(type);
+  snprintf(type, sizeof type, "%s * int64", shape);
+  pred = empty_xnd(type);
+  job.dist = rb_xnd_const_xnd(dist)->ptr;
+  job.pred = (int64_t *)rb_xnd_const_xnd(pred)->ptr;
+
+  rb_ensure(search_body, (VALUE)&job, search_cleanup, (VALUE)&job);
+  ALLOCV_END(tmp);
+
+  if (job.ret < 0) {
+    rb_ndtypes_set_error(&job.ctx);
+    raise_error();
+  }
+
+  RB_GC_GUARD(graph);
+  RB_GC_GUARD(sources);
+  return rb_assoc_new(dist, pred);
+}
+
+
+/****************************************************************************/
+/*                               Ruby methods                               */
+/****************************************************************************/
+
+/* Gumath::Graphs.dijkstra(graph, source): [distances, predecessors] of the
+   shortest paths from source, with Float::INFINITY and -1 for unreachable
+   nodes and -1 as the predecessor of the source. With an Array of sources
+   both results have one row per source. */
+static VALUE
+mGumath_Graphs_s_dijkstra(VALUE module, VALUE graph, VALUE source)
+{
+  return search(graph, source, G_DIJKSTRA);
+}
+
+/* Gumath::Graphs.bfs(graph, source): [levels, predecessors] of a breadth
+   first search from source, ignoring weights; unreachable nodes have level
+   -1. Takes an Array of sources like dijkstra. */
+static VALUE
+mGumath_Graphs_s_bfs(VALUE module, VALUE graph, VALUE source)
+{
+  return search(graph, source, G_BFS);
+}
+
+void
+Init_gumath_graphs(void)
+{
+  VALUE mGumath_Graphs = rb_define_module_under(cGumath, "Graphs");
+
+  rb_define_singleton_method(mGumath_Graphs, "dijkstra", mGumath_Graphs_s_dijkstra, 2);
+  rb_define_singleton_method(mGumath_Graphs, "bfs", mGumath_Graphs_s_bfs, 2);
+}
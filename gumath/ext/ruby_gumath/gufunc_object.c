@@ -40,7 +40,9 @@ GufuncObject_dfree(void *self)
 {
   GufuncObject *guobj = (GufuncObject*)self;
 
+  gufunc_cache_clear(guobj);
   ndt_free(guobj->name);
+  xfree(guobj);
 }
 
 static size_t
@@ -58,7 +60,7 @@ const rb_data_type_t GufuncObject_type = {
     .reserved = {0,0},
   },
   .parent = 0,
-  .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+  .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED,
 };
 
 VALUE
@@ -74,6 +76,221 @@ GufuncObject_alloc(const gm_tbl_t *table, const char *name)
   if (guobj_p->name == NULL) {
     seterr(&ctx);
   }
+  guobj_p->profile = rb_gumath_profile_get(name);
 
   return guobj;
 }
+
+/****************************************************************************/
+/*                              Dispatch cache                              */
+/****************************************************************************/
+
+/* Only fixed dimensions over a scalar dtype are cached. Everything the
+   kernel selection depends on is then visible in the type itself: shapes,
+   steps (hence contiguity and broadcasting) and the dtype. Var dimensions
+   keep their offsets outside the type and are always dispatched afresh. */
+static int
+cache_type_ok(const ndt_t *t)
+{
+  while (t->tag == FixedDim) {
+    t = t->FixedDim.type;
+  }
+
+  return ndt_is_concrete(t) && ndt_is_scalar(t);
+}
+
+static int
+cache_type_equal(const ndt_t *t, const ndt_t *u)
+{
+  while (t->tag == FixedDim && u->tag == FixedDim) {
+    if (t->FixedDim.shape != u->FixedDim.shape ||
+        t->Concrete.FixedDim.step != u->Concrete.FixedDim.step ||
+        t->flags != u->flags) {
+      return 0;
+    }
+    t = t->FixedDim.type;
+    u = u->FixedDim.type;
+  }
+
+  return t->tag != FixedDim && u->tag != FixedDim && ndt_equal(t, u);
+}
+
+static void
+cache_entry_clear(gufunc_cache_entry_t *e)
+{
+  int i;
+
+  for (i = 0; i < GUFUNC_CACHE_MAX_ARGS; i++) {
+    ndt_del(e->in[i]);
+    ndt_del(e->out[i]);
+    ndt_del(e->broadcast[i]);
+    e->in[i] = e->out[i] = e->broadcast[i] = NULL;
+  }
+  e->generation = 0;
+  e->serial = 0;
+  e->pins = 0;
+}
+
+static uint64_t cache_serial = 0;
+
+/* Statistics summed over all GufuncObjects. */
+static gufunc_cache_stats_t cache_totals;
+
+void
+gufunc_cache_clear(GufuncObject *guobj)
+{
+  int k;
+
+  for (k = 0; k < GUFUNC_CACHE_SIZE; k++) {
+    cache_entry_clear(&guobj->cache[k]);
+  }
+}
+
+const gufunc_cache_stats_t *
+gufunc_cache_totals(void)
+{
+  return &cache_totals;
+}
+
+void
+gufunc_cache_pin(gufunc_cache_entry_t *e)
+{
+  e->pins++;
+}
+
+void
+gufunc_cache_unpin(gufunc_cache_entry_t *e)
+{
+  e->pins--;
+}
+
+/* Return the cache entry for the input types, or NULL. Entries from an
+   older table generation are dropped once no call uses them. */
+gufunc_cache_entry_t *
+gufunc_cache_lookup(GufuncObject *guobj, const ndt_t *in[], int nin)
+{
+  const uint64_t generation = rb_gumath_table_generation();
+  int i, k;
+
+  for (k = 0; k < GUFUNC_CACHE_SIZE; k++) {
+    gufunc_cache_entry_t *e = &guobj->cache[k];
+
+    if (e->generation == 0) {
+      continue;
+    }
+    if (e->generation != generation) {
+      if (e->pins == 0) {
+        cache_entry_clear(e);
+      }
+      continue;
+    }
+    if (e->nin != nin) {
+      continue;
+    }
+
+    for (i = 0; i < nin; i++) {
+      if (!cache_type_equal(e->in[i], in[i])) {
+        break;
+      }
+    }
+    if (i == nin) {
+      e->last_used = ++guobj->cache_clock;
+      guobj->cache_stats.hits++;
+      cache_totals.hits++;
+      return e;
+    }
+  }
+
+  guobj->cache_stats.misses++;
+  cache_totals.misses++;
+  return NULL;
+}
+
+/* Remember the outcome of gm_select for the input types, if cacheable. */
+void
+gufunc_cache_insert(GufuncObject *guobj, const ndt_t *in[], int nin,
+                    const gm_kernel_t *kernel, const ndt_apply_spec_t *spec)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  gufunc_cache_entry_t *e;
+  int i;
+
+  if (nin > GUFUNC_CACHE_MAX_ARGS || spec->nout > GUFUNC_CACHE_MAX_ARGS) {
+    return;
+  }
+
+  for (i = 0; i < nin; i++) {
+    if (!cache_type_ok(in[i])) {
+      return;
+    }
+  }
+
+  for (i = 0; i < spec->nout; i++) {
+    if (!ndt_is_concrete(spec->out[i])) {
+      return;
+    }
+  }
+
+  /* Replace an empty slot or the least recently used entry that no call
+     is using. */
+  e = NULL;
+  for (i = 0; i < GUFUNC_CACHE_SIZE; i++) {
+    gufunc_cache_entry_t *c = &guobj->cache[i];
+    if (c->pins > 0) {
+      continue;
+    }
+    if (c->generation == 0) {
+      e = c;
+      break;
+    }
+    if (e == NULL || c->last_used < e->last_used) {
+      e = c;
+    }
+  }
+  if (e == NULL) {
+    return;
+  }
+  if (e->generation != 0) {
+    guobj->cache_stats.evictions++;
+    cache_totals.evictions++;
+  }
+  cache_entry_clear(e);
+
+  e->nin = nin;
+  e->kernel = *kernel;
+  e->flags = spec->flags;
+  e->outer_dims = spec->outer_dims;
+  e->nout = spec->nout;
+  e->nbroadcast = spec->nbroadcast;
+
+  for (i = 0; i < nin; i++) {
+    e->in[i] = ndt_copy(in[i], &ctx);
+    if (e->in[i] == NULL) {
+      goto error;
+    }
+  }
+
+  for (i = 0; i < spec->nout; i++) {
+    e->out[i] = ndt_copy(spec->out[i], &ctx);
+    if (e->out[i] == NULL) {
+      goto error;
+    }
+  }
+
+  for (i = 0; i < spec->nbroadcast; i++) {
+    e->broadcast[i] = ndt_copy(spec->broadcast[i], &ctx);
+    if (e->broadcast[i] == NULL) {
+      goto error;
+    }
+  }
+
+  e->generation = rb_gumath_table_generation();
+  e->serial = ++cache_serial;
+  e->last_used = ++guobj->cache_clock;
+  return;
+
+error:
+  /* The cache is an optimization: drop the entry and the error. */
+  cache_entry_clear(e);
+  ndt_context_del(&ctx);
+}
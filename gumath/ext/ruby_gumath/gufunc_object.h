@@ -32,10 +32,47 @@
 #define GUFUNC_OBJECT_H
 
 #include "ruby_gumath_internal.h"
+#include "profile.h"
+
+#define GUFUNC_CACHE_SIZE 8
+#define GUFUNC_CACHE_MAX_ARGS 8
+
+/* Result of gm_select for one signature of input types. All types are owned
+   copies. An entry with generation 0 is empty.
+
+   Calls borrow the broadcast types of an entry instead of copying them. The
+   entry is pinned while a kernel runs on them and is not replaced until it
+   is unpinned; serial changes whenever the slot is cleared or reused. */
+typedef struct {
+  uint64_t generation;            /* table generation at insertion */
+  uint64_t serial;                /* unique per insertion, 0 when empty */
+  uint64_t last_used;             /* LRU clock of the last hit */
+  int pins;                       /* calls using the broadcast types */
+  int nin;
+  ndt_t *in[GUFUNC_CACHE_MAX_ARGS];
+  gm_kernel_t kernel;
+  uint32_t flags;
+  int outer_dims;
+  int nout;
+  int nbroadcast;
+  ndt_t *out[GUFUNC_CACHE_MAX_ARGS];
+  ndt_t *broadcast[GUFUNC_CACHE_MAX_ARGS];
+} gufunc_cache_entry_t;
+
+typedef struct {
+  uint64_t hits;                  /* lookups that found an entry */
+  uint64_t misses;                /* lookups that did not */
+  uint64_t evictions;             /* entries replaced by newer ones */
+} gufunc_cache_stats_t;
 
 typedef struct {
   const gm_tbl_t *table;          /* kernel table */
   char *name;                     /* function name */
+  uint64_t cache_clock;           /* LRU clock */
+  gufunc_cache_stats_t cache_stats; /* dispatch cache statistics */
+  gufunc_cache_entry_t cache[GUFUNC_CACHE_SIZE]; /* dispatch cache */
+  double ns_per_byte;             /* measured single-thread cost, 0: unknown */
+  gm_profile_t *profile;          /* counters of the function name */
 } GufuncObject;
 
 const rb_data_type_t GufuncObject_type;
@@ -52,4 +89,13 @@ VALUE cGumath_GufuncObject;
 
 VALUE GufuncObject_alloc(const gm_tbl_t *table, const char *name);
 
+gufunc_cache_entry_t *gufunc_cache_lookup(GufuncObject *guobj,
+                                          const ndt_t *in[], int nin);
+void gufunc_cache_insert(GufuncObject *guobj, const ndt_t *in[], int nin,
+                         const gm_kernel_t *kernel, const ndt_apply_spec_t *spec);
+void gufunc_cache_clear(GufuncObject *guobj);
+void gufunc_cache_pin(gufunc_cache_entry_t *e);
+const gufunc_cache_stats_t *gufunc_cache_totals(void);
+void gufunc_cache_unpin(gufunc_cache_entry_t *e);
+
 #endif
@@ -0,0 +1,262 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+   Profiling counters, kept per function name.
+
+   With profiling off a call pays one load and compare. The sampled mode is
+   meant to stay on in production: every call is counted, but only one in
+   GM_PROFILE_SAMPLE reads the clock, and the reported times are scaled up
+   to all calls. The full mode, used by Gumath.profile { }, times every
+   call.
+*/
+
+#include "ruby_gumath_internal.h"
+#include "profile.h"
+
+gm_profile_mode_t rb_gumath_profile_mode = GM_PROFILE_OFF;
+
+static gm_profile_t **records = NULL;
+static long nrecords = 0;
+static long capacity = 0;
+
+static const char *mode_names[] = {
+  [GM_PROFILE_OFF] = "off",
+  [GM_PROFILE_SAMPLED] = "sampled",
+  [GM_PROFILE_FULL] = "full"
+};
+
+gm_profile_t *
+rb_gumath_profile_get(const char *name)
+{
+  gm_profile_t *p;
+  long i;
+
+  for (i = 0; i < nrecords; i++) {
+    if (strcmp(records[i]->name, name) == 0) {
+      return records[i];
+    }
+  }
+
+  if (nrecords == capacity) {
+    capacity = capacity ? 2 * capacity : 64;
+    REALLOC_N(records, gm_profile_t *, capacity);
+  }
+
+  p = ZALLOC(gm_profile_t);
+  p->name = ALLOC_N(char, strlen(name) + 1);
+  strcpy(p->name, name);
+  records[nrecords++] = p;
+
+  return p;
+}
+
+void
+rb_gumath_profile_add(gm_profile_t *p, int timed, double select_ns,
+                      double alloc_ns, double kernel_ns, int64_t threads,
+                      int64_t bytes)
+{
+  p->calls++;
+  p->threads += threads;
+  p->bytes += bytes;
+
+  if (timed) {
+    p->timed++;
+    p->select_ns += select_ns;
+    p->alloc_ns += alloc_ns;
+    p->kernel_ns += kernel_ns;
+  }
+}
+
+/* Counters of p minus those of base, as a Hash. Times are in seconds,
+   scaled from the timed calls to all calls. */
+static VALUE
+record_hash(const gm_profile_t *p, const gm_profile_t *base)
+{
+  const uint64_t calls = p->calls - base->calls;
+  const uint64_t timed = p->timed - base->timed;
+  const double scale = timed > 0 ? 1e-9 * calls / timed : 0;
+  VALUE h = rb_hash_new();
+
+  rb_hash_aset(h, ID2SYM(rb_intern("calls")), ULL2NUM(calls));
+  rb_hash_aset(h, ID2SYM(rb_intern("timed_calls")), ULL2NUM(timed));
+  rb_hash_aset(h, ID2SYM(rb_intern("select_time")), DBL2NUM((p->select_ns - base->select_ns) * scale));
+  rb_hash_aset(h, ID2SYM(rb_intern("alloc_time")), DBL2NUM((p->alloc_ns - base->alloc_ns) * scale));
+  rb_hash_aset(h, ID2SYM(rb_intern("kernel_time")), DBL2NUM((p->kernel_ns - base->kernel_ns) * scale));
+  rb_hash_aset(h, ID2SYM(rb_intern("threads")), DBL2NUM((double)(p->threads - base->threads) / calls));
+  rb_hash_aset(h, ID2SYM(rb_intern("bytes")), ULL2NUM(p->bytes - base->bytes));
+
+  return h;
+}
+
+/* { name => counters } for the functions called since the snapshot. */
+static VALUE
+stats_hash(const gm_profile_t *snap, long nsnap)
+{
+  const gm_profile_t zero = {0};
+  VALUE stats = rb_hash_new();
+  long i;
+
+  for (i = 0; i < nrecords; i++) {
+    const gm_profile_t *base = i < nsnap ? &snap[i] : &zero;
+    if (records[i]->calls > base->calls) {
+      rb_hash_aset(stats, ID2SYM(rb_intern(records[i]->name)),
+                   record_hash(records[i], base));
+    }
+  }
+
+  return stats;
+}
+
+static gm_profile_mode_t
+mode_from_name(const char *name)
+{
+  int i;
+
+  for (i = GM_PROFILE_OFF; i <= GM_PROFILE_FULL; i++) {
+    if (strcmp(name, mode_names[i]) == 0) {
+      return (gm_profile_mode_t)i;
+    }
+  }
+
+  rb_raise(rb_eArgError, "profile mode must be :off, :sampled or :full, "
+           "got %s.", name);
+}
+
+/* Counters of every function called so far. */
+static VALUE
+Gumath_s_profile_stats(VALUE klass)
+{
+  return stats_hash(NULL, 0);
+}
+
+static VALUE
+Gumath_s_profile_reset(VALUE klass)
+{
+  long i;
+
+  for (i = 0; i < nrecords; i++) {
+    char *name = records[i]->name;
+    memset(records[i], 0, sizeof(gm_profile_t));
+    records[i]->name = name;
+  }
+
+  return Qnil;
+}
+
+static VALUE
+Gumath_s_profile_mode(VALUE klass)
+{
+  return ID2SYM(rb_intern(mode_names[rb_gumath_profile_mode]));
+}
+
+static VALUE
+Gumath_s_set_profile_mode(VALUE klass, VALUE mode)
+{
+  if (SYMBOL_P(mode)) {
+    mode = rb_sym2str(mode);
+  }
+  rb_gumath_profile_mode = mode_from_name(StringValueCStr(mode));
+
+  return Qnil;
+}
+
+typedef struct {
+  gm_profile_mode_t mode;
+  gm_profile_t *snap;
+  long nsnap;
+} profile_block_t;
+
+static VALUE
+profile_body(VALUE arg)
+{
+  profile_block_t *b = (profile_block_t *)arg;
+
+  rb_yield(Qnil);
+  return stats_hash(b->snap, b->nsnap);
+}
+
+static VALUE
+profile_restore(VALUE arg)
+{
+  profile_block_t *b = (profile_block_t *)arg;
+
+  rb_gumath_profile_mode = b->mode;
+  xfree(b->snap);
+
+  return Qnil;
+}
+
+/* Gumath.profile { ... }: time every gumath call made while the block runs
+   and return the counters of those calls. Calls made by other threads in
+   the meantime are included. */
+static VALUE
+Gumath_s_profile(VALUE klass)
+{
+  profile_block_t b;
+  long i;
+
+  rb_need_block();
+
+  b.mode = rb_gumath_profile_mode;
+  b.nsnap = nrecords;
+  b.snap = ALLOC_N(gm_profile_t, nrecords);
+  for (i = 0; i < nrecords; i++) {
+    b.snap[i] = *records[i];
+  }
+
+  rb_gumath_profile_mode = GM_PROFILE_FULL;
+  return rb_ensure(profile_body, (VALUE)&b, profile_restore, (VALUE)&b);
+}
+
+void
+Init_gumath_profile(void)
+{
+  const char *env = getenv("GUMATH_PROFILE");
+
+  if (env != NULL && *env != '\0') {
+    if (strcmp(env, "sampled") == 0) {
+      rb_gumath_profile_mode = GM_PROFILE_SAMPLED;
+    }
+    else if (strcmp(env, "full") == 0) {
+      rb_gumath_profile_mode = GM_PROFILE_FULL;
+    }
+    else if (strcmp(env, "off") != 0) {
+      rb_warn("gumath: ignoring unknown GUMATH_PROFILE '%s' (expected off, sampled or full)", env);
+    }
+  }
+
+  rb_define_singleton_method(cGumath, "profile", Gumath_s_profile, 0);
+  rb_define_singleton_method(cGumath, "profile_stats", Gumath_s_profile_stats, 0);
+  rb_define_singleton_method(cGumath, "profile_reset", Gumath_s_profile_reset, 0);
+  rb_define_singleton_method(cGumath, "profile_mode", Gumath_s_profile_mode, 0);
+  rb_define_singleton_method(cGumath, "profile_mode=", Gumath_s_set_profile_mode, 1);
+}
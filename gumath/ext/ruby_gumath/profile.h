@@ -0,0 +1,79 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Per-function profiling counters. */
+
+#ifndef GUMATH_PROFILE_H
+#define GUMATH_PROFILE_H
+
+typedef enum {
+  GM_PROFILE_OFF,
+  GM_PROFILE_SAMPLED,         /* count every call, time one in GM_PROFILE_SAMPLE */
+  GM_PROFILE_FULL             /* time every call */
+} gm_profile_mode_t;
+
+#define GM_PROFILE_SAMPLE 64
+
+/* Counters of all functions of one name. Only updated with the GVL held. */
+typedef struct {
+  char *name;
+  uint64_t calls;
+  uint64_t timed;             /* calls whose phases were timed */
+  double select_ns;           /* gm_select or dispatch cache, timed calls */
+  double alloc_ns;            /* output allocation, timed calls */
+  double kernel_ns;           /* running the kernel, timed calls */
+  uint64_t threads;           /* sum over calls of the threads used */
+  uint64_t bytes;             /* inputs and outputs, every call */
+} gm_profile_t;
+
+extern gm_profile_mode_t rb_gumath_profile_mode;
+
+/* The counters for name, created on first use and never freed. */
+gm_profile_t *rb_gumath_profile_get(const char *name);
+
+/* Whether the call about to be counted by p should be timed. */
+static inline int
+rb_gumath_profile_timed(const gm_profile_t *p)
+{
+  return rb_gumath_profile_mode == GM_PROFILE_FULL ||
+         (rb_gumath_profile_mode == GM_PROFILE_SAMPLED && p->calls % GM_PROFILE_SAMPLE == 0);
+}
+
+/* Count one call. The times are ignored unless timed is set. */
+void rb_gumath_profile_add(gm_profile_t *p, int timed, double select_ns,
+                           double alloc_ns, double kernel_ns, int64_t threads,
+                           int64_t bytes);
+
+/* Gumath.profile, Gumath.profile_stats, Gumath.profile_reset and
+   Gumath.profile_mode. */
+void Init_gumath_profile(void);
+
+#endif  /* GUMATH_PROFILE_H */
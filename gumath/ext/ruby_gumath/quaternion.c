@@ -0,0 +1,741 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+/*
+   Batched quaternion kernels on N * quaternion64 and N * quaternion128
+   arrays: multiply, conjugate, normalize, slerp and rotate (of N * 3 *
+   float64 vectors). These are the nominal 2 * 2 complex matrices of the
+   quaternion kernels in Gumath::Examples, where q = w + xi + yj + zk is
+   stored as [[w + xi, y + zi], [-y + zi, w - xi]] and the matrix product
+   is the Hamilton product.
+
+   Elements are read in blocks of QUAT_BLOCK, converted to float64 and
+   transposed into struct of arrays layout, so that the vector kernels of
+   quaternion_impl.h for the CPU tier process SIMD_BYTES / 8 quaternions
+   per instruction; results are transposed back on the way out. Short runs,
+   conjugate (which only flips signs in place) and compilers without vector
+   extensions use the element at a time array of structs path.
+
+   A length 1 operand broadcasts against the others. Large calls are split
+   into pool tasks and release the GVL.
+
+   The quaternion64 and quaternion128 typedefs come with the quaternion
+   group of Gumath::Examples, which is loaded into its table when this
+   module is defined, without defining Gumath::Examples itself.
+*/
+
+#include <math.h>
+#include "ruby_gumath_internal.h"
+#include "thread_pool.h"
+#include "cpu_features.h"
+
+
+/****************************************************************************/
+/*                                Parameters                                */
+/****************************************************************************/
+
+/* Quaternions per struct of arrays block; a multiple of every vector width. */
+#define QUAT_BLOCK 64
+
+/* Quaternions per pool task. */
+#define QUAT_TASK (QUAT_BLOCK * 64)
+
+/* Calls with fewer quaternions use the array of structs path. */
+#define QUAT_SOA_MIN 16
+
+/* Calls with fewer quaternions keep the GVL. */
+#define QUAT_GVL_CUTOFF (1 << 14)
+
+
+/****************************************************************************/
+/*                                   Types                                  */
+/****************************************************************************/
+
+enum quat_op { Q_MULTIPLY, Q_CONJUGATE, Q_NORMALIZE, Q_SLERP, Q_ROTATE };
+enum { QUAT_FLOAT32, QUAT_FLOAT64 };
+
+typedef struct {
+  double w, x, y, z;
+} quat_t;
+
+typedef struct {
+  double w[QUAT_BLOCK];
+  double x[QUAT_BLOCK];
+  double y[QUAT_BLOCK];
+  double z[QUAT_BLOCK];
+} quat_soa_t;
+
+typedef struct {
+  double x[QUAT_BLOCK];
+  double y[QUAT_BLOCK];
+  double z[QUAT_BLOCK];
+} vec_soa_t;
+
+typedef struct {
+  void (*mul)(const quat_soa_t *a, const quat_soa_t *b, quat_soa_t *o, int64_t n);
+  void (*normalize)(quat_soa_t *q, int64_t n);
+  void (*spread)(const quat_soa_t *a, const quat_soa_t *b, double *minus,
+                 double *plus, int64_t n);
+  void (*blend)(const quat_soa_t *a, const quat_soa_t *b, const double *wa,
+                const double *wb, quat_soa_t *o, int64_t n);
+  void (*rotate)(const quat_soa_t *q, const vec_soa_t *v, vec_soa_t *o, int64_t n);
+} quat_kernels_t;
+
+/* An input or output. Length 1 operands have step 0. */
+typedef struct {
+  const char *ptr;
+  int64_t n;
+  int64_t step;               /* bytes between elements */
+  int64_t col;                /* vectors: bytes between components */
+  int type;                   /* quaternions: QUAT_FLOAT32 or QUAT_FLOAT64 */
+  int ndim;                   /* 0 for a single element */
+  const char *name;           /* quaternions: name of the nominal type */
+} operand_t;
+
+typedef struct {
+  enum quat_op op;
+  const quat_kernels_t *kernels;  /* NULL for the array of structs path */
+  int64_t n;
+  int64_t nthreads;
+  operand_t a, b, t, v;
+  operand_t out;
+  double tval;
+  volatile int stop;          /* set by the unblocking function */
+  uint8_t *done;              /* finished tasks, skipped after a restart */
+} quat_job_t;
+
+
+/****************************************************************************/
+/*                                  Kernels                                 */
+/****************************************************************************/
+
+#if defined(__GNUC__) && !defined(_MSC_VER)
+
+#define SIMD_CAT_(a, b) a##_##b
+#define SIMD_CAT(a, b) SIMD_CAT_(a, b)
+
+#define SIMD_TIER base
+#define SIMD_BYTES 16
+#include "quaternion_impl.h"
+#undef SIMD_BYTES
+#undef SIMD_TIER
+
+#ifdef GM_CPU_X86
+GM_TARGET_PUSH("avx2,fma")
+#define SIMD_TIER avx2
+#define SIMD_BYTES 32
+#include "quaternion_impl.h"
+#undef SIMD_BYTES
+#undef SIMD_TIER
+GM_TARGET_POP
+
+GM_TARGET_PUSH("avx512f")
+#define SIMD_TIER avx512
+#define SIMD_BYTES 64
+#include "quaternion_impl.h"
+#undef SIMD_BYTES
+#undef SIMD_TIER
+GM_TARGET_POP
+#endif  /* GM_CPU_X86 */
+
+static const quat_kernels_t *
+quat_kernels(void)
+{
+  switch (rb_gumath_cpu_tier()) {
+#ifdef GM_CPU_X86
+  case GM_CPU_AVX512: return &quat_kernels_avx512;
+  case GM_CPU_AVX2: return &quat_kernels_avx2;
+#endif
+  default: return &quat_kernels_base;
+  }
+}
+
+#else
+
+static const quat_kernels_t *
+quat_kernels(void)
+{
+  return NULL;
+}
+
+#endif
+
+
+/****************************************************************************/
+/*                              Array of structs                            */
+/****************************************************************************/
+
+static inline quat_t
+quat_load(const operand_t *o, int64_t i)
+{
+  const char *p = o->ptr + i * o->step;
+  quat_t q;
+
+  if (o->type == QUAT_FLOAT32) {
+    const float *f = (const float *)p;
+    q.w = f[0]; q.x = f[1]; q.y = f[2]; q.z = f[3];
+  }
+  else {
+    const double *d = (const double *)p;
+    q.w = d[0]; q.x = d[1]; q.y = d[2]; q.z = d[3];
+  }
+
+  return q;
+}
+
+static inline void
+quat_store(const operand_t *o, int64_t i, quat_t q)
+{
+  char *p = (char *)o->ptr + i * o->step;
+  const double m[8] = {q.w, q.x, q.y, q.z, -q.y, q.z, q.w, -q.x};
+  int k;
+
+  if (o->type == QUAT_FLOAT32) {
+    for (k = 0; k < 8; k++) {
+      ((float *)p)[k] = (float)m[k];
+    }
+  }
+  else {
+    memcpy(p, m, sizeof m);
+  }
+}
+
+static inline double
+vec_load(const operand_t *o, int64_t i, int k)
+{
+  return *(const double *)(o->ptr + i * o->step + k * o->col);
+}
+
+static inline void
+vec_store(const operand_t *o, int64_t i, int k, double x)
+{
+  *(double *)(o->ptr + i * o->step + k * o->col) = x;
+}
+
+static inline double
+t_load(const operand_t *o, int64_t i)
+{
+  return *(const double *)(o->ptr + i * o->step);
+}
+
+static inline quat_t
+quat_mul(quat_t a, quat_t b)
+{
+  quat_t o;
+
+  o.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
+  o.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
+  o.y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x;
+  o.z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w;
+  return o;
+}
+
+static inline quat_t
+quat_normalize(quat_t q)
+{
+  const double r = 1.0 / sqrt(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+
+  q.w *= r; q.x *= r; q.y *= r; q.z *= r;
+  return q;
+}
+
+/* Weights of a and b in slerp(a, b, t), given |a - b|^2 and |a + b|^2. The
+   angle is taken as 2 atan2(|a - b|, |a + b|), which unlike acos(a.b) is
+   accurate for nearly equal rotations; b is negated (wb < 0) to take the
+   shorter arc. */
+static inline void
+slerp_weights(double minus, double plus, double t, double *wa, double *wb)
+{
+  const double sign = minus > plus ? -1.0 : 1.0;
+  const double lo = minus > plus ? plus : minus;
+  const double hi = minus > plus ? minus : plus;
+  const double theta = 2.0 * atan2(sqrt(lo), sqrt(hi));
+  const double s = 1.0 - t;
+
+  if (theta < 1e-4) {
+    /* sin(k theta) / sin(theta) = k (1 + (1 - k^2) theta^2 / 6 + ...) */
+    *wa = s * (1.0 + (1.0 - s * s) * theta * theta / 6.0);
+    *wb = sign * t * (1.0 + (1.0 - t * t) * theta * theta / 6.0);
+  }
+  else {
+    *wa = sin(s * theta) / sin(theta);
+    *wb = sign * sin(t * theta) / sin(theta);
+  }
+}
+
+static void
+aos_run(const quat_job_t *j, int64_t start, int64_t end)
+{
+  quat_t a, b, o;
+  double wa, wb, v[3];
+  int64_t i;
+
+  for (i = start; i < end; i++) {
+    switch (j->op) {
+    case Q_MULTIPLY:
+      quat_store(&j->out, i, quat_mul(quat_load(&j->a, i), quat_load(&j->b, i)));
+      break;
+    case Q_CONJUGATE:
+      a = quat_load(&j->a, i);
+      a.x = -a.x; a.y = -a.y; a.z = -a.z;
+      quat_store(&j->out, i, a);
+      break;
+    case Q_NORMALIZE:
+      quat_store(&j->out, i, quat_normalize(quat_load(&j->a, i)));
+      break;
+    case Q_SLERP:
+      a = quat_load(&j->a, i);
+      b = quat_load(&j->b, i);
+      slerp_weights((a.w - b.w) * (a.w - b.w) + (a.x - b.x) * (a.x - b.x) +
+                    (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z),
+                    (a.w + b.w) * (a.w + b.w) + (a.x + b.x) * (a.x + b.x) +
+                    (a.y + b.y) * (a.y + b.y) + (a.z + b.z) * (a.z + b.z),
+                    t_load(&j->t, i), &wa, &wb);
+      o.w = wa * a.w + wb * b.w;
+      o.x = wa * a.x + wb * b.x;
+      o.y = wa * a.y + wb * b.y;
+      o.z = wa * a.z + wb * b.z;
+      quat_store(&j->out, i, o);
+      break;
+    case Q_ROTATE: {
+      /* q (0, v) q^-1 */
+      quat_t p, c;
+      a = quat_load(&j->a, i);
+      p.w = 0; p.x = vec_load(&j->v, i, 0); p.y = vec_load(&j->v, i, 1); p.z = vec_load(&j->v, i, 2);
+      c.w = a.w; c.x = -a.x; c.y = -a.y; c.z = -a.z;
+      o = quat_mul(quat_mul(a, p), c);
+      wa = 1.0 / (a.w * a.w + a.x * a.x + a.y * a.y + a.z * a.z);
+      v[0] = o.x * wa; v[1] = o.y * wa; v[2] = o.z * wa;
+      vec_store(&j->out, i, 0, v[0]);
+      vec_store(&j->out, i, 1, v[1]);
+      vec_store(&j->out, i, 2, v[2]);
+      break;
+    }
+    }
+  }
+}
+
+
+/****************************************************************************/
+/*                             Struct of arrays                             */
+/****************************************************************************/
+
+static void
+quat_gather(const operand_t *o, int64_t start, int64_t n, quat_soa_t *s)
+{
+  int64_t i;
+
+  for (i = 0; i < n; i++) {
+    const quat_t q = quat_load(o, start + i);
+    s->w[i] = q.w; s->x[i] = q.x; s->y[i] = q.y; s->z[i] = q.z;
+  }
+}
+
+static void
+quat_scatter(const operand_t *o, int64_t start, int64_t n, const quat_soa_t *s)
+{
+  int64_t i;
+
+  for (i = 0; i < n; i++) {
+    quat_t q;
+    q.w = s->w[i]; q.x = s->x[i]; q.y = s->y[i]; q.z = s->z[i];
+    quat_store(o, start + i, q);
+  }
+}
+
+static void
+soa_run(const quat_job_t *j, int64_t start, int64_t end)
+{
+  const quat_kernels_t *k = j->kernels;
+  quat_soa_t a, b, o;
+  vec_soa_t v, w;
+  double minus[QUAT_BLOCK], plus[QUAT_BLOCK];
+  int64_t i, n, m;
+
+  for (i = start; i < end; i += QUAT_BLOCK) {
+    n = end - i < QUAT_BLOCK ? end - i : QUAT_BLOCK;
+    quat_gather(&j->a, i, n, &a);
+
+    switch (j->op) {
+    case Q_MULTIPLY:
+      quat_gather(&j->b, i, n, &b);
+      k->mul(&a, &b, &o, n);
+      quat_scatter(&j->out, i, n, &o);
+      break;
+    case Q_NORMALIZE:
+      k->normalize(&a, n);
+      quat_scatter(&j->out, i, n, &a);
+      break;
+    case Q_SLERP:
+      quat_gather(&j->b, i, n, &b);
+      k->spread(&a, &b, minus, plus, n);
+      for (m = 0; m < n; m++) {
+        slerp_weights(minus[m], plus[m], t_load(&j->t, i + m), &minus[m], &plus[m]);
+      }
+      k->blend(&a, &b, minus, plus, &o, n);
+      quat_scatter(&j->out, i, n, &o);
+      break;
+    case Q_ROTATE:
+      for (m = 0; m < n; m++) {
+        v.x[m] = vec_load(&j->v, i + m, 0);
+        v.y[m] = vec_load(&j->v, i + m, 1);
+        v.z[m] = vec_load(&j->v, i + m, 2);
+      }
+      k->rotate(&a, &v, &w, n);
+      for (m = 0; m < n; m++) {
+        vec_store(&j->out, i + m, 0, w.x[m]);
+        vec_store(&j->out, i + m, 1, w.y[m]);
+        vec_store(&j->out, i + m, 2, w.z[m]);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+static int
+quat_task(void *job, int64_t i, ndt_context_t *ctx)
+{
+  const quat_job_t *j = (const quat_job_t *)job;
+  const int64_t start = i * QUAT_TASK;
+  const int64_t end = start + QUAT_TASK < j->n ? start + QUAT_TASK : j->n;
+
+  (void)ctx;
+
+  if (j->stop || (j->done != NULL && j->done[i])) {
+    return 0;
+  }
+
+  if (j->kernels == NULL || j->op == Q_CONJUGATE) {
+    aos_run(j, start, end);
+  }
+  else {
+    soa_run(j, start, end);
+  }
+
+  if (j->done != NULL) {
+    j->done[i] = 1;
+  }
+  return 0;
+}
+
+static void *
+run_quat(void *job)
+{
+  quat_job_t *j = (quat_job_t *)job;
+  NDT_STATIC_CONTEXT(ctx);
+
+  (void)rb_gumath_pool_run(j->nthreads, (j->n + QUAT_TASK - 1) / QUAT_TASK,
+                           quat_task, j, &ctx);
+  return NULL;
+}
+
+/* Unblocking function: the remaining tasks return at once. */
+static void
+quat_ubf(void *job)
+{
+  ((quat_job_t *)job)->stop = 1;
+}
+
+
+/****************************************************************************/
+/*                                   Setup                                  */
+/****************************************************************************/
+
+static const xnd_t *
+xnd_arg(VALUE x, const char *fn)
+{
+  if (!rb_xnd_check_type(x)) {
+    rb_raise(rb_eTypeError, "%s: arguments must be XND.", fn);
+  }
+  return rb_xnd_const_xnd(x);
+}
+
+/* A quaternion64 or quaternion128, or a 1-D array of them. */
+static void
+quat_arg(VALUE x, const char *fn, operand_t *o)
+{
+  const xnd_t *xnd = xnd_arg(x, fn);
+  const ndt_t *t = xnd->type, *dtype = t;
+
+  memset(o, 0, sizeof *o);
+  if (t->tag == FixedDim) {
+    dtype = t->FixedDim.type;
+    o->ndim = 1;
+    o->n = t->FixedDim.shape;
+    o->step = t->Concrete.FixedDim.step * dtype->datasize;
+  }
+  else {
+    o->n = 1;
+  }
+
+  if (dtype->tag != Nominal || (strcmp(dtype->Nominal.name, "quaternion64") != 0 &&
+                                strcmp(dtype->Nominal.name, "quaternion128") != 0)) {
+    rb_raise(rb_eTypeError, "%s: need an N * quaternion64 or N * quaternion128 array.", fn);
+  }
+
+  o->name = dtype->Nominal.name;
+  o->type = strcmp(o->name, "quaternion64") == 0 ? QUAT_FLOAT32 : QUAT_FLOAT64;
+  o->ptr = xnd->ptr + (o->ndim ? xnd->index * dtype->datasize : 0);
+  if (o->n == 1) {
+    o->step = 0;
+  }
+}
+
+/* A float64 vector of 3, or an N * 3 array of them. */
+static void
+vec_arg(VALUE x, const char *fn, operand_t *o)
+{
+  const xnd_t *xnd = xnd_arg(x, fn);
+  const ndt_t *t = xnd->type, *row = t;
+
+  memset(o, 0, sizeof *o);
+  if (t->ndim == 2 && t->tag == FixedDim) {
+    row = t->FixedDim.type;
+    o->ndim = 1;
+    o->n = t->FixedDim.shape;
+    o->step = t->Concrete.FixedDim.step * 8;
+  }
+  else {
+    o->n = 1;
+  }
+
+  if (row->ndim != 1 || row->tag != FixedDim || row->FixedDim.shape != 3 ||
+      row->FixedDim.type->tag != Float64 || ndt_is_optional(row->FixedDim.type)) {
+    rb_raise(rb_eTypeError, "%s: need an N * 3 * float64 array of vectors.", fn);
+  }
+
+  o->col = row->Concrete.FixedDim.step * 8;
+  o->ptr = xnd->ptr + xnd->index * 8;
+  if (o->n == 1) {
+    o->step = 0;
+  }
+}
+
+/* The slerp parameter: a Float or a float64 XND of one or N values. */
+static void
+t_arg(VALUE x, const char *fn, quat_job_t *j)
+{
+  operand_t *o = &j->t;
+  const xnd_t *xnd;
+  const ndt_t *t, *dtype;
+
+  memset(o, 0, sizeof *o);
+  o->n = 1;
+  if (!rb_xnd_check_type(x)) {
+    j->tval = NUM2DBL(x);
+    o->ptr = (const char *)&j->tval;
+    return;
+  }
+
+  xnd = rb_xnd_const_xnd(x);
+  t = dtype = xnd->type;
+  if (t->tag == FixedDim && t->ndim == 1) {
+    dtype = t->FixedDim.type;
+    o->ndim = 1;
+    o->n = t->FixedDim.shape;
+    o->step = o->n == 1 ? 0 : t->Concrete.FixedDim.step * 8;
+  }
+  if (dtype->tag != Float64 || ndt_is_optional(dtype)) {
+    rb_raise(rb_eTypeError, "%s: t must be a Float or a float64 array.", fn);
+  }
+
+  o->ptr = xnd->ptr + (o->ndim ? xnd->index * 8 : 0);
+}
+
+static void
+broadcast(quat_job_t *j, const operand_t *o, const char *fn)
+{
+  if (o->n == j->n || o->n == 1) {
+    return;
+  }
+  if (j->n == 1) {
+    j->n = o->n;
+    return;
+  }
+
+  rb_raise(rb_eArgError, "%s: cannot broadcast lengths %" PRIi64 " and %" PRIi64 ".",
+           fn, j->n, o->n);
+}
+
+static VALUE
+empty_xnd(const char *type)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  ndt_t *t = ndt_from_string(type, &ctx);
+
+  if (t == NULL) {
+    rb_ndtypes_set_error(&ctx);
+    raise_error();
+  }
+
+  return rb_xnd_empty_from_type(t);
+}
+
+static VALUE
+quaternion(enum quat_op op, VALUE a, VALUE b, VALUE t)
+{
+  static const char *const names[] = {"multiply", "conjugate", "normalize", "slerp", "rotate"};
+  const char *fn = names[op];
+  quat_job_t j;
+  char type[128], shape[32] = "";
+  VALUE result, tmp = 0;
+  int64_t ntasks;
+  int ndim;
+
+  memset(&j, 0, sizeof j);
+  j.op = op;
+  j.nthreads = rb_gumath_call_threads();
+
+  quat_arg(a, fn, &j.a);
+  j.n = j.a.n;
+  ndim = j.a.ndim;
+
+  switch (op) {
+  case Q_MULTIPLY: case Q_SLERP:
+    quat_arg(b, fn, &j.b);
+    if (j.b.type != j.a.type) {
+      rb_raise(rb_eTypeError, "%s: both arguments must have the same type.", fn);
+    }
+    broadcast(&j, &j.b, fn);
+    ndim |= j.b.ndim;
+    if (op == Q_SLERP) {
+      t_arg(t, fn, &j);
+      broadcast(&j, &j.t, fn);
+      ndim |= j.t.ndim;
+    }
+    break;
+  case Q_ROTATE:
+    vec_arg(b, fn, &j.v);
+    broadcast(&j, &j.v, fn);
+    ndim |= j.v.ndim;
+    break;
+  default:
+    break;
+  }
+
+  if (ndim) {
+    snprintf(shape, sizeof shape, "%" PRIi64 " * ", j.n);
+  }
+  if (op == Q_ROTATE) {
+    snprintf(type, sizeof type, "%s3 * float64", shape);
+  }
+  else {
+    snprintf(type, sizeof type, "%s%s", shape, j.a.name);
+  }
+  result = empty_xnd(type);
+
+  j.out.ptr = rb_xnd_const_xnd(result)->ptr;
+  j.out.n = j.n;
+  j.out.type = j.a.type;
+  j.out.step = op == Q_ROTATE ? 3 * sizeof(double) : (j.a.type == QUAT_FLOAT32 ? 32 : 64);
+  j.out.col = sizeof(double);
+
+  j.kernels = j.n < QUAT_SOA_MIN ? NULL : quat_kernels();
+  if (j.n < QUAT_GVL_CUTOFF) {
+    run_quat(&j);
+  }
+  else {
+    /* If an interrupt handler does not raise, go on with the tasks that
+       were not finished yet. */
+    ntasks = (j.n + QUAT_TASK - 1) / QUAT_TASK;
+    j.done = ALLOCV_N(uint8_t, tmp, ntasks);
+    memset(j.done, 0, ntasks);
+    do {
+      j.stop = 0;
+      rb_thread_call_without_gvl(run_quat, &j, quat_ubf, &j);
+    } while (j.stop);
+    ALLOCV_END(tmp);
+  }
+
+  RB_GC_GUARD(a);
+  RB_GC_GUARD(b);
+  RB_GC_GUARD(t);
+  return result;
+}
+
+
+/****************************************************************************/
+/*                               Ruby methods                               */
+/****************************************************************************/
+
+/* Gumath::Quaternions.multiply(a, b): the Hamilton products a[i] b[i]. */
+static VALUE
+mGumath_Quaternions_s_multiply(VALUE module, VALUE a, VALUE b)
+{
+  return quaternion(Q_MULTIPLY, a, b, Qnil);
+}
+
+/* conjugate(q): w - xi - yj - zk. */
+static VALUE
+mGumath_Quaternions_s_conjugate(VALUE module, VALUE q)
+{
+  return quaternion(Q_CONJUGATE, q, Qnil, Qnil);
+}
+
+/* normalize(q): q / |q|. */
+static VALUE
+mGumath_Quaternions_s_normalize(VALUE module, VALUE q)
+{
+  return quaternion(Q_NORMALIZE, q, Qnil, Qnil);
+}
+
+/* slerp(a, b, t): spherical interpolation between unit quaternions along
+   the shorter arc; t is a Float or a float64 array. */
+static VALUE
+mGumath_Quaternions_s_slerp(VALUE module, VALUE a, VALUE b, VALUE t)
+{
+  return quaternion(Q_SLERP, a, b, t);
+}
+
+/* rotate(q, v): the N * 3 * float64 vectors v rotated by q, q v q^-1. */
+static VALUE
+mGumath_Quaternions_s_rotate(VALUE module, VALUE q, VALUE v)
+{
+  return quaternion(Q_ROTATE, q, v, Qnil);
+}
+
+void
+Init_gumath_quaternions(void)
+{
+  VALUE mGumath_Quaternions = rb_define_module_under(cGumath, "Quaternions");
+
+  rb_gumath_load_group("Examples", "quaternion");
+
+  rb_define_singleton_method(mGumath_Quaternions, "multiply", mGumath_Quaternions_s_multiply, 2);
+  rb_define_singleton_method(mGumath_Quaternions, "conjugate", mGumath_Quaternions_s_conjugate, 1);
+  rb_define_singleton_method(mGumath_Quaternions, "normalize", mGumath_Quaternions_s_normalize, 1);
+  rb_define_singleton_method(mGumath_Quaternions, "slerp", mGumath_Quaternions_s_slerp, 3);
+  rb_define_singleton_method(mGumath_Quaternions, "rotate", mGumath_Quaternions_s_rotate, 2);
+}
@@ -0,0 +1,182 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+   Vector bodies of the quaternion kernels. Like simd_math_impl.h this file
+   has no include guard: quaternion.c includes it once per instruction set
+   tier, with SIMD_TIER naming the tier and SIMD_BYTES giving its vector
+   width.
+
+   The kernels work on blocks in struct of arrays layout (quat_soa_t,
+   vec_soa_t), so that every vector holds one component of SIMD_BYTES / 8
+   consecutive quaternions. n is rounded up to whole vectors; the extra
+   lanes hold stale values and are never stored back.
+*/
+
+#define SIMD_FN(name) SIMD_CAT(name, SIMD_TIER)
+#define SIMD_LANES (SIMD_BYTES / 8)
+
+#define VD SIMD_FN(vd)
+
+typedef double VD __attribute__((vector_size(SIMD_BYTES)));
+
+static inline VD
+SIMD_FN(load)(const double *p)
+{
+  VD v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+static inline void
+SIMD_FN(store)(double *p, VD v)
+{
+  memcpy(p, &v, sizeof v);
+}
+
+/* Hamilton product o = a b. */
+static void
+SIMD_FN(quat_mul)(const quat_soa_t *a, const quat_soa_t *b, quat_soa_t *o, int64_t n)
+{
+  int64_t i;
+
+  for (i = 0; i < n; i += SIMD_LANES) {
+    const VD aw = SIMD_FN(load)(a->w + i), ax = SIMD_FN(load)(a->x + i);
+    const VD ay = SIMD_FN(load)(a->y + i), az = SIMD_FN(load)(a->z + i);
+    const VD bw = SIMD_FN(load)(b->w + i), bx = SIMD_FN(load)(b->x + i);
+    const VD by = SIMD_FN(load)(b->y + i), bz = SIMD_FN(load)(b->z + i);
+
+    SIMD_FN(store)(o->w + i, aw * bw - ax * bx - ay * by - az * bz);
+    SIMD_FN(store)(o->x + i, aw * bx + ax * bw + ay * bz - az * by);
+    SIMD_FN(store)(o->y + i, aw * by - ax * bz + ay * bw + az * bx);
+    SIMD_FN(store)(o->z + i, aw * bz + ax * by - ay * bx + az * bw);
+  }
+}
+
+/* q / |q|, in place. */
+static void
+SIMD_FN(quat_normalize)(quat_soa_t *q, int64_t n)
+{
+  int64_t i;
+  int k;
+
+  for (i = 0; i < n; i += SIMD_LANES) {
+    const VD w = SIMD_FN(load)(q->w + i), x = SIMD_FN(load)(q->x + i);
+    const VD y = SIMD_FN(load)(q->y + i), z = SIMD_FN(load)(q->z + i);
+    VD r = w * w + x * x + y * y + z * z;
+
+    /* Vector extensions have no square root; the lanes compile to
+       sqrtsd, which is still cheap next to the loads and stores. */
+    for (k = 0; k < SIMD_LANES; k++) {
+      r[k] = sqrt(r[k]);
+    }
+    r = 1.0 / r;
+
+    SIMD_FN(store)(q->w + i, w * r);
+    SIMD_FN(store)(q->x + i, x * r);
+    SIMD_FN(store)(q->y + i, y * r);
+    SIMD_FN(store)(q->z + i, z * r);
+  }
+}
+
+/* |a - b|^2 and |a + b|^2, from which slerp_weights finds the angle. */
+static void
+SIMD_FN(quat_spread)(const quat_soa_t *a, const quat_soa_t *b, double *minus,
+                     double *plus, int64_t n)
+{
+  int64_t i;
+
+  for (i = 0; i < n; i += SIMD_LANES) {
+    const VD aw = SIMD_FN(load)(a->w + i), ax = SIMD_FN(load)(a->x + i);
+    const VD ay = SIMD_FN(load)(a->y + i), az = SIMD_FN(load)(a->z + i);
+    const VD bw = SIMD_FN(load)(b->w + i), bx = SIMD_FN(load)(b->x + i);
+    const VD by = SIMD_FN(load)(b->y + i), bz = SIMD_FN(load)(b->z + i);
+    const VD dw = aw - bw, dx = ax - bx, dy = ay - by, dz = az - bz;
+    const VD sw = aw + bw, sx = ax + bx, sy = ay + by, sz = az + bz;
+
+    SIMD_FN(store)(minus + i, dw * dw + dx * dx + dy * dy + dz * dz);
+    SIMD_FN(store)(plus + i, sw * sw + sx * sx + sy * sy + sz * sz);
+  }
+}
+
+/* o = wa a + wb b. */
+static void
+SIMD_FN(quat_blend)(const quat_soa_t *a, const quat_soa_t *b, const double *wa,
+                    const double *wb, quat_soa_t *o, int64_t n)
+{
+  int64_t i;
+
+  for (i = 0; i < n; i += SIMD_LANES) {
+    const VD ka = SIMD_FN(load)(wa + i), kb = SIMD_FN(load)(wb + i);
+
+    SIMD_FN(store)(o->w + i, ka * SIMD_FN(load)(a->w + i) + kb * SIMD_FN(load)(b->w + i));
+    SIMD_FN(store)(o->x + i, ka * SIMD_FN(load)(a->x + i) + kb * SIMD_FN(load)(b->x + i));
+    SIMD_FN(store)(o->y + i, ka * SIMD_FN(load)(a->y + i) + kb * SIMD_FN(load)(b->y + i));
+    SIMD_FN(store)(o->z + i, ka * SIMD_FN(load)(a->z + i) + kb * SIMD_FN(load)(b->z + i));
+  }
+}
+
+/* o = q v q^-1, for q of any non-zero norm:
+   ((w^2 - u.u) v + 2 (u.v) u + 2 w (u x v)) / |q|^2 with u = (x, y, z). */
+static void
+SIMD_FN(quat_rotate)(const quat_soa_t *q, const vec_soa_t *v, vec_soa_t *o, int64_t n)
+{
+  int64_t i;
+
+  for (i = 0; i < n; i += SIMD_LANES) {
+    const VD w = SIMD_FN(load)(q->w + i), x = SIMD_FN(load)(q->x + i);
+    const VD y = SIMD_FN(load)(q->y + i), z = SIMD_FN(load)(q->z + i);
+    const VD vx = SIMD_FN(load)(v->x + i), vy = SIMD_FN(load)(v->y + i);
+    const VD vz = SIMD_FN(load)(v->z + i);
+    const VD uu = x * x + y * y + z * z;
+    const VD r = 1.0 / (w * w + uu);
+    const VD s = (w * w - uu) * r;
+    const VD uv = 2.0 * (x * vx + y * vy + z * vz) * r;
+    const VD w2 = 2.0 * w * r;
+
+    SIMD_FN(store)(o->x + i, s * vx + uv * x + w2 * (y * vz - z * vy));
+    SIMD_FN(store)(o->y + i, s * vy + uv * y + w2 * (z * vx - x * vz));
+    SIMD_FN(store)(o->z + i, s * vz + uv * z + w2 * (x * vy - y * vx));
+  }
+}
+
+static const quat_kernels_t SIMD_FN(quat_kernels) = {
+  SIMD_FN(quat_mul),
+  SIMD_FN(quat_normalize),
+  SIMD_FN(quat_spread),
+  SIMD_FN(quat_blend),
+  SIMD_FN(quat_rotate)
+};
+
+#undef VD
+#undef SIMD_LANES
+#undef SIMD_FN
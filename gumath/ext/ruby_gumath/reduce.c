@@ -0,0 +1,958 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+   Reductions: sum, prod, min, max, mean and var over any set of axes of an
+   array of fixed dimensions, with keepdims: and NA skipping for optional
+   dtypes.
+
+   The axes, the keepdims: option and the NA semantics do not fit a gufunc
+   signature, so these are direct entry points in Gumath::Reductions rather
+   than kernels in the function table. They still run on the worker pool
+   and without the GVL for large inputs.
+
+   The dimensions that are kept enumerate the outputs. For every output the
+   reduced elements are visited as rows along the reduced dimension with the
+   smallest step, cut into segments of at most REDUCE_SEGMENT elements.
+   Segments are reduced with fast inner loops (pairwise summation with eight
+   accumulators for sums and means, which the compiler vectorizes), combined
+   in order within groups of REDUCE_GROUP segments, and the groups are then
+   combined in order; float sums are combined with Neumaier compensation and
+   variances with Chan's formula. Threads only ever compute whole groups, so
+   the result does not depend on the number of threads.
+*/
+
+#include <math.h>
+#include "ruby_gumath_internal.h"
+#include "thread_pool.h"
+
+
+/****************************************************************************/
+/*                                Parameters                                */
+/****************************************************************************/
+
+/* Elements per segment. */
+#define REDUCE_SEGMENT (1 << 14)
+
+/* Segments per group, the unit of work of a thread. */
+#define REDUCE_GROUP 16
+
+/* Inputs smaller than this many bytes are reduced with the GVL held. */
+#define REDUCE_GVL_CUTOFF (1 << 16)
+
+/* Block size of the pairwise summation. */
+#define PAIRWISE_BLOCK 128
+
+
+/****************************************************************************/
+/*                                   Types                                  */
+/****************************************************************************/
+
+enum reduce_op { R_SUM, R_PROD, R_MIN, R_MAX, R_MEAN, R_VAR };
+
+/* How values are accumulated. Means and variances always use doubles. */
+enum reduce_kind { K_SIGNED, K_UNSIGNED, K_FLOAT };
+
+typedef struct {
+  int64_t n;                  /* valid elements seen */
+  union {
+    int64_t i;
+    uint64_t u;
+    double f;
+  } v;                        /* sum, product, minimum or maximum */
+  double c;                   /* compensation of a float sum */
+  double mean;                /* var: mean ... */
+  double m2;                  /* ... and sum of squared deviations */
+} reduce_acc_t;
+
+typedef struct reduce reduce_t;
+
+/* Reduce n elements starting at element index, step r->row_step, into a
+   fresh accumulator. */
+typedef void (*reduce_row_t)(const reduce_t *r, int64_t index, int64_t n,
+                             reduce_acc_t *acc);
+
+struct reduce {
+  enum reduce_op op;
+  enum reduce_kind kind;
+  reduce_row_t row;
+
+  /* input */
+  const char *ptr;            /* element i lives at ptr + i * itemsize */
+  int64_t itemsize;
+  const uint8_t *bitmap;      /* validity bits, NULL if there are no NAs */
+
+  int nkept;
+  int64_t kept_shape[NDT_MAX_DIM];
+  int64_t kept_step[NDT_MAX_DIM];
+  int nred;                   /* reduced dimensions except the row dimension */
+  int64_t red_shape[NDT_MAX_DIM];
+  int64_t red_step[NDT_MAX_DIM];
+  int64_t index;              /* index of the first element */
+  int64_t row_len;
+  int64_t row_step;
+
+  int64_t nout;               /* outputs */
+  int64_t nrows;              /* rows per output */
+  int64_t nseg;               /* segments per row */
+  int64_t ngroups;            /* groups per output */
+  int64_t ddof;
+  int64_t nthreads;
+  int nogvl;                  /* run without the GVL */
+  volatile int stop;          /* set by the unblocking function */
+
+  /* output, C contiguous */
+  enum ndt out_tag;
+  char *out;
+  uint8_t *out_bitmap;        /* NULL unless the output is optional */
+  int error;                  /* set by store: an empty min or max */
+
+  /* group results when outputs are split into groups */
+  reduce_acc_t *partial;
+  int64_t chunk;              /* outputs per task otherwise */
+
+  /* finished groups or outputs, so that a restart after an interrupt skips
+     them; NULL with the GVL held */
+  uint8_t *done;
+};
+
+#define BIT(bitmap, i) (((bitmap)[(i) >> 3] >> ((i) & 7)) & 1)
+
+
+/****************************************************************************/
+/*                               Accumulators                               */
+/****************************************************************************/
+
+static void
+acc_init(const reduce_t *r, reduce_acc_t *acc)
+{
+  acc->n = 0;
+  acc->v.u = 0;
+  acc->c = 0;
+  acc->mean = 0;
+  acc->m2 = 0;
+
+  if (r->op == R_PROD) {
+    switch (r->kind) {
+    case K_SIGNED: acc->v.i = 1; break;
+    case K_UNSIGNED: acc->v.u = 1; break;
+    case K_FLOAT: acc->v.f = 1; break;
+    }
+  }
+}
+
+/* Add b to a; a holds the elements that come first. */
+static void
+acc_combine(const reduce_t *r, reduce_acc_t *a, const reduce_acc_t *b)
+{
+  if (b->n == 0) {
+    return;
+  }
+  if (a->n == 0) {
+    *a = *b;
+    return;
+  }
+
+  switch (r->op) {
+  case R_SUM: case R_MEAN:
+    switch (r->kind) {
+    case K_SIGNED: a->v.i = (int64_t)((uint64_t)a->v.i + (uint64_t)b->v.i); break;
+    case K_UNSIGNED: a->v.u += b->v.u; break;
+    case K_FLOAT: {
+      /* Neumaier: the compensation collects the low bits lost in the sum. */
+      const double s = a->v.f + b->v.f;
+      if (fabs(a->v.f) >= fabs(b->v.f)) {
+        a->c += (a->v.f - s) + b->v.f;
+      }
+      else {
+        a->c += (b->v.f - s) + a->v.f;
+      }
+      a->c += b->c;
+      a->v.f = s;
+      break;
+    }
+    }
+    break;
+
+  case R_PROD:
+    switch (r->kind) {
+    case K_SIGNED: a->v.i = (int64_t)((uint64_t)a->v.i * (uint64_t)b->v.i); break;
+    case K_UNSIGNED: a->v.u *= b->v.u; break;
+    case K_FLOAT: a->v.f *= b->v.f; break;
+    }
+    break;
+
+  case R_MIN:
+    switch (r->kind) {
+    case K_SIGNED: if (b->v.i < a->v.i) a->v.i = b->v.i; break;
+    case K_UNSIGNED: if (b->v.u < a->v.u) a->v.u = b->v.u; break;
+    case K_FLOAT:
+      if (!isnan(a->v.f) && (isnan(b->v.f) || b->v.f < a->v.f)) a->v.f = b->v.f;
+      break;
+    }
+    break;
+
+  case R_MAX:
+    switch (r->kind) {
+    case K_SIGNED: if (b->v.i > a->v.i) a->v.i = b->v.i; break;
+    case K_UNSIGNED: if (b->v.u > a->v.u) a->v.u = b->v.u; break;
+    case K_FLOAT:
+      if (!isnan(a->v.f) && (isnan(b->v.f) || b->v.f > a->v.f)) a->v.f = b->v.f;
+      break;
+    }
+    break;
+
+  case R_VAR: {
+    /* Chan et al.: merge two (count, mean, m2) triples. */
+    const double na = (double)a->n, nb = (double)b->n, n = na + nb;
+    const double delta = b->mean - a->mean;
+    a->mean += delta * nb / n;
+    a->m2 += b->m2 + delta * delta * na * nb / n;
+    break;
+  }
+  }
+
+  a->n += b->n;
+}
+
+
+/****************************************************************************/
+/*                                Inner loops                               */
+/****************************************************************************/
+
+#define LOAD(T, i) (*(const T *)(p + (i) * stride))
+
+/* Pairwise sum as in NumPy: blocks of PAIRWISE_BLOCK elements are summed
+   with eight independent accumulators, blocks are added pairwise. The error
+   grows with log(n) instead of n. */
+#define PAIRWISE(NAME, T)                                                    \
+static double                                                                \
+pairwise_##NAME(const char *p, int64_t n, int64_t stride)                    \
+{                                                                            \
+  int64_t i;                                                                 \
+                                                                             \
+  if (n < 8) {                                                               \
+    double s = 0;                                                            \
+    for (i = 0; i < n; i++) {                                                \
+      s += (double)LOAD(T, i);                                               \
+    }                                                                        \
+    return s;                                                                \
+  }                                                                          \
+  else if (n <= PAIRWISE_BLOCK) {                                            \
+    double a[8], s;                                                          \
+    int k;                                                                   \
+    for (k = 0; k < 8; k++) {                                                \
+      a[k] = (double)LOAD(T, k);                                             \
+    }                                                                        \
+    for (i = 8; i < n - n % 8; i += 8) {                                     \
+      for (k = 0; k < 8; k++) {                                              \
+        a[k] += (double)LOAD(T, i + k);                                      \
+      }                                                                      \
+    }                                                                        \
+    s = ((a[0] + a[1]) + (a[2] + a[3])) + ((a[4] + a[5]) + (a[6] + a[7]));   \
+    for (; i < n; i++) {                                                     \
+      s += (double)LOAD(T, i);                                               \
+    }                                                                        \
+    return s;                                                                \
+  }                                                                          \
+  else {                                                                     \
+    int64_t n2 = n / 2;                                                      \
+    n2 -= n2 % 8;                                                            \
+    return pairwise_##NAME(p, n2, stride) +                                  \
+           pairwise_##NAME(p + n2 * stride, n - n2, stride);                 \
+  }                                                                          \
+}
+
+/* Sum of squared deviations from mean, four accumulators. */
+#define SQDEV(NAME, T)                                                       \
+static double                                                                \
+sqdev_##NAME(const char *p, int64_t n, int64_t stride, double mean)          \
+{                                                                            \
+  double a[4] = {0, 0, 0, 0};                                                \
+  int64_t i;                                                                 \
+  int k;                                                                     \
+                                                                             \
+  for (i = 0; i + 4 <= n; i += 4) {                                          \
+    for (k = 0; k < 4; k++) {                                                \
+      const double d = (double)LOAD(T, i + k) - mean;                        \
+      a[k] += d * d;                                                         \
+    }                                                                        \
+  }                                                                          \
+  for (; i < n; i++) {                                                       \
+    const double d = (double)LOAD(T, i) - mean;                              \
+    a[0] += d * d;                                                           \
+  }                                                                          \
+                                                                             \
+  return (a[0] + a[1]) + (a[2] + a[3]);                                      \
+}
+
+/* Row reducer for dtype T. KT is the accumulator type of sums, products and
+   extrema, KF its field in the accumulator, FLOAT whether T is a float. */
+#define ROW(NAME, T, KT, KF, FLOAT)                                          \
+PAIRWISE(NAME, T)                                                            \
+SQDEV(NAME, T)                                                               \
+                                                                             \
+static void                                                                  \
+row_##NAME(const reduce_t *r, int64_t index, int64_t n, reduce_acc_t *acc)   \
+{                                                                            \
+  const char *p = r->ptr + index * r->itemsize;                              \
+  const int64_t stride = r->row_step * r->itemsize;                          \
+  int64_t i;                                                                 \
+                                                                             \
+  acc_init(r, acc);                                                          \
+  if (n == 0) {                                                              \
+    return;                                                                  \
+  }                                                                          \
+                                                                             \
+  /* NAs: one element at a time. */                                          \
+  if (r->bitmap != NULL) {                                                   \
+    for (i = 0; i < n; i++) {                                                \
+      reduce_acc_t one;                                                      \
+      if (!BIT(r->bitmap, index + i * r->row_step)) {                        \
+        continue;                                                            \
+      }                                                                      \
+      acc_init(r, &one);                                                     \
+      one.n = 1;                                                             \
+      if (r->op == R_MEAN || r->op == R_VAR) {                               \
+        one.v.f = one.mean = (double)LOAD(T, i);                             \
+      }                                                                      \
+      else {                                                                 \
+        one.v.KF = (KT)LOAD(T, i);                                           \
+      }                                                                      \
+      acc_combine(r, acc, &one);                                             \
+    }                                                                        \
+    return;                                                                  \
+  }                                                                          \
+                                                                             \
+  acc->n = n;                                                                \
+  switch (r->op) {                                                           \
+  case R_SUM:                                                                \
+    if (FLOAT) {                                                             \
+      acc->v.f = pairwise_##NAME(p, n, stride);                              \
+    }                                                                        \
+    else {                                                                   \
+      /* Unsigned, so that signed sums wrap instead of overflowing. */       \
+      uint64_t s = 0;                                                        \
+      for (i = 0; i < n; i++) {                                              \
+        s += (uint64_t)(KT)LOAD(T, i);                                       \
+      }                                                                      \
+      acc->v.KF = (KT)s;                                                     \
+    }                                                                        \
+    break;                                                                   \
+  case R_PROD:                                                               \
+    if (FLOAT) {                                                             \
+      double s = 1;                                                          \
+      for (i = 0; i < n; i++) {                                              \
+        s *= (double)LOAD(T, i);                                             \
+      }                                                                      \
+      acc->v.KF = (KT)s;                                                     \
+    }                                                                        \
+    else {                                                                   \
+      uint64_t s = 1;                                                        \
+      for (i = 0; i < n; i++) {                                              \
+        s *= (uint64_t)(KT)LOAD(T, i);                                       \
+      }                                                                      \
+      acc->v.KF = (KT)s;                                                     \
+    }                                                                        \
+    break;                                                                   \
+  case R_MIN: {                                                              \
+    KT m = (KT)LOAD(T, 0);                                                   \
+    for (i = 1; i < n; i++) {                                                \
+      const KT v = (KT)LOAD(T, i);                                           \
+      if (FLOAT && v != v) {                                                 \
+        m = v;                                                               \
+        break;                                                               \
+      }                                                                      \
+      m = v < m ? v : m;                                                     \
+    }                                                                        \
+    acc->v.KF = m;                                                           \
+    break;                                                                   \
+  }                                                                          \
+  case R_MAX: {                                                              \
+    KT m = (KT)LOAD(T, 0);                                                   \
+    for (i = 1; i < n; i++) {                                                \
+      const KT v = (KT)LOAD(T, i);                                           \
+      if (FLOAT && v != v) {                                                 \
+        m = v;                                                               \
+        break;                                                               \
+      }                                                                      \
+      m = v > m ? v : m;                                                     \
+    }                                                                        \
+    acc->v.KF = m;                                                           \
+    break;                                                                   \
+  }                                                                          \
+  case R_MEAN:                                                               \
+    acc->v.f = pairwise_##NAME(p, n, stride);                                \
+    break;                                                                   \
+  case R_VAR:                                                                \
+    acc->mean = pairwise_##NAME(p, n, stride) / n;                           \
+    acc->m2 = sqdev_##NAME(p, n, stride, acc->mean);                         \
+    break;                                                                   \
+  }                                                                          \
+}
+
+ROW(int8, int8_t, int64_t, i, 0)
+ROW(int16, int16_t, int64_t, i, 0)
+ROW(int32, int32_t, int64_t, i, 0)
+ROW(int64, int64_t, int64_t, i, 0)
+ROW(uint8, uint8_t, uint64_t, u, 0)
+ROW(uint16, uint16_t, uint64_t, u, 0)
+ROW(uint32, uint32_t, uint64_t, u, 0)
+ROW(uint64, uint64_t, uint64_t, u, 0)
+ROW(float32, float, double, f, 1)
+ROW(float64, double, double, f, 1)
+
+
+/****************************************************************************/
+/*                                  Driver                                  */
+/****************************************************************************/
+
+/* Index of the first element of output o. */
+static int64_t
+output_index(const reduce_t *r, int64_t o)
+{
+  int64_t index = r->index;
+  int k;
+
+  for (k = r->nkept - 1; k >= 0; k--) {
+    index += (o % r->kept_shape[k]) * r->kept_step[k];
+    o /= r->kept_shape[k];
+  }
+
+  return index;
+}
+
+/* Reduce group g of output o. */
+static void
+reduce_group(const reduce_t *r, int64_t o, int64_t g, reduce_acc_t *acc)
+{
+  const int64_t base = output_index(r, o);
+  const int64_t first = g * REDUCE_GROUP;
+  const int64_t nsegs = r->nrows * r->nseg;
+  const int64_t last = first + REDUCE_GROUP < nsegs ? first + REDUCE_GROUP : nsegs;
+  int64_t s;
+
+  acc_init(r, acc);
+
+  for (s = first; s < last; s++) {
+    int64_t row = s / r->nseg, start = (s % r->nseg) * REDUCE_SEGMENT;
+    int64_t index = base + start * r->row_step;
+    int64_t len = r->row_len - start < REDUCE_SEGMENT ? r->row_len - start : REDUCE_SEGMENT;
+    reduce_acc_t seg;
+    int k;
+
+    for (k = r->nred - 1; k >= 0; k--) {
+      index += (row % r->red_shape[k]) * r->red_step[k];
+      row /= r->red_shape[k];
+    }
+
+    r->row(r, index, len, &seg);
+    acc_combine(r, acc, &seg);
+  }
+}
+
+static void
+store(reduce_t *r, int64_t o, const reduce_acc_t *acc)
+{
+  int valid = 1;
+  union { int64_t i; uint64_t u; double f; } v;
+
+  v.u = 0;
+  switch (r->op) {
+  case R_SUM:
+    v.u = acc->v.u;
+    if (r->kind == K_FLOAT) {
+      v.f = acc->v.f + acc->c;
+    }
+    break;
+  case R_PROD:
+    v.u = acc->v.u;
+    break;
+  case R_MIN: case R_MAX:
+    v.u = acc->v.u;
+    if (acc->n == 0) {
+      valid = 0;
+      if (r->out_bitmap == NULL) {
+        r->error = 1;
+      }
+    }
+    break;
+  case R_MEAN:
+    v.f = acc->n > 0 ? (acc->v.f + acc->c) / acc->n : NAN;
+    valid = acc->n > 0;
+    break;
+  case R_VAR:
+    v.f = acc->n - r->ddof > 0 ? acc->m2 / (acc->n - r->ddof) : NAN;
+    valid = acc->n - r->ddof > 0;
+    break;
+  }
+
+  if (r->out_bitmap != NULL) {
+    if (valid) {
+      r->out_bitmap[o >> 3] |= (uint8_t)(1 << (o & 7));
+    }
+    else {
+      r->out_bitmap[o >> 3] &= (uint8_t)~(1 << (o & 7));
+      return;
+    }
+  }
+
+  switch (r->out_tag) {
+  case Int8: ((int8_t *)r->out)[o] = (int8_t)v.i; break;
+  case Int16: ((int16_t *)r->out)[o] = (int16_t)v.i; break;
+  case Int32: ((int32_t *)r->out)[o] = (int32_t)v.i; break;
+  case Int64: ((int64_t *)r->out)[o] = v.i; break;
+  case Uint8: ((uint8_t *)r->out)[o] = (uint8_t)v.u; break;
+  case Uint16: ((uint16_t *)r->out)[o] = (uint16_t)v.u; break;
+  case Uint32: ((uint32_t *)r->out)[o] = (uint32_t)v.u; break;
+  case Uint64: ((uint64_t *)r->out)[o] = v.u; break;
+  case Float32: ((float *)r->out)[o] = (float)v.f; break;
+  case Float64: ((double *)r->out)[o] = v.f; break;
+  default: break;
+  }
+}
+
+static void
+reduce_output(reduce_t *r, int64_t o)
+{
+  reduce_acc_t acc, group;
+  int64_t g;
+
+  acc_init(r, &acc);
+  for (g = 0; g < r->ngroups; g++) {
+    reduce_group(r, o, g, &group);
+    acc_combine(r, &acc, &group);
+  }
+  store(r, o, &acc);
+}
+
+/* Task over a range of outputs. */
+static int
+output_task(void *job, int64_t i, ndt_context_t *ctx)
+{
+  reduce_t *r = (reduce_t *)job;
+  const int64_t first = i * r->chunk;
+  const int64_t last = first + r->chunk < r->nout ? first + r->chunk : r->nout;
+  int64_t o;
+
+  for (o = first; o < last && !r->stop; o++) {
+    if (r->done == NULL || !r->done[o]) {
+      reduce_output(r, o);
+      if (r->done != NULL) {
+        r->done[o] = 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/* Task over one group of one output. */
+static int
+group_task(void *job, int64_t i, ndt_context_t *ctx)
+{
+  reduce_t *r = (reduce_t *)job;
+
+  if (!r->stop && (r->done == NULL || !r->done[i])) {
+    reduce_group(r, i / r->ngroups, i % r->ngroups, &r->partial[i]);
+    if (r->done != NULL) {
+      r->done[i] = 1;
+    }
+  }
+  return 0;
+}
+
+/* Few outputs: split every output into its groups and combine the group
+   results in order afterwards, which is what reduce_output does too. Many
+   outputs: split the outputs. */
+static void *
+run_reduce(void *job)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  reduce_t *r = (reduce_t *)job;
+  const int64_t nthreads = r->nthreads;
+  int64_t ntasks, o, g;
+
+  if (r->nout == 0) {
+    return NULL;
+  }
+
+  if (r->partial != NULL) {
+    rb_gumath_pool_run(nthreads, r->nout * r->ngroups, group_task, r, &ctx);
+    for (o = 0; o < r->nout && !r->stop; o++) {
+      reduce_acc_t acc;
+      acc_init(r, &acc);
+      for (g = 0; g < r->ngroups; g++) {
+        acc_combine(r, &acc, &r->partial[o * r->ngroups + g]);
+      }
+      store(r, o, &acc);
+    }
+  }
+  else {
+    ntasks = nthreads * 8 < r->nout ? nthreads * 8 : r->nout;
+    r->chunk = (r->nout + ntasks - 1) / ntasks;
+    if (r->out_bitmap != NULL) {
+      /* Whole bytes of the validity bitmap, so tasks never share one. */
+      r->chunk = (r->chunk + 7) & ~(int64_t)7;
+    }
+    ntasks = (r->nout + r->chunk - 1) / r->chunk;
+    rb_gumath_pool_run(nthreads, ntasks, output_task, r, &ctx);
+  }
+
+  return NULL;
+}
+
+/* Unblocking function: the remaining tasks return at once. */
+static void
+reduce_ubf(void *job)
+{
+  ((reduce_t *)job)->stop = 1;
+}
+
+/* Large reductions release the GVL. If an interrupt stops them and its
+   handler does not raise, they go on with the groups or outputs that were
+   not finished yet. */
+static VALUE
+reduce_body(VALUE job)
+{
+  reduce_t *r = (reduce_t *)job;
+
+  if (r->nout * r->ngroups < 2 * r->nthreads && r->ngroups > 1) {
+    r->partial = ALLOC_N(reduce_acc_t, r->nout * r->ngroups);
+  }
+
+  if (!r->nogvl) {
+    run_reduce(r);
+    return Qnil;
+  }
+
+  r->done = ZALLOC_N(uint8_t, r->partial != NULL ? r->nout * r->ngroups : r->nout);
+  do {
+    r->stop = 0;
+    rb_thread_call_without_gvl(run_reduce, r, reduce_ubf, r);
+  } while (r->stop);
+
+  return Qnil;
+}
+
+static VALUE
+reduce_cleanup(VALUE job)
+{
+  reduce_t *r = (reduce_t *)job;
+
+  xfree(r->partial);
+  xfree(r->done);
+  r->partial = NULL;
+  r->done = NULL;
+  return Qnil;
+}
+
+
+/****************************************************************************/
+/*                                 Setup                                    */
+/****************************************************************************/
+
+static const char *
+dtype_name(enum ndt tag)
+{
+  switch (tag) {
+  case Int8: return "int8";
+  case Int16: return "int16";
+  case Int32: return "int32";
+  case Int64: return "int64";
+  case Uint8: return "uint8";
+  case Uint16: return "uint16";
+  case Uint32: return "uint32";
+  case Uint64: return "uint64";
+  case Float32: return "float32";
+  case Float64: return "float64";
+  default: return NULL;
+  }
+}
+
+static reduce_row_t
+row_function(enum ndt tag)
+{
+  switch (tag) {
+  case Int8: return row_int8;
+  case Int16: return row_int16;
+  case Int32: return row_int32;
+  case Int64: return row_int64;
+  case Uint8: return row_uint8;
+  case Uint16: return row_uint16;
+  case Uint32: return row_uint32;
+  case Uint64: return row_uint64;
+  case Float32: return row_float32;
+  case Float64: return row_float64;
+  default: return NULL;
+  }
+}
+
+/* Mark the axes named by axis (nil, an Integer or an Array of Integers). */
+static void
+parse_axes(VALUE axis, int ndim, int reduced[])
+{
+  VALUE list;
+  long i;
+
+  if (NIL_P(axis)) {
+    for (i = 0; i < ndim; i++) {
+      reduced[i] = 1;
+    }
+    return;
+  }
+
+  list = RB_TYPE_P(axis, T_ARRAY) ? axis : rb_ary_new_from_args(1, axis);
+  for (i = 0; i < RARRAY_LEN(list); i++) {
+    int a = NUM2INT(rb_ary_entry(list, i));
+    if (a < 0) {
+      a += ndim;
+    }
+    if (a < 0 || a >= ndim) {
+      rb_raise(rb_eIndexError, "axis %d is out of range for %d dimensions.",
+               NUM2INT(rb_ary_entry(list, i)), ndim);
+    }
+    if (reduced[a]) {
+      rb_raise(rb_eArgError, "axis %d is given more than once.", a);
+    }
+    reduced[a] = 1;
+  }
+}
+
+static VALUE
+reduce(int argc, VALUE *argv, enum reduce_op op)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  static const char *const names[] = {"sum", "prod", "min", "max", "mean", "var"};
+  VALUE x, opts, result, values[3];
+  ID kw[3];
+  const xnd_t *xnd;
+  const ndt_t *t, *dtype;
+  xnd_t out;
+  reduce_t r;
+  int reduced[NDT_MAX_DIM] = {0};
+  int64_t shape[NDT_MAX_DIM], step[NDT_MAX_DIM];
+  int keepdims, optional, out_optional, ndim, row_dim, i;
+  const char *out_dtype;
+  char type[NDT_MAX_DIM * 24 + 32];
+  size_t len = 0;
+  ndt_t *out_type;
+
+  rb_scan_args(argc, argv, "1:", &x, &opts);
+  kw[0] = rb_intern("axis");
+  kw[1] = rb_intern("keepdims");
+  kw[2] = rb_intern("ddof");
+  values[0] = values[1] = values[2] = Qundef;
+  if (!NIL_P(opts)) {
+    rb_get_kwargs(opts, kw, 0, op == R_VAR ? 3 : 2, values);
+  }
+
+  if (!rb_xnd_check_type(x)) {
+    rb_raise(rb_eTypeError, "%s: argument must be XND.", names[op]);
+  }
+  xnd = rb_xnd_const_xnd(x);
+
+  /* Fixed dimensions over a numeric dtype. */
+  ndim = 0;
+  for (t = xnd->type; t->tag == FixedDim; t = t->FixedDim.type) {
+    shape[ndim] = t->FixedDim.shape;
+    step[ndim] = t->Concrete.FixedDim.step;
+    ndim++;
+  }
+  dtype = t;
+  if (dtype_name(dtype->tag) == NULL || dtype->ndim != 0) {
+    rb_raise(rb_eTypeError, "%s: need fixed dimensions over an integer or "
+             "float dtype.", names[op]);
+  }
+  optional = ndt_is_optional(dtype);
+
+  parse_axes(values[0] == Qundef ? Qnil : values[0], ndim, reduced);
+  keepdims = values[1] != Qundef && RTEST(values[1]);
+
+  memset(&r, 0, sizeof r);
+  r.op = op;
+  r.nthreads = rb_gumath_call_threads();
+  r.ptr = xnd->ptr;
+  r.itemsize = dtype->datasize;
+  r.bitmap = optional ? xnd->bitmap.data : NULL;
+  r.index = xnd->index;
+  r.row = row_function(dtype->tag);
+  r.ddof = values[2] == Qundef ? 0 : NUM2LL(values[2]);
+
+  switch (dtype->tag) {
+  case Float32: case Float64: r.kind = K_FLOAT; break;
+  case Uint8: case Uint16: case Uint32: case Uint64: r.kind = K_UNSIGNED; break;
+  default: r.kind = K_SIGNED; break;
+  }
+  if (op == R_MEAN || op == R_VAR) {
+    r.kind = K_FLOAT;
+  }
+
+  /* The row dimension is the reduced dimension with the smallest step. */
+  row_dim = -1;
+  for (i = 0; i < ndim; i++) {
+    if (reduced[i] && (row_dim < 0 || llabs(step[i]) <= llabs(step[row_dim]))) {
+      row_dim = i;
+    }
+  }
+
+  r.nout = 1;
+  r.nrows = 1;
+  for (i = 0; i < ndim; i++) {
+    if (!reduced[i]) {
+      r.kept_shape[r.nkept] = shape[i];
+      r.kept_step[r.nkept++] = step[i];
+      r.nout *= shape[i];
+    }
+    else if (i != row_dim) {
+      r.red_shape[r.nred] = shape[i];
+      r.red_step[r.nred++] = step[i];
+      r.nrows *= shape[i];
+    }
+  }
+  r.row_len = row_dim < 0 ? 1 : shape[row_dim];
+  r.row_step = row_dim < 0 ? 0 : step[row_dim];
+  r.nseg = (r.row_len + REDUCE_SEGMENT - 1) / REDUCE_SEGMENT;
+  r.ngroups = (r.nrows * r.nseg + REDUCE_GROUP - 1) / REDUCE_GROUP;
+
+  if ((op == R_MIN || op == R_MAX) && !optional && r.nout > 0 &&
+      r.nrows * r.row_len == 0) {
+    rb_raise(rb_eArgError, "%s: reduction over zero elements.", names[op]);
+  }
+
+  /* Output type. */
+  switch (op) {
+  case R_SUM: case R_PROD:
+    out_dtype = r.kind == K_FLOAT ? "float64" : r.kind == K_UNSIGNED ? "uint64" : "int64";
+    out_optional = 0;
+    break;
+  case R_MIN: case R_MAX:
+    out_dtype = dtype_name(dtype->tag);
+    out_optional = optional;
+    break;
+  default:
+    out_dtype = "float64";
+    out_optional = optional;
+    break;
+  }
+
+  for (i = 0; i < ndim; i++) {
+    if (!reduced[i]) {
+      len += snprintf(type + len, sizeof type - len, "%" PRIi64 " * ", shape[i]);
+    }
+    else if (keepdims) {
+      len += snprintf(type + len, sizeof type - len, "1 * ");
+    }
+  }
+  snprintf(type + len, sizeof type - len, "%s%s", out_optional ? "?" : "", out_dtype);
+
+  out_type = ndt_from_string(type, &ctx);
+  if (out_type == NULL) {
+    rb_ndtypes_set_error(&ctx);
+    raise_error();
+  }
+  result = rb_xnd_empty_from_type(out_type);
+  out = *rb_xnd_const_xnd(result);
+
+  r.out = out.ptr;
+  r.out_bitmap = out_optional ? out.bitmap.data : NULL;
+  for (t = out.type; t->tag == FixedDim; t = t->FixedDim.type);
+  r.out_tag = t->tag;
+
+  r.nogvl = xnd->type->datasize >= REDUCE_GVL_CUTOFF;
+  rb_ensure(reduce_body, (VALUE)&r, reduce_cleanup, (VALUE)&r);
+
+  if (r.error) {
+    rb_raise(rb_eArgError, "%s: reduction over zero elements.", names[op]);
+  }
+
+  RB_GC_GUARD(x);
+  return result;
+}
+
+
+/****************************************************************************/
+/*                               Ruby methods                               */
+/****************************************************************************/
+
+/* Gumath::Reductions.sum(x, axis: nil, keepdims: false): integer sums wrap
+   around in 64 bits, float sums are compensated. NAs are skipped. */
+static VALUE
+mGumath_Reductions_s_sum(int argc, VALUE *argv, VALUE module)
+{
+  return reduce(argc, argv, R_SUM);
+}
+
+static VALUE
+mGumath_Reductions_s_prod(int argc, VALUE *argv, VALUE module)
+{
+  return reduce(argc, argv, R_PROD);
+}
+
+/* min and max propagate NaN. Over only NAs the result is NA. */
+static VALUE
+mGumath_Reductions_s_min(int argc, VALUE *argv, VALUE module)
+{
+  return reduce(argc, argv, R_MIN);
+}
+
+static VALUE
+mGumath_Reductions_s_max(int argc, VALUE *argv, VALUE module)
+{
+  return reduce(argc, argv, R_MAX);
+}
+
+static VALUE
+mGumath_Reductions_s_mean(int argc, VALUE *argv, VALUE module)
+{
+  return reduce(argc, argv, R_MEAN);
+}
+
+/* var(x, axis: nil, keepdims: false, ddof: 0): divides by n - ddof. */
+static VALUE
+mGumath_Reductions_s_var(int argc, VALUE *argv, VALUE module)
+{
+  return reduce(argc, argv, R_VAR);
+}
+
+void
+Init_gumath_reductions(void)
+{
+  VALUE mGumath_Reductions = rb_define_module_under(cGumath, "Reductions");
+
+  rb_define_singleton_method(mGumath_Reductions, "sum", mGumath_Reductions_s_sum, -1);
+  rb_define_singleton_method(mGumath_Reductions, "prod", mGumath_Reductions_s_prod, -1);
+  rb_define_singleton_method(mGumath_Reductions, "min", mGumath_Reductions_s_min, -1);
+  rb_define_singleton_method(mGumath_Reductions, "max", mGumath_Reductions_s_max, -1);
+  rb_define_singleton_method(mGumath_Reductions, "mean", mGumath_Reductions_s_mean, -1);
+  rb_define_singleton_method(mGumath_Reductions, "var", mGumath_Reductions_s_var, -1);
+}
@@ -28,7 +28,16 @@
  * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <math.h>
+#include <time.h>
+#ifdef HAVE_DLFCN_H
+#include <dlfcn.h>
+#endif
 #include "ruby_gumath_internal.h"
+#include "thread_pool.h"
+#include "future.h"
+#include "cpu_features.h"
+#include "simd_math.h"
 
 /* libxnd.so is not linked without at least one xnd symbol. */
 const void *dummy = NULL;
@@ -37,147 +46,1711 @@ const void *dummy = NULL;
 /*                              Class globals                               */
 /****************************************************************************/
 
-/* Function table */
+/* Function table of the kernels added with Gumath.unsafe_add_kernel */
 static gm_tbl_t *table = NULL;
 
+/* Gumath::Batch */
+static VALUE cGumath_Batch;
+
 /* Maximum number of threads */
 static int64_t max_threads = 1;
+
+GM_THREAD_LOCAL int64_t rb_gumath_kernel_threads = 0;
+
+/* Kernel table generation, never 0 */
+static uint64_t table_generation = 1;
 static int initialized = 0;
+
+/* Kernel groups, loaded into the table of their module on first use */
+#define GUMATH_MAX_GROUPS 32
+
+/* Each kernel module has its own table, so that functions of the same name
+   in different modules stay apart. */
+typedef struct {
+  const char *name;
+  gm_tbl_t *table;            /* created when the first group is loaded */
+} kernel_module_t;
+
+typedef struct {
+  kernel_module_t *module;
+  const char *name;
+  rb_gumath_group_init_t init;
+  int loaded;
+} kernel_group_t;
+
+static kernel_module_t modules[GUMATH_MAX_GROUPS];
+static int nmodules = 0;
+static kernel_group_t groups[GUMATH_MAX_GROUPS];
+static int ngroups = 0;
+
+struct map_args {
+  VALUE module;
+  const gm_tbl_t *table;
+  VALUE before;               /* kernel counts before a group was loaded, or nil */
+};
+
+static VALUE load_kernel_module(ID id);
+int add_function(const gm_func_t *f, void *args);
 extern VALUE cGumath;
 
-/****************************************************************************/
-/*                               Error handling                             */
-/****************************************************************************/
+/****************************************************************************/
+/*                               Error handling                             */
+/****************************************************************************/
+
+VALUE
+seterr(ndt_context_t *ctx)
+{
+  return rb_ndtypes_set_error(ctx);
+}
+
+/****************************************************************************/
+/*                                Thread count                              */
+/****************************************************************************/
+
+/* Every thread should get at least this many times the cost of handing it
+   work through the pool. */
+#define THREAD_WORK_FACTOR 8
+
+/* Weight of a new measurement in the running cost estimate of a function. */
+#define COST_WEIGHT 0.25
+
+/* Thread-local keys: default set by Gumath.with_threads, and the number of
+   threads chosen for the last call. */
+static ID id_threads;
+static ID id_last_threads;
+
+/* Hidden instance variable of a kernel module: its kernel methods. */
+static ID id_kernel_methods;
+
+/* Measured on the first call that could use several threads: the time to
+   run an empty job on the pool and the time of one pass over memory, which
+   is the lower bound for the cost of any kernel. */
+static double dispatch_ns = 0;
+static double memory_ns_per_byte = 0;
+
+typedef struct {
+  int64_t threads;            /* requested count, 0: use the cost model */
+  double *ns_per_byte;        /* cost estimate of the function, updated */
+  int64_t used;               /* threads chosen for the call */
+} thread_plan_t;
+
+static double
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+noop_task(void *job, int64_t i, ndt_context_t *ctx)
+{
+  return 0;
+}
+
+static void
+calibrate(void)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  const int64_t n = max_threads < GM_POOL_MAX_THREADS ? max_threads : GM_POOL_MAX_THREADS;
+  const int64_t len = (1 << 20) / sizeof(uint64_t);
+  volatile uint64_t sink = 0;
+  uint64_t *buf, sum;
+  double t, best;
+  int64_t i;
+  int run;
+
+  /* The first run starts the workers. */
+  rb_gumath_pool_run(n, n, noop_task, NULL, &ctx);
+  best = HUGE_VAL;
+  for (run = 0; run < 16; run++) {
+    t = now_ns();
+    rb_gumath_pool_run(n, n, noop_task, NULL, &ctx);
+    t = now_ns() - t;
+    best = t < best ? t : best;
+  }
+  dispatch_ns = best > 1 ? best : 1;
+
+  memory_ns_per_byte = 0.01;
+  buf = calloc(len, sizeof *buf);
+  if (buf != NULL) {
+    best = HUGE_VAL;
+    for (run = 0; run < 4; run++) {
+      t = now_ns();
+      for (i = 0, sum = 0; i < len; i++) {
+        sum += buf[i];
+      }
+      sink += sum;
+      t = now_ns() - t;
+      best = t < best ? t : best;
+    }
+    free(buf);
+    if (best / (len * sizeof *buf) > memory_ns_per_byte) {
+      memory_ns_per_byte = best / (len * sizeof *buf);
+    }
+  }
+}
+
+/* Threads worth using for nbytes of work at the given cost per byte, up to
+   Gumath.get_max_threads. */
+static int64_t
+model_threads(double ns_per_byte, int64_t nbytes)
+{
+  double n;
+
+  if (max_threads <= 1) {
+    return 1;
+  }
+  if (dispatch_ns == 0) {
+    calibrate();
+  }
+  if (ns_per_byte < memory_ns_per_byte) {
+    ns_per_byte = memory_ns_per_byte;
+  }
+
+  n = nbytes * ns_per_byte / (THREAD_WORK_FACTOR * dispatch_ns);
+  if (n < 1) {
+    return 1;
+  }
+  return n < max_threads ? (int64_t)n : max_threads;
+}
+
+/* Fold the duration of a call into the cost estimate of its function. */
+static void
+update_cost(double *ns_per_byte, double elapsed_ns, int64_t nthreads, int64_t nbytes)
+{
+  const double cost = elapsed_ns * nthreads / nbytes;
+
+  if (*ns_per_byte == 0) {
+    *ns_per_byte = cost;
+  }
+  else {
+    *ns_per_byte += COST_WEIGHT * (cost - *ns_per_byte);
+  }
+}
+
+/* Threads requested for a call: the threads: keyword, else the default of
+   the current thread set by Gumath.with_threads, else 0 for the model. */
+static int64_t
+requested_threads(VALUE threads)
+{
+  int64_t n;
+
+  if (threads == Qundef || NIL_P(threads)) {
+    threads = rb_thread_local_aref(rb_thread_current(), id_threads);
+    if (NIL_P(threads)) {
+      return 0;
+    }
+  }
+
+  n = NUM2LL(threads);
+  if (n < 1) {
+    rb_raise(rb_eArgError, "threads must be at least 1.");
+  }
+
+  return n < GM_POOL_MAX_THREADS ? n : GM_POOL_MAX_THREADS;
+}
+
+/****************************************************************************/
+/*                              Kernel execution                            */
+/****************************************************************************/
+
+/* Calls whose arguments are smaller than this many bytes in total run with
+   the GVL held: releasing it costs more than the kernel. */
+#define GVL_RELEASE_CUTOFF (1 << 16)
+
+/* Without the GVL, kernels run over chunks of the outermost dimension of
+   about this many bytes, checking for interrupts in between. */
+#define APPLY_CHUNK_BYTES (1 << 22)
+
+/* Rows handed to one pool task: at least this many bytes, and at most a
+   slice of the chunk small enough that idle threads can steal work. */
+#define APPLY_TASK_BYTES (1 << 16)
+#define APPLY_TASKS_PER_THREAD 8
+
+typedef struct {
+  const gm_kernel_t *kernel;
+  xnd_t *stack;
+  int nargs;                  /* inputs and outputs on the stack */
+  int outer_dims;
+  int64_t nthreads;
+  int64_t kernel_threads;     /* threads of the call, for the kernel itself */
+  int64_t nrows;              /* rows of the outermost dimension, 0: no chunking */
+  int64_t chunk;              /* rows per chunk and thread */
+  int64_t task_rows;          /* rows per pool task */
+  int64_t next;               /* first row not yet computed */
+  int64_t stop;               /* end of the rows handed to the pool */
+  volatile int interrupted;
+  int done;                   /* every row has been computed */
+  int ret;
+  ndt_context_t ctx;
+} apply_args_t;
+
+/* Run rows [start, stop) of the outermost dimension. */
+static int
+apply_rows(const apply_args_t *a, int64_t start, int64_t stop, ndt_context_t *ctx)
+{
+  xnd_t sub[NDT_MAX_ARGS];
+  xnd_index_t index;
+  int i, k, ret;
+
+  index.tag = Slice;
+  index.Slice.start = start;
+  index.Slice.stop = stop;
+  index.Slice.step = 1;
+
+  for (i = 0; i < a->nargs; i++) {
+    sub[i] = xnd_subscript(&a->stack[i], &index, 1, ctx);
+    if (sub[i].ptr == NULL) {
+      for (k = 0; k < i; k++) {
+        ndt_del((ndt_t *)sub[k].type);
+      }
+      return -1;
+    }
+  }
+
+  ret = gm_apply(a->kernel, sub, a->outer_dims, ctx);
+
+  for (i = 0; i < a->nargs; i++) {
+    ndt_del((ndt_t *)sub[i].type);
+  }
+
+  return ret;
+}
+
+/* Pool task i: rows [next + i*task_rows, ...) of the current round. */
+static int
+apply_task(void *job, int64_t i, ndt_context_t *ctx)
+{
+  const apply_args_t *a = (const apply_args_t *)job;
+  const int64_t start = a->next + i * a->task_rows;
+  const int64_t stop = start + a->task_rows < a->stop ? start + a->task_rows : a->stop;
+
+  return apply_rows(a, start, stop, ctx);
+}
+
+/* Rounds of up to chunk*nthreads rows are split into pool tasks; between
+   rounds the unblocking function can stop the loop. */
+static void *
+apply_without_gvl(void *args)
+{
+  apply_args_t *a = (apply_args_t *)args;
+
+  /* Rows that are spread over the pool already keep their kernels on one
+     thread each. */
+  rb_gumath_kernel_threads = a->nthreads > 1 ? 1 : a->kernel_threads;
+
+  if (a->nrows == 0) {
+    a->ret = gm_apply(a->kernel, a->stack, a->outer_dims, &a->ctx);
+    rb_gumath_kernel_threads = 0;
+    a->done = 1;
+    return NULL;
+  }
+
+  while (a->next < a->nrows && !a->interrupted) {
+    const int64_t round = a->chunk * a->nthreads;
+    int64_t ntasks;
+
+    a->stop = a->next + round < a->nrows ? a->next + round : a->nrows;
+    ntasks = (a->stop - a->next + a->task_rows - 1) / a->task_rows;
+
+    a->ret = rb_gumath_pool_run(a->nthreads, ntasks, apply_task, a, &a->ctx);
+    if (a->ret < 0) {
+      break;
+    }
+    a->next = a->stop;
+  }
+
+  rb_gumath_kernel_threads = 0;
+  a->done = a->ret == 0 && a->next >= a->nrows;
+  return NULL;
+}
+
+/* Unblocking function: stop at the next chunk boundary. */
+static void
+apply_ubf(void *args)
+{
+  ((apply_args_t *)args)->interrupted = 1;
+}
+
+static VALUE
+check_ints(VALUE unused)
+{
+  rb_thread_check_ints();
+  return Qnil;
+}
+
+/* Length of the outermost dimension of x, or -1 if it is not a fixed or var
+   dimension. Var dimensions are split like fixed ones, so rows of uneven
+   length are balanced by the pool. */
+static int64_t
+outer_shape(const xnd_t *x)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  const ndt_t *t = x->type;
+  int64_t start, step, shape;
+
+  if (t == NULL) {
+    return -1;
+  }
+
+  switch (t->tag) {
+  case FixedDim:
+    return t->FixedDim.shape;
+  case VarDim:
+    shape = ndt_var_indices(&start, &step, t, x->index, &ctx);
+    if (shape < 0) {
+      ndt_context_del(&ctx);
+    }
+    return shape;
+  default:
+    return -1;
+  }
+}
+
+/* Number of rows to chunk over, or 0 if the stack cannot be split along a
+   common outermost dimension. */
+static int64_t
+apply_nrows(const xnd_t stack[], int nargs, int outer_dims)
+{
+  int64_t nrows;
+  int i;
+
+  if (outer_dims < 1) {
+    return 0;
+  }
+
+  nrows = outer_shape(&stack[0]);
+  if (nrows <= 0) {
+    return 0;
+  }
+  for (i = 1; i < nargs; i++) {
+    if (stack[i].type == NULL || stack[i].type->tag != stack[0].type->tag ||
+        outer_shape(&stack[i]) != nrows) {
+      return 0;
+    }
+  }
+
+  return nrows;
+}
+
+/* Run the kernel over the prepared stack. Large calls release the GVL and
+   can be interrupted between chunks; pending interrupts are then handled
+   and the remaining chunks are run. On error, the context is copied to ctx
+   and -1 is returned. If an interrupt raises, cleanup is called with data
+   before the exception propagates.
+
+   rb_thread_call_without_gvl2 neither raises nor runs interrupt handlers:
+   if an interrupt is pending it returns without calling the function, so
+   every interrupt is handled under rb_protect below. */
+static int
+apply_kernel(const gm_kernel_t *kernel, xnd_t stack[], int nargs,
+             const ndt_apply_spec_t *spec, thread_plan_t *plan, ndt_context_t *ctx,
+             void (*cleanup)(void *), void *data)
+{
+  apply_args_t a;
+  int64_t nbytes = 0;
+  double start;
+  int i, state;
+
+  a.kernel = kernel;
+  a.stack = stack;
+  a.nargs = nargs;
+  a.outer_dims = spec->outer_dims;
+  a.nthreads = 1;
+  a.kernel_threads = plan->threads > 0 ? plan->threads : max_threads;
+  a.nrows = 0;
+  a.chunk = 0;
+  a.task_rows = 0;
+  a.next = 0;
+  a.stop = 0;
+  a.interrupted = 0;
+  a.done = 0;
+  a.ret = 0;
+  a.ctx = *ctx;
+
+  for (i = 0; i < nargs; i++) {
+    if (stack[i].type != NULL) {
+      nbytes += stack[i].type->datasize;
+    }
+  }
+
+  if (nbytes < GVL_RELEASE_CUTOFF) {
+    a.ret = gm_apply(kernel, stack, spec->outer_dims, &a.ctx);
+  }
+  else {
+    a.nrows = apply_nrows(stack, nargs, spec->outer_dims);
+    if (a.nrows > 0) {
+      const int64_t row_bytes = nbytes / a.nrows + 1;
+      int64_t min_rows = APPLY_TASK_BYTES / row_bytes;
+
+      a.nthreads = plan->threads > 0 ? plan->threads
+                                     : model_threads(*plan->ns_per_byte, nbytes);
+      if (a.nthreads > a.nrows) {
+        a.nthreads = a.nrows;
+      }
+
+      a.chunk = APPLY_CHUNK_BYTES / row_bytes;
+      if (a.chunk < 1) {
+        a.chunk = 1;
+      }
+      if (a.nthreads == 1 && a.chunk >= a.nrows) {
+        a.nrows = 0;
+      }
+
+      a.task_rows = a.chunk / APPLY_TASKS_PER_THREAD;
+      if (min_rows < 1) {
+        min_rows = 1;
+      }
+      if (a.task_rows < min_rows) {
+        a.task_rows = min_rows;
+      }
+      if (a.nthreads == 1 || a.task_rows > a.chunk) {
+        a.task_rows = a.chunk;
+      }
+    }
+
+    start = now_ns();
+    for (;;) {
+      a.interrupted = 0;
+      rb_thread_call_without_gvl2(apply_without_gvl, &a, apply_ubf, &a);
+      if (a.ret < 0 || a.done) {
+        break;
+      }
+
+      rb_protect(check_ints, Qnil, &state);
+      if (state) {
+        cleanup(data);
+        rb_jump_tag(state);
+      }
+    }
+    if (a.ret == 0) {
+      update_cost(plan->ns_per_byte, now_ns() - start, a.nthreads, nbytes);
+    }
+  }
+
+  plan->used = a.nthreads;
+  *ctx = a.ctx;
+  return a.ret;
+}
+
+/****************************************************************************/
+/*                               Instance methods                           */
+/****************************************************************************/
+
+static void
+free_broadcast(void *data)
+{
+  ndt_apply_spec_t *spec = (ndt_apply_spec_t *)data;
+  int i;
+
+  for (i = 0; i < spec->nbroadcast; ++i) {
+    ndt_del(spec->broadcast[i]);
+    spec->broadcast[i] = NULL;
+  }
+  spec->nbroadcast = 0;
+}
+
+/* What a call has to give back once its kernel has run: the broadcast
+   types it owns and the cache entry whose types it borrowed. */
+typedef struct {
+  ndt_apply_spec_t *spec;
+  gufunc_cache_entry_t *pinned;
+} call_state_t;
+
+static void
+release_call(void *data)
+{
+  call_state_t *call = (call_state_t *)data;
+
+  free_broadcast(call->spec);
+  if (call->pinned != NULL) {
+    gufunc_cache_unpin(call->pinned);
+    call->pinned = NULL;
+  }
+}
+
+/* Borrow the broadcast types of a cache entry for a call, or select them
+   afresh if the entry was replaced since the lookup. That can only happen
+   if another thread ran while the outputs were allocated. */
+static void
+borrow_broadcast(call_state_t *call, GufuncObject *self_p,
+                 gufunc_cache_entry_t *entry, uint64_t serial,
+                 const ndt_t *in_types[], xnd_t stack[], int nin)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  ndt_apply_spec_t fresh = ndt_apply_spec_empty;
+  gm_kernel_t kernel;
+  int i;
+
+  if (entry->serial == serial) {
+    gufunc_cache_pin(entry);
+    call->pinned = entry;
+    for (i = 0; i < entry->nbroadcast; i++) {
+      stack[i].type = entry->broadcast[i];
+    }
+    return;
+  }
+
+  for (i = 0; i < nin; i++) {
+    stack[i].type = in_types[i];
+  }
+
+  kernel = gm_select(&fresh, self_p->table, self_p->name, in_types, nin, stack, &ctx);
+  if (kernel.set == NULL) {
+    seterr(&ctx);
+    raise_error();
+  }
+
+  for (i = 0; i < fresh.nout; i++) {
+    ndt_del(fresh.out[i]);
+  }
+  for (i = 0; i < fresh.nbroadcast; i++) {
+    call->spec->broadcast[i] = fresh.broadcast[i];
+    stack[i].type = fresh.broadcast[i];
+  }
+  call->spec->nbroadcast = fresh.nbroadcast;
+}
+
+/* Whether every argument of the kernel signature is "... * T": such kernels
+   read each input element before writing the output element at the same
+   position, so an output may be the very same view as an input. */
+static int
+sig_is_elementwise(const ndt_t *sig)
+{
+  const ndt_t *t;
+  int64_t i;
+
+  for (i = 0; i < sig->Function.nargs; i++) {
+    t = sig->Function.types[i];
+    if (t->tag == EllipsisDim) {
+      t = t->EllipsisDim.type;
+    }
+    if (t->ndim != 0) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int
+kernel_is_elementwise(const gm_kernel_t *kernel)
+{
+  return sig_is_elementwise(kernel->set->sig);
+}
+
+/* Byte range [lo, hi) touched by a view. Returns 0 if the view is empty. */
+static int
+xnd_extent(const xnd_t *x, const char **lo, const char **hi)
+{
+  const ndt_t *t = x->type;
+  int64_t first = x->index, last = x->index, span;
+
+  if (!ndt_is_ndarray(t)) {
+    *lo = x->ptr;
+    *hi = x->ptr + t->datasize;
+    return t->datasize > 0;
+  }
+
+  while (t->tag == FixedDim) {
+    if (t->FixedDim.shape == 0) {
+      return 0;
+    }
+    span = (t->FixedDim.shape - 1) * t->Concrete.FixedDim.step;
+    if (span < 0) {
+      first += span;
+    }
+    else {
+      last += span;
+    }
+    t = t->FixedDim.type;
+  }
+
+  *lo = x->ptr + first * t->datasize;
+  *hi = x->ptr + (last + 1) * t->datasize;
+  return 1;
+}
+
+/* 1 if x and y share memory, 2 if they are the same view, 0 otherwise. */
+static int
+xnd_overlap(const xnd_t *x, const xnd_t *y)
+{
+  const char *xlo, *xhi, *ylo, *yhi;
+
+  if (!xnd_extent(x, &xlo, &xhi) || !xnd_extent(y, &ylo, &yhi)) {
+    return 0;
+  }
+  if (xhi <= ylo || yhi <= xlo) {
+    return 0;
+  }
+  if (x->ptr == y->ptr && x->index == y->index && ndt_equal(x->type, y->type)) {
+    return 2;
+  }
+
+  return 1;
+}
+
+/* Put the caller supplied out: arguments on the stack after the inputs.
+   They must match the output types chosen by the kernel exactly. Outputs
+   may not overlap each other or any input, except that an elementwise
+   kernel may write over the very view it reads from. Raises after
+   releasing the spec if the arguments are not usable. */
+static void
+stack_from_out(VALUE out, const gm_kernel_t *kernel, ndt_apply_spec_t *spec,
+               xnd_t stack[], int nin, VALUE result[])
+{
+  const char *msg = NULL;
+  VALUE exc = rb_eArgError;
+  int elementwise;
+  int i, k;
+
+  if (RB_TYPE_P(out, T_ARRAY)) {
+    if (RARRAY_LEN(out) != spec->nout) {
+      ndt_apply_spec_clear(spec);
+      rb_raise(rb_eArgError, "expected %d out: arguments, got %ld.",
+               spec->nout, RARRAY_LEN(out));
+    }
+    for (i = 0; i < spec->nout; i++) {
+      result[i] = rb_ary_entry(out, i);
+    }
+  }
+  else {
+    if (spec->nout != 1) {
+      ndt_apply_spec_clear(spec);
+      rb_raise(rb_eArgError, "expected an Array of %d out: arguments.",
+               spec->nout);
+    }
+    result[0] = out;
+  }
+
+  elementwise = kernel_is_elementwise(kernel);
+
+  for (i = 0; i < spec->nout && msg == NULL; i++) {
+    if (!rb_xnd_check_type(result[i])) {
+      exc = rb_eTypeError;
+      msg = "out: arguments must be XND.";
+      break;
+    }
+    stack[nin+i] = *rb_xnd_const_xnd(result[i]);
+
+    if (ndt_is_abstract(spec->out[i])) {
+      msg = "out: is not supported for kernels with variable-size output.";
+      break;
+    }
+    if (!ndt_equal(stack[nin+i].type, spec->out[i])) {
+      exc = rb_eTypeError;
+      msg = "out: argument type does not match the kernel output type.";
+      break;
+    }
+
+    for (k = 0; k < nin; k++) {
+      switch (xnd_overlap(&stack[nin+i], &stack[k])) {
+      case 0:
+        break;
+      case 2:
+        if (elementwise) {
+          break;
+        }
+        /* fall through */
+      default:
+        msg = "out: argument overlaps an input in an unsupported way.";
+        break;
+      }
+    }
+    for (k = nin; k < nin+i; k++) {
+      if (xnd_overlap(&stack[nin+i], &stack[k])) {
+        msg = "out: arguments overlap each other.";
+        break;
+      }
+    }
+  }
+
+  if (msg != NULL) {
+    ndt_apply_spec_clear(spec);
+    rb_raise(exc, "%s", msg);
+  }
+
+  /* The buffers carry their own types. */
+  for (i = 0; i < spec->nout; i++) {
+    ndt_del(spec->out[i]);
+    spec->out[i] = NULL;
+  }
+}
+
+/* Check the arguments and fill in the stack and the input types. */
+static void
+stack_from_args(int argc, VALUE *argv, xnd_t stack[], const ndt_t *in_types[])
+{
+  int i;
+
+  for (i = 0; i < argc; i++) {
+    if (!rb_xnd_check_type(argv[i])) {
+      VALUE str = rb_funcall(argv[i], rb_intern("inspect"), 0, NULL);
+      rb_raise(rb_eArgError, "Args must be XND. Received %s.", RSTRING_PTR(str));
+    }
+
+    stack[i] = *rb_xnd_const_xnd(argv[i]);
+    in_types[i] = stack[i].type;
+  }
+}
+
+/* Select the gumath function to be called from the function table, or
+   reuse the selection made for the same input types before. The spec gets
+   its own copies of the cached output types, which the results take over.
+   If entry is not NULL the broadcast types of a cache hit are borrowed:
+   *entry and *serial identify the cache entry for borrow_broadcast.
+   Otherwise the spec owns copies of them as well. */
+static gm_kernel_t
+select_kernel(GufuncObject *self_p, const ndt_t *in_types[], int nin,
+              xnd_t stack[], ndt_apply_spec_t *spec,
+              gufunc_cache_entry_t **entry, uint64_t *serial)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  gufunc_cache_entry_t *e;
+  gm_kernel_t kernel;
+  int i;
+
+  if (entry != NULL) {
+    *entry = NULL;
+  }
+
+  e = gufunc_cache_lookup(self_p, in_types, nin);
+  if (e != NULL) {
+    kernel = e->kernel;
+    spec->flags = e->flags;
+    spec->outer_dims = e->outer_dims;
+    spec->nin = nin;
+    for (i = 0; i < e->nout; i++) {
+      spec->out[i] = ndt_copy(e->out[i], &ctx);
+      if (spec->out[i] == NULL) {
+        ndt_apply_spec_clear(spec);
+        seterr(&ctx);
+        raise_error();
+      }
+      spec->nout++;
+    }
+
+    if (entry != NULL) {
+      *entry = e;
+      *serial = e->serial;
+      for (i = 0; i < e->nbroadcast; i++) {
+        stack[i].type = e->broadcast[i];
+      }
+      return kernel;
+    }
+
+    for (i = 0; i < e->nbroadcast; i++) {
+      spec->broadcast[i] = ndt_copy(e->broadcast[i], &ctx);
+      if (spec->broadcast[i] == NULL) {
+        ndt_apply_spec_clear(spec);
+        seterr(&ctx);
+        raise_error();
+      }
+      spec->nbroadcast++;
+    }
+  }
+  else {
+    kernel = gm_select(spec, self_p->table, self_p->name, in_types, nin, stack, &ctx);
+    if (kernel.set == NULL) {
+      seterr(&ctx);
+      raise_error();
+    }
+    gufunc_cache_insert(self_p, in_types, nin, &kernel, spec);
+  }
+
+  for (i = 0; i < spec->nbroadcast; i++) {
+    stack[i].type = spec->broadcast[i];
+  }
+
+  return kernel;
+}
+
+/* Fill in the output part of the stack from out: or with new XND objects.
+   Outputs of abstract type are left to the kernel. */
+static void
+prepare_outputs(VALUE out, const gm_kernel_t *kernel, ndt_apply_spec_t *spec,
+                xnd_t stack[], int nin, VALUE result[])
+{
+  int i;
+
+  if (out != Qundef) {
+    stack_from_out(out, kernel, spec, stack, nin, result);
+    return;
+  }
+
+  for (i = 0; i < spec->nout; i++) {
+    if (ndt_is_concrete(spec->out[i])) {
+      VALUE x = rb_xnd_empty_from_type(spec->out[i]);
+      if (x == NULL) {
+        ndt_apply_spec_clear(spec);
+        rb_raise(rb_eNoMemError, "could not allocate empty XND object.");
+      }
+      result[i] = x;
+      stack[nin+i] = *rb_xnd_const_xnd(x);
+    }
+    else {
+      result[i] = NULL;
+      stack[nin+i] = xnd_error;
+    }
+  }
+}
+
+/* Count a call in the profile of its function. t[0] to t[1] is kernel
+   selection, t[1] to t[2] output allocation and, if kernel is set, t[2] to
+   now the kernel. The times are only read when timed is set. */
+static void
+profile_call(GufuncObject *self_p, int timed, const double t[3], int kernel,
+             int64_t threads, const xnd_t stack[], int nargs)
+{
+  const double t3 = timed && kernel ? now_ns() : t[2];
+  int64_t nbytes = 0;
+  int i;
+
+  for (i = 0; i < nargs; i++) {
+    if (stack[i].type != NULL) {
+      nbytes += stack[i].type->datasize;
+    }
+  }
+
+  rb_gumath_profile_add(self_p->profile, timed, t[1] - t[0], t[2] - t[1],
+                        t3 - t[2], threads, nbytes);
+}
+
+static VALUE
+Gumath_GufuncObject_call(int argc, VALUE *argv, VALUE self)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  xnd_t stack[NDT_MAX_ARGS];
+  const ndt_t *in_types[NDT_MAX_ARGS];
+  gm_kernel_t kernel;
+  ndt_apply_spec_t spec = ndt_apply_spec_empty;
+  gufunc_cache_entry_t *entry;
+  call_state_t call = {&spec, NULL};
+  uint64_t serial = 0;
+  GufuncObject *self_p;
+  VALUE result[NDT_MAX_ARGS];
+  VALUE out = Qundef, threads = Qundef;
+  thread_plan_t plan;
+  double t[3] = {0, 0, 0};
+  int profiled, timed = 0;
+  int i, k;
+  size_t nin;
+
+  /* Keyword arguments: out:, threads: */
+  if (argc > 0 && RB_TYPE_P(argv[argc-1], T_HASH)) {
+    VALUE opts = argv[--argc];
+    VALUE values[2];
+    ID kw[2];
+
+    kw[0] = rb_intern("out");
+    kw[1] = rb_intern("threads");
+    rb_get_kwargs(opts, kw, 0, 2, values);
+    out = values[0] == Qnil ? Qundef : values[0];
+    threads = values[1];
+  }
+  nin = argc;
+
+  if (argc > NDT_MAX_ARGS) {
+    rb_raise(rb_eArgError, "too many arguments.");
+  }
+
+  /* Prepare arguments for sending into gumath function. */
+  stack_from_args(argc, argv, stack, in_types);
+
+  GET_GUOBJ(self, self_p);
+
+  plan.threads = requested_threads(threads);
+  plan.ns_per_byte = &self_p->ns_per_byte;
+  plan.used = 1;
+
+  profiled = rb_gumath_profile_mode != GM_PROFILE_OFF;
+  if (profiled && (timed = rb_gumath_profile_timed(self_p->profile))) {
+    t[0] = now_ns();
+  }
+
+  kernel = select_kernel(self_p, in_types, argc, stack, &spec, &entry, &serial);
+  if (timed) {
+    t[1] = now_ns();
+  }
+
+  /* Populate output values with the out: arguments or with empty XND
+     objects. */
+  prepare_outputs(out, &kernel, &spec, stack, nin, result);
+  if (timed) {
+    t[2] = now_ns();
+  }
+
+  /* Actually call the kernel function with prepared input and output args.
+     The argument and result objects are referenced from this frame, which
+     keeps them alive and pins them while the GVL is released. */
+  if (entry != NULL) {
+    borrow_broadcast(&call, self_p, entry, serial, in_types, stack, nin);
+  }
+
+  if (apply_kernel(&kernel, stack, nin + spec.nout, &spec, &plan, &ctx,
+                   release_call, &call) < 0) {
+    release_call(&call);
+    seterr(&ctx);
+    raise_error();
+  }
+  release_call(&call);
+
+  if (profiled) {
+    profile_call(self_p, timed, t, 1, plan.used, stack, nin + spec.nout);
+  }
+
+  rb_thread_local_aset(rb_thread_current(), id_last_threads, LL2NUM(plan.used));
+
+  for (i = 0; i < argc; i++) {
+    RB_GC_GUARD(argv[i]);
+  }
+  for (i = 0; i < spec.nout; i++) {
+    RB_GC_GUARD(result[i]);
+  }
+
+  /* Prepare output XND objects. */
+  for (i = 0; i < spec.nout; i++) {
+    if (out == Qundef && ndt_is_abstract(spec.out[i])) {
+      ndt_del(spec.out[i]);
+      VALUE x = rb_xnd_from_xnd(&stack[nin+i]);
+      stack[nin+i] = xnd_error;
+      if (x == NULL) {
+        for (k = i+i; k < spec.nout; k++) {
+          if (ndt_is_abstract(spec.out[k])) {
+            xnd_del_buffer(&stack[nin+k], XND_OWN_ALL);
+          }
+        }
+      }
+      result[i] = x;
+    }
+  }
+
+  /* Return result */
+  switch(spec.nout) {
+  case 0: return Qnil;
+  case 1: return result[0];
+  default: {
+    VALUE tuple = array_new(spec.nout);
+    for (i = 0; i < spec.nout; ++i) {
+      rb_ary_store(tuple, i, result[i]);
+    }
+    return tuple;
+  }
+  }
+}
+
+/* An async call: everything gm_apply needs, owned by the job. */
+typedef struct {
+  gm_kernel_t kernel;
+  ndt_apply_spec_t spec;      /* owns the broadcast types */
+  xnd_t stack[NDT_MAX_ARGS];
+} async_call_t;
+
+static int
+async_call_run(void *data, ndt_context_t *ctx)
+{
+  async_call_t *a = (async_call_t *)data;
+
+  return gm_apply(&a->kernel, a->stack, a->spec.outer_dims, ctx);
+}
+
+static void
+async_call_free(void *data)
+{
+  async_call_t *a = (async_call_t *)data;
+
+  free_broadcast(&a->spec);
+  ndt_free(a);
+}
+
+/* GufuncObject#call_async(*args, out: nil): select the kernel and allocate
+   the outputs as #call does, then run the kernel on a background thread.
+   Returns a Gumath::Future for the result. Type errors are raised here;
+   errors of the kernel itself are raised by Future#value. Kernels whose
+   output shape is only known after running them are not supported. */
+static VALUE
+Gumath_GufuncObject_call_async(int argc, VALUE *argv, VALUE self)
+{
+  xnd_t stack[NDT_MAX_ARGS];
+  const ndt_t *in_types[NDT_MAX_ARGS];
+  VALUE result[NDT_MAX_ARGS];
+  VALUE out = Qundef, keep, value;
+  ndt_apply_spec_t spec = ndt_apply_spec_empty;
+  gm_kernel_t kernel;
+  GufuncObject *self_p;
+  async_call_t *a;
+  double t[3] = {0, 0, 0};
+  int profiled, timed = 0;
+  int nin, i;
+
+  if (argc > 0 && RB_TYPE_P(argv[argc-1], T_HASH)) {
+    VALUE opts = argv[--argc];
+    ID kw[1];
+
+    kw[0] = rb_intern("out");
+    rb_get_kwargs(opts, kw, 0, 1, &out);
+    out = out == Qnil ? Qundef : out;
+  }
+  nin = argc;
+
+  if (argc > NDT_MAX_ARGS) {
+    rb_raise(rb_eArgError, "too many arguments.");
+  }
+
+  stack_from_args(argc, argv, stack, in_types);
+  GET_GUOBJ(self, self_p);
+
+  profiled = rb_gumath_profile_mode != GM_PROFILE_OFF;
+  if (profiled && (timed = rb_gumath_profile_timed(self_p->profile))) {
+    t[0] = now_ns();
+  }
+
+  /* The job owns its broadcast types: it may outlive any cache entry. */
+  kernel = select_kernel(self_p, in_types, nin, stack, &spec, NULL, NULL);
+  if (timed) {
+    t[1] = now_ns();
+  }
+
+  for (i = 0; i < spec.nout; i++) {
+    if (!ndt_is_concrete(spec.out[i])) {
+      ndt_apply_spec_clear(&spec);
+      rb_raise(rb_eNotImpError, "call_async: %s has an output of variable "
+               "size.", self_p->name);
+    }
+  }
+
+  prepare_outputs(out, &kernel, &spec, stack, nin, result);
+  if (timed) {
+    t[2] = now_ns();
+  }
+  if (profiled) {
+    profile_call(self_p, timed, t, 0, 1, stack, nin + spec.nout);
+  }
+
+  a = ndt_alloc(1, sizeof *a);
+  if (a == NULL) {
+    free_broadcast(&spec);
+    rb_raise(rb_eNoMemError, "could not allocate gumath job.");
+  }
+  a->kernel = kernel;
+  a->spec = spec;
+  memcpy(a->stack, stack, (nin + spec.nout) * sizeof(xnd_t));
+
+  keep = rb_ary_new_from_values(argc, argv);
+  for (i = 0; i < spec.nout; i++) {
+    rb_ary_push(keep, result[i]);
+  }
+
+  switch (spec.nout) {
+  case 0: value = Qnil; break;
+  case 1: value = result[0]; break;
+  default: value = rb_ary_new_from_values(spec.nout, result); break;
+  }
+
+  return rb_gumath_future_new(async_call_run, async_call_free, a, value, keep);
+}
+
+/* Whether every kernel of the function is elementwise with one output, so
+   that calls can be split into blocks along any dimension. */
+static VALUE
+Gumath_GufuncObject_elementwise_p(VALUE self)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  GufuncObject *self_p;
+  const gm_func_t *f;
+  int i;
+
+  GET_GUOBJ(self, self_p);
+
+  f = gm_tbl_find(self_p->table, self_p->name, &ctx);
+  if (f == NULL) {
+    seterr(&ctx);
+    raise_error();
+  }
+
+  for (i = 0; i < f->nkernels; i++) {
+    const ndt_t *sig = f->kernels[i].sig;
+    if (sig->Function.nout != 1 || !sig_is_elementwise(sig)) {
+      return Qfalse;
+    }
+  }
+
+  return f->nkernels > 0 ? Qtrue : Qfalse;
+}
+
+static VALUE
+cache_stats_hash(const gufunc_cache_stats_t *stats, int size, int pinned)
+{
+  const uint64_t lookups = stats->hits + stats->misses;
+  VALUE hash = rb_hash_new();
+
+  rb_hash_aset(hash, ID2SYM(rb_intern("hits")), ULL2NUM(stats->hits));
+  rb_hash_aset(hash, ID2SYM(rb_intern("misses")), ULL2NUM(stats->misses));
+  rb_hash_aset(hash, ID2SYM(rb_intern("evictions")), ULL2NUM(stats->evictions));
+  rb_hash_aset(hash, ID2SYM(rb_intern("hit_rate")),
+               DBL2NUM(lookups == 0 ? 0.0 : (double)stats->hits / lookups));
+  if (size >= 0) {
+    rb_hash_aset(hash, ID2SYM(rb_intern("size")), INT2FIX(size));
+  }
+  if (pinned >= 0) {
+    rb_hash_aset(hash, ID2SYM(rb_intern("pinned")), INT2FIX(pinned));
+  }
+
+  return hash;
+}
+
+/* Dispatch cache statistics of this function: hits, misses, evictions,
+   hit_rate, the number of cached input signatures and the number of
+   entries borrowed by calls that are still running. */
+static VALUE
+Gumath_GufuncObject_cache_stats(VALUE self)
+{
+  GufuncObject *self_p;
+  int i, size = 0, pinned = 0;
+
+  GET_GUOBJ(self, self_p);
+  for (i = 0; i < GUFUNC_CACHE_SIZE; i++) {
+    size += self_p->cache[i].generation != 0;
+    pinned += self_p->cache[i].pins > 0;
+  }
+
+  return cache_stats_hash(&self_p->cache_stats, size, pinned);
+}
+
+static VALUE
+Gumath_GufuncObject_name(VALUE self)
+{
+  GufuncObject *self_p;
+
+  GET_GUOBJ(self, self_p);
+  return rb_str_new_cstr(self_p->name);
+}
+
+/****************************************************************************/
+/*                                  Batches                                 */
+/****************************************************************************/
+
+typedef struct {
+  gm_kernel_t kernel;
+  ndt_apply_spec_t spec;      /* owns the broadcast types */
+  int64_t first;              /* arguments in batch_t.stack */
+} batch_item_t;
+
+typedef struct {
+  VALUE items;                /* Array of [GufuncObject, Array of args] */
+  VALUE results;
+  long nitems;
+  long nprepared;             /* items whose spec must be cleared */
+  batch_item_t *item;
+  xnd_t *stack;
+  int64_t nstack;
+  int64_t stack_size;
+  int64_t nbytes;
+  int parallel;
+  int64_t nthreads;           /* pool threads if parallel */
+  int64_t kernel_threads;     /* threads of each kernel otherwise */
+  volatile int stop;          /* set by the unblocking function */
+  uint8_t *done;              /* finished items, skipped after a restart */
+  int ret;
+  ndt_context_t ctx;
+} batch_t;
+
+static int
+batch_task(void *job, int64_t i, ndt_context_t *ctx)
+{
+  batch_t *b = (batch_t *)job;
+  batch_item_t *item = &b->item[i];
+  int ret;
+
+  if (b->stop || (b->done != NULL && b->done[i])) {
+    return 0;
+  }
+
+  ret = gm_apply(&item->kernel, b->stack + item->first, item->spec.outer_dims, ctx);
+  if (ret == 0 && b->done != NULL) {
+    b->done[i] = 1;
+  }
+  return ret;
+}
+
+static void *
+batch_run(void *arg)
+{
+  batch_t *b = (batch_t *)arg;
+
+  if (b->parallel) {
+    b->ret = rb_gumath_pool_run(b->nthreads, b->nitems, batch_task, b, &b->ctx);
+  }
+  else {
+    long i;
+    rb_gumath_kernel_threads = b->kernel_threads;
+    for (i = 0; i < b->nitems && b->ret == 0 && !b->stop; i++) {
+      b->ret = batch_task(b, i, &b->ctx);
+    }
+    rb_gumath_kernel_threads = 0;
+  }
+
+  return NULL;
+}
+
+/* Unblocking function: the items that have not started are skipped. */
+static void
+batch_ubf(void *arg)
+{
+  ((batch_t *)arg)->stop = 1;
+}
+
+/* Select the kernel and allocate the outputs of item i. */
+static void
+batch_prepare(batch_t *b, long i)
+{
+  xnd_t stack[NDT_MAX_ARGS];
+  const ndt_t *in_types[NDT_MAX_ARGS];
+  VALUE result[NDT_MAX_ARGS];
+  VALUE entry, func, args;
+  batch_item_t *item = &b->item[i];
+  GufuncObject *self_p;
+  double t[3] = {0, 0, 0};
+  int profiled, timed = 0;
+  int argc, nargs, k;
+
+  entry = rb_ary_entry(b->items, i);
+  func = rb_ary_entry(entry, 0);
+  args = rb_ary_entry(entry, 1);
+  if (!rb_obj_is_kind_of(func, cGumath_GufuncObject) || !RB_TYPE_P(args, T_ARRAY)) {
+    rb_raise(rb_eTypeError, "batch item %ld is not a function and its arguments.", i);
+  }
+  GET_GUOBJ(func, self_p);
+
+  argc = (int)RARRAY_LEN(args);
+  if (argc > NDT_MAX_ARGS) {
+    rb_raise(rb_eArgError, "too many arguments.");
+  }
+  stack_from_args(argc, (VALUE *)RARRAY_CONST_PTR(args), stack, in_types);
+
+  profiled = rb_gumath_profile_mode != GM_PROFILE_OFF;
+  if (profiled && (timed = rb_gumath_profile_timed(self_p->profile))) {
+    t[0] = now_ns();
+  }
+
+  /* Items of the same function and input types share the cached
+     selection. */
+  item->spec = ndt_apply_spec_empty;
+  item->kernel = select_kernel(self_p, in_types, argc, stack, &item->spec, NULL, NULL);
+  b->nprepared = i + 1;
+  if (timed) {
+    t[1] = now_ns();
+  }
+
+  for (k = 0; k < item->spec.nout; k++) {
+    if (!ndt_is_concrete(item->spec.out[k])) {
+      ndt_apply_spec_clear(&item->spec);
+      rb_raise(rb_eNotImpError, "batch: %s has an output of variable size.",
+               self_p->name);
+    }
+  }
+
+  prepare_outputs(Qundef, &item->kernel, &item->spec, stack, argc, result);
+  if (timed) {
+    t[2] = now_ns();
+  }
+
+  nargs = argc + item->spec.nout;
+  if (profiled) {
+    profile_call(self_p, timed, t, 0, b->nthreads, stack, nargs);
+  }
+  if (b->nstack + nargs > b->stack_size) {
+    b->stack_size = 2 * (b->nstack + nargs);
+    REALLOC_N(b->stack, xnd_t, b->stack_size);
+  }
+  item->first = b->nstack;
+  memcpy(b->stack + b->nstack, stack, nargs * sizeof(xnd_t));
+  b->nstack += nargs;
+
+  for (k = 0; k < nargs; k++) {
+    b->nbytes += stack[k].type->datasize;
+  }
+
+  switch (item->spec.nout) {
+  case 0: rb_ary_push(b->results, Qnil); break;
+  case 1: rb_ary_push(b->results, result[0]); break;
+  default: rb_ary_push(b->results, rb_ary_new_from_values(item->spec.nout, result)); break;
+  }
+
+  RB_GC_GUARD(args);
+}
+
+static VALUE
+batch_body(VALUE arg)
+{
+  batch_t *b = (batch_t *)arg;
+  long i;
+
+  for (i = 0; i < b->nitems; i++) {
+    batch_prepare(b, i);
+  }
+
+  if (b->nitems == 0) {
+    return b->results;
+  }
+
+  /* Without the GVL an interrupt stops the batch between items. If its
+     handler does not raise, the batch goes on with the items that were not
+     finished yet. */
+  if (!b->parallel && b->nbytes < GVL_RELEASE_CUTOFF) {
+    batch_run(b);
+  }
+  else {
+    b->done = ZALLOC_N(uint8_t, b->nitems);
+    do {
+      b->stop = 0;
+      rb_thread_call_without_gvl(batch_run, b, batch_ubf, b);
+    } while (b->stop && b->ret == 0);
+  }
+
+  if (b->ret < 0) {
+    seterr(&b->ctx);
+    raise_error();
+  }
+
+  return b->results;
+}
+
+static VALUE
+batch_cleanup(VALUE arg)
+{
+  batch_t *b = (batch_t *)arg;
+  long i;
+
+  for (i = 0; i < b->nprepared; i++) {
+    free_broadcast(&b->item[i].spec);
+  }
+  xfree(b->item);
+  xfree(b->stack);
+  xfree(b->done);
+
+  return Qnil;
+}
+
+/* Gumath::Batch#run(parallel: false): call every function added to the
+   batch, in one go, and return their results in order. The functions are
+   selected and the outputs allocated for all items before any kernel runs;
+   identical signatures share the cached kernel selection. With parallel:
+   true the items run concurrently on the worker pool, which is only safe
+   because no item can see the outputs of another. */
+static VALUE
+Gumath_Batch_run(int argc, VALUE *argv, VALUE self)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  VALUE opts, parallel = Qundef, items;
+  ID kw[1];
+  batch_t b;
+
+  rb_scan_args(argc, argv, "0:", &opts);
+  if (!NIL_P(opts)) {
+    kw[0] = rb_intern("parallel");
+    rb_get_kwargs(opts, kw, 0, 1, &parallel);
+  }
+
+  /* A copy, so that adding to the batch while it runs changes nothing. */
+  items = rb_ivar_get(self, rb_intern("@items"));
+  if (!RB_TYPE_P(items, T_ARRAY)) {
+    rb_raise(rb_eTypeError, "batch has no items.");
+  }
+  items = rb_ary_dup(items);
+
+  memset(&b, 0, sizeof b);
+  b.items = items;
+  b.nitems = RARRAY_LEN(items);
+  b.results = rb_ary_new_capa(b.nitems);
+  b.item = ALLOC_N(batch_item_t, b.nitems);
+  b.parallel = parallel != Qundef && RTEST(parallel);
+  b.nthreads = b.parallel ? rb_gumath_call_threads() : 1;
+  b.kernel_threads = b.parallel ? 1 : rb_gumath_call_threads();
+  b.ctx = ctx;
+
+  RB_GC_GUARD(items);
+  return rb_ensure(batch_body, (VALUE)&b, batch_cleanup, (VALUE)&b);
+}
+
+/****************************************************************************/
+/*                               Singleton methods                          */
+/****************************************************************************/
+
+#ifdef HAVE_DLFCN_H
+/* Handle of the process for symbol lookups, opened once */
+static void *process_handle = NULL;
+#endif
+
+/* Resolve a kernel given as an address: an Integer, a Fiddle::Pointer, an
+   FFI::Pointer, or the name of a symbol in lib (or in the process if lib is
+   NULL). */
+static void *
+kernel_pointer(VALUE ptr, void *lib, const char *tag)
+{
+  void *p;
+
+  if (RB_TYPE_P(ptr, T_STRING)) {
+#ifdef HAVE_DLFCN_H
+    if (lib == NULL) {
+      if (process_handle == NULL) {
+        process_handle = dlopen(NULL, RTLD_NOW);
+      }
+      lib = process_handle;
+    }
+    p = dlsym(lib, StringValueCStr(ptr));
+    if (p == NULL) {
+      rb_raise(rb_eArgError, "%s: symbol %s not found.", tag, StringValueCStr(ptr));
+    }
+    return p;
+#else
+    rb_raise(rb_eNotImpError, "%s: symbol lookup is not supported on this "
+             "platform.", tag);
+#endif
+  }
+
+  if (rb_respond_to(ptr, rb_intern("address"))) {        /* FFI::Pointer */
+    ptr = rb_funcall(ptr, rb_intern("address"), 0);
+  }
+  else if (!RB_INTEGER_TYPE_P(ptr) && !RB_FLOAT_TYPE_P(ptr) &&
+           rb_respond_to(ptr, rb_intern("to_i"))) {
+    ptr = rb_funcall(ptr, rb_intern("to_i"), 0);         /* Fiddle::Pointer */
+  }
+  if (!RB_INTEGER_TYPE_P(ptr)) {
+    rb_raise(rb_eTypeError, "%s: expected an address, a pointer or a symbol "
+             "name.", tag);
+  }
+
+  p = (void *)(uintptr_t)NUM2ULL(ptr);
+  if (p == NULL) {
+    rb_raise(rb_eArgError, "%s: NULL kernel.", tag);
+  }
 
-VALUE
-seterr(ndt_context_t *ctx)
-{
-  return rb_ndtypes_set_error(ctx);
+  return p;
 }
 
-/****************************************************************************/
-/*                               Instance methods                           */
-/****************************************************************************/
+/* Gumath.unsafe_add_kernel(name:, sig:, c:, fortran:, strided:, xnd:, opt:,
+   lib: nil)
 
+   Add a native kernel with the type signature sig to the function name and
+   define Gumath.<name>. At least one of the kernel variants must be given:
+   opt:, c:, fortran: and xnd: take int (*)(xnd_t stack[], ndt_context_t *),
+   strided: takes int (*)(char **args, intptr_t *dimensions, intptr_t *steps,
+   void *data). Each is an address or, with lib: the path of a shared
+   library, a symbol name. Nothing about the functions can be checked:
+   a wrong signature crashes the interpreter. Returns the GufuncObject.
+
+   The kernels go into a table of Gumath's own, so a name such as "sin"
+   never adds kernels to the functions of Gumath::Functions or any other
+   kernel module. */
 static VALUE
-Gumath_GufuncObject_call(int argc, VALUE *argv, VALUE self)
+Gumath_s_unsafe_add_kernel(int argc, VALUE *argv, VALUE klass)
 {
   NDT_STATIC_CONTEXT(ctx);
-  xnd_t stack[NDT_MAX_ARGS];
-  const ndt_t *in_types[NDT_MAX_ARGS];
-  gm_kernel_t kernel;
-  ndt_apply_spec_t spec = ndt_apply_spec_empty;
-  GufuncObject *self_p;
-  VALUE result[NDT_MAX_ARGS];
-  int i, k;
-  size_t nin = argc;
+  static const char *const keys[] = {
+    "name", "sig", "opt", "c", "fortran", "xnd", "strided", "lib"
+  };
+  VALUE opts, values[8], name, func_hash, func;
+  ID kw[8];
+  gm_kernel_init_t k;
+  struct map_args args;
+  const gm_func_t *f;
+  void *lib = NULL;
+  int i;
 
-  if (argc > NDT_MAX_ARGS) {
-    rb_raise(rb_eArgError, "too many arguments.");
+  rb_scan_args(argc, argv, "0:", &opts);
+  for (i = 0; i < 8; i++) {
+    kw[i] = rb_intern(keys[i]);
   }
+  rb_get_kwargs(NIL_P(opts) ? rb_hash_new() : opts, kw, 2, 6, values);
 
-  /* Prepare arguments for sending into gumath function. */
-  for (i = 0; i < argc; i++) {
-    if (!rb_xnd_check_type(argv[i])) {
-      VALUE str = rb_funcall(argv[i], rb_intern("inspect"), 0, NULL);
-      rb_raise(rb_eArgError, "Args must be XND. Received %s.", RSTRING_PTR(str));
-    }
-
-    stack[i] = *rb_xnd_const_xnd(argv[i]);
-    in_types[i] = stack[i].type;
+  name = rb_String(values[0]);
+  if (RSTRING_LEN(name) == 0) {
+    rb_raise(rb_eArgError, "unsafe_add_kernel: empty name.");
   }
 
-  /* Select the gumath function to be called from the function table. */
-  GET_GUOBJ(self, self_p);
-
-  kernel = gm_select(&spec, self_p->table, self_p->name, in_types, argc, stack, &ctx);
-  if (kernel.set == NULL) {
-    seterr(&ctx);
-    raise_error();
+  /* Don't shadow the methods of Gumath itself. */
+  func_hash = rb_ivar_get(klass, GUMATH_FUNCTION_HASH);
+  if (NIL_P(func_hash)) {
+    func_hash = rb_hash_new();
+    rb_ivar_set(klass, GUMATH_FUNCTION_HASH, func_hash);
+  }
+  if (NIL_P(rb_hash_lookup(func_hash, rb_to_symbol(name))) &&
+      rb_respond_to(klass, rb_intern_str(name))) {
+    rb_raise(rb_eArgError, "unsafe_add_kernel: Gumath.%s already exists.",
+             StringValueCStr(name));
   }
 
-  if (spec.nbroadcast > 0) {
-    for (i = 0; i < argc; i++) {
-      stack[i].type = spec.broadcast[i];
+  if (values[7] != Qundef && !NIL_P(values[7])) {
+#ifdef HAVE_DLFCN_H
+    /* Kernels stay in the table for good: the library is never closed. */
+    lib = dlopen(StringValueCStr(values[7]), RTLD_NOW | RTLD_LOCAL);
+    if (lib == NULL) {
+      rb_raise(rb_eLoadError, "unsafe_add_kernel: %s", dlerror());
     }
+#else
+    rb_raise(rb_eNotImpError, "unsafe_add_kernel: lib: is not supported on "
+             "this platform.");
+#endif
   }
 
-  /* Populate output values with empty XND objects. */
-  for (i = 0; i < spec.nout; i++) {
-    if (ndt_is_concrete(spec.out[i])) {
-      VALUE x = rb_xnd_empty_from_type(spec.out[i]);
-      if (x == NULL) {
-        ndt_apply_spec_clear(&spec);
-        rb_raise(rb_eNoMemError, "could not allocate empty XND object.");
-      }
-      result[i] = x;
-      stack[nin+i] = *rb_xnd_const_xnd(x);
+  memset(&k, 0, sizeof k);
+  k.sig = StringValueCStr(values[1]);
+  for (i = 2; i < 7; i++) {
+    void *p;
+
+    if (values[i] == Qundef || NIL_P(values[i])) {
+      continue;
     }
-    else {
-      result[i] = NULL;
-      stack[nin+i] = xnd_error;
+    p = kernel_pointer(values[i], lib, keys[i]);
+    switch (i) {
+    case 2: k.Opt = (gm_xnd_kernel_t)p; break;
+    case 3: k.C = (gm_xnd_kernel_t)p; break;
+    case 4: k.Fortran = (gm_xnd_kernel_t)p; break;
+    case 5: k.Xnd = (gm_xnd_kernel_t)p; break;
+    case 6: k.Strided = (gm_strided_kernel_t)p; break;
     }
   }
+  if (!k.Opt && !k.C && !k.Fortran && !k.Xnd && !k.Strided) {
+    rb_raise(rb_eArgError, "unsafe_add_kernel: need at least one of opt:, "
+             "c:, fortran:, xnd: and strided:.");
+  }
+  k.name = StringValueCStr(name);
 
-  /* Actually call the kernel function with prepared input and output args. */
-#ifdef HAVE_PTHREAD_H
-  if (gm_apply_thread(&kernel, stack, spec.outer_dims, spec.flags,
-                      max_threads, &ctx) < 0) {
+  if (gm_add_kernel(table, &k, &ctx) < 0) {
     seterr(&ctx);
     raise_error();
   }
-#else
-  if (gm_apply(&kernel, stack, spec.outer_dims, &ctx) < 0) {
+  rb_gumath_table_modified();
+
+  f = gm_tbl_find(table, k.name, &ctx);
+  if (f == NULL) {
     seterr(&ctx);
     raise_error();
   }
-#endif
 
-  /* Prepare output XND objects. */
-  for (i = 0; i < spec.nout; i++) {
-    if (ndt_is_abstract(spec.out[i])) {
-      ndt_del(spec.out[i]);
-      VALUE x = rb_xnd_from_xnd(&stack[nin+i]);
-      stack[nin+i] = xnd_error;
-      if (x == NULL) {
-        for (k = i+i; k < spec.nout; k++) {
-          if (ndt_is_abstract(spec.out[k])) {
-            xnd_del_buffer(&stack[nin+k], XND_OWN_ALL);
-          }
-        }
-      }
-      result[i] = x;
+  /* Define Gumath.<name> the first time. */
+  func = rb_hash_lookup(func_hash, rb_to_symbol(name));
+  if (NIL_P(func)) {
+    args.module = klass;
+    args.table = table;
+    args.before = Qnil;
+    if (add_function(f, &args) < 0) {
+      rb_raise(rb_eNoMemError, "failed to allocate GufuncObject.");
     }
+    func = rb_hash_lookup(func_hash, rb_to_symbol(name));
   }
 
-  if (spec.nbroadcast > 0) {
-    for (i = 0; i < nin; ++i) {
-      ndt_del(spec.broadcast[i]);
-    }
+  RB_GC_GUARD(name);
+  return func;
+}
+
+/* Dispatch cache statistics summed over all functions. */
+static VALUE
+Gumath_s_cache_stats(VALUE klass)
+{
+  return cache_stats_hash(gufunc_cache_totals(), -1, -1);
+}
+
+/* Kernel modules such as Gumath::Functions are created, and their kernels
+   registered, when the constant is first referenced. */
+static VALUE
+Gumath_s_const_missing(VALUE klass, VALUE name)
+{
+  VALUE module = load_kernel_module(SYM2ID(name));
+
+  if (module == Qundef) {
+    return rb_call_super(1, &name);
   }
 
-  /* Return result */
-  switch(spec.nout) {
-  case 0: return Qnil;
-  case 1: return result[0];
-  default: {
-    VALUE tuple = array_new(spec.nout);
-    for (i = 0; i < spec.nout; ++i) {
-      rb_ary_store(tuple, i, result[i]);
-    }
-    return tuple;
+  return module;
+}
+
+static VALUE
+restore_threads(VALUE threads)
+{
+  rb_thread_local_aset(rb_thread_current(), id_threads, threads);
+  return Qnil;
+}
+
+/* Run the block with a fixed thread count for kernels called by the
+   current thread, instead of the one chosen by the cost model or by
+   Gumath.set_max_threads. nil restores the default. */
+static VALUE
+Gumath_s_with_threads(VALUE klass, VALUE threads)
+{
+  VALUE prev;
+
+  rb_need_block();
+  if (!NIL_P(threads) && NUM2LL(threads) < 1) {
+    rb_raise(rb_eArgError, "threads must be at least 1.");
   }
+
+  prev = rb_thread_local_aref(rb_thread_current(), id_threads);
+  rb_thread_local_aset(rb_thread_current(), id_threads, threads);
+
+  return rb_ensure(rb_yield, threads, restore_threads, prev);
+}
+
+/* Number of threads chosen for the last kernel call of the current thread. */
+static VALUE
+Gumath_s_last_threads(VALUE klass)
+{
+  return rb_thread_local_aref(rb_thread_current(), id_last_threads);
+}
+
+/* Instruction set features of the CPU that kernels may use. */
+static VALUE
+Gumath_s_cpu_features(VALUE klass)
+{
+  const gm_cpu_feature_t *f;
+  VALUE features = rb_ary_new();
+
+  for (f = rb_gumath_cpu_features(); f->name != NULL; f++) {
+    if (f->supported) {
+      rb_ary_push(features, ID2SYM(rb_intern(f->name)));
+    }
   }
+
+  return features;
 }
 
-/****************************************************************************/
-/*                               Singleton methods                          */
-/****************************************************************************/
+/* Tier of the multi-versioned kernels, lowered by GUMATH_CPU_TIER. */
+static VALUE
+Gumath_s_cpu_tier(VALUE klass)
+{
+  return ID2SYM(rb_intern(rb_gumath_cpu_tier_name(rb_gumath_cpu_tier())));
+}
 
+/* Every tier this CPU can run, lowest first. */
 static VALUE
-Gumath_s_unsafe_add_kernel(int argc, VALUE *argv, VALUE klass)
+Gumath_s_cpu_tiers(VALUE klass)
+{
+  VALUE tiers = rb_ary_new();
+  int i;
+
+  for (i = GM_CPU_BASE; i <= (int)rb_gumath_cpu_max_tier(); i++) {
+    rb_ary_push(tiers, ID2SYM(rb_intern(rb_gumath_cpu_tier_name((gm_cpu_tier_t)i))));
+  }
+
+  return tiers;
+}
+
+/* Gumath.kernel_variant(:sin) => :avx2. Functions without vectorized
+   variants report :portable. */
+static VALUE
+Gumath_s_kernel_variant(VALUE klass, VALUE name)
 {
-  /* TODO: implement this. */
+  const char *variant;
+
+  if (SYMBOL_P(name)) {
+    name = rb_sym2str(name);
+  }
+  variant = rb_gumath_simd_variant(StringValueCStr(name));
+
+  return ID2SYM(rb_intern(variant ? variant : "portable"));
 }
 
 static VALUE
@@ -186,12 +1759,25 @@ Gumath_s_get_max_threads(VALUE klass)
   return INT2NUM(max_threads);
 }
 
+/* Stopping workers waits for any job they are in. */
+static void *
+resize_without_gvl(void *arg)
+{
+  rb_gumath_pool_resize(*(int *)arg);
+  return NULL;
+}
+
 static VALUE
 Gumath_s_set_max_threads(VALUE klass, VALUE threads)
 {
+  int n;
+
   Check_Type(threads, T_FIXNUM);
   
-  max_threads = NUM2INT(threads);
+  max_threads = n = NUM2INT(threads);
+  rb_thread_call_without_gvl(resize_without_gvl, &n, NULL, NULL);
+
+  return threads;
 }
 
 /****************************************************************************/
@@ -210,11 +1796,100 @@ init_max_threads(void)
 /*                                   C-API                                  */
 /****************************************************************************/
 
-struct map_args {
-  VALUE module;
-  const gm_tbl_t *table;
+int64_t
+rb_gumath_max_threads(void)
+{
+  return max_threads;
+}
+
+int64_t
+rb_gumath_call_threads(void)
+{
+  const int64_t n = requested_threads(Qundef);
+
+  return n > 0 ? n : max_threads;
+}
+
+uint64_t
+rb_gumath_table_generation(void)
+{
+  return table_generation;
+}
+
+void
+rb_gumath_table_modified(void)
+{
+  table_generation++;
+}
+
+/* The kernel methods of a module: an st_table from the method name to its
+   GufuncObject, wrapped in a hidden object. */
+static void
+kernel_methods_mark(void *ptr)
+{
+  if (ptr != NULL) {
+    rb_mark_tbl((st_table *)ptr);
+  }
+}
+
+static void
+kernel_methods_free(void *ptr)
+{
+  if (ptr != NULL) {
+    st_free_table((st_table *)ptr);
+  }
+}
+
+static size_t
+kernel_methods_size(const void *ptr)
+{
+  return ptr != NULL ? st_memsize((const st_table *)ptr) : 0;
+}
+
+static const rb_data_type_t kernel_methods_type = {
+  .wrap_struct_name = "GumathKernelMethods",
+  .function = {
+    .dmark = kernel_methods_mark,
+    .dfree = kernel_methods_free,
+    .dsize = kernel_methods_size,
+  },
+  .parent = 0,
+  .data = 0,
+  .flags = RUBY_TYPED_FREE_IMMEDIATELY,
 };
 
+/* The table of module, created on first use. */
+static st_table *
+kernel_methods(VALUE module)
+{
+  VALUE obj = rb_attr_get(module, id_kernel_methods);
+
+  if (NIL_P(obj)) {
+    obj = TypedData_Wrap_Struct(0, &kernel_methods_type, NULL);
+    RTYPEDDATA_DATA(obj) = st_init_numtable();
+    rb_ivar_set(module, id_kernel_methods, obj);
+  }
+
+  return (st_table *)RTYPEDDATA_DATA(obj);
+}
+
+/* Body of the singleton method defined for every kernel. One C function
+   serves all of them: the name the method was defined with selects the
+   GufuncObject, which is then called without a second method dispatch. */
+static VALUE
+call_kernel_method(int argc, VALUE *argv, VALUE module)
+{
+  ID name = rb_frame_this_func();
+  st_data_t func;
+
+  if (!st_lookup(kernel_methods(module), (st_data_t)name, &func)) {
+    rb_raise(rb_eNoMethodError, "undefined method '%s' for %" PRIsVALUE,
+             rb_id2name(name), module);
+  }
+
+  return Gumath_GufuncObject_call(argc, argv, (VALUE)func);
+}
+
 /* Function called by libgumath that will load function kernels from function
    table of type gm_tbl_t into a Ruby module. Don't call this directly use
    rb_gumath_add_functions.
@@ -223,7 +1898,19 @@ int
 add_function(const gm_func_t *f, void *args)
 {
   struct map_args *a = (struct map_args *)args;
-  VALUE func, func_hash;
+  VALUE func, func_hash, name;
+
+  name = ID2SYM(rb_intern(f->name));
+
+  if (f->nkernels == 0) {
+    return 0;
+  }
+
+  /* Only expose the functions a group added kernels to. */
+  if (!NIL_P(a->before) &&
+      f->nkernels <= FIX2INT(rb_hash_lookup2(a->before, name, INT2FIX(0)))) {
+    return 0;
+  }
 
   func = GufuncObject_alloc(a->table, f->name);
   if (func == NULL) {
@@ -231,7 +1918,10 @@ add_function(const gm_func_t *f, void *args)
   }
 
   func_hash = rb_ivar_get(a->module, GUMATH_FUNCTION_HASH);
-  rb_hash_aset(func_hash, ID2SYM(rb_intern(f->name)), func);
+  rb_hash_aset(func_hash, name, func);
+
+  st_insert(kernel_methods(a->module), (st_data_t)SYM2ID(name), (st_data_t)func);
+  rb_define_singleton_method(a->module, f->name, call_kernel_method, -1);
 
   return 0;
 }
@@ -240,11 +1930,175 @@ add_function(const gm_func_t *f, void *args)
 int
 rb_gumath_add_functions(VALUE module, const gm_tbl_t *tbl)
 {
-  struct map_args args = {module, tbl};
+  struct map_args args = {module, tbl, Qnil};
 
   if (gm_tbl_map(tbl, add_function, &args) < 0) {
     return -1;
   }
+
+  return 0;
+}
+
+/****************************************************************************/
+/*                                Kernel groups                             */
+/****************************************************************************/
+
+static kernel_module_t *
+find_module(const char *name)
+{
+  int i;
+
+  for (i = 0; i < nmodules; i++) {
+    if (strcmp(modules[i].name, name) == 0) {
+      return &modules[i];
+    }
+  }
+
+  return NULL;
+}
+
+void
+rb_gumath_register_group(const char *module, const char *name,
+                         rb_gumath_group_init_t init)
+{
+  kernel_module_t *m;
+  kernel_group_t *g;
+
+  if (ngroups == GUMATH_MAX_GROUPS) {
+    rb_raise(rb_eRuntimeError, "too many gumath kernel groups.");
+  }
+
+  m = find_module(module);
+  if (m == NULL) {
+    m = &modules[nmodules++];
+    m->name = module;
+    m->table = NULL;
+  }
+
+  g = &groups[ngroups++];
+  g->module = m;
+  g->name = name;
+  g->init = init;
+  g->loaded = 0;
+}
+
+static int
+count_kernels(const gm_func_t *f, void *args)
+{
+  VALUE counts = *(VALUE *)args;
+
+  rb_hash_aset(counts, ID2SYM(rb_intern(f->name)), INT2FIX(f->nkernels));
+  return 0;
+}
+
+/* Take every function back to the number of kernels it had before a group
+   failed part of the way. Functions the group created are left without
+   kernels and are never defined. */
+static int
+drop_kernels(const gm_func_t *f, void *args)
+{
+  VALUE counts = *(VALUE *)args;
+  gm_func_t *func = (gm_func_t *)f;
+  const int n = FIX2INT(rb_hash_lookup2(counts, ID2SYM(rb_intern(f->name)), INT2FIX(0)));
+  int i;
+
+  for (i = n; i < func->nkernels; i++) {
+    ndt_del((ndt_t *)func->kernels[i].sig);
+    memset(&func->kernels[i], 0, sizeof func->kernels[i]);
+  }
+  if (func->nkernels > n) {
+    func->nkernels = n;
+  }
+  return 0;
+}
+
+/* Add the kernels of a group to the table of its module. If the module is
+   already defined, the functions that gained kernels are (re)defined on it.
+   A name that several groups of a module use is a single function whose
+   kernels are tried in the order the groups were registered. */
+static void
+load_group(kernel_group_t *g)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  kernel_module_t *m = g->module;
+  const ID id = rb_intern(m->name);
+  struct map_args args = {Qundef, NULL, Qnil};
+
+  if (g->loaded) {
+    return;
+  }
+
+  if (m->table == NULL) {
+    m->table = gm_tbl_new(&ctx);
+    if (m->table == NULL) {
+      seterr(&ctx);
+      raise_error();
+    }
+  }
+  args.table = m->table;
+  args.before = rb_hash_new();
+  gm_tbl_map(m->table, count_kernels, &args.before);
+
+  if (rb_const_defined_at(cGumath, id)) {
+    args.module = rb_const_get_at(cGumath, id);
+  }
+
+  /* A retry must not add the kernels that made it in twice. */
+  if (g->init(m->table, &ctx) < 0) {
+    gm_tbl_map(m->table, drop_kernels, &args.before);
+    rb_gumath_table_modified();
+    seterr(&ctx);
+    raise_error();
+  }
+  g->loaded = 1;
+  rb_gumath_table_modified();
+
+  if (args.module != Qundef && gm_tbl_map(m->table, add_function, &args) < 0) {
+    rb_raise(rb_eLoadError, "failed to load %s kernels into Gumath::%s.",
+             g->name, m->name);
+  }
+  RB_GC_GUARD(args.before);
+}
+
+void
+rb_gumath_load_group(const char *module, const char *name)
+{
+  int i;
+
+  for (i = 0; i < ngroups; i++) {
+    if (strcmp(groups[i].module->name, module) == 0 &&
+        strcmp(groups[i].name, name) == 0) {
+      load_group(&groups[i]);
+    }
+  }
+}
+
+/* Create Gumath::<id>, load every group registered for it and define its
+   functions. Returns Qundef if no group belongs to such a module. */
+static VALUE
+load_kernel_module(ID id)
+{
+  kernel_module_t *m = find_module(rb_id2name(id));
+  VALUE module;
+  int i;
+
+  if (m == NULL) {
+    return Qundef;
+  }
+
+  for (i = 0; i < ngroups; i++) {
+    if (groups[i].module == m) {
+      load_group(&groups[i]);
+    }
+  }
+
+  module = rb_define_module_under(cGumath, m->name);
+  rb_ivar_set(module, GUMATH_FUNCTION_HASH, rb_hash_new());
+  if (rb_gumath_add_functions(module, m->table) < 0) {
+    rb_raise(rb_eLoadError, "failed to load kernels into Gumath::%s.", m->name);
+  }
+
+  return module;
 }
 
 void Init_ruby_gumath(void)
@@ -270,11 +2124,17 @@ void Init_ruby_gumath(void)
       raise_error();
     }
 
+    rb_gumath_cpu_init();
     init_max_threads();
+    rb_gumath_pool_init();
 
     initialized = 1;
   }
 
+  id_threads = rb_intern("__gumath_threads__");
+  id_last_threads = rb_intern("__gumath_last_threads__");
+  id_kernel_methods = rb_intern("__gumath_kernel_methods__");
+
   cGumath = rb_define_class("Gumath", rb_cObject);
   cGumath_GufuncObject = rb_define_class_under(cGumath, "GufuncObject", rb_cObject);
     
@@ -284,12 +2144,37 @@ void Init_ruby_gumath(void)
   rb_define_singleton_method(cGumath, "unsafe_add_kernel", Gumath_s_unsafe_add_kernel, -1);
   rb_define_singleton_method(cGumath, "get_max_threads", Gumath_s_get_max_threads, 0);
   rb_define_singleton_method(cGumath, "set_max_threads", Gumath_s_set_max_threads, 1);
+  rb_define_singleton_method(cGumath, "const_missing", Gumath_s_const_missing, 1);
+  rb_define_singleton_method(cGumath, "with_threads", Gumath_s_with_threads, 1);
+  rb_define_singleton_method(cGumath, "last_threads", Gumath_s_last_threads, 0);
+  rb_define_singleton_method(cGumath, "cache_stats", Gumath_s_cache_stats, 0);
+  rb_define_singleton_method(cGumath, "cpu_features", Gumath_s_cpu_features, 0);
+  rb_define_singleton_method(cGumath, "cpu_tier", Gumath_s_cpu_tier, 0);
+  rb_define_singleton_method(cGumath, "cpu_tiers", Gumath_s_cpu_tiers, 0);
+  rb_define_singleton_method(cGumath, "kernel_variant", Gumath_s_kernel_variant, 1);
+
+  /* Class: Gumath::Batch */
+  cGumath_Batch = rb_define_class_under(cGumath, "Batch", rb_cObject);
+  rb_define_method(cGumath_Batch, "run", Gumath_Batch_run, -1);
 
   /* Class: Gumath::GufuncObject */
 
   /* Instance methods */
   rb_define_method(cGumath_GufuncObject, "call", Gumath_GufuncObject_call,-1);
+  rb_define_method(cGumath_GufuncObject, "call_async", Gumath_GufuncObject_call_async, -1);
+  rb_define_method(cGumath_GufuncObject, "elementwise?", Gumath_GufuncObject_elementwise_p, 0);
+  rb_define_method(cGumath_GufuncObject, "name", Gumath_GufuncObject_name, 0);
+  rb_define_method(cGumath_GufuncObject, "cache_stats", Gumath_GufuncObject_cache_stats, 0);
   
-  Init_gumath_functions();
-  Init_gumath_examples();
+  /* Register the kernel groups. Nothing is loaded until a module is used. */
+  if (ngroups == 0) {
+    Init_gumath_functions();
+    Init_gumath_examples();
+  }
+  Init_gumath_reductions();
+  Init_gumath_distances();
+  Init_gumath_graphs();
+  Init_gumath_quaternions();
+  Init_gumath_profile();
+  Init_gumath_future();
 }
@@ -33,6 +33,7 @@
 #define RUBY_GUMATH_INTERNAL_H
 
 #include <ruby.h>
+#include <ruby/thread.h>
 #include "ndtypes.h"
 #include "ruby_ndtypes.h"
 #include "xnd.h"
@@ -42,4 +43,50 @@
 #include "ruby_gumath.h"
 #include "util.h"
 
+/* Number of threads kernels may use, as set by Gumath.set_max_threads. */
+int64_t rb_gumath_max_threads(void);
+
+/* Threads for a call made by the current thread: the Gumath.with_threads
+   setting, else rb_gumath_max_threads(). Needs the GVL. */
+int64_t rb_gumath_call_threads(void);
+
+#ifdef _MSC_VER
+#define GM_THREAD_LOCAL __declspec(thread)
+#else
+#define GM_THREAD_LOCAL __thread
+#endif
+
+/* Threads a kernel may use for parallel work of its own, such as sorting one
+   long row. Set by the thread that runs the kernel, without the GVL: the
+   thread count of the call, or 1 if the call already spreads its rows over
+   the pool. 0 outside of a call, which kernels treat as 1. */
+extern GM_THREAD_LOCAL int64_t rb_gumath_kernel_threads;
+
+/* Generation of the kernel tables. Bumped whenever kernels are added so
+   that cached dispatch results can be invalidated. */
+uint64_t rb_gumath_table_generation(void);
+void rb_gumath_table_modified(void);
+
+/* Register a group of kernels for the Ruby module Gumath::<module>. The
+   init function adds the kernels to the table of that module when the
+   module is first referenced. */
+typedef int (*rb_gumath_group_init_t)(gm_tbl_t *tbl, ndt_context_t *ctx);
+void rb_gumath_register_group(const char *module, const char *name,
+                              rb_gumath_group_init_t init);
+
+/* Load a registered group now, for the typedefs it defines. The module is
+   not created; its functions are defined when it is first referenced. Does
+   nothing if no such group is registered. */
+void rb_gumath_load_group(const char *module, const char *name);
+
+void Init_gumath_functions(void);
+void Init_gumath_examples(void);
+
+/* Gumath::Reductions, Distances, Graphs and Quaternions, which are not
+   table kernels. */
+void Init_gumath_reductions(void);
+void Init_gumath_distances(void);
+void Init_gumath_graphs(void);
+void Init_gumath_quaternions(void);
+
 #endif  /* RUBY_GUMATH_INTERNAL_H */
@@ -0,0 +1,310 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+   Transcendental kernels: sin, cos, exp and log for float32 and float64.
+
+   Contiguous runs are evaluated a vector at a time with polynomial
+   approximations; strided runs are gathered into a small buffer first, so
+   the result of an element never depends on the layout it is stored in.
+   The vector code (simd_math_impl.h) is compiled once per instruction set
+   tier and the tier of cpu_features.c is chosen when the kernels are
+   registered. float32 is computed in double precision and rounded once.
+
+   Algorithms and error bounds (float64, round to nearest):
+
+     exp   Cody-Waite reduction x = k ln2 + r, |r| <= ln2/2, with a two
+           part ln2; the fdlibm rational form for exp(r), degree 10
+           Remez polynomial; 2^k applied in two factors so that subnormal
+           results are rounded once.                           < 1 ulp
+     log   x = 2^k (1 + f) with 1 + f in [sqrt(2)/2, sqrt(2)),
+           s = f / (2 + f) and the fdlibm degree 14 polynomial in s.
+                                                               < 1 ulp
+     sin,  x = n pi/2 + r with pi/2 in three 33 bit parts, which is exact
+     cos   for |x| <= 2^20 (TRIG_MAX); the fdlibm kernels on r and its
+           tail, quadrant from n mod 4. Larger finite arguments need the
+           full Payne-Hanek reduction and are passed to libm.  < 1 ulp
+
+   float32 results are within 1 ulp (the double result rounded to float).
+   Non-finite inputs, zeros and overflow follow C99 Annex F.
+*/
+
+#include "ruby_gumath_internal.h"
+#include "simd_math.h"
+#include "cpu_features.h"
+
+#if defined(__GNUC__) && !defined(_MSC_VER)
+#define SIMD_MATH
+#endif
+
+enum { SIMD_SIN, SIMD_COS, SIMD_EXP, SIMD_LOG, SIMD_NFUNCS };
+enum { SIMD_FLOAT32, SIMD_FLOAT64, SIMD_NTYPES };
+
+/* Contiguous loop over n elements; dst may be src. */
+typedef void (*simd_loop_t)(const char *src, char *dst, int64_t n);
+
+/* Elements gathered per step of a strided loop. */
+#define SIMD_GATHER 256
+
+#ifdef SIMD_MATH
+
+#define SIMD_CAT_(a, b) a##_##b
+#define SIMD_CAT(a, b) SIMD_CAT_(a, b)
+
+/* 1.5 * 2^52: adding and subtracting it rounds to an integer. */
+#define SIMD_ROUND_SHIFT 0x1.8p52
+
+#define LOG2E         1.44269504088896338700e+00
+#define LN2_HI        6.93147180369123816490e-01
+#define LN2_LO        1.90821492927058770002e-10
+#define EXP_OVERFLOW  710.0
+#define EXP_UNDERFLOW -746.0
+#define EXP_P1        1.66666666666666019037e-01
+#define EXP_P2       -2.77777777770155933842e-03
+#define EXP_P3        6.61375632143793436117e-05
+#define EXP_P4       -1.65339022054652515390e-06
+#define EXP_P5        4.13813679705723846039e-08
+
+#define LOG_LG1 6.666666666666735130e-01
+#define LOG_LG2 3.999999999940941908e-01
+#define LOG_LG3 2.857142874366239149e-01
+#define LOG_LG4 2.222219843214978396e-01
+#define LOG_LG5 1.818357216161805012e-01
+#define LOG_LG6 1.531383769920937332e-01
+#define LOG_LG7 1.479819860511658591e-01
+
+#define TRIG_MAX 0x1p20
+#define INV_PIO2 6.36619772367581382433e-01
+#define PIO2_1   1.57079632673412561417e+00
+#define PIO2_2   6.07710050630396597660e-11
+#define PIO2_2T  2.02226624879595063154e-21
+#define PIO2_3   2.02226624871116645580e-21
+#define PIO2_3T  8.47842766036889956997e-32
+
+#define SIN_S1 -1.66666666666666324348e-01
+#define SIN_S2  8.33333333332248946124e-03
+#define SIN_S3 -1.98412698298579493134e-04
+#define SIN_S4  2.75573137070700676789e-06
+#define SIN_S5 -2.50507602534068634195e-08
+#define SIN_S6  1.58969099521155010221e-10
+
+#define COS_C1  4.16666666666666019037e-02
+#define COS_C2 -1.38888888888741095749e-03
+#define COS_C3  2.48015872894767294178e-05
+#define COS_C4 -2.75573143513906633035e-07
+#define COS_C5  2.08757232129817482790e-09
+#define COS_C6 -1.13596475577881948265e-11
+
+/* Baseline: 128 bit vectors, SSE2 on x86-64, NEON/VSX elsewhere. */
+#define SIMD_TIER base
+#define SIMD_BYTES 16
+#include "simd_math_impl.h"
+#undef SIMD_BYTES
+#undef SIMD_TIER
+
+#ifdef GM_CPU_X86
+GM_TARGET_PUSH("avx2,fma")
+#define SIMD_TIER avx2
+#define SIMD_BYTES 32
+#include "simd_math_impl.h"
+#undef SIMD_BYTES
+#undef SIMD_TIER
+GM_TARGET_POP
+
+GM_TARGET_PUSH("avx512f")
+#define SIMD_TIER avx512
+#define SIMD_BYTES 64
+#include "simd_math_impl.h"
+#undef SIMD_BYTES
+#undef SIMD_TIER
+GM_TARGET_POP
+#endif  /* GM_CPU_X86 */
+
+static const simd_loop_t (*simd_loops)[SIMD_NTYPES] = loops_base;
+
+/* Every tier cpu_features.c can report is compiled above. */
+static void
+select_tier(void)
+{
+  switch (rb_gumath_cpu_tier()) {
+#ifdef GM_CPU_X86
+  case GM_CPU_AVX512: simd_loops = loops_avx512; break;
+  case GM_CPU_AVX2: simd_loops = loops_avx2; break;
+#endif
+  default: simd_loops = loops_base; break;
+  }
+}
+
+/****************************************************************************/
+/*                                 Kernels                                  */
+/****************************************************************************/
+
+/* One input and one output run of n elements with byte strides is and os. */
+static void
+run_strided(simd_loop_t loop, int64_t size, const char *src, int64_t is,
+            char *dst, int64_t os, int64_t n)
+{
+  char buf[SIMD_GATHER * sizeof(double)];
+  int64_t i, j, m;
+
+  if (is == size && os == size) {
+    loop(src, dst, n);
+    return;
+  }
+
+  for (i = 0; i < n; i += m) {
+    m = n - i < SIMD_GATHER ? n - i : SIMD_GATHER;
+    for (j = 0; j < m; j++) {
+      memcpy(buf + j * size, src + (i + j) * is, size);
+    }
+    loop(buf, buf, m);
+    for (j = 0; j < m; j++) {
+      memcpy(dst + (i + j) * os, buf + j * size, size);
+    }
+  }
+}
+
+/* Walks the fixed dimensions of in and out down to the innermost one. */
+static void
+run_xnd(simd_loop_t loop, int64_t size, const xnd_t *in, const xnd_t *out)
+{
+  const ndt_t *t = in->type;
+  const ndt_t *u = out->type;
+  int64_t i;
+
+  if (t->tag != FixedDim) {
+    loop(in->ptr, out->ptr, 1);
+  }
+  else if (t->FixedDim.type->tag != FixedDim) {
+    run_strided(loop, size,
+                in->ptr + in->index * size, t->Concrete.FixedDim.step * size,
+                out->ptr + out->index * size, u->Concrete.FixedDim.step * size,
+                t->FixedDim.shape);
+  }
+  else {
+    for (i = 0; i < t->FixedDim.shape; i++) {
+      const xnd_t next_in = xnd_fixed_dim_next(in, i);
+      const xnd_t next_out = xnd_fixed_dim_next(out, i);
+      run_xnd(loop, size, &next_in, &next_out);
+    }
+  }
+}
+
+#define SIMD_KERNEL(fn, FN, type, TYPE, size)                           \
+static int                                                              \
+gm_simd_##fn##_##type(xnd_t stack[], ndt_context_t *ctx)                \
+{                                                                       \
+  (void)ctx;                                                            \
+  run_xnd(simd_loops[SIMD_##FN][SIMD_##TYPE], size, &stack[0], &stack[1]); \
+  return 0;                                                             \
+}                                                                       \
+                                                                        \
+static int                                                              \
+gm_simd_strided_##fn##_##type(char **args, intptr_t *dimensions,        \
+                              intptr_t *steps, void *data)              \
+{                                                                       \
+  (void)data;                                                           \
+  run_strided(simd_loops[SIMD_##FN][SIMD_##TYPE], size,                 \
+              args[0], steps[0], args[1], steps[1], dimensions[0]);     \
+  return 0;                                                             \
+}
+
+#define SIMD_KERNELS(fn, FN) \
+  SIMD_KERNEL(fn, FN, float32, FLOAT32, 4) \
+  SIMD_KERNEL(fn, FN, float64, FLOAT64, 8)
+
+SIMD_KERNELS(sin, SIN)
+SIMD_KERNELS(cos, COS)
+SIMD_KERNELS(exp, EXP)
+SIMD_KERNELS(log, LOG)
+
+#define SIMD_INIT(fn, type) \
+  { .name = #fn, .sig = "... * " #type " -> ... * " #type, \
+    .C = gm_simd_##fn##_##type, .Xnd = gm_simd_##fn##_##type, \
+    .Strided = gm_simd_strided_##fn##_##type }
+
+static const gm_kernel_init_t simd_kernels[] = {
+  SIMD_INIT(sin, float32), SIMD_INIT(sin, float64),
+  SIMD_INIT(cos, float32), SIMD_INIT(cos, float64),
+  SIMD_INIT(exp, float32), SIMD_INIT(exp, float64),
+  SIMD_INIT(log, float32), SIMD_INIT(log, float64),
+  { .name = NULL, .sig = NULL }
+};
+
+int
+rb_gumath_init_simd_kernels(gm_tbl_t *tbl, ndt_context_t *ctx)
+{
+  const gm_kernel_init_t *k;
+
+  select_tier();
+
+  for (k = simd_kernels; k->name != NULL; k++) {
+    if (gm_add_kernel(tbl, k, ctx) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+const char *
+rb_gumath_simd_variant(const char *name)
+{
+  const gm_kernel_init_t *k;
+
+  for (k = simd_kernels; k->name != NULL; k++) {
+    if (strcmp(k->name, name) == 0) {
+      return rb_gumath_cpu_tier_name(rb_gumath_cpu_tier());
+    }
+  }
+
+  return NULL;
+}
+
+#else  /* !SIMD_MATH */
+
+/* Without vector extensions the scalar kernels of libgumath are used. */
+int
+rb_gumath_init_simd_kernels(gm_tbl_t *tbl, ndt_context_t *ctx)
+{
+  (void)tbl;
+  (void)ctx;
+  return 0;
+}
+
+const char *
+rb_gumath_simd_variant(const char *name)
+{
+  (void)name;
+  return NULL;
+}
+
+#endif  /* SIMD_MATH */
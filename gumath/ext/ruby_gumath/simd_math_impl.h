@@ -0,0 +1,358 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+   Vector bodies of the transcendental kernels. This file has no include
+   guard: simd_math.c includes it once per instruction set tier, with
+   SIMD_TIER naming the tier and SIMD_BYTES giving its vector width, inside
+   a region compiled for that tier.
+
+   Only GCC/Clang vector extensions are used. Every lane runs the same
+   branch free code; special inputs are patched with bit selects at the
+   end instead of being tested up front.
+*/
+
+#define SIMD_FN(name) SIMD_CAT(name, SIMD_TIER)
+#define SIMD_LANES (SIMD_BYTES / 8)
+
+#define VD SIMD_FN(vd)
+#define VL SIMD_FN(vl)
+#define VU SIMD_FN(vu)
+
+typedef double VD __attribute__((vector_size(SIMD_BYTES)));
+typedef int64_t VL __attribute__((vector_size(SIMD_BYTES)));
+typedef uint64_t VU __attribute__((vector_size(SIMD_BYTES)));
+
+/* Lanes of a where the mask m is set, lanes of b elsewhere. */
+static inline VD
+SIMD_FN(select)(VL m, VD a, VD b)
+{
+  return (VD)((m & (VL)a) | (~m & (VL)b));
+}
+
+static inline VD
+SIMD_FN(splat)(double c)
+{
+  VD v;
+  int k;
+
+  for (k = 0; k < SIMD_LANES; k++) {
+    v[k] = c;
+  }
+
+  return v;
+}
+
+/* Round to the nearest integer, |x| < 2^51. The integer is also returned
+   in *n. */
+static inline VD
+SIMD_FN(round)(VD x, VL *n)
+{
+  const VD shift = SIMD_FN(splat)(SIMD_ROUND_SHIFT);
+  VD t = x + shift;
+
+  *n = (VL)t - (VL)shift;
+  return t - shift;
+}
+
+/* Integer to double, |n| < 2^51. */
+static inline VD
+SIMD_FN(to_double)(VL n)
+{
+  const VD shift = SIMD_FN(splat)(SIMD_ROUND_SHIFT);
+
+  return (VD)(n + (VL)shift) - shift;
+}
+
+/****************************************************************************/
+/*                                   exp                                    */
+/****************************************************************************/
+
+static inline VD
+SIMD_FN(exp_v)(VD x)
+{
+  VD xc, n, hi, lo, r, z, c, y, s1, s2;
+  VL k, k1, k2;
+
+  xc = SIMD_FN(select)(x > EXP_OVERFLOW, SIMD_FN(splat)(EXP_OVERFLOW), x);
+  xc = SIMD_FN(select)(xc < EXP_UNDERFLOW, SIMD_FN(splat)(EXP_UNDERFLOW), xc);
+
+  n = SIMD_FN(round)(xc * LOG2E, &k);
+  hi = xc - n * LN2_HI;
+  lo = n * LN2_LO;
+  r = hi - lo;
+
+  z = r * r;
+  c = r - z * (EXP_P1 + z * (EXP_P2 + z * (EXP_P3 + z * (EXP_P4 + z * EXP_P5))));
+  y = 1.0 - ((lo - (r * c) / (2.0 - c)) - hi);
+
+  /* 2^k in two factors, so that neither leaves the normal range. */
+  k1 = k >> 1;
+  k2 = k - k1;
+  s1 = (VD)((VU)(k1 + 1023) << 52);
+  s2 = (VD)((VU)(k2 + 1023) << 52);
+
+  return y * s1 * s2;
+}
+
+/****************************************************************************/
+/*                                   log                                    */
+/****************************************************************************/
+
+static inline VD
+SIMD_FN(log_v)(VD x)
+{
+  VD xs, f, dk, s, z, w, t1, t2, hfsq, y;
+  VL hx, sub, k, m, i;
+
+  /* Scale subnormals into the normal range. */
+  sub = x < 0x1p-1022;
+  xs = SIMD_FN(select)(sub, x * 0x1p54, x);
+  hx = (VL)xs;
+
+  /* x = 2^k * (1 + f) with 1 + f in [sqrt(2)/2, sqrt(2)). */
+  k = ((hx >> 52) & 0x7ff) - 1023 - (sub & 54);
+  m = hx & 0x000fffffffffffffLL;
+  i = (m + 0x00095f6400000000LL) & 0x0010000000000000LL;
+  f = (VD)(m | (i ^ 0x3ff0000000000000LL)) - 1.0;
+  k += i >> 52;
+  dk = SIMD_FN(to_double)(k);
+
+  s = f / (2.0 + f);
+  z = s * s;
+  w = z * z;
+  t1 = w * (LOG_LG2 + w * (LOG_LG4 + w * LOG_LG6));
+  t2 = z * (LOG_LG1 + w * (LOG_LG3 + w * (LOG_LG5 + w * LOG_LG7)));
+  hfsq = 0.5 * f * f;
+  y = dk * LN2_HI - ((hfsq - (s * (hfsq + t1 + t2) + dk * LN2_LO)) - f);
+
+  y = SIMD_FN(select)(x == __builtin_inf(), x, y);
+  y = SIMD_FN(select)(x == 0.0, SIMD_FN(splat)(-__builtin_inf()), y);
+  y = SIMD_FN(select)(x < 0.0, SIMD_FN(splat)(__builtin_nan("")), y);
+  y = SIMD_FN(select)(x != x, x, y);
+
+  return y;
+}
+
+/****************************************************************************/
+/*                                 sin, cos                                 */
+/****************************************************************************/
+
+/* x = n * pi/2 + (y0 + y1) with |y0 + y1| <= pi/4, valid for |x| up to
+   TRIG_MAX. The quadrant n is returned in *q. */
+static inline void
+SIMD_FN(rem_pio2)(VD x, VD *y0, VD *y1, VL *q)
+{
+  VD n, r, w, t;
+
+  n = SIMD_FN(round)(x * INV_PIO2, q);
+  r = x - n * PIO2_1;
+
+  t = r;
+  w = n * PIO2_2;
+  r = t - w;
+  w = n * PIO2_2T - ((t - r) - w);
+
+  t = r;
+  w = n * PIO2_3;
+  r = t - w;
+  w = n * PIO2_3T - ((t - r) - w);
+
+  *y0 = r - w;
+  *y1 = (r - *y0) - w;
+}
+
+/* sin(x + y) for |x + y| <= pi/4, y a tail of x. */
+static inline VD
+SIMD_FN(kernel_sin)(VD x, VD y)
+{
+  VD z = x * x;
+  VD w = z * z;
+  VD r = SIN_S2 + z * (SIN_S3 + z * SIN_S4) + z * w * (SIN_S5 + z * SIN_S6);
+  VD v = z * x;
+
+  return x - ((z * (0.5 * y - v * r) - y) - v * SIN_S1);
+}
+
+/* cos(x + y) for |x + y| <= pi/4, y a tail of x. */
+static inline VD
+SIMD_FN(kernel_cos)(VD x, VD y)
+{
+  VD z = x * x;
+  VD w = z * z;
+  VD r = z * (COS_C1 + z * (COS_C2 + z * COS_C3)) + w * w * (COS_C4 + z * (COS_C5 + z * COS_C6));
+  VD hz = 0.5 * z;
+  VD one_hz = 1.0 - hz;
+
+  return one_hz + (((1.0 - one_hz) - hz) + (z * r - x * y));
+}
+
+/* sin(x) for odd == 0, cos(x) for odd == 1: cos(x) = sin(x + pi/2). */
+static inline VD
+SIMD_FN(sincos_v)(VD x, int odd)
+{
+  VD y0, y1, s, c, r;
+  VL q;
+
+  SIMD_FN(rem_pio2)(x, &y0, &y1, &q);
+  q += odd;
+
+  s = SIMD_FN(kernel_sin)(y0, y1);
+  c = SIMD_FN(kernel_cos)(y0, y1);
+  r = SIMD_FN(select)((q & 1) != 0, c, s);
+
+  return (VD)((VU)r ^ ((VU)(q & 2) << 62));
+}
+
+static inline VD
+SIMD_FN(sin_v)(VD x)
+{
+  return SIMD_FN(sincos_v)(x, 0);
+}
+
+static inline VD
+SIMD_FN(cos_v)(VD x)
+{
+  return SIMD_FN(sincos_v)(x, 1);
+}
+
+/****************************************************************************/
+/*                              Array loops                                 */
+/****************************************************************************/
+
+/* Lanes whose sin or cos argument is beyond TRIG_MAX but finite. */
+static inline VL
+SIMD_FN(trig_big)(VD x)
+{
+  VD ax = (VD)((VL)x & 0x7fffffffffffffffLL);
+
+  return (ax > TRIG_MAX) & (ax < __builtin_inf());
+}
+
+static inline int
+SIMD_FN(any)(VL m)
+{
+  int64_t r = 0;
+  int k;
+
+  for (k = 0; k < SIMD_LANES; k++) {
+    r |= m[k];
+  }
+
+  return r != 0;
+}
+
+/* Contiguous loops over n elements; the last partial vector is padded with
+   an input the function handles on the fast path. Finite sin and cos
+   arguments beyond TRIG_MAX are recomputed with libm. dst may be src. */
+#define SIMD_LOOPS(fn, pad, trig, libm)                                 \
+static inline VD                                                        \
+SIMD_FN(fn##_fix)(VD x)                                                 \
+{                                                                       \
+  VD y = SIMD_FN(fn##_v)(x);                                            \
+  VL big;                                                               \
+  int k;                                                                \
+                                                                        \
+  if (trig) {                                                           \
+    big = SIMD_FN(trig_big)(x);                                         \
+    if (SIMD_FN(any)(big)) {                                            \
+      for (k = 0; k < SIMD_LANES; k++) {                                \
+        if (big[k]) {                                                   \
+          y[k] = libm(x[k]);                                            \
+        }                                                               \
+      }                                                                 \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  return y;                                                             \
+}                                                                       \
+                                                                        \
+static void                                                             \
+SIMD_FN(fn##_float64)(const char *src, char *dst, int64_t n)            \
+{                                                                       \
+  int64_t i;                                                            \
+  VD x, y;                                                              \
+                                                                        \
+  for (i = 0; i + SIMD_LANES <= n; i += SIMD_LANES) {                   \
+    memcpy(&x, src + i * 8, sizeof x);                                  \
+    y = SIMD_FN(fn##_fix)(x);                                           \
+    memcpy(dst + i * 8, &y, sizeof y);                                  \
+  }                                                                     \
+                                                                        \
+  if (i < n) {                                                          \
+    x = SIMD_FN(splat)(pad);                                            \
+    memcpy(&x, src + i * 8, (n - i) * 8);                               \
+    y = SIMD_FN(fn##_fix)(x);                                           \
+    memcpy(dst + i * 8, &y, (n - i) * 8);                               \
+  }                                                                     \
+}                                                                       \
+                                                                        \
+static void                                                             \
+SIMD_FN(fn##_float32)(const char *src, char *dst, int64_t n)            \
+{                                                                       \
+  int64_t i, m;                                                         \
+  int k;                                                                \
+  float buf[SIMD_LANES];                                                \
+  VD x, y;                                                              \
+                                                                        \
+  for (i = 0; i < n; i += m) {                                          \
+    m = n - i < SIMD_LANES ? n - i : SIMD_LANES;                        \
+    memcpy(buf, src + i * 4, m * 4);                                    \
+    x = SIMD_FN(splat)(pad);                                            \
+    for (k = 0; k < m; k++) {                                           \
+      x[k] = buf[k];                                                    \
+    }                                                                   \
+    y = SIMD_FN(fn##_fix)(x);                                           \
+    for (k = 0; k < m; k++) {                                           \
+      buf[k] = (float)y[k];                                             \
+    }                                                                   \
+    memcpy(dst + i * 4, buf, m * 4);                                    \
+  }                                                                     \
+}
+
+SIMD_LOOPS(sin, 0.0, 1, sin)
+SIMD_LOOPS(cos, 0.0, 1, cos)
+SIMD_LOOPS(exp, 0.0, 0, exp)
+SIMD_LOOPS(log, 1.0, 0, log)
+
+static const simd_loop_t SIMD_FN(loops)[SIMD_NFUNCS][SIMD_NTYPES] = {
+  [SIMD_SIN] = { SIMD_FN(sin_float32), SIMD_FN(sin_float64) },
+  [SIMD_COS] = { SIMD_FN(cos_float32), SIMD_FN(cos_float64) },
+  [SIMD_EXP] = { SIMD_FN(exp_float32), SIMD_FN(exp_float64) },
+  [SIMD_LOG] = { SIMD_FN(log_float32), SIMD_FN(log_float64) },
+};
+
+#undef SIMD_LOOPS
+#undef VU
+#undef VL
+#undef VD
+#undef SIMD_LANES
+#undef SIMD_FN
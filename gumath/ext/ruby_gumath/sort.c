@@ -0,0 +1,756 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+   Sorting kernels: sort and argsort along the innermost dimension.
+
+   Every supported dtype is first mapped to unsigned 64-bit keys whose
+   unsigned order matches the numeric order of the values (sign bit flipped
+   for signed integers, IEEE bit pattern folding for floats). Long rows are
+   then sorted with an LSD radix sort that skips byte positions on which all
+   keys agree, short rows with a pattern-defeating quicksort. Very long rows
+   are cut into chunks that are radix sorted on the worker pool and merged
+   pairwise. All paths are stable, so argsort returns the first occurrence of
+   equal values first. NaNs sort last.
+*/
+
+#include "ruby_gumath_internal.h"
+#include "sort.h"
+
+#include "thread_pool.h"
+
+/* Rows shorter than this are sorted by comparison. */
+#define SORT_RADIX_CUTOFF 256
+
+/* Rows at least this long are sorted in parallel chunks. */
+#define SORT_PARALLEL_CUTOFF (1 << 20)
+
+/* pdqsort parameters. */
+#define PDQ_INSERTION_CUTOFF 24
+#define PDQ_NINTHER_CUTOFF 128
+#define PDQ_PARTIAL_INSERTION_LIMIT 8
+
+#define SIGN_BIT_64 0x8000000000000000ULL
+#define CANONICAL_NAN 0x7ff8000000000000ULL
+
+typedef struct {
+  uint64_t key;
+  int64_t idx;
+} sort_pair_t;
+
+/****************************************************************************/
+/*                              Key encoding                                */
+/****************************************************************************/
+
+static inline uint64_t
+encode_signed(int64_t v)
+{
+  return (uint64_t)v ^ SIGN_BIT_64;
+}
+
+static inline int64_t
+decode_signed(uint64_t k)
+{
+  return (int64_t)(k ^ SIGN_BIT_64);
+}
+
+static inline uint64_t
+encode_double(double d)
+{
+  uint64_t bits;
+
+  if (isnan(d)) {
+    return CANONICAL_NAN | SIGN_BIT_64;
+  }
+
+  memcpy(&bits, &d, sizeof bits);
+  return (bits & SIGN_BIT_64) ? ~bits : bits | SIGN_BIT_64;
+}
+
+static inline double
+decode_double(uint64_t k)
+{
+  uint64_t bits = (k & SIGN_BIT_64) ? k & ~SIGN_BIT_64 : ~k;
+  double d;
+
+  memcpy(&d, &bits, sizeof d);
+  return d;
+}
+
+/* Base address and element stride (in bytes) of a one dimensional view. */
+static inline void
+row_layout(const xnd_t *x, char **base, int64_t *stride)
+{
+  const ndt_t *t = x->type;
+  const int64_t itemsize = t->FixedDim.type->datasize;
+
+  *base = x->ptr + x->index * itemsize;
+  *stride = t->Concrete.FixedDim.step * itemsize;
+}
+
+#define SORT_LOAD_STORE(name, type, encode, decode)                     \
+static void                                                             \
+load_keys_##name(uint64_t *keys, const char *p, int64_t stride, int64_t n) \
+{                                                                       \
+  int64_t i;                                                            \
+  for (i = 0; i < n; i++, p += stride) {                                \
+    type v;                                                             \
+    memcpy(&v, p, sizeof v);                                            \
+    keys[i] = encode(v);                                                \
+  }                                                                     \
+}                                                                       \
+                                                                        \
+static void                                                             \
+store_keys_##name(char *p, int64_t stride, const uint64_t *keys, int64_t n) \
+{                                                                       \
+  int64_t i;                                                            \
+  for (i = 0; i < n; i++, p += stride) {                                \
+    type v = (type)decode(keys[i]);                                     \
+    memcpy(p, &v, sizeof v);                                            \
+  }                                                                     \
+}
+
+#define IDENTITY(k) (k)
+
+SORT_LOAD_STORE(int8, int8_t, encode_signed, decode_signed)
+SORT_LOAD_STORE(int16, int16_t, encode_signed, decode_signed)
+SORT_LOAD_STORE(int32, int32_t, encode_signed, decode_signed)
+SORT_LOAD_STORE(int64, int64_t, encode_signed, decode_signed)
+SORT_LOAD_STORE(uint8, uint8_t, IDENTITY, IDENTITY)
+SORT_LOAD_STORE(uint16, uint16_t, IDENTITY, IDENTITY)
+SORT_LOAD_STORE(uint32, uint32_t, IDENTITY, IDENTITY)
+SORT_LOAD_STORE(uint64, uint64_t, IDENTITY, IDENTITY)
+SORT_LOAD_STORE(float32, float, encode_double, decode_double)
+SORT_LOAD_STORE(float64, double, encode_double, decode_double)
+
+typedef void (*load_keys_t)(uint64_t *, const char *, int64_t, int64_t);
+typedef void (*store_keys_t)(char *, int64_t, const uint64_t *, int64_t);
+
+/****************************************************************************/
+/*                                Radix sort                                */
+/****************************************************************************/
+
+/* Stable LSD radix sort of keys (and idx, if not NULL) using the scratch
+   buffers of the same length. Returns 1 if the result ended up in the
+   scratch buffers, 0 if it is in keys/idx. */
+static int
+radix_sort(uint64_t *keys, int64_t *idx, uint64_t *tmp_keys, int64_t *tmp_idx,
+           int64_t n)
+{
+  int64_t count[8][256];
+  uint64_t *src = keys, *dst = tmp_keys;
+  int64_t *isrc = idx, *idst = tmp_idx;
+  int64_t i;
+  int pass, swapped = 0;
+
+  memset(count, 0, sizeof count);
+  for (i = 0; i < n; i++) {
+    const uint64_t k = keys[i];
+    for (pass = 0; pass < 8; pass++) {
+      count[pass][(k >> (8*pass)) & 0xff]++;
+    }
+  }
+
+  for (pass = 0; pass < 8; pass++) {
+    const int shift = 8 * pass;
+    int64_t offset[256];
+    int64_t sum = 0;
+    int b;
+
+    /* Every key has the same byte here: the pass would be a plain copy. */
+    if (count[pass][(keys[0] >> shift) & 0xff] == n) {
+      continue;
+    }
+
+    for (b = 0; b < 256; b++) {
+      offset[b] = sum;
+      sum += count[pass][b];
+    }
+
+    if (isrc != NULL) {
+      for (i = 0; i < n; i++) {
+        const int64_t j = offset[(src[i] >> shift) & 0xff]++;
+        dst[j] = src[i];
+        idst[j] = isrc[i];
+      }
+    }
+    else {
+      for (i = 0; i < n; i++) {
+        dst[offset[(src[i] >> shift) & 0xff]++] = src[i];
+      }
+    }
+
+    { uint64_t *t = src; src = dst; dst = t; }
+    { int64_t *t = isrc; isrc = idst; idst = t; }
+    swapped = !swapped;
+  }
+
+  return swapped;
+}
+
+/****************************************************************************/
+/*                        Pattern-defeating quicksort                       */
+/****************************************************************************/
+
+/* Generates a pdqsort over an array of T ordered by LESS. Without the block
+   partitioning of the original algorithm, which only pays off for
+   expensive comparisons. */
+#define PDQSORT_DEFINE(name, T, LESS)                                   \
+static void                                                             \
+name##_insertion(T *a, int64_t n)                                       \
+{                                                                       \
+  int64_t i, j;                                                         \
+  for (i = 1; i < n; i++) {                                             \
+    T v = a[i];                                                         \
+    for (j = i; j > 0 && LESS(v, a[j-1]); j--) {                        \
+      a[j] = a[j-1];                                                    \
+    }                                                                   \
+    a[j] = v;                                                           \
+  }                                                                     \
+}                                                                       \
+                                                                        \
+/* Insertion sort that gives up after a few moves. */                   \
+static int                                                              \
+name##_partial_insertion(T *a, int64_t n)                               \
+{                                                                       \
+  int64_t i, j, moves = 0;                                              \
+  for (i = 1; i < n; i++) {                                             \
+    T v = a[i];                                                         \
+    for (j = i; j > 0 && LESS(v, a[j-1]); j--) {                        \
+      a[j] = a[j-1];                                                    \
+    }                                                                   \
+    a[j] = v;                                                           \
+    moves += i - j;                                                     \
+    if (moves > PDQ_PARTIAL_INSERTION_LIMIT) {                          \
+      return 0;                                                         \
+    }                                                                   \
+  }                                                                     \
+  return 1;                                                             \
+}                                                                       \
+                                                                        \
+static void                                                             \
+name##_sift_down(T *a, int64_t start, int64_t n)                        \
+{                                                                       \
+  int64_t root = start;                                                 \
+  while (2*root + 1 < n) {                                              \
+    int64_t child = 2*root + 1;                                         \
+    T t;                                                                \
+    if (child + 1 < n && LESS(a[child], a[child+1])) {                  \
+      child++;                                                          \
+    }                                                                   \
+    if (!LESS(a[root], a[child])) {                                     \
+      return;                                                           \
+    }                                                                   \
+    t = a[root]; a[root] = a[child]; a[child] = t;                      \
+    root = child;                                                       \
+  }                                                                     \
+}                                                                       \
+                                                                        \
+static void                                                             \
+name##_heapsort(T *a, int64_t n)                                        \
+{                                                                       \
+  int64_t i;                                                            \
+  for (i = n/2 - 1; i >= 0; i--) {                                      \
+    name##_sift_down(a, i, n);                                          \
+  }                                                                     \
+  for (i = n - 1; i > 0; i--) {                                         \
+    T t = a[0]; a[0] = a[i]; a[i] = t;                                  \
+    name##_sift_down(a, 0, i);                                          \
+  }                                                                     \
+}                                                                       \
+                                                                        \
+static inline void                                                      \
+name##_sort2(T *a, int64_t i, int64_t j)                                \
+{                                                                       \
+  if (LESS(a[j], a[i])) {                                               \
+    T t = a[i]; a[i] = a[j]; a[j] = t;                                  \
+  }                                                                     \
+}                                                                       \
+                                                                        \
+static inline void                                                      \
+name##_sort3(T *a, int64_t i, int64_t j, int64_t k)                     \
+{                                                                       \
+  name##_sort2(a, i, j);                                                \
+  name##_sort2(a, j, k);                                                \
+  name##_sort2(a, i, j);                                                \
+}                                                                       \
+                                                                        \
+/* Partition a[1..n) around the pivot in a[0]. Returns the final pivot    \
+   position and whether the range was already partitioned. */           \
+static int64_t                                                          \
+name##_partition(T *a, int64_t n, int *no_swaps)                        \
+{                                                                       \
+  const T pivot = a[0];                                                 \
+  int64_t i = 0, j = n;                                                 \
+  T t;                                                                  \
+                                                                        \
+  while ((++i, LESS(a[i], pivot)));                                     \
+  if (i == 1) {                                                         \
+    while (i < j && (--j, !LESS(a[j], pivot)));                         \
+  }                                                                     \
+  else {                                                                \
+    while ((--j, !LESS(a[j], pivot)));                                  \
+  }                                                                     \
+                                                                        \
+  *no_swaps = i >= j;                                                   \
+  while (i < j) {                                                       \
+    t = a[i]; a[i] = a[j]; a[j] = t;                                    \
+    while ((++i, LESS(a[i], pivot)));                                   \
+    while ((--j, !LESS(a[j], pivot)));                                  \
+  }                                                                     \
+                                                                        \
+  a[0] = a[i-1];                                                        \
+  a[i-1] = pivot;                                                       \
+  return i - 1;                                                         \
+}                                                                       \
+                                                                        \
+static void                                                             \
+name##_loop(T *a, int64_t n, int bad_allowed, int leftmost)             \
+{                                                                       \
+  while (n > PDQ_INSERTION_CUTOFF) {                                    \
+    const int64_t half = n / 2;                                         \
+    int64_t p, l_size, r_size;                                          \
+    int no_swaps;                                                       \
+                                                                        \
+    if (n > PDQ_NINTHER_CUTOFF) {                                       \
+      name##_sort3(a, 0, half, n-1);                                    \
+      name##_sort3(a, 1, half-1, n-2);                                  \
+      name##_sort3(a, 2, half+1, n-3);                                  \
+      name##_sort3(a, half-1, half, half+1);                            \
+      { T t = a[0]; a[0] = a[half]; a[half] = t; }                      \
+    }                                                                   \
+    else {                                                              \
+      name##_sort3(a, half, 0, n-1);                                    \
+    }                                                                   \
+                                                                        \
+    /* Many equal elements: put everything equal to the pivot left. */  \
+    if (!leftmost && !LESS(a[-1], a[0])) {                              \
+      const T pivot = a[0];                                             \
+      int64_t i = 0, j = n;                                             \
+      while ((--j, LESS(pivot, a[j])));                                 \
+      if (j == n - 1) {                                                 \
+        while (i < j && (++i, !LESS(pivot, a[i])));                     \
+      }                                                                 \
+      else {                                                            \
+        while ((++i, !LESS(pivot, a[i])));                              \
+      }                                                                 \
+      while (i < j) {                                                   \
+        T t = a[i]; a[i] = a[j]; a[j] = t;                              \
+        while ((--j, LESS(pivot, a[j])));                               \
+        while ((++i, !LESS(pivot, a[i])));                              \
+      }                                                                 \
+      a[0] = a[j];                                                      \
+      a[j] = pivot;                                                     \
+      a += j + 1;                                                       \
+      n -= j + 1;                                                       \
+      continue;                                                         \
+    }                                                                   \
+                                                                        \
+    p = name##_partition(a, n, &no_swaps);                              \
+    l_size = p;                                                         \
+    r_size = n - p - 1;                                                 \
+                                                                        \
+    if (l_size < n / 8 || r_size < n / 8) {                             \
+      if (--bad_allowed == 0) {                                         \
+        name##_heapsort(a, n);                                          \
+        return;                                                         \
+      }                                                                 \
+      /* Break up the pattern that produced the bad pivot. */           \
+      if (l_size >= PDQ_INSERTION_CUTOFF) {                             \
+        T t;                                                            \
+        t = a[0]; a[0] = a[l_size/4]; a[l_size/4] = t;                  \
+        t = a[p-1]; a[p-1] = a[p - l_size/4]; a[p - l_size/4] = t;     \
+      }                                                                 \
+      if (r_size >= PDQ_INSERTION_CUTOFF) {                             \
+        T t;                                                            \
+        t = a[p+1]; a[p+1] = a[p+1 + r_size/4]; a[p+1 + r_size/4] = t;  \
+        t = a[n-1]; a[n-1] = a[n - r_size/4]; a[n - r_size/4] = t;      \
+      }                                                                 \
+    }                                                                   \
+    else if (no_swaps &&                                                \
+             name##_partial_insertion(a, p) &&                          \
+             name##_partial_insertion(a + p + 1, r_size)) {             \
+      return;                                                           \
+    }                                                                   \
+                                                                        \
+    /* Recurse into the smaller side, loop on the larger one. */        \
+    if (l_size < r_size) {                                              \
+      name##_loop(a, l_size, bad_allowed, leftmost);                    \
+      a += p + 1;                                                       \
+      n = r_size;                                                       \
+      leftmost = 0;                                                     \
+    }                                                                   \
+    else {                                                              \
+      name##_loop(a + p + 1, r_size, bad_allowed, 0);                   \
+      n = l_size;                                                       \
+    }                                                                   \
+  }                                                                     \
+                                                                        \
+  name##_insertion(a, n);                                               \
+}                                                                       \
+                                                                        \
+static void                                                             \
+name(T *a, int64_t n)                                                   \
+{                                                                       \
+  int bad_allowed = 1;                                                  \
+  int64_t m = n;                                                        \
+  while (m >>= 1) {                                                     \
+    bad_allowed++;                                                      \
+  }                                                                     \
+  name##_loop(a, n, bad_allowed, 1);                                    \
+}
+
+#define KEY_LESS(a, b) ((a) < (b))
+#define PAIR_LESS(a, b) ((a).key < (b).key || ((a).key == (b).key && (a).idx < (b).idx))
+
+PDQSORT_DEFINE(pdqsort_keys, uint64_t, KEY_LESS)
+PDQSORT_DEFINE(pdqsort_pairs, sort_pair_t, PAIR_LESS)
+
+/****************************************************************************/
+/*                              Parallel merge                              */
+/****************************************************************************/
+
+/* Stable merge of src[lo,mid) and src[mid,hi) into dst[lo,hi). */
+static void
+merge_runs(const uint64_t *src, const int64_t *isrc, uint64_t *dst, int64_t *idst,
+           int64_t lo, int64_t mid, int64_t hi)
+{
+  int64_t i = lo, j = mid, k = lo;
+
+  while (i < mid && j < hi) {
+    if (src[j] < src[i]) {
+      if (idst) idst[k] = isrc[j];
+      dst[k++] = src[j++];
+    }
+    else {
+      if (idst) idst[k] = isrc[i];
+      dst[k++] = src[i++];
+    }
+  }
+  for (; i < mid; i++, k++) {
+    if (idst) idst[k] = isrc[i];
+    dst[k] = src[i];
+  }
+  for (; j < hi; j++, k++) {
+    if (idst) idst[k] = isrc[j];
+    dst[k] = src[j];
+  }
+}
+
+typedef struct {
+  uint64_t *keys, *tmp_keys;
+  int64_t *idx, *tmp_idx;
+  int64_t lo, mid, hi;
+  int in_tmp;               /* result of the chunk sort lives in tmp */
+  int merge;                /* 0: sort chunk, 1: merge two runs */
+} sort_task_t;
+
+static int
+sort_task(void *job, int64_t i, ndt_context_t *ctx)
+{
+  sort_task_t *t = (sort_task_t *)job + i;
+  const int64_t lo = t->lo;
+
+  (void)ctx;
+
+  if (t->merge) {
+    merge_runs(t->keys, t->idx, t->tmp_keys, t->tmp_idx, lo, t->mid, t->hi);
+  }
+  else {
+    t->in_tmp = radix_sort(t->keys + lo, t->idx ? t->idx + lo : NULL,
+                           t->tmp_keys + lo, t->tmp_idx ? t->tmp_idx + lo : NULL,
+                           t->hi - lo);
+  }
+
+  return 0;
+}
+
+/* Radix sort nchunks chunks on the worker pool, then merge pairs of runs
+   level by level. Returns 1 if the result is in the scratch buffers, 0 if
+   it is in keys/idx. */
+static int
+parallel_sort(uint64_t *keys, int64_t *idx, uint64_t *tmp_keys, int64_t *tmp_idx,
+              int64_t n, int nchunks)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  sort_task_t task[nchunks];
+  int64_t bound[nchunks+1];
+  uint64_t *src = keys, *dst = tmp_keys;
+  int64_t *isrc = idx, *idst = tmp_idx;
+  int nruns = nchunks, swapped = 0;
+  int i;
+
+  for (i = 0; i <= nchunks; i++) {
+    bound[i] = n * i / nchunks;
+  }
+
+  /* The tasks cannot fail. */
+  for (i = 0; i < nchunks; i++) {
+    task[i] = (sort_task_t){ keys, tmp_keys, idx, tmp_idx,
+                             bound[i], 0, bound[i+1], 0, 0 };
+  }
+  rb_gumath_pool_run(nchunks, nchunks, sort_task, task, &ctx);
+
+  /* Bring all chunks into keys/idx so that the merge levels can ping-pong. */
+  for (i = 0; i < nchunks; i++) {
+    if (task[i].in_tmp) {
+      const int64_t lo = bound[i], len = bound[i+1] - bound[i];
+      memcpy(keys + lo, tmp_keys + lo, len * sizeof *keys);
+      if (idx) {
+        memcpy(idx + lo, tmp_idx + lo, len * sizeof *idx);
+      }
+    }
+  }
+
+  while (nruns > 1) {
+    int npairs = nruns / 2;
+    int j = 0;
+
+    for (i = 0; i < npairs; i++) {
+      task[i] = (sort_task_t){ src, dst, isrc, idst,
+                               bound[2*i], bound[2*i+1], bound[2*i+2], 0, 1 };
+    }
+    rb_gumath_pool_run(npairs, npairs, sort_task, task, &ctx);
+
+    /* Odd run out is copied through unchanged. */
+    if (nruns % 2) {
+      const int64_t lo = bound[nruns-1], len = bound[nruns] - lo;
+      memcpy(dst + lo, src + lo, len * sizeof *dst);
+      if (isrc) {
+        memcpy(idst + lo, isrc + lo, len * sizeof *idst);
+      }
+    }
+
+    for (i = 0; i <= nruns; i += 2) {
+      bound[j++] = bound[i];
+    }
+    if (nruns % 2 == 0) {
+      bound[j-1] = n;
+    }
+    else {
+      bound[j++] = n;
+    }
+    nruns = j - 1;
+
+    { uint64_t *t = src; src = dst; dst = t; }
+    { int64_t *t = isrc; isrc = idst; idst = t; }
+    swapped = !swapped;
+  }
+
+  return swapped;
+}
+
+/****************************************************************************/
+/*                                  Driver                                  */
+/****************************************************************************/
+
+/* Sort keys[0..n) (carrying idx along if not NULL). Returns a pointer to the
+   sorted keys, which may be tmp_keys; *sorted_idx receives the matching
+   index array. */
+static const uint64_t *
+sort_keys(uint64_t *keys, int64_t *idx, uint64_t *tmp_keys, int64_t *tmp_idx,
+          int64_t n, const int64_t **sorted_idx)
+{
+  int in_tmp = 0;
+
+  if (n < SORT_RADIX_CUTOFF) {
+    if (idx != NULL) {
+      sort_pair_t *pairs = (sort_pair_t *)tmp_keys;
+      int64_t i;
+
+      /* tmp_keys and tmp_idx are allocated back to back. */
+      for (i = 0; i < n; i++) {
+        pairs[i].key = keys[i];
+        pairs[i].idx = idx[i];
+      }
+      pdqsort_pairs(pairs, n);
+      for (i = n-1; i >= 0; i--) {
+        const sort_pair_t p = pairs[i];
+        keys[i] = p.key;
+        idx[i] = p.idx;
+      }
+    }
+    else {
+      pdqsort_keys(keys, n);
+    }
+    *sorted_idx = idx;
+    return keys;
+  }
+
+  if (n >= SORT_PARALLEL_CUTOFF) {
+    int64_t nthreads = rb_gumath_kernel_threads;
+    if (nthreads > n / (SORT_PARALLEL_CUTOFF / 4)) {
+      nthreads = n / (SORT_PARALLEL_CUTOFF / 4);
+    }
+    if (nthreads > 64) {
+      nthreads = 64;
+    }
+    if (nthreads > 1) {
+      in_tmp = parallel_sort(keys, idx, tmp_keys, tmp_idx, n, (int)nthreads);
+      *sorted_idx = in_tmp ? tmp_idx : idx;
+      return in_tmp ? tmp_keys : keys;
+    }
+  }
+
+  in_tmp = radix_sort(keys, idx, tmp_keys, tmp_idx, n);
+
+  *sorted_idx = in_tmp ? tmp_idx : idx;
+  return in_tmp ? tmp_keys : keys;
+}
+
+static int
+sort_dispatch(const ndt_t *dtype, load_keys_t *load, store_keys_t *store)
+{
+  switch (dtype->tag) {
+  case Int8: *load = load_keys_int8; *store = store_keys_int8; return 0;
+  case Int16: *load = load_keys_int16; *store = store_keys_int16; return 0;
+  case Int32: *load = load_keys_int32; *store = store_keys_int32; return 0;
+  case Int64: *load = load_keys_int64; *store = store_keys_int64; return 0;
+  case Uint8: *load = load_keys_uint8; *store = store_keys_uint8; return 0;
+  case Uint16: *load = load_keys_uint16; *store = store_keys_uint16; return 0;
+  case Uint32: *load = load_keys_uint32; *store = store_keys_uint32; return 0;
+  case Uint64: *load = load_keys_uint64; *store = store_keys_uint64; return 0;
+  case Float32: *load = load_keys_float32; *store = store_keys_float32; return 0;
+  case Float64: *load = load_keys_float64; *store = store_keys_float64; return 0;
+  default: return -1;
+  }
+}
+
+/* Common body of the sort and argsort kernels. */
+static int
+sort_row(xnd_t stack[], int arg, ndt_context_t *ctx)
+{
+  const xnd_t *in = &stack[0];
+  const xnd_t *out = &stack[1];
+  const int64_t n = in->type->FixedDim.shape;
+  load_keys_t load;
+  store_keys_t store;
+  const uint64_t *sorted;
+  const int64_t *sorted_idx;
+  uint64_t *keys, *tmp_keys;
+  int64_t *idx = NULL, *tmp_idx = NULL;
+  char *src, *dst;
+  int64_t src_stride, dst_stride;
+  int64_t i;
+  char *buf;
+
+  if (n == 0) {
+    return 0;
+  }
+
+  if (sort_dispatch(in->type->FixedDim.type, &load, &store) < 0) {
+    ndt_err_format(ctx, NDT_NotImplementedError, "sort: unsupported dtype");
+    return -1;
+  }
+
+  /* keys, tmp_keys and (for argsort) idx, tmp_idx in one block. The pair
+     buffer of the comparison path overlays tmp_keys and tmp_idx. */
+  buf = ndt_alloc(arg ? 4 : 2, n * sizeof(uint64_t));
+  if (buf == NULL) {
+    (void)ndt_memory_error(ctx);
+    return -1;
+  }
+  keys = (uint64_t *)buf;
+  tmp_keys = keys + n;
+  if (arg) {
+    tmp_idx = (int64_t *)(tmp_keys + n);
+    idx = tmp_idx + n;
+    for (i = 0; i < n; i++) {
+      idx[i] = i;
+    }
+  }
+
+  row_layout(in, &src, &src_stride);
+  row_layout(out, &dst, &dst_stride);
+
+  load(keys, src, src_stride, n);
+  sorted = sort_keys(keys, idx, tmp_keys, tmp_idx, n, &sorted_idx);
+
+  if (arg) {
+    for (i = 0; i < n; i++, dst += dst_stride) {
+      memcpy(dst, &sorted_idx[i], sizeof(int64_t));
+    }
+  }
+  else {
+    store(dst, dst_stride, sorted, n);
+  }
+
+  ndt_free(buf);
+  return 0;
+}
+
+static int
+gm_sort(xnd_t stack[], ndt_context_t *ctx)
+{
+  return sort_row(stack, 0, ctx);
+}
+
+static int
+gm_argsort(xnd_t stack[], ndt_context_t *ctx)
+{
+  return sort_row(stack, 1, ctx);
+}
+
+/****************************************************************************/
+/*                                  Kernels                                 */
+/****************************************************************************/
+
+#define SORT_KERNELS(type) \
+  { .name = "sort", .sig = "... * N * " #type " -> ... * N * " #type, .Xnd = gm_sort }, \
+  { .name = "argsort", .sig = "... * N * " #type " -> ... * N * int64", .Xnd = gm_argsort }
+
+static const gm_kernel_init_t sort_kernels[] = {
+  SORT_KERNELS(int8),
+  SORT_KERNELS(int16),
+  SORT_KERNELS(int32),
+  SORT_KERNELS(int64),
+  SORT_KERNELS(uint8),
+  SORT_KERNELS(uint16),
+  SORT_KERNELS(uint32),
+  SORT_KERNELS(uint64),
+  SORT_KERNELS(float32),
+  SORT_KERNELS(float64),
+  { .name = NULL, .sig = NULL }
+};
+
+int
+rb_gumath_init_sort_kernels(gm_tbl_t *tbl, ndt_context_t *ctx)
+{
+  const gm_kernel_init_t *k;
+
+  for (k = sort_kernels; k->name != NULL; k++) {
+    if (gm_add_kernel(tbl, k, ctx) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,446 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+   Persistent worker pool.
+
+   Workers are started on first use and then wait on a condition variable for
+   jobs. A job is a range of task numbers that is split evenly into one queue
+   per participating thread. A thread takes tasks from the front of its own
+   queue; once that is empty it steals the back half of another queue, so
+   rows of uneven cost still keep every thread busy until the end. The
+   calling thread takes part as thread 0 and waits for the workers to leave
+   the job before returning.
+
+   Only one job runs at a time. A caller that finds the pool busy, which
+   includes kernels started from inside a pool task, runs its tasks inline.
+   After fork() the child starts with an empty pool, since the workers do
+   not exist there.
+*/
+
+#include "ruby_gumath_internal.h"
+#include "thread_pool.h"
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+
+/****************************************************************************/
+/*                                Inline run                                */
+/****************************************************************************/
+
+static int
+run_inline(int64_t ntasks, rb_gumath_pool_task_t task, void *job, ndt_context_t *ctx)
+{
+  int64_t i;
+
+  for (i = 0; i < ntasks; i++) {
+    if (task(job, i, ctx) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+#ifndef HAVE_PTHREAD_H
+void
+rb_gumath_pool_init(void)
+{
+}
+
+int
+rb_gumath_pool_run(int64_t nthreads, int64_t ntasks, rb_gumath_pool_task_t task,
+                   void *job, ndt_context_t *ctx)
+{
+  return run_inline(ntasks, task, job, ctx);
+}
+
+void
+rb_gumath_pool_resize(int64_t nthreads)
+{
+}
+#else
+
+/****************************************************************************/
+/*                                   Jobs                                   */
+/****************************************************************************/
+
+typedef struct {
+  pthread_mutex_t lock;
+  int64_t lo;                 /* next task to take */
+  int64_t hi;                 /* end of the queue */
+} pool_queue_t;
+
+typedef struct {
+  rb_gumath_pool_task_t task;
+  void *job;
+  int nthreads;               /* participants, including the caller */
+  volatile int failed;
+  pthread_mutex_t error_lock;
+  ndt_context_t ctx;          /* context of the first failing task */
+  pool_queue_t queue[GM_POOL_MAX_THREADS];
+} pool_job_t;
+
+static int64_t
+take_task(pool_job_t *j, int self)
+{
+  pool_queue_t *q = &j->queue[self];
+  int64_t i = -1;
+
+  pthread_mutex_lock(&q->lock);
+  if (q->lo < q->hi) {
+    i = q->lo++;
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  return i;
+}
+
+/* Move the back half of the first non-empty queue after self's to self's
+   queue and return its first task, or -1 if there is nothing left. */
+static int64_t
+steal_task(pool_job_t *j, int self)
+{
+  int64_t lo = -1, hi = -1;
+  int k;
+
+  for (k = 1; k < j->nthreads && lo < 0; k++) {
+    pool_queue_t *q = &j->queue[(self + k) % j->nthreads];
+
+    pthread_mutex_lock(&q->lock);
+    if (q->lo < q->hi) {
+      lo = q->lo + (q->hi - q->lo) / 2;
+      hi = q->hi;
+      q->hi = lo;
+    }
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  if (lo < 0) {
+    return -1;
+  }
+
+  if (hi - lo > 1) {
+    pool_queue_t *q = &j->queue[self];
+    pthread_mutex_lock(&q->lock);
+    q->lo = lo + 1;
+    q->hi = hi;
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  return lo;
+}
+
+static void
+run_job(pool_job_t *j, int self)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  int64_t i;
+
+  for (;;) {
+    i = take_task(j, self);
+    if (i < 0) {
+      i = steal_task(j, self);
+      if (i < 0) {
+        return;
+      }
+    }
+
+    if (j->failed) {
+      continue;
+    }
+
+    if (j->task(j->job, i, &ctx) < 0) {
+      pthread_mutex_lock(&j->error_lock);
+      if (!j->failed) {
+        j->ctx = ctx;
+        j->failed = 1;
+      }
+      else {
+        ndt_context_del(&ctx);
+      }
+      pthread_mutex_unlock(&j->error_lock);
+      ctx = (ndt_context_t){ .err = NDT_Success, .msg = ConstMsg, .ConstMsg = "Success" };
+    }
+  }
+}
+
+
+/****************************************************************************/
+/*                                  Workers                                 */
+/****************************************************************************/
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work;        /* a job was posted or the limit changed */
+  pthread_cond_t done;        /* the last worker left the job */
+  pthread_t thread[GM_POOL_MAX_THREADS];
+  int nworkers;               /* started workers */
+  int limit;                  /* workers with an id >= limit exit when idle */
+  int resizing;               /* workers above the limit are being joined */
+  int busy;                   /* a caller owns the pool */
+  int active;                 /* workers still inside the current job */
+  uint64_t generation;        /* bumped for every job */
+  pool_job_t *job;
+} pool = {
+  PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
+/* Worker number id takes part in the job as thread id+1. A job posted
+   before the limit was lowered still counts on its workers, so a worker
+   leaves only once it has seen the current job. */
+static void *
+worker(void *arg)
+{
+  const int id = (int)(intptr_t)arg;
+  uint64_t seen = 0;          /* workers are only started between jobs */
+  pool_job_t *j;
+
+  pthread_mutex_lock(&pool.lock);
+
+  for (;;) {
+    while (id < pool.limit && (pool.job == NULL || pool.generation == seen)) {
+      pthread_cond_wait(&pool.work, &pool.lock);
+    }
+    if (pool.job == NULL || pool.generation == seen) {
+      break;
+    }
+
+    seen = pool.generation;
+    j = pool.job;
+    if (id + 1 >= j->nthreads) {
+      continue;
+    }
+
+    pthread_mutex_unlock(&pool.lock);
+    run_job(j, id + 1);
+    pthread_mutex_lock(&pool.lock);
+
+    if (--pool.active == 0) {
+      pthread_cond_signal(&pool.done);
+    }
+  }
+
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
+
+/* Start workers until there are n of them. Called with pool.lock held and
+   no job running. */
+static void
+start_workers(int n)
+{
+  if (pool.resizing) {
+    return;
+  }
+
+  pool.limit = GM_POOL_MAX_THREADS;
+  while (pool.nworkers < n) {
+    if (pthread_create(&pool.thread[pool.nworkers], NULL, worker,
+                       (void *)(intptr_t)pool.nworkers) != 0) {
+      break;
+    }
+    pool.nworkers++;
+  }
+}
+
+/* Stop workers with an id >= n and wait for them. Called without the lock;
+   workers busy with a job leave after it. */
+static void
+stop_workers(int n)
+{
+  int i, nworkers;
+
+  pthread_mutex_lock(&pool.lock);
+  if (pool.resizing || n >= pool.nworkers) {
+    pthread_mutex_unlock(&pool.lock);
+    return;
+  }
+  pool.limit = n;
+  pool.resizing = 1;
+  nworkers = pool.nworkers;
+  pthread_cond_broadcast(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (i = n; i < nworkers; i++) {
+    pthread_join(pool.thread[i], NULL);
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  pool.nworkers = n;
+  pool.resizing = 0;
+  pthread_mutex_unlock(&pool.lock);
+}
+
+
+/****************************************************************************/
+/*                                    API                                   */
+/****************************************************************************/
+
+int
+rb_gumath_pool_run(int64_t nthreads, int64_t ntasks, rb_gumath_pool_task_t task,
+                   void *job, ndt_context_t *ctx)
+{
+  pool_job_t j;
+  int64_t i, n;
+
+  if (nthreads > GM_POOL_MAX_THREADS) {
+    nthreads = GM_POOL_MAX_THREADS;
+  }
+  if (nthreads > ntasks) {
+    nthreads = ntasks;
+  }
+  if (nthreads <= 1) {
+    return run_inline(ntasks, task, job, ctx);
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  if (pool.busy) {
+    pthread_mutex_unlock(&pool.lock);
+    return run_inline(ntasks, task, job, ctx);
+  }
+  if (pool.nworkers < nthreads - 1) {
+    start_workers((int)nthreads - 1);
+  }
+  n = (pool.nworkers < pool.limit ? pool.nworkers : pool.limit) + 1;
+  if (n > nthreads) {
+    n = nthreads;
+  }
+  if (n <= 1) {
+    pthread_mutex_unlock(&pool.lock);
+    return run_inline(ntasks, task, job, ctx);
+  }
+
+  j.task = task;
+  j.job = job;
+  j.nthreads = (int)n;
+  j.failed = 0;
+  pthread_mutex_init(&j.error_lock, NULL);
+  for (i = 0; i < n; i++) {
+    pthread_mutex_init(&j.queue[i].lock, NULL);
+    j.queue[i].lo = ntasks * i / n;
+    j.queue[i].hi = ntasks * (i+1) / n;
+  }
+
+  pool.busy = 1;
+  pool.job = &j;
+  pool.active = (int)n - 1;
+  pool.generation++;
+  pthread_cond_broadcast(&pool.work);
+  pthread_mutex_unlock(&pool.lock);
+
+  run_job(&j, 0);
+
+  pthread_mutex_lock(&pool.lock);
+  while (pool.active > 0) {
+    pthread_cond_wait(&pool.done, &pool.lock);
+  }
+  pool.job = NULL;
+  pool.busy = 0;
+  pthread_mutex_unlock(&pool.lock);
+
+  for (i = 0; i < n; i++) {
+    pthread_mutex_destroy(&j.queue[i].lock);
+  }
+  pthread_mutex_destroy(&j.error_lock);
+
+  if (j.failed) {
+    *ctx = j.ctx;
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+rb_gumath_pool_resize(int64_t nthreads)
+{
+  stop_workers(nthreads < 1 ? 0 : (int)(nthreads - 1));
+}
+
+/* At exit idle workers are stopped. If a job is still running somewhere the
+   workers are left alone; the process is going away. */
+static void
+pool_atexit(void)
+{
+  int busy;
+
+  pthread_mutex_lock(&pool.lock);
+  busy = pool.busy;
+  pthread_mutex_unlock(&pool.lock);
+
+  if (!busy) {
+    stop_workers(0);
+  }
+}
+
+static void
+pool_prefork(void)
+{
+  pthread_mutex_lock(&pool.lock);
+}
+
+static void
+pool_postfork_parent(void)
+{
+  pthread_mutex_unlock(&pool.lock);
+}
+
+/* Only the forking thread exists in the child. */
+static void
+pool_postfork_child(void)
+{
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.work, NULL);
+  pthread_cond_init(&pool.done, NULL);
+  pool.nworkers = 0;
+  pool.limit = 0;
+  pool.resizing = 0;
+  pool.busy = 0;
+  pool.active = 0;
+  pool.job = NULL;
+}
+
+void
+rb_gumath_pool_init(void)
+{
+  static int initialized = 0;
+
+  if (!initialized) {
+    pthread_atfork(pool_prefork, pool_postfork_parent, pool_postfork_child);
+    atexit(pool_atexit);
+    initialized = 1;
+  }
+}
+#endif
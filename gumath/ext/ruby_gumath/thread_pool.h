@@ -0,0 +1,61 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* Persistent worker pool used to run kernels on several threads. */
+
+#ifndef GUMATH_THREAD_POOL_H
+#define GUMATH_THREAD_POOL_H
+
+/* Upper bound on the number of threads taking part in one job. */
+#define GM_POOL_MAX_THREADS 256
+
+/* Runs task number i of a job. Returns 0 on success, -1 with ctx set. */
+typedef int (*rb_gumath_pool_task_t)(void *job, int64_t i, ndt_context_t *ctx);
+
+/* Install the exit and fork handlers. Called once at load time. */
+void rb_gumath_pool_init(void);
+
+/* Run tasks [0, ntasks) on up to nthreads threads, counting the caller, and
+   return once all of them have finished. Safe to call without the GVL. If
+   the pool is already running a job the tasks are run on the calling thread.
+   On failure the context of the first failing task is copied to ctx and -1
+   is returned; tasks that were not started yet are skipped. */
+int rb_gumath_pool_run(int64_t nthreads, int64_t ntasks, rb_gumath_pool_task_t task,
+                       void *job, ndt_context_t *ctx);
+
+/* Keep at most nthreads-1 workers. Idle workers above that are stopped and
+   busy ones leave after the current job, which this waits for; call it
+   without the GVL. The pool only grows again when a job asks for more
+   threads. */
+void rb_gumath_pool_resize(int64_t nthreads);
+
+#endif  /* GUMATH_THREAD_POOL_H */
@@ -5,3 +5,5 @@ require 'etc'
 
 require 'ruby_gumath.so'
 require 'gumath/version'
+require 'gumath/lazy'
+require 'gumath/batch'
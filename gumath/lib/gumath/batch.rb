@@ -0,0 +1,49 @@
+class Gumath
+  # Many small calls in one crossing into C:
+  #
+  #   batch = Gumath::Batch.new Gumath::Functions
+  #   batch.add :sin, x
+  #   batch.add :add, x, y
+  #   batch.run # => [sin(x), add(x, y)]
+  #
+  # All kernels are selected and all outputs allocated before any kernel
+  # runs, so a type error in any item raises before anything is computed.
+  # run(parallel: true) runs the items concurrently on the worker pool.
+  # Results come back in the order the items were added, each as #call
+  # would return it.
+  class Batch
+    def initialize mod = Gumath::Functions
+      @functions = mod.instance_variable_get(:@gumath_functions)
+      unless @functions.is_a?(Hash)
+        raise ArgumentError, "#{mod} is not a gumath kernel module."
+      end
+      @items = []
+    end
+
+    # Add a call of function, a name in the module of the batch or a
+    # GufuncObject, on the XND arguments args. Returns self.
+    def add function, *args
+      unless function.is_a?(GufuncObject)
+        name = function
+        function = @functions[name.to_sym]
+        raise ArgumentError, "no gumath function #{name}." unless function
+      end
+
+      @items << [function, args.freeze].freeze
+      self
+    end
+
+    def size
+      @items.size
+    end
+
+    def empty?
+      @items.empty?
+    end
+
+    def clear
+      @items.clear
+      self
+    end
+  end
+end
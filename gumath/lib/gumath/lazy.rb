@@ -0,0 +1,162 @@
+class Gumath
+  # Lazily evaluated expressions over the kernels of a gumath module.
+  #
+  #   f = Gumath::Lazy.new Gumath::Functions
+  #   e = f.add(f.multiply(f.sin(a), b), c)
+  #   e.evaluate # => XND
+  #
+  # Calls on the builder only record a DAG of Expr nodes. If every function
+  # in the DAG is elementwise and all XND inputs share their outermost
+  # dimension, evaluation walks that dimension in blocks of about
+  # BLOCK_BYTES: each block goes through every operation before the next
+  # block is read, so temporaries are block sized and stay in cache. Blocks
+  # after the first reuse the temporaries of the previous one through the
+  # out: keyword and the root writes straight into the result.
+  #
+  # Anything else (non-elementwise kernels, several outputs, inputs of
+  # different shapes or without a fixed outer dimension) is evaluated one
+  # operation at a time, still computing shared subexpressions only once.
+  class Lazy
+    # Bytes of inputs and temporaries touched per block.
+    BLOCK_BYTES = 1 << 18
+
+    # A function applied to Expr nodes or XND values.
+    class Expr
+      attr_reader :function, :args
+
+      def initialize function, args
+        @function = function
+        @args = args
+      end
+
+      def evaluate block_bytes: BLOCK_BYTES
+        Lazy.evaluate self, block_bytes: block_bytes
+      end
+
+      def inspect
+        "#<#{self.class} #{@function.name}(#{@args.map { |a| a.is_a?(Expr) ? a.inspect : a.type.to_s }.join(', ')})>"
+      end
+    end
+
+    def initialize mod
+      functions = mod.instance_variable_get(:@gumath_functions)
+      unless functions.is_a?(Hash)
+        raise ArgumentError, "#{mod} is not a gumath kernel module."
+      end
+
+      functions.each do |name, function|
+        define_singleton_method(name) { |*args| Expr.new(function, args) }
+      end
+    end
+
+    class << self
+      def evaluate expr, block_bytes: BLOCK_BYTES
+        nodes = post_order expr
+        leaves = nodes.flat_map(&:args).grep(XND).uniq(&:object_id)
+
+        nrows, block_rows = plan_blocks(nodes, leaves, block_bytes)
+        return evaluate_eager(nodes) unless nrows
+
+        evaluate_blocked nodes, leaves, nrows, block_rows
+      end
+
+      private
+
+      # Unique nodes, each after all of its arguments.
+      def post_order expr, seen = {}, order = []
+        return order if seen[expr.object_id]
+        seen[expr.object_id] = true
+
+        expr.args.each do |arg|
+          post_order(arg, seen, order) if arg.is_a?(Expr)
+        end
+        order << expr
+      end
+
+      def evaluate_eager nodes
+        values = {}
+        nodes.each do |node|
+          args = node.args.map { |a| a.is_a?(Expr) ? values[a.object_id] : a }
+          values[node.object_id] = node.function.call(*args)
+        end
+        values[nodes.last.object_id]
+      end
+
+      # Returns [rows, rows per block], or nil if the DAG cannot be blocked
+      # or would fit in a single block anyway.
+      def plan_blocks nodes, leaves, block_bytes
+        return nil unless nodes.all? { |n| n.function.elementwise? }
+        return nil unless leaves.all? { |x| x.is_a?(XND) }
+
+        arrays = leaves.reject { |x| x.type.ndim == 0 }
+        return nil if arrays.empty?
+
+        # Inputs of lower rank broadcast along the outer dimension and cannot
+        # be sliced with it. Blocks of a fixed dimension have the same type
+        # from one block to the next, which out: relies on.
+        ndim = arrays.first.type.ndim
+        nrows = arrays.first.size
+        return nil unless arrays.all? { |x| x.type.ndim == ndim && x.size == nrows }
+        return nil unless arrays.all? { |x| x.type.to_s.match?(/\A\d+ \*/) }
+        return nil if nrows < 2
+
+        # Inputs plus one temporary per node, each about as wide as the
+        # widest input row.
+        row_bytes = arrays.map { |x| x.type.datasize / nrows }
+        bytes = row_bytes.sum + nodes.size * row_bytes.max
+        block_rows = [block_bytes / [bytes, 1].max, 1].max
+        return nil if block_rows >= nrows
+
+        [nrows, block_rows]
+      end
+
+      def evaluate_blocked nodes, leaves, nrows, block_rows
+        root = nodes.last
+        temps = {}
+        result = nil
+
+        0.step(nrows - 1, block_rows) do |start|
+          stop = [start + block_rows, nrows].min
+          full = stop - start == block_rows
+          values = {}
+
+          leaves.each do |x|
+            values[x.object_id] = x.type.ndim == 0 ? x : x[start..(stop - 1)]
+          end
+
+          nodes.each do |node|
+            args = node.args.map { |a| values[a.object_id] }
+
+            if node.equal?(root)
+              result ||= XND.empty result_type(root, args, nrows)
+              values[node.object_id] = node.function.call(*args, out: result[start..(stop - 1)])
+            elsif full && temps[node.object_id]
+              values[node.object_id] = node.function.call(*args, out: temps[node.object_id])
+            else
+              value = node.function.call(*args)
+              temps[node.object_id] = value if full
+              values[node.object_id] = value
+            end
+          end
+        end
+
+        result
+      end
+
+      # Type of the root over all rows, from a call on the first row of its
+      # arguments.
+      def result_type root, args, nrows
+        row = args.map { |a| a.type.ndim == 0 ? a : a[0..0] }
+        root.function.call(*row).type.to_s.sub(/\A\d+/, nrows.to_s)
+      end
+    end
+  end
+
+  # Build and evaluate a lazy expression in one go:
+  #
+  #   Gumath.lazy(Gumath::Functions) { |f| f.add(f.sin(a), b) }
+  def self.lazy mod = Gumath::Functions
+    expr = yield Lazy.new(mod)
+    expr.is_a?(Lazy::Expr) ? expr.evaluate : expr
+  end
+end
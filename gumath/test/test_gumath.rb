@@ -6,6 +6,34 @@ class TestFunctionHash < Minitest::Test
 
     assert_instance_of Gumath::GufuncObject, hash[:sin]
   end
+
+  def test_kernels_are_singleton_methods
+    assert Fn.respond_to?(:sin)
+    assert Ex.respond_to?(:multiply)
+    assert_includes Fn.singleton_methods, :sin
+  end
+
+  def test_singleton_method_returns_result
+    x = XND.new [1.0, 2.0], type: "2 * float64"
+    y = Fn.method(:sin).call x
+
+    assert_array_in_delta y.value, compute(:sin, [1.0, 2.0]), 0.00001
+  end
+
+  def test_aliased_kernel_method
+    x = XND.new [1.0, 2.0], type: "2 * float64"
+    out = XND.empty "2 * float64"
+    Fn.singleton_class.send(:alias_method, :gumath_test_sin, :sin)
+
+    Fn.gumath_test_sin x, out: out
+    assert_equal Fn.sin(x).value, out.value
+  ensure
+    Fn.singleton_class.send(:remove_method, :gumath_test_sin)
+  end
+
+  def test_unknown_kernel
+    assert_raises(NoMethodError) { Fn.no_such_kernel XND.new(1.0) }
+  end
 end
 
 class TestCall < Minitest::Test
@@ -104,6 +132,1106 @@ class TestCall < Minitest::Test
   end
 end
 
+class TestQuaternions < Minitest::Test
+  Q = Gumath::Quaternions
+
+  # w + xi + yj + zk as its 2 * 2 complex matrix.
+  def quat w, x, y, z
+    [[Complex(w, x), Complex(y, z)], [Complex(-y, z), Complex(w, -x)]]
+  end
+
+  def assert_quat_in_delta expected, actual, delta = 1e-12
+    expected.flatten.zip(actual.flatten).each do |e, a|
+      assert_in_delta e.real, a.real, delta
+      assert_in_delta e.imag, a.imag, delta
+    end
+  end
+
+  def setup
+    @data = [
+      [[1+2i, 4+3i],
+       [-4+3i, 1-2i]],
+      [[4+2i, 1+10i],
+       [-1+10i, 4-2i]],
+      [[-4+2i, 3+10i],
+       [-3+10i, -4-2i]]
+    ]
+  end
+
+  def test_multiply_matches_example
+    # Long enough for the vector path, with a short tail.
+    data = @data * 7
+    %w(quaternion64 quaternion128).each do |t|
+      x = XND.new data, type: "#{data.size} * #{t}"
+      y = Q.multiply x, x
+      assert_equal "21 * #{t}", y.type.to_s
+      assert_quat_in_delta Ex.multiply(x, x).value, y.value, 1e-3
+    end
+
+    x = XND.new @data, type: "3 * quaternion128"
+    one = XND.new quat(0, 0, 0, 1), type: "quaternion128"
+    assert_quat_in_delta Ex.multiply(x, XND.new([quat(0, 0, 0, 1)] * 3, type: "3 * quaternion128")).value,
+                         Q.multiply(x, one).value
+  end
+
+  def test_conjugate_and_normalize
+    x = XND.new [quat(1, 2, 3, 4)] * 20, type: "20 * quaternion128"
+    assert_quat_in_delta [quat(1, -2, -3, -4)] * 20, Q.conjugate(x).value
+
+    r = Math.sqrt(30)
+    assert_quat_in_delta [quat(1 / r, 2 / r, 3 / r, 4 / r)] * 20, Q.normalize(x).value
+  end
+
+  def test_slerp
+    c = Math.sqrt(0.5)
+    a = XND.new [quat(1, 0, 0, 0)] * 20, type: "20 * quaternion128"
+    b = XND.new [quat(c, 0, 0, c)] * 20, type: "20 * quaternion128"
+
+    assert_quat_in_delta a.value, Q.slerp(a, b, 0.0).value
+    assert_quat_in_delta b.value, Q.slerp(a, b, 1.0).value
+
+    # Half of a 90 degree turn about z is a 45 degree turn.
+    half = quat(Math.cos(Math::PI / 8), 0, 0, Math.sin(Math::PI / 8))
+    assert_quat_in_delta [half] * 20, Q.slerp(a, b, 0.5).value
+
+    t = XND.new [0.0, 1.0] * 10, type: "20 * float64"
+    assert_quat_in_delta [a.value[0], b.value[0]] * 10, Q.slerp(a, b, t).value
+
+    # -b is the same rotation; the shorter arc is taken.
+    minus_b = XND.new [quat(-c, 0, 0, -c)] * 20, type: "20 * quaternion128"
+    assert_quat_in_delta [half] * 20, Q.slerp(a, minus_b, 0.5).value
+  end
+
+  def test_rotate
+    c = Math.sqrt(0.5)
+    q = XND.new quat(c, 0, 0, c), type: "quaternion128"
+    v = XND.new [[1.0, 0.0, 0.0], [0.0, 1.0, 0.0], [0.0, 0.0, 2.0]] * 8, type: "24 * 3 * float64"
+
+    r = Q.rotate(q, v)
+    assert_equal "24 * 3 * float64", r.type.to_s
+    assert_array_in_delta [[0.0, 1.0, 0.0], [-1.0, 0.0, 0.0], [0.0, 0.0, 2.0]] * 8, r.value, 1e-12
+
+    # Not unit: q v q^-1 does not depend on the norm.
+    q = XND.new [quat(2 * c, 0, 0, 2 * c)] * 24, type: "24 * quaternion128"
+    assert_array_in_delta r.value, Q.rotate(q, v).value, 1e-12
+  end
+
+  def test_thread_raise_interrupts_multiply
+    x = XND.empty "4000000 * quaternion128"
+    t = Thread.new do
+      Thread.current.report_on_exception = false
+      loop { Q.multiply x, x }
+    end
+
+    sleep 0.2
+    t.raise RuntimeError, "stop"
+    assert_raises(RuntimeError) { t.join }
+  end
+
+  def test_exceptions
+    x = XND.new @data, type: "3 * quaternion128"
+    f = XND.new @data, type: "3 * quaternion64"
+    assert_raises(TypeError) { Q.multiply x, f }
+    assert_raises(TypeError) { Q.normalize XND.new(@data, type: "3 * Foo(2 * 2 * complex64)") }
+    assert_raises(TypeError) { Q.rotate x, XND.new([[1.0, 2.0]], type: "1 * 2 * float64") }
+    assert_raises(ArgumentError) { Q.multiply x, XND.new(@data[0, 2], type: "2 * quaternion128") }
+  end
+end
+
+class TestSort < Minitest::Test
+  def test_sort_dtypes
+    data = [5, -3, 0, 127, -128, 7, 7, 1]
+
+    ["int8", "int16", "int32", "int64", "float32", "float64"].each do |dtype|
+      x = XND.new data, type: "8 * #{dtype}"
+      y = Fn.sort x
+
+      assert_equal y.type, NDT.new("8 * #{dtype}")
+      assert_equal y.value, data.sort.map { |v| dtype.start_with?("float") ? v.to_f : v }
+    end
+
+    x = XND.new [3, 255, 0, 1], type: "4 * uint8"
+    assert_equal Fn.sort(x).value, [0, 1, 3, 255]
+  end
+
+  def test_sort_floats
+    x = XND.new [2.5, -0.0, Float::INFINITY, -1e300, Float::NAN, 1e-300], type: "6 * float64"
+    y = Fn.sort(x).value
+
+    assert_equal y[0..4], [-1e300, -0.0, 1e-300, 2.5, Float::INFINITY]
+    assert y[5].nan?
+  end
+
+  def test_sort_innermost_dimension
+    x = XND.new [[3, 1, 2], [9, 8, 7]], type: "2 * 3 * int64"
+
+    assert_equal Fn.sort(x).value, [[1, 2, 3], [7, 8, 9]]
+    assert_equal Fn.argsort(x).value, [[1, 2, 0], [2, 1, 0]]
+  end
+
+  def test_argsort_is_stable
+    data = 1000.times.map { |i| (i * 7919) % 13 }
+    x = XND.new data, type: "1000 * int32"
+    y = Fn.argsort x
+
+    assert_equal y.type, NDT.new("1000 * int64")
+    assert_equal y.value, (0...1000).sort_by { |i| [data[i], i] }
+  end
+
+  def test_sort_large
+    data = 300_000.times.map { |i| (i * 2654435761) % 1_000_003 - 500_000 }
+    x = XND.new data, type: "300000 * int64"
+
+    assert_equal Fn.sort(x).value, data.sort
+  end
+
+  def test_sort_any_thread_count
+    n = 1_200_000
+    data = n.times.map { |i| (i * 2654435761) % 1_000_003 }
+    x = XND.new data, type: "#{n} * int64"
+    expected = data.sort
+
+    assert_equal expected, Gumath.with_threads(1) { Fn.sort(x).value }
+    assert_equal expected, Gumath.with_threads(4) { Fn.sort(x).value }
+    assert_equal expected, Fn.sort(x, threads: 3).value
+    assert_equal Gumath.with_threads(1) { Fn.argsort(x).value },
+                 Fn.argsort(x, threads: 4).value
+  end
+
+  def test_sort_slice
+    x = XND.new [[5, 4, 3], [2, 1, 0]], type: "2 * 3 * int64"
+    y = x[0..1, 1..2]
+
+    assert_equal Fn.sort(y).value, [[3, 4], [0, 1]]
+  end
+end
+
+class TestTranscendental < Minitest::Test
+  FUNCTIONS = [:sin, :cos, :exp, :log]
+
+  def inputs name
+    values = 1000.times.map { |i| (i - 500) * 0.731 }
+    case name
+    when :exp then values + [-745.2, -700.0, 709.7, 710.0, 1e-300]
+    when :log then values.map(&:abs).map { |v| v + 1e-3 } + [1e-310, 1e300, 1.0 + 1e-12]
+    else values + [1e5 + 0.5, 1048575.0, 1e7, 3e300]
+    end
+  end
+
+  def assert_close got, want, rel
+    if want.nan?
+      assert got.nan?, "expected NaN, got #{got}"
+    elsif want.infinite? || want == 0.0
+      assert_equal want, got
+    else
+      assert_in_delta want, got, want.abs * rel
+    end
+  end
+
+  def test_float64_matches_math
+    FUNCTIONS.each do |name|
+      data = inputs name
+      y = Fn.send(name, XND.new(data, type: "#{data.size} * float64"))
+
+      assert_equal y.type, NDT.new("#{data.size} * float64")
+      y.value.zip(data).each { |got, v| assert_close got, Math.send(name, v), 3e-16 }
+    end
+  end
+
+  def test_float32_matches_math
+    FUNCTIONS.each do |name|
+      data = inputs(name).select { |v| v.abs < 1e30 && (v == 0 || v.abs > 1e-30) }
+      x = XND.new data, type: "#{data.size} * float32"
+      y = Fn.send(name, x)
+
+      assert_equal y.type, NDT.new("#{data.size} * float32")
+      y.value.zip(x.value).each do |got, v|
+        want = [Math.send(name, v)].pack("f").unpack1("f")
+        assert_close got, want, 1.2e-7
+      end
+    end
+  end
+
+  def test_special_values
+    inf = Float::INFINITY
+    x = XND.new [0.0, -0.0, inf, -inf, Float::NAN], type: "5 * float64"
+
+    exp = Fn.exp(x).value
+    assert_equal exp[0..3], [1.0, 1.0, inf, 0.0]
+    assert exp[4].nan?
+
+    log = Fn.log(x).value
+    assert_equal log[0..2], [-inf, -inf, inf]
+    assert log[3].nan? && log[4].nan?
+    assert Fn.log(XND.new([-1.0], type: "1 * float64")).value[0].nan?
+
+    sin = Fn.sin(x).value
+    assert_equal 1.0 / sin[1], -inf
+    assert sin[2..4].all?(&:nan?)
+  end
+
+  def test_layouts_agree
+    data = 64.times.map { |i| i * 0.37 - 11.0 }
+    x = XND.new data.each_slice(8).to_a, type: "8 * 8 * float64"
+
+    FUNCTIONS.each do |name|
+      next if name == :log
+      full = Fn.send(name, x).value
+      strided = Fn.send(name, x[0..7, 1..7]).value
+      column = Fn.send(name, x[0..7, 3]).value
+      scalar = Fn.send(name, x[2, 5]).value
+
+      assert_equal strided, full.map { |row| row[1..7] }
+      assert_equal column, full.map { |row| row[3] }
+      assert_equal scalar, full[2][5]
+    end
+  end
+end
+
+class TestCpuDispatch < Minitest::Test
+  def test_features
+    assert Gumath.cpu_features.all? { |f| f.is_a?(Symbol) }
+    assert_equal Gumath.cpu_tiers.first, :base
+    assert_includes Gumath.cpu_tiers, Gumath.cpu_tier
+    assert_includes Gumath.cpu_features, :avx2 if Gumath.cpu_tiers.include?(:avx2)
+  end
+
+  def test_kernel_variant
+    assert_includes [Gumath.cpu_tier, :portable], Gumath.kernel_variant(:sin)
+    assert_equal Gumath.kernel_variant("sin"), Gumath.kernel_variant(:sin)
+    assert_equal Gumath.kernel_variant(:add), :portable
+  end
+
+  # The tier is fixed when the extension loads, so each one runs in a
+  # child process.
+  def test_every_tier
+    script = <<~RUBY
+      require 'gumath'
+      data = 1000.times.map { |i| (i - 500) * 0.731 }
+      x = XND.new data, type: "1000 * float64"
+      values = [:sin, :cos, :exp].map { |f| Gumath::Functions.send(f, x).value }
+      values << Gumath::Functions.log(XND.new(data.map(&:abs), type: "1000 * float64")).value
+      print Marshal.dump([Gumath.cpu_tier, Gumath.kernel_variant(:sin), values])
+    RUBY
+    env = { "RUBYLIB" => $LOAD_PATH.join(File::PATH_SEPARATOR) }
+    data = 1000.times.map { |i| (i - 500) * 0.731 }
+
+    Gumath.cpu_tiers.each do |tier|
+      out = IO.popen(env.merge("GUMATH_CPU_TIER" => tier.to_s),
+                     [RbConfig.ruby, "-e", script], "rb", &:read)
+      assert $?.success?, "tier #{tier} failed"
+
+      cpu_tier, variant, values = Marshal.load(out)
+      assert_equal tier, cpu_tier
+      assert_includes [tier, :portable], variant
+
+      [:sin, :cos, :exp].each_with_index do |f, i|
+        values[i].zip(data).each do |got, v|
+          want = Math.send(f, v)
+          assert_in_delta want, got, want.abs * 3e-16, "#{f}(#{v}) on #{tier}"
+        end
+      end
+      values[3].zip(data).each do |got, v|
+        want = Math.log(v.abs)
+        assert_in_delta want, got, want.abs * 3e-16 unless want.infinite?
+      end
+    end
+  end
+end
+
+class TestProfile < Minitest::Test
+  def teardown
+    Gumath.profile_mode = :off
+  end
+
+  def test_profile_block
+    x = XND.new [1.0, 2.0, 3.0], type: "3 * float64"
+    mode = Gumath.profile_mode
+
+    stats = Gumath.profile do
+      4.times { Fn.sin x }
+      Fn.add x, x
+    end
+
+    sin = stats[:sin]
+    assert_equal 4, sin[:calls]
+    assert_equal 4, sin[:timed_calls]
+    assert_equal 4 * 2 * 24, sin[:bytes]
+    assert_equal 1.0, sin[:threads]
+    [:select_time, :alloc_time, :kernel_time].each { |k| assert sin[k] >= 0 }
+    assert_equal 1, stats[:add][:calls]
+    refute stats.key?(:cos)
+    assert_equal mode, Gumath.profile_mode
+  end
+
+  def test_sampled_mode
+    x = XND.new [1.0, 2.0], type: "2 * float64"
+    Gumath.profile_reset
+    Gumath.profile_mode = :sampled
+
+    100.times { Fn.cos x }
+    cos = Gumath.profile_stats[:cos]
+
+    assert_equal 100, cos[:calls]
+    assert cos[:timed_calls].between?(1, 99)
+
+    Gumath.profile_reset
+    refute Gumath.profile_stats.key?(:cos)
+  end
+
+  def test_off_by_default
+    x = XND.new [1.0], type: "1 * float64"
+    Gumath.profile_reset
+
+    Fn.exp x
+    assert_nil Gumath.profile_stats[:exp]
+    assert_raises(ArgumentError) { Gumath.profile_mode = :verbose }
+  end
+end
+
+class TestDispatchCache < Minitest::Test
+  def test_repeated_calls
+    x = XND.new [1.0, 2.0, 3.0], type: "3 * float64"
+    expected = [1.0, 2.0, 3.0].map { |v| Math.sin(v) }
+
+    5.times do
+      assert_array_in_delta Fn.sin(x).value, expected, 0.00001
+    end
+  end
+
+  def test_same_shape_different_layout
+    data = [[1.0, 2.0, 3.0], [4.0, 5.0, 6.0], [7.0, 8.0, 9.0]]
+    x = XND.new data, type: "3 * 3 * float64"
+
+    a = Fn.sin x[0..1, 0..1]
+    b = Fn.sin x[1..2, 1..2]
+    c = Fn.sin x[0..1, 0..1]
+
+    assert_array_in_delta a.value, compute(:sin, [[1.0, 2.0], [4.0, 5.0]]), 0.00001
+    assert_array_in_delta b.value, compute(:sin, [[5.0, 6.0], [8.0, 9.0]]), 0.00001
+    assert_array_in_delta c.value, a.value, 0.0
+  end
+
+  def test_dtype_change
+    x = XND.new [1.0, 2.0], type: "2 * float64"
+    y = XND.new [1.0, 2.0], type: "2 * float32"
+
+    assert_equal Fn.sin(x).type, NDT.new("2 * float64")
+    assert_equal Fn.sin(y).type, NDT.new("2 * float32")
+    assert_equal Fn.sin(x).type, NDT.new("2 * float64")
+  end
+
+  def test_outputs_are_fresh
+    x = XND.new [1.0, 2.0], type: "2 * float64"
+    y = Fn.copy x
+    z = Fn.copy x
+
+    y[0] = 10.0
+    assert_equal z.value, [1.0, 2.0]
+  end
+
+  def test_repeated_broadcast
+    w = XND.new [2.0] * 64, type: "64 * float64"
+    multiply = Fn.instance_variable_get(:@gumath_functions)[:multiply]
+
+    3.times do |n|
+      x = XND.new [[1.0 * n] * 64] * 4, type: "4 * 64 * float64"
+      before = multiply.cache_stats[:hits]
+      2.times { assert_equal [[2.0 * n] * 64] * 4, Fn.multiply(x, w).value }
+      assert_operator multiply.cache_stats[:hits], :>, before
+    end
+  end
+
+  def test_stats_and_lru
+    sin = Fn.instance_variable_get(:@gumath_functions)[:sin]
+    before = sin.cache_stats
+    total = Gumath.cache_stats
+
+    xs = (1..12).map { |n| XND.new [1.0] * n, type: "#{n} * float64" }
+    xs.each { |x| Fn.sin x; Fn.sin xs[0] }
+
+    stats = sin.cache_stats
+    assert_operator stats[:size], :<=, 8
+    assert_operator stats[:evictions], :>, before[:evictions]
+    assert_operator stats[:hits], :>=, before[:hits] + 11
+    assert_operator Gumath.cache_stats[:misses], :>, total[:misses]
+    assert_operator stats[:hit_rate], :>, 0.0
+
+    # xs[0] was used after every other shape and is still cached.
+    hits = sin.cache_stats[:hits]
+    Fn.sin xs[0]
+    assert_equal hits + 1, sin.cache_stats[:hits]
+  end
+end
+
+class TestKernelGroups < Minitest::Test
+  def run_ruby code
+    includes = $LOAD_PATH.flat_map { |p| ["-I", p] }
+    IO.popen([RbConfig.ruby, *includes, "-e", "require 'gumath'; #{code}"], &:read)
+  end
+
+  def test_modules_are_loaded_on_first_use
+    out = run_ruby "p Gumath.const_defined?(:Examples, false); " \
+                   "Gumath::Examples; p Gumath.const_defined?(:Examples, false)"
+
+    assert_equal "false\ntrue\n", out
+  end
+
+  def test_module_is_loaded_once
+    assert_same Gumath::Functions, Gumath.const_get(:Functions)
+    assert_same Fn.instance_variable_get(:@gumath_functions)[:sin],
+                Gumath::Functions.instance_variable_get(:@gumath_functions)[:sin]
+  end
+
+  def test_groups_stay_in_their_module
+    refute Fn.respond_to?(:single_source_shortest_paths)
+    assert Ex.respond_to?(:single_source_shortest_paths)
+
+    # Both modules have a multiply, each with only its own kernels.
+    q = XND.new [[[1+2i, 4+3i], [-4+3i, 1-2i]]], type: "1 * quaternion128"
+    x = XND.new [1.0, 2.0], type: "2 * float64"
+    refute_same Fn.instance_variable_get(:@gumath_functions)[:multiply],
+                Ex.instance_variable_get(:@gumath_functions)[:multiply]
+    assert_raises(TypeError) { Fn.multiply q, q }
+    assert_raises(TypeError) { Ex.multiply x, x }
+    assert_equal [1.0, 4.0], Fn.multiply(x, x).value
+  end
+
+  def test_module_order_does_not_matter
+    out = run_ruby "Gumath::Examples; p Gumath::Functions.multiply(" \
+                   "XND.new([3.0], type: '1 * float64'), XND.new([2.0], type: '1 * float64')).value"
+
+    assert_equal "[6.0]\n", out
+  end
+
+  def test_quaternions_without_examples
+    out = run_ruby "x = XND.new([[[1+2i, 4+3i], [-4+3i, 1-2i]]], type: '1 * quaternion128'); " \
+                   "p Gumath::Quaternions.conjugate(x).value; " \
+                   "p Gumath.const_defined?(:Examples, false)"
+
+    assert_equal "[[[(1.0-2.0i), (-4.0-3.0i)], [(4.0-3.0i), (1.0+2.0i)]]]\nfalse\n", out
+  end
+
+  def test_unknown_constant
+    assert_raises(NameError) { Gumath::NoSuchModule }
+  end
+end
+
+class TestOut < Minitest::Test
+  def test_out_is_written_and_returned
+    x = XND.new [1.0, 2.0, 3.0], type: "3 * float64"
+    out = XND.empty "3 * float64"
+    y = Fn.sin x, out: out
+
+    assert_same out, y
+    assert_array_in_delta out.value, compute(:sin, [1.0, 2.0, 3.0]), 0.00001
+  end
+
+  def test_in_place
+    x = XND.new [[1.0, 2.0], [3.0, 4.0]], type: "2 * 2 * float64"
+    Fn.sin x, out: x
+
+    assert_array_in_delta x.value, compute(:sin, [[1.0, 2.0], [3.0, 4.0]]), 0.00001
+  end
+
+  def test_multiple_outputs
+    q = XND.new 0
+    r = XND.new 0
+    ans = Ex.divmod10 XND.new(233), out: [q, r]
+
+    assert_equal ans, [q, r]
+    assert_equal q.value, 23
+    assert_equal r.value, 3
+  end
+
+  def test_out_type_must_match
+    x = XND.new [1.0, 2.0, 3.0], type: "3 * float64"
+
+    assert_raises(TypeError) { Fn.sin x, out: XND.empty("3 * float32") }
+    assert_raises(TypeError) { Fn.sin x, out: XND.empty("4 * float64") }
+    assert_raises(TypeError) { Fn.sin x, out: 1.0 }
+    assert_raises(ArgumentError) { Ex.divmod10 XND.new(233), out: XND.new(0) }
+  end
+
+  def test_overlapping_out_is_rejected
+    x = XND.new [1.0, 2.0, 3.0, 4.0], type: "4 * float64"
+
+    assert_raises(ArgumentError) { Fn.sin x[0..2], out: x[1..3] }
+    assert_raises(ArgumentError) { Fn.sort x, out: x }
+    assert_equal x.value, [1.0, 2.0, 3.0, 4.0]
+  end
+end
+
+class TestGVL < Minitest::Test
+  def test_other_threads_run_during_large_calls
+    x = XND.empty "8000000 * float64"
+    ticks = 0
+    running = true
+    counter = Thread.new { ticks += 1 while running }
+
+    sleep 0.05
+    before = ticks
+    y = Fn.sin x
+    after = ticks
+    running = false
+    counter.join
+
+    assert_equal y.type, x.type
+    assert_operator after, :>, before
+  end
+
+  def test_results_are_complete_for_chunked_calls
+    data = 300_000.times.map { |i| i / 1000.0 }
+    x = XND.new [data] * 4, type: "4 * 300000 * float64"
+    y = Fn.sin(x).value
+
+    assert_equal y.size, 4
+    [0, 1234, 299_999].each do |i|
+      assert_in_delta y[3][i], Math.sin(data[i]), 0.00001
+    end
+  end
+
+  def test_thread_raise_interrupts_kernel
+    x = XND.empty "16000000 * float64"
+    t = Thread.new do
+      Thread.current.report_on_exception = false
+      loop { Fn.sin x }
+    end
+
+    sleep 0.2
+    t.raise RuntimeError, "stop"
+    assert_raises(RuntimeError) { t.join }
+  end
+
+  def test_interrupted_calls_give_back_cache_entries
+    x = XND.empty "4 * 2000000 * float64"
+    sin = Fn.instance_variable_get(:@gumath_functions)[:sin]
+
+    10.times do
+      t = Thread.new do
+        Thread.current.report_on_exception = false
+        loop { Fn.sin x }
+      end
+      sleep 0.05
+      t.raise RuntimeError, "stop"
+      assert_raises(RuntimeError) { t.join }
+    end
+    assert_equal 0, sin.cache_stats[:pinned]
+
+    hits = sin.cache_stats[:hits]
+    Fn.sin x
+    Fn.sin x
+    assert_operator sin.cache_stats[:hits], :>=, hits + 2
+  end
+end
+
+class TestThreadPool < Minitest::Test
+  def setup
+    @threads = Gumath.get_max_threads
+  end
+
+  def teardown
+    Gumath.set_max_threads @threads
+  end
+
+  def test_results_do_not_depend_on_thread_count
+    data = 2000.times.map { |i| 64.times.map { |j| (i * 64 + j) / 1000.0 } }
+    x = XND.new data, type: "2000 * 64 * float64"
+
+    Gumath.set_max_threads 1
+    expected = Fn.sin(x).value
+    [2, 3, 8].each do |n|
+      Gumath.set_max_threads n
+      assert_equal expected, Fn.sin(x).value
+    end
+  end
+
+  def test_uneven_var_dim_rows
+    data = 300.times.map { |i| Array.new(i % 7 == 0 ? 400 : 3) { |j| (i + j) / 100.0 } }
+    x = XND.new data, type: "var * var * float64"
+
+    Gumath.set_max_threads 4
+    y = Fn.sin(x).value
+
+    assert_equal data.map(&:size), y.map(&:size)
+    assert_array_in_delta y[7], compute(:sin, data[7]), 0.00001
+  end
+
+  def test_resize_while_kernels_run
+    x = XND.new [1.0] * 200_000, type: "200000 * float64"
+    Gumath.set_max_threads 8
+    expected = Fn.sin(x).value
+
+    t = Thread.new { 20.times.map { Fn.sin(x).value } }
+    20.times { |i| Gumath.set_max_threads(i.even? ? 1 : 8) }
+
+    assert t.join(30), "kernel did not finish while the pool was resized"
+    assert t.value.all? { |y| y == expected }
+  end
+
+  def test_pool_works_after_fork
+    skip "fork is not available" unless Process.respond_to?(:fork)
+
+    x = XND.new [1.0] * 100_000, type: "100000 * float64"
+    Gumath.set_max_threads 4
+    Fn.sin x
+
+    rd, wr = IO.pipe
+    pid = fork do
+      rd.close
+      wr.write Fn.sin(x)[99_999].value.to_s
+      wr.close
+      exit!(0)
+    end
+    wr.close
+    Process.wait pid
+
+    assert_in_delta rd.read.to_f, Math.sin(1.0), 0.00001
+  end
+end
+
+class TestFuture < Minitest::Test
+  def setup
+    @sin = Fn.instance_variable_get(:@gumath_functions)[:sin]
+    @add = Fn.instance_variable_get(:@gumath_functions)[:add]
+    @x = XND.new [1.0] * 100_000, type: "100000 * float64"
+  end
+
+  def test_value
+    f = @sin.call_async @x
+
+    assert_instance_of Gumath::Future, f
+    assert f.wait
+    assert f.ready?
+    assert_equal Fn.sin(@x).value, f.value
+    assert_same f.value, f.value
+  end
+
+  def test_wait_timeout
+    f = @sin.call_async @x
+
+    assert_includes [true, false], f.wait(0)
+    assert f.wait(nil)
+  end
+
+  def test_out
+    out = XND.empty "100000 * float64"
+    f = @add.call_async @x, @x, out: out
+
+    assert_same out, f.value
+    assert_equal [2.0] * 100_000, out.value
+  end
+
+  def test_concurrent_calls
+    ys = 8.times.map { |i| XND.new [i.to_f] * 100_000, type: "100000 * float64" }
+    futures = ys.map { |y| @add.call_async(@x, y) }
+
+    futures.each_with_index do |f, i|
+      assert_equal [1.0 + i] * 100_000, f.value
+    end
+  end
+
+  def test_dropped_futures
+    50.times { @sin.call_async @x }
+    GC.start
+
+    assert_equal Fn.sin(@x).value, @sin.call_async(@x).value
+  end
+
+  def test_type_errors_are_raised_immediately
+    assert_raises(ArgumentError) { @sin.call_async [1.0] }
+    assert_raises(TypeError) { @sin.call_async XND.new(["a"]) }
+  end
+end
+
+class TestBatch < Minitest::Test
+  def setup
+    @x = XND.new [1.0, 2.0, 3.0], type: "3 * float64"
+    @y = XND.new [4.0, 5.0, 6.0], type: "3 * float64"
+  end
+
+  def test_run
+    batch = Gumath::Batch.new Fn
+    batch.add :sin, @x
+    batch.add :add, @x, @y
+    batch.add Fn.instance_variable_get(:@gumath_functions)[:cos], @y
+
+    results = batch.run
+    assert_equal 3, results.size
+    assert_equal Fn.sin(@x).value, results[0].value
+    assert_equal [5.0, 7.0, 9.0], results[1].value
+    assert_equal Fn.cos(@y).value, results[2].value
+  end
+
+  def test_many_small_items
+    xs = 1000.times.map { |i| XND.new [i.to_f], type: "1 * float64" }
+    batch = Gumath::Batch.new
+    xs.each { |x| batch.add :sin, x }
+
+    sequential = batch.run.map(&:value)
+    parallel = batch.run(parallel: true).map(&:value)
+    four = Gumath.with_threads(4) { batch.run(parallel: true).map(&:value) }
+
+    assert_equal xs.map { |x| [Math.sin(x.value[0])] }.flatten, sequential.flatten
+    assert_equal sequential, parallel
+    assert_equal sequential, four
+  end
+
+  def test_thread_raise_interrupts_batch
+    x = XND.empty "100000 * float64"
+    batch = Gumath::Batch.new Fn
+    100.times { batch.add :sin, x }
+
+    [false, true].each do |parallel|
+      t = Thread.new do
+        Thread.current.report_on_exception = false
+        loop { batch.run parallel: parallel }
+      end
+
+      sleep 0.2
+      t.raise RuntimeError, "stop"
+      assert_raises(RuntimeError) { t.join }
+    end
+  end
+
+  def test_multiple_outputs
+    results = Gumath::Batch.new(Ex).add(:divmod10, XND.new(233)).run
+
+    assert_equal [23, 3], results[0].map(&:value)
+  end
+
+  def test_empty
+    assert_equal [], Gumath::Batch.new.run
+  end
+
+  def test_errors
+    batch = Gumath::Batch.new
+    assert_raises(ArgumentError) { batch.add :no_such_function, @x }
+
+    batch.add(:sin, @x).add(:sin, XND.new("xyz"))
+    assert_raises(TypeError) { batch.run }
+    batch.clear
+    assert batch.empty?
+  end
+end
+
+class TestUnsafeAddKernel < Minitest::Test
+  def test_add_native_kernel
+    require 'fiddle'
+
+    calls = 0
+    kernel = Fiddle::Closure::BlockCaller.new(Fiddle::TYPE_INT,
+                                              [Fiddle::TYPE_VOIDP, Fiddle::TYPE_VOIDP]) do |stack, ctx|
+      calls += 1
+      0
+    end
+
+    func = Gumath.unsafe_add_kernel(name: "test_noop", sig: "... * float64 -> ... * float64",
+                                    xnd: Fiddle::Pointer.new(kernel.to_i))
+    assert_instance_of Gumath::GufuncObject, func
+    assert Gumath.respond_to?(:test_noop)
+
+    x = XND.new [1.0, 2.0, 3.0], type: "3 * float64"
+    y = Gumath.with_threads(1) { Gumath.test_noop x }
+    assert_equal "3 * float64", y.type.to_s
+    assert calls > 0
+  end
+
+  def test_kernel_modules_are_not_changed
+    require 'fiddle'
+
+    kernel = Fiddle::Closure::BlockCaller.new(Fiddle::TYPE_INT,
+                                              [Fiddle::TYPE_VOIDP, Fiddle::TYPE_VOIDP]) { 0 }
+    sin = Fn.instance_variable_get(:@gumath_functions)[:sin]
+    x = XND.new [1.0, 2.0], type: "2 * float64"
+
+    Gumath.unsafe_add_kernel(name: "sin", sig: "... * float64 -> ... * float64",
+                             xnd: Fiddle::Pointer.new(kernel.to_i))
+    assert Gumath.respond_to?(:sin)
+    assert_same sin, Fn.instance_variable_get(:@gumath_functions)[:sin]
+    assert_array_in_delta Fn.sin(x).value, compute(:sin, [1.0, 2.0]), 0.00001
+  end
+
+  def test_exceptions
+    assert_raises(ArgumentError) { Gumath.unsafe_add_kernel(sig: "float64 -> float64", c: 1) }
+    assert_raises(ArgumentError) { Gumath.unsafe_add_kernel(name: "test_none", sig: "float64 -> float64") }
+    assert_raises(ArgumentError) { Gumath.unsafe_add_kernel(name: "test_null", sig: "float64 -> float64", c: 0) }
+    assert_raises(TypeError) { Gumath.unsafe_add_kernel(name: "test_float", sig: "float64 -> float64", c: 1.5) }
+    assert_raises(ArgumentError) do
+      Gumath.unsafe_add_kernel(name: "test_missing", sig: "float64 -> float64",
+                               c: "gumath_test_no_such_symbol")
+    end
+    assert_raises(ArgumentError) do
+      Gumath.unsafe_add_kernel(name: "get_max_threads", sig: "float64 -> float64", c: 1)
+    end
+    assert_raises(LoadError) do
+      Gumath.unsafe_add_kernel(name: "test_lib", sig: "float64 -> float64", c: "f",
+                               lib: "/nonexistent/libkernel.so")
+    end
+  end
+end
+
+class TestThreadCount < Minitest::Test
+  def setup
+    @threads = Gumath.get_max_threads
+    Gumath.set_max_threads 4
+    @x = XND.new [1.0] * 200_000, type: "200000 * float64"
+  end
+
+  def teardown
+    Gumath.set_max_threads @threads
+  end
+
+  def test_small_calls_use_one_thread
+    Fn.sin XND.new([1.0, 2.0], type: "2 * float64")
+    assert_equal 1, Gumath.last_threads
+  end
+
+  def test_cost_model_stays_within_max_threads
+    3.times { Fn.sin @x }
+    assert_includes 1..4, Gumath.last_threads
+  end
+
+  def test_threads_keyword
+    y = Fn.sin @x, threads: 3
+
+    assert_equal 3, Gumath.last_threads
+    assert_in_delta y[0].value, Math.sin(1.0), 0.00001
+    assert_raises(ArgumentError) { Fn.sin @x, threads: 0 }
+  end
+
+  def test_with_threads
+    n = Gumath.with_threads(2) do
+      Fn.sin @x
+      Gumath.last_threads
+    end
+    assert_equal 2, n
+
+    Fn.sin @x, threads: 1
+    Gumath.with_threads(2) { Fn.sin @x, threads: 3 }
+    assert_equal 3, Gumath.last_threads
+  end
+
+  def test_with_threads_is_restored
+    Gumath.with_threads(2) do
+      Gumath.with_threads(3) { Fn.sin @x }
+      Fn.sin @x
+      assert_equal 2, Gumath.last_threads
+    end
+    assert_nil Thread.current[:__gumath_threads__]
+    assert_raises(ArgumentError) { Gumath.with_threads(0) { } }
+  end
+end
+
+class TestLazy < Minitest::Test
+  def setup
+    @f = Gumath::Lazy.new Fn
+    @data = 10_000.times.map { |i| i / 1000.0 }
+    @x = XND.new @data, type: "10000 * float64"
+    @y = XND.new @data.reverse, type: "10000 * float64"
+  end
+
+  def test_elementwise_p
+    functions = Fn.instance_variable_get(:@gumath_functions)
+
+    assert functions[:sin].elementwise?
+    refute functions[:sort].elementwise?
+  end
+
+  def test_blocked_matches_eager
+    e = @f.add(@f.sin(@x), @f.cos(@y))
+    z = e.evaluate block_bytes: 4096
+
+    assert_equal Fn.add(Fn.sin(@x), Fn.cos(@y)).value, z.value
+  end
+
+  def test_shared_subexpression
+    s = @f.sin(@x)
+    z = @f.multiply(s, s).evaluate block_bytes: 8192
+    expected = @data.map { |v| Math.sin(v) ** 2 }
+
+    assert_array_in_delta z.value, expected, 0.00001
+  end
+
+  def test_multi_dimensional_blocks
+    x = XND.new [[1.0, 2.0, 3.0]] * 5000, type: "5000 * 3 * float64"
+    z = @f.sin(@f.sin(x)).evaluate block_bytes: 2048
+
+    assert_equal Fn.sin(Fn.sin(x)).value, z.value
+  end
+
+  def test_root_runs_once_per_block
+    sin = Fn.instance_variable_get(:@gumath_functions)[:sin]
+    rows = []
+    root = Object.new
+    root.define_singleton_method(:elementwise?) { true }
+    root.define_singleton_method(:call) do |*args, **kwargs|
+      rows << [args.first.size, kwargs.key?(:out)]
+      sin.call(*args, **kwargs)
+    end
+
+    e = Gumath::Lazy::Expr.new(root, [@f.cos(@x)])
+    z = e.evaluate block_bytes: 4096
+
+    assert_equal Fn.sin(Fn.cos(@x)).value, z.value
+    assert_equal @x.size, rows.sum { |n, out| out ? n : 0 }
+    assert rows.all? { |n, out| out || n == 1 }
+  end
+
+  def test_falls_back_for_other_kernels
+    z = @f.sort(@f.sin(@x)).evaluate block_bytes: 4096
+
+    assert_equal Fn.sort(Fn.sin(@x)).value, z.value
+  end
+
+  def test_lazy_block
+    z = Gumath.lazy(Fn) { |f| f.sin(@x) }
+
+    assert_equal Fn.sin(@x).value, z.value
+  end
+end
+
+class TestReductions < Minitest::Test
+  R = Gumath::Reductions
+
+  def setup
+    @x = XND.new [[1, 2, 3], [4, 5, 6]], type: "2 * 3 * int64"
+  end
+
+  def test_all_axes
+    assert_equal 21, R.sum(@x).value
+    assert_equal 720, R.prod(@x).value
+    assert_equal 1, R.min(@x).value
+    assert_equal 6, R.max(@x).value
+    assert_in_delta 3.5, R.mean(@x).value, 1e-12
+    assert_in_delta 17.5 / 6, R.var(@x).value, 1e-12
+  end
+
+  def test_one_axis
+    assert_equal [5, 7, 9], R.sum(@x, axis: 0).value
+    assert_equal [6, 15], R.sum(@x, axis: 1).value
+    assert_equal [6, 15], R.sum(@x, axis: -1).value
+    assert_equal [3, 6], R.max(@x, axis: 1).value
+    assert_equal [2.5, 3.5, 4.5], R.mean(@x, axis: 0).value
+  end
+
+  def test_axes_and_keepdims
+    assert_equal 21, R.sum(@x, axis: [0, 1]).value
+    assert_equal [[21]], R.sum(@x, keepdims: true).value
+    assert_equal [[6], [15]], R.sum(@x, axis: 1, keepdims: true).value
+    assert_equal "2 * 1 * int64", R.sum(@x, axis: 1, keepdims: true).type.to_s
+  end
+
+  def test_types
+    x = XND.new [1, 2, 3], type: "3 * uint8"
+    assert_equal "uint64", R.sum(x).type.to_s
+    assert_equal "uint8", R.max(x).type.to_s
+    assert_equal "float64", R.mean(x).type.to_s
+
+    x = XND.new [1.5, 2.5], type: "2 * float32"
+    assert_equal "float64", R.sum(x).type.to_s
+    assert_equal "float32", R.min(x).type.to_s
+  end
+
+  def test_integer_wrap_around
+    x = XND.new [2**62] * 3, type: "3 * int64"
+    assert_equal(-2**62, R.sum(x).value)
+    assert_equal 0, R.prod(x).value
+
+    x = XND.new [-2**63, -1], type: "2 * int64"
+    assert_equal 2**63 - 1, R.sum(x).value
+  end
+
+  def test_missing_values
+    x = XND.new [[1.0, nil], [nil, nil]], type: "2 * 2 * ?float64"
+
+    assert_equal 1.0, R.sum(x).value
+    assert_equal [1.0, nil], R.mean(x, axis: 1).value
+    assert_equal [1.0, nil], R.max(x, axis: 1).value
+  end
+
+  def test_missing_values_for_any_thread_count
+    data = 100.times.map { |i| i % 3 == 0 ? [nil, nil] : [i.to_f, nil] }
+    x = XND.new data, type: "100 * 2 * ?float64"
+    expected = data.map(&:first)
+
+    [1, 4].each do |n|
+      Gumath.with_threads(n) do
+        assert_equal expected, R.max(x, axis: 1).value
+        assert_equal expected, R.mean(x, axis: 1).value
+      end
+    end
+  end
+
+  def test_var_ddof
+    x = XND.new [1.0, 2.0, 3.0, 4.0], type: "4 * float64"
+
+    assert_in_delta 1.25, R.var(x).value, 1e-12
+    assert_in_delta 5.0 / 3, R.var(x, ddof: 1).value, 1e-12
+  end
+
+  def test_nan
+    x = XND.new [1.0, Float::NAN, 3.0], type: "3 * float64"
+
+    assert R.min(x).value.nan?
+    assert R.max(x).value.nan?
+  end
+
+  def test_float_accuracy
+    n = 1_000_000
+    x = XND.new Array.new(n, 0.1), type: "#{n} * float64"
+
+    assert_in_delta 100_000.0, R.sum(x).value, 1e-6
+  end
+
+  def test_same_result_for_any_thread_count
+    n = 300_000
+    data = n.times.map { |i| Math.sin(i) * 1e6 }
+    x = XND.new data, type: "#{n} * float64"
+    y = XND.new data.each_slice(100_000).to_a, type: "3 * 100000 * float64"
+
+    one = Gumath.with_threads(1) { [R.sum(x).value, R.var(y, axis: 1).value] }
+    four = Gumath.with_threads(4) { [R.sum(x).value, R.var(y, axis: 1).value] }
+    assert_equal one, four
+  end
+
+  def test_thread_raise_interrupts_reduction
+    x = XND.empty "4 * 4000000 * float64"
+    t = Thread.new do
+      Thread.current.report_on_exception = false
+      loop { R.var x, axis: 1 }
+    end
+
+    sleep 0.2
+    t.raise RuntimeError, "stop"
+    assert_raises(RuntimeError) { t.join }
+    assert_equal [0.0] * 4, R.var(x, axis: 1).value
+  end
+
+  def test_wakeups_do_not_restart_reduction
+    x = XND.empty "4 * 4000000 * float64"
+    t = Thread.new { R.var x, axis: 1 }
+
+    while t.alive?
+      sleep 0.005
+      begin
+        t.wakeup
+      rescue ThreadError
+        # finished in between
+      end
+    end
+    assert_equal [0.0] * 4, t.value.value
+  end
+
+  def test_exceptions
+    assert_raises(IndexError) { R.sum(@x, axis: 2) }
+    assert_raises(ArgumentError) { R.sum(@x, axis: [1, -1]) }
+    assert_raises(ArgumentError) { R.min(XND.new([], type: "0 * int64")) }
+    assert_raises(TypeError) { R.sum(XND.new(["a"], type: "1 * string")) }
+    assert_raises(TypeError) { R.sum([1, 2]) }
+  end
+end
+
 class TestMissingValues < Minitest::Test
   def test_missing_values
     x = [{'index'=> 0, 'name'=> 'brazil', 'value'=> 10},
@@ -191,6 +1319,94 @@ class TestGraphs < Minitest::Test
   end
 end
 
+class TestGraphKernels < Minitest::Test
+  G = Gumath::Graphs
+
+  def setup
+    @data = [[[1, 1.2], [2, 4.4]],
+             [[2, 2.2]],
+             [[1, 2.3]],
+             [[2, 1.1]]]
+  end
+
+  def path pred, node
+    return [] if pred[node] < 0 && node != @source
+    node == @source ? [node] : path(pred, pred[node]) + [node]
+  end
+
+  def test_dijkstra_matches_example
+    graph = Graph.new @data
+
+    @data.size.times do |start|
+      @source = start
+      dist, pred = G.dijkstra(graph, start)
+      assert_equal "4 * float64", dist.type.to_s
+      expected = Ex.single_source_shortest_paths(graph, XND.new(start, type: "node")).value
+
+      pred.value.each_index do |node|
+        assert_equal expected[node], path(pred.value, node)
+      end
+      assert_equal Float::INFINITY, dist.value[0] unless start == 0
+    end
+
+    assert_in_delta 3.4, G.dijkstra(graph, 3)[0].value[1], 1e-12
+  end
+
+  def test_bfs
+    graph = XND.new [[1, 2], [3], [3], [], [0]], type: "var * var * int64"
+    levels, pred = G.bfs(graph, 0)
+    assert_equal [0, 1, 1, 2, -1], levels.value
+    assert_equal [-1, 0, 0, 1, -1], pred.value
+
+    levels, _ = G.bfs(Graph.new(@data), 3)
+    assert_equal [-1, 2, 1, 0], levels.value
+  end
+
+  def test_many_sources
+    graph = Graph.new @data
+    dist, pred = G.dijkstra(graph, [0, 3, 1])
+    assert_equal "3 * 4 * float64", dist.type.to_s
+    assert_equal "3 * 4 * int64", pred.type.to_s
+    [0, 3, 1].each_with_index do |s, i|
+      assert_equal G.dijkstra(graph, s)[0].value, dist.value[i]
+      assert_equal G.dijkstra(graph, s)[1].value, pred.value[i]
+    end
+
+    levels, _ = G.bfs(graph, [2, 3])
+    assert_equal [[-1, 1, 0, -1], [-1, 2, 1, 0]], levels.value
+  end
+
+  def test_thread_raise_interrupts_search
+    n = 200_000
+    ring = XND.new n.times.map { |i| [(i + 1) % n, (i + 7) % n] }, type: "var * var * int64"
+    t = Thread.new do
+      Thread.current.report_on_exception = false
+      loop { G.bfs ring, (0...8).to_a }
+    end
+
+    sleep 0.2
+    t.raise RuntimeError, "stop"
+    assert_raises(RuntimeError) { t.join }
+
+    one = Gumath.with_threads(1) { G.bfs(ring, [0, 5]).map(&:value) }
+    four = Gumath.with_threads(4) { G.bfs(ring, [0, 5]).map(&:value) }
+    assert_equal one, four
+  end
+
+  def test_exceptions
+    graph = Graph.new @data
+    assert_raises(IndexError) { G.dijkstra graph, 4 }
+    assert_raises(IndexError) { G.bfs graph, [0, -1] }
+    assert_raises(TypeError) { G.dijkstra XND.new([[1], [0]], type: "var * var * int64"), 0 }
+    assert_raises(TypeError) { G.bfs XND.new([[1.0]], type: "var * var * float64"), 0 }
+
+    bad = XND.new [[[1, 1.0]], [[5, 1.0]]], type: "var * var * (int64, float64)"
+    assert_raises(ValueError) { G.dijkstra bad, 0 }
+    negative = XND.new [[[1, -1.0]], []], type: "var * var * (int64, float64)"
+    assert_raises(ValueError) { G.dijkstra negative, 0 }
+  end
+end
+
 class TestPdist < Minitest::Test
   def test_exceptions
     x = XND.new [], dtype: "float64"
@@ -222,3 +1438,135 @@ class TestPdist < Minitest::Test
     assert_equal y.value, [198.78529349275314, 170.0746899276903, 315.75385646576035]
   end
 end
+
+class TestDistances < Minitest::Test
+  D = Gumath::Distances
+
+  def setup
+    @a = [[-1.2200, -100.5000,   20.1250,  30.1230],
+          [ 2.2200,    2.2720, -122.8400, 122.3330],
+          [ 2.1000,  -25.0000,  100.2000, -99.5000]]
+    @b = [[1.0, 2.0, 3.0, 4.0], [0.0, 0.0, 0.0, 0.0],
+          [-5.0, 7.5, 1.0, 2.0], [2.0, -25.0, 100.0, -99.0],
+          [1.0, 2.0, 3.0, 4.0]]
+  end
+
+  def reference metric, x, y
+    case metric
+    when :euclidean then Math.sqrt(x.zip(y).sum { |p, q| (p - q)**2 })
+    when :sqeuclidean then x.zip(y).sum { |p, q| (p - q)**2 }
+    when :manhattan then x.zip(y).sum { |p, q| (p - q).abs }
+    when :cosine
+      dot = x.zip(y).sum { |p, q| p * q }
+      1 - dot / Math.sqrt(x.sum { |p| p * p } * y.sum { |q| q * q })
+    end
+  end
+
+  def assert_close expected, actual, delta
+    expected.flatten.zip(actual.flatten).each do |e, a|
+      if e.nan?
+        assert a.nan?
+      else
+        assert_in_delta e, a, delta * (1 + e.abs)
+      end
+    end
+  end
+
+  def test_pdist
+    x = XND.new @a, dtype: "float64"
+    assert_close [198.78529349275314, 170.0746899276903, 315.75385646576035],
+                 D.pdist(x).value, 1e-12
+
+    [:sqeuclidean, :cosine, :manhattan].each do |metric|
+      expected = [[0, 1], [0, 2], [1, 2]].map { |i, j| reference(metric, @a[i], @a[j]) }
+      assert_close expected, D.pdist(x, metric: metric).value, 1e-12
+    end
+
+    assert_equal [], D.pdist(XND.new([[1.0, 2.0]], dtype: "float64")).value
+  end
+
+  def test_cdist
+    a = XND.new @a, dtype: "float64"
+    b = XND.new @b, dtype: "float64"
+
+    [:euclidean, :sqeuclidean, :cosine, :manhattan].each do |metric|
+      d = D.cdist(a, b, metric: metric)
+      assert_equal "3 * 5 * float64", d.type.to_s
+      expected = @a.map { |x| @b.map { |y| reference(metric, x, y) } }
+      assert_close expected, d.value, 1e-12
+    end
+
+    # The zero row of b has no cosine distance.
+    assert D.cdist(a, b, metric: :cosine).value[0][1].nan?
+  end
+
+  def test_float32_and_views
+    a = XND.new @a, dtype: "float32"
+    b = XND.new @b, dtype: "float32"
+    d = D.cdist(a, b, metric: :manhattan)
+    assert_equal "3 * 5 * float32", d.type.to_s
+    assert_close @a.map { |x| @b.map { |y| reference(:manhattan, x, y) } }, d.value, 1e-5
+
+    x = XND.new @a, dtype: "float64"
+    view = D.cdist(x[0..2, 1..3], x[1..2, 1..3]).value
+    expected = @a.map { |p| @a[1..2].map { |q| reference(:euclidean, p[1..3], q[1..3]) } }
+    assert_close expected, view, 1e-12
+  end
+
+  def test_knn
+    a = XND.new @a, dtype: "float64"
+    b = XND.new @b, dtype: "float64"
+
+    dist, idx = D.knn(a, b, 3, metric: :sqeuclidean)
+    assert_equal "3 * 3 * float64", dist.type.to_s
+    assert_equal "3 * 3 * int64", idx.type.to_s
+
+    @a.each_with_index do |x, i|
+      # Stable sort: equal distances keep the lower index first.
+      order = @b.each_index.sort_by { |j| [reference(:sqeuclidean, x, @b[j]), j] }
+      assert_equal order[0, 3], idx.value[i]
+      assert_close order[0, 3].map { |j| reference(:sqeuclidean, x, @b[j]) }, dist.value[i], 1e-12
+    end
+
+    # Rows 0 and 4 of b are equal.
+    _, idx = D.knn(b, b, 2)
+    assert_equal [0, 4], idx.value[0]
+    assert_equal [0, 4], idx.value[4]
+
+    # The NaN distance to the zero row comes last.
+    _, idx = D.knn(a, b, 5, metric: :cosine)
+    assert_equal 1, idx.value[0][4]
+  end
+
+  def test_thread_count
+    data = 300.times.map { |i| 16.times.map { |j| Math.sin(i * 16 + j) } }
+    x = XND.new data, dtype: "float64"
+
+    one = Gumath.with_threads(1) { D.knn(x, x, 5).map(&:value) }
+    four = Gumath.with_threads(4) { D.knn(x, x, 5).map(&:value) }
+    assert_equal one, four
+  end
+
+  def test_thread_raise_interrupts_pdist
+    x = XND.empty "3000 * 128 * float64"
+    t = Thread.new do
+      Thread.current.report_on_exception = false
+      loop { D.pdist x }
+    end
+
+    sleep 0.2
+    t.raise RuntimeError, "stop"
+    assert_raises(RuntimeError) { t.join }
+  end
+
+  def test_exceptions
+    a = XND.new @a, dtype: "float64"
+    assert_raises(TypeError) { D.pdist XND.new([1.0, 2.0], dtype: "float64") }
+    assert_raises(TypeError) { D.pdist XND.new([[1, 2]], dtype: "int64") }
+    assert_raises(TypeError) { D.cdist a, XND.new(@b, dtype: "float32") }
+    assert_raises(ArgumentError) { D.cdist a, XND.new([[1.0, 2.0]], dtype: "float64") }
+    assert_raises(ArgumentError) { D.pdist a, metric: :chebyshev }
+    assert_raises(ArgumentError) { D.knn a, a, 4 }
+    assert_raises(ArgumentError) { D.knn a, a, 0 }
+  end
+end
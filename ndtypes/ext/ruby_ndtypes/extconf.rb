@@ -13,7 +13,9 @@ end
   have_header(header)
 end
 
-basenames = %w{gc_guard ruby_ndtypes}
+have_func("rb_gc_mark_movable", "ruby.h")
+
+basenames = %w{gc_guard type_cache ruby_ndtypes}
 $objs = basenames.map { |b| "#{b}.o"   }
 $srcs = basenames.map { |b| "#{b}.c" }
 
@@ -4,6 +4,9 @@
 
 #define GC_GUARD_TABLE_NAME "@__gc_guard_table"
 
+/* The table is a Ruby Hash keyed by the address of the C struct, which never
+   moves. Hash marks its values as movable and updates them on GC.compact,
+   so the table is compaction-safe and pins nothing. */
 static ID id_gc_guard_table;
 
 /* Unregister an NDT object-rbuf pair from the GC guard. */
@@ -4,6 +4,7 @@
  */
 
 #include "ruby_ndtypes_internal.h"
+#include "type_cache.h"
 
 /* ---------- Interal declarations ---------- */
 /* data_type_t variables. */
@@ -114,11 +115,22 @@ ResourceBufferObject_dfree(void * self)
   xfree(rbf);
 }
 
-/* Calculate the size of the object. */
+/* Calculate the size of the object, including the offset arrays. */
 static size_t
 ResourceBufferObject_dsize(const void *self)
 {
-  return sizeof(ResourceBufferObject);           
+  const ResourceBufferObject *rbf = (const ResourceBufferObject*)self;
+  size_t size = sizeof(ResourceBufferObject);
+  int i;
+
+  if (rbf->m != NULL) {
+    size += sizeof(ndt_meta_t);
+    for (i = 0; i < rbf->m->ndims; i++) {
+      size += rbf->m->noffsets[i] * sizeof(int32_t);
+    }
+  }
+
+  return size;
 }
 
 static const rb_data_type_t ResourceBufferObject_type = {
@@ -130,7 +142,7 @@ static const rb_data_type_t ResourceBufferObject_type = {
     .reserved = {0,0},
   },
   .parent = 0,
-  .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+  .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED,
 };
 
 /* FIXME: change this to rbuf_alloc to reflect that its not called by Ruby alloc. */
@@ -267,8 +279,19 @@ NdtObject_dmark(void * self)
 {
   NdtObject * ndt = (NdtObject*)self;
   
-  rb_gc_mark(ndt->rbuf);
+  rb_gc_mark_movable(ndt->rbuf);
+}
+
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+/* Update references moved by GC.compact. */
+static void
+NdtObject_dcompact(void * self)
+{
+  NdtObject * ndt = (NdtObject*)self;
+
+  ndt->rbuf = rb_gc_location(ndt->rbuf);
 }
+#endif
 
 /* GC free the NdtObject struct. */
 static void
@@ -280,11 +303,58 @@ NdtObject_dfree(void * self)
   xfree(ndt);
 }
 
-/* Calculate the size of the object. */
+/* Approximate number of bytes allocated by libndtypes for the type tree t.
+   Offset arrays of var dimensions live in the resource buffer and are
+   counted there. */
+static size_t
+ndt_nbytes(const ndt_t *t)
+{
+  size_t size = sizeof(ndt_t);
+  int64_t i;
+
+  if (t == NULL) {
+    return 0;
+  }
+
+  switch (t->tag) {
+  case FixedDim:
+    return size + ndt_nbytes(t->FixedDim.type);
+  case VarDim:
+    return size + ndt_nbytes(t->VarDim.type);
+  case Ref:
+    return size + ndt_nbytes(t->Ref.type);
+  case Constr:
+    return size + strlen(t->Constr.name) + 1 + ndt_nbytes(t->Constr.type);
+  case Nominal:
+    /* the underlying type belongs to the typedef table */
+    return size + strlen(t->Nominal.name) + 1;
+  case Tuple:
+    for (i = 0; i < t->Tuple.shape; i++) {
+      size += sizeof(ndt_t *) + sizeof(int64_t) + 2 * sizeof(uint16_t);
+      size += ndt_nbytes(t->Tuple.types[i]);
+    }
+    return size;
+  case Record:
+    for (i = 0; i < t->Record.shape; i++) {
+      size += sizeof(char *) + strlen(t->Record.names[i]) + 1;
+      size += sizeof(ndt_t *) + sizeof(int64_t) + 2 * sizeof(uint16_t);
+      size += ndt_nbytes(t->Record.types[i]);
+    }
+    return size;
+  case Categorical:
+    return size + t->Categorical.ntypes * sizeof(ndt_value_t);
+  default:
+    return size;
+  }
+}
+
+/* Calculate the size of the object, including the type it owns. */
 static size_t
 NdtObject_dsize(const void *self)
 {
-  return sizeof(NdtObject);
+  const NdtObject *ndt = (const NdtObject*)self;
+
+  return sizeof(NdtObject) + ndt_nbytes(ndt->ndt);
 }
 
 static const rb_data_type_t NdtObject_type = {
@@ -293,10 +363,15 @@ static const rb_data_type_t NdtObject_type = {
     .dmark = NdtObject_dmark,
     .dfree = NdtObject_dfree,
     .dsize = NdtObject_dsize,
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    .dcompact = NdtObject_dcompact,
+    .reserved = {0},
+#else
     .reserved = {0,0},
+#endif
   },
   .parent = 0,
-  .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+  .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED,
 };
 
 /* Allocate an NDT object and return a Ruby object. Used for Ruby class initialization. */
@@ -340,6 +415,7 @@ NDTypes_from_object(VALUE self, VALUE type)
   NDT_STATIC_CONTEXT(ctx);
   const char *cp;
   NdtObject *ndt_p;
+  rb_ndtypes_cache_value_t *cached;
 
   if (NDT_CHECK_TYPE(type)) {
     return rb_funcall(type, rb_intern("dup"), 0, NULL);
@@ -348,7 +424,15 @@ NDTypes_from_object(VALUE self, VALUE type)
   cp = StringValuePtr(type);
 
   GET_NDT(self, ndt_p);
-  RBUF(ndt_p) = rbuf_allocate();
+  cached = rb_ndtypes_cache_lookup(cp, RSTRING_LEN(type));
+  if (cached != NULL) {
+    /* the cache keeps the rbuf alive, no GC guard entry is needed */
+    RB_OBJ_WRITE(self, &RBUF(ndt_p), cached->rbuf);
+    NDT(ndt_p) = (ndt_t *)cached->ndt;
+    return self;
+  }
+
+  RB_OBJ_WRITE(self, &RBUF(ndt_p), rbuf_allocate());
   if (RBUF(ndt_p) == NULL) {
     rb_raise(rb_eNoMemError, "problem in allocating RBUF object.");
   }
@@ -360,6 +444,7 @@ NDTypes_from_object(VALUE self, VALUE type)
     seterr(&ctx);
     raise_error();
   }
+  rb_ndtypes_cache_insert(cp, RSTRING_LEN(type), NDT(ndt_p), RBUF(ndt_p));
 
   return self; 
 }
@@ -378,7 +463,7 @@ NDTypes_from_offsets_and_dtype(VALUE offsets, VALUE type)
 
   self = NdtObject_alloc();
   GET_NDT(self, self_p);
-  RBUF(self_p) = rbuf_from_offset_lists(offsets);
+  RB_OBJ_WRITE(self, &RBUF(self_p), rbuf_from_offset_lists(offsets));
   NDT(self_p) = ndt_from_metadata_and_dtype(rbuf_ndt_meta(self_p), cp, &ctx);
 
   rb_ndtypes_gc_guard_register(self_p, RBUF(self_p));
@@ -392,6 +477,9 @@ NDTypes_initialize(int argc, VALUE *argv, VALUE self)
 {
   NdtObject *ndt_p;
   VALUE offsets = Qnil, type;
+
+  /* types shared through the cache are frozen */
+  rb_check_frozen(self);
   
   if (argc < 1) {
     rb_raise(rb_eArgError, "expected atleast type. offset optional. Number of args: %d.",
@@ -711,6 +799,7 @@ NDTypes_s_deserialize(VALUE klass, VALUE str)
   }
 
   rbuf = WRAP_RBUF(cNDTypes_RBuf, rbuf_p);
+  /* ndt_p is not wrapped yet, so no write barrier is needed. */
   RBUF(ndt_p) = rbuf;
   rb_ndtypes_gc_guard_register(ndt_p, rbuf);
   ndt = WRAP_NDT(cNDTypes, ndt_p);
@@ -890,7 +979,7 @@ rb_ndtypes_move_subtree(VALUE src, ndt_t *t)
   }
 
   GET_NDT(src, src_p);
-  RBUF(dest_p) = RBUF(src_p);
+  RB_OBJ_WRITE(dest, &RBUF(dest_p), RBUF(src_p));
 
   rb_ndtypes_gc_guard_register(dest_p, RBUF(dest_p));
 
@@ -898,6 +987,8 @@ rb_ndtypes_move_subtree(VALUE src, ndt_t *t)
 }
 
 /* Create NDT object from String. Returns the same object if type is NDT. 
+   Strings are looked up in the type cache, and every call with the same
+   string returns the same frozen NDT object while it stays cached.
    
    @param type String object containing description of type.
    @return New NDT object.
@@ -909,6 +1000,7 @@ rb_ndtypes_from_object(VALUE type)
   VALUE copy;
   NdtObject *copy_p;
   const char *cp;
+  rb_ndtypes_cache_value_t *cached;
   
   if (NDT_CHECK_TYPE(type)) {
     return type;
@@ -922,18 +1014,35 @@ rb_ndtypes_from_object(VALUE type)
              "error is getting C string from type in rb_ndtypes_from_object.");
   }
 
+  cached = rb_ndtypes_cache_lookup(cp, RSTRING_LEN(type));
+  if (cached != NULL && cached->type != Qnil) {
+    return cached->type;
+  }
+
   copy = NdtObject_alloc();
   GET_NDT(copy, copy_p);
 
-  RBUF(copy_p) = rbuf_allocate();
-  NDT(copy_p) = ndt_from_string_fill_meta(
-                                          rbuf_ndt_meta(copy),
-                                          cp, &ctx);
-  if (NDT(copy_p) == NULL) {
-    seterr(&ctx);
-    raise_error();
+  if (cached != NULL) {
+    RB_OBJ_WRITE(copy, &RBUF(copy_p), cached->rbuf);
+    NDT(copy_p) = (ndt_t *)cached->ndt;
+  }
+  else {
+    RB_OBJ_WRITE(copy, &RBUF(copy_p), rbuf_allocate());
+    NDT(copy_p) = ndt_from_string_fill_meta(
+                                            rbuf_ndt_meta(copy),
+                                            cp, &ctx);
+    if (NDT(copy_p) == NULL) {
+      seterr(&ctx);
+      raise_error();
+    }
+    rb_ndtypes_gc_guard_register(copy_p, RBUF(copy_p));
+    cached = rb_ndtypes_cache_insert(cp, RSTRING_LEN(type), NDT(copy_p), RBUF(copy_p));
+  }
+
+  if (cached != NULL) {
+    rb_obj_freeze(copy);
+    rb_ndtypes_cache_set_type(cached, copy);
   }
-  rb_ndtypes_gc_guard_register(copy_p, RBUF(copy_p));
 
   return copy;
 }
@@ -999,5 +1108,8 @@ void Init_ruby_ndtypes(void)
 
   /* GC guard init */
   rb_ndtypes_init_gc_guard();
+
+  /* Type string cache */
+  rb_ndtypes_init_type_cache(cNDTypes);
 }
 
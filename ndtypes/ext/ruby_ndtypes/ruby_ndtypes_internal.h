@@ -15,6 +15,11 @@ typedef struct NdtObject NdtObject;
 typedef struct ResourceBufferObject ResourceBufferObject;
 
 /* macros */
+/* Ruby < 2.7 has no compaction: movable marks degrade to pinning marks. */
+#ifndef HAVE_RB_GC_MARK_MOVABLE
+#define rb_gc_mark_movable(v) rb_gc_mark(v)
+#endif
+
 #if SIZEOF_LONG == SIZEOF_VOIDP
 # define PTR2NUM(x)   (LONG2NUM((long)(x)))
 # define NUM2PTR(x)   ((void*)(NUM2ULONG(x)))
@@ -0,0 +1,281 @@
+/* Bounded LRU cache from type strings to parsed types.
+ *
+ * XND.new(data, type: "100 * float64") in a loop would otherwise lex and
+ * parse the same string and allocate a new resource buffer on every call.
+ * Entries are looked up by the exact bytes of the string in a chained hash
+ * table and kept on a most recently used list; when the cache is full the
+ * least recently used entry is dropped. Types are never freed by NDT
+ * objects, so an evicted type stays valid for the objects still using it.
+ *
+ * The cache is only touched from Ruby methods and from C API calls that
+ * must hold the GVL, which serializes all access to it.
+ */
+
+#include "type_cache.h"
+
+#define TYPE_CACHE_DEFAULT_CAPACITY 256
+
+typedef struct {
+  char *key;
+  long len;
+  st_index_t hash;
+  rb_ndtypes_cache_value_t value;
+  long prev, next;              /* recency list, most recent first */
+  long chain;                   /* next entry in the same bucket */
+} cache_entry_t;
+
+static struct {
+  cache_entry_t *entries;
+  long capacity;
+  long size;
+  long *buckets;                /* first entry of each bucket, or -1 */
+  long nbuckets;                /* a power of two */
+  long head, tail;              /* most and least recently used */
+  unsigned long long hits, misses, evictions;
+} cache = { NULL, 0, 0, NULL, 0, -1, -1, 0, 0, 0 };
+
+/* Marks the cached types and resource buffers. */
+static VALUE cache_holder;
+
+static void
+cache_mark(void *self)
+{
+  long i;
+
+  for (i = 0; i < cache.size; i++) {
+    rb_gc_mark(cache.entries[i].value.rbuf);
+    rb_gc_mark(cache.entries[i].value.type);
+  }
+}
+
+static const rb_data_type_t cache_holder_type = {
+  .wrap_struct_name = "NDTypesTypeCache",
+  .function = {
+    .dmark = cache_mark,
+    .dfree = 0,
+    .dsize = 0,
+  },
+  .parent = 0,
+  .flags = 0,
+};
+
+static void
+cache_free_entries(void)
+{
+  long i;
+
+  for (i = 0; i < cache.size; i++) {
+    xfree(cache.entries[i].key);
+  }
+  xfree(cache.entries);
+  xfree(cache.buckets);
+
+  cache.entries = NULL;
+  cache.buckets = NULL;
+  cache.size = 0;
+  cache.nbuckets = 0;
+  cache.head = cache.tail = -1;
+}
+
+static void
+cache_resize(long capacity)
+{
+  long i;
+
+  cache_free_entries();
+  cache.capacity = capacity;
+  if (capacity == 0) {
+    return;
+  }
+
+  cache.nbuckets = 1;
+  while (cache.nbuckets < 2 * capacity) {
+    cache.nbuckets <<= 1;
+  }
+  cache.entries = ALLOC_N(cache_entry_t, capacity);
+  cache.buckets = ALLOC_N(long, cache.nbuckets);
+  for (i = 0; i < cache.nbuckets; i++) {
+    cache.buckets[i] = -1;
+  }
+}
+
+static void
+lru_unlink(long i)
+{
+  cache_entry_t *e = &cache.entries[i];
+
+  if (e->prev >= 0) {
+    cache.entries[e->prev].next = e->next;
+  }
+  else {
+    cache.head = e->next;
+  }
+  if (e->next >= 0) {
+    cache.entries[e->next].prev = e->prev;
+  }
+  else {
+    cache.tail = e->prev;
+  }
+}
+
+static void
+lru_push_front(long i)
+{
+  cache_entry_t *e = &cache.entries[i];
+
+  e->prev = -1;
+  e->next = cache.head;
+  if (cache.head >= 0) {
+    cache.entries[cache.head].prev = i;
+  }
+  cache.head = i;
+  if (cache.tail < 0) {
+    cache.tail = i;
+  }
+}
+
+static void
+chain_unlink(long i)
+{
+  long *p = &cache.buckets[cache.entries[i].hash & (cache.nbuckets - 1)];
+
+  while (*p != i) {
+    p = &cache.entries[*p].chain;
+  }
+  *p = cache.entries[i].chain;
+}
+
+rb_ndtypes_cache_value_t *
+rb_ndtypes_cache_lookup(const char *str, long len)
+{
+  st_index_t hash;
+  long i;
+
+  if (cache.capacity == 0) {
+    cache.misses++;
+    return NULL;
+  }
+
+  hash = rb_memhash(str, len);
+  for (i = cache.buckets[hash & (cache.nbuckets - 1)]; i >= 0; i = cache.entries[i].chain) {
+    cache_entry_t *e = &cache.entries[i];
+    if (e->hash == hash && e->len == len && memcmp(e->key, str, len) == 0) {
+      if (cache.head != i) {
+        lru_unlink(i);
+        lru_push_front(i);
+      }
+      cache.hits++;
+      return &e->value;
+    }
+  }
+
+  cache.misses++;
+  return NULL;
+}
+
+/* Adds a parse that rb_ndtypes_cache_lookup missed. Returns NULL if the
+   cache is disabled. */
+rb_ndtypes_cache_value_t *
+rb_ndtypes_cache_insert(const char *str, long len, const ndt_t *ndt, VALUE rbuf)
+{
+  cache_entry_t *e;
+  long i, b;
+
+  if (cache.capacity == 0) {
+    return NULL;
+  }
+
+  if (cache.size < cache.capacity) {
+    i = cache.size++;
+  }
+  else {
+    i = cache.tail;
+    lru_unlink(i);
+    chain_unlink(i);
+    xfree(cache.entries[i].key);
+    cache.evictions++;
+  }
+
+  e = &cache.entries[i];
+  e->key = ALLOC_N(char, len + 1);
+  memcpy(e->key, str, len);
+  e->key[len] = '\0';
+  e->len = len;
+  e->hash = rb_memhash(str, len);
+  e->value.ndt = ndt;
+  e->value.rbuf = rbuf;
+  e->value.type = Qnil;
+
+  b = e->hash & (cache.nbuckets - 1);
+  e->chain = cache.buckets[b];
+  cache.buckets[b] = i;
+  lru_push_front(i);
+
+  return &e->value;
+}
+
+void
+rb_ndtypes_cache_set_type(rb_ndtypes_cache_value_t *value, VALUE type)
+{
+  value->type = type;
+}
+
+/* NDTypes.cache_stats: hits, misses and evictions since the last
+   cache_clear, with the current size and capacity. */
+static VALUE
+NDTypes_s_cache_stats(VALUE klass)
+{
+  VALUE hash = rb_hash_new();
+
+  rb_hash_aset(hash, ID2SYM(rb_intern("hits")), ULL2NUM(cache.hits));
+  rb_hash_aset(hash, ID2SYM(rb_intern("misses")), ULL2NUM(cache.misses));
+  rb_hash_aset(hash, ID2SYM(rb_intern("evictions")), ULL2NUM(cache.evictions));
+  rb_hash_aset(hash, ID2SYM(rb_intern("size")), LONG2NUM(cache.size));
+  rb_hash_aset(hash, ID2SYM(rb_intern("capacity")), LONG2NUM(cache.capacity));
+
+  return hash;
+}
+
+/* NDTypes.cache_clear: drops every entry and resets the counters. */
+static VALUE
+NDTypes_s_cache_clear(VALUE klass)
+{
+  cache_resize(cache.capacity);
+  cache.hits = cache.misses = cache.evictions = 0;
+
+  return Qnil;
+}
+
+static VALUE
+NDTypes_s_cache_capacity(VALUE klass)
+{
+  return LONG2NUM(cache.capacity);
+}
+
+/* NDTypes.cache_capacity = n: clears the cache and bounds it to n entries;
+   0 disables it. */
+static VALUE
+NDTypes_s_set_cache_capacity(VALUE klass, VALUE capacity)
+{
+  const long n = NUM2LONG(capacity);
+
+  if (n < 0) {
+    rb_raise(rb_eArgError, "cache capacity must be >= 0.");
+  }
+  cache_resize(n);
+
+  return capacity;
+}
+
+void
+rb_ndtypes_init_type_cache(VALUE cNDTypes)
+{
+  cache_holder = TypedData_Wrap_Struct(0, &cache_holder_type, NULL);
+  rb_gc_register_mark_object(cache_holder);
+  cache_resize(TYPE_CACHE_DEFAULT_CAPACITY);
+
+  rb_define_singleton_method(cNDTypes, "cache_stats", NDTypes_s_cache_stats, 0);
+  rb_define_singleton_method(cNDTypes, "cache_clear", NDTypes_s_cache_clear, 0);
+  rb_define_singleton_method(cNDTypes, "cache_capacity", NDTypes_s_cache_capacity, 0);
+  rb_define_singleton_method(cNDTypes, "cache_capacity=", NDTypes_s_set_cache_capacity, 1);
+}
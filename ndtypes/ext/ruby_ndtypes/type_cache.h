@@ -0,0 +1,23 @@
+/* Header file for the cache of types parsed from strings. */
+
+#ifndef TYPE_CACHE_H
+#define TYPE_CACHE_H
+
+#include "ruby_ndtypes_internal.h"
+
+/* A cached parse. The type and the resource buffer holding its offsets are
+   shared by every NDT object made from the same string and must not be
+   modified. */
+typedef struct {
+  const ndt_t *ndt;
+  VALUE rbuf;
+  VALUE type;       /* frozen NDT object for rb_ndtypes_from_object, or Qnil */
+} rb_ndtypes_cache_value_t;
+
+rb_ndtypes_cache_value_t *rb_ndtypes_cache_lookup(const char *str, long len);
+rb_ndtypes_cache_value_t *rb_ndtypes_cache_insert(const char *str, long len,
+                                                  const ndt_t *ndt, VALUE rbuf);
+void rb_ndtypes_cache_set_type(rb_ndtypes_cache_value_t *value, VALUE type);
+void rb_ndtypes_init_type_cache(VALUE cNDTypes);
+
+#endif  /* TYPE_CACHE_H */
@@ -8,3 +8,22 @@ describe "global GC guard table" do
     expect(gc_table.keys.size).to eq(1)
   end
 end
+
+describe "GC.compact" do
+  it "keeps NDT objects and their resource buffers valid when objects move" do
+    skip "GC.compact is not supported" unless GC.respond_to?(:verify_compaction_references)
+
+    strs = Array.new(500) { |i| "#{i + 1} * {a: int64, b: 2 * float64}" }
+    types = strs.map { |s| NDT.new s }
+    vars = Array.new(100) { NDT.new "var(offsets=[0,2]) * var(offsets=[0,3,10]) * int8" }
+
+    3.times do
+      GC.verify_compaction_references(toward: :empty)
+
+      types.each_with_index do |t, i|
+        expect(t).to eq(NDT.new(strs[i]))
+      end
+      expect(vars.map(&:to_s).uniq.size).to eq(1)
+    end
+  end
+end
@@ -271,6 +271,65 @@ describe NDTypes do
     end
   end
 
+  context "memsize" do
+    it "includes the type tree" do
+      require 'objspace'
+
+      small = NDT.new "int64"
+      large = NDT.new "{#{(0...100).map { |i| "field#{i}: 10 * int64" }.join(', ')}}"
+
+      expect(ObjectSpace.memsize_of(large)).to be > ObjectSpace.memsize_of(small)
+    end
+  end
+
+  context "type cache" do
+    before { NDT.cache_clear }
+    after { NDT.cache_capacity = 256 }
+
+    it "parses a string once and counts hits and misses" do
+      t = NDT.new "100 * float64"
+      u = NDT.new "100 * float64"
+
+      expect(t).to eq(u)
+      expect(t).not_to be(u)
+      expect(NDT.cache_stats).to include(hits: 1, misses: 1, size: 1)
+    end
+
+    it "is bounded and drops the least recently used type" do
+      NDT.cache_capacity = 2
+      NDT.new "1 * int8"
+      NDT.new "2 * int8"
+      NDT.new "1 * int8"
+      NDT.new "3 * int8"
+
+      expect(NDT.cache_stats).to include(size: 2, evictions: 1)
+      NDT.new "1 * int8"
+      expect(NDT.cache_stats[:hits]).to eq(2)
+      NDT.new "2 * int8"
+      expect(NDT.cache_stats[:misses]).to eq(4)
+    end
+
+    it "shares var dimension offsets safely" do
+      s = "var(offsets=[0,2]) * var(offsets=[0,3,10]) * int8"
+      types = Array.new(3) { NDT.new s }
+      GC.start
+
+      expect(types.map(&:to_s).uniq).to eq([types.first.to_s])
+      expect(types.first.concrete?).to eq(true)
+    end
+
+    it "does not cache errors and can be disabled" do
+      expect { NDT.new "100 * foo_not_a_type" }.to raise_error(ValueError)
+      expect(NDT.cache_stats[:size]).to eq(0)
+
+      NDT.cache_capacity = 0
+      NDT.new "int64"
+      NDT.new "int64"
+      expect(NDT.cache_stats).to include(hits: 0, size: 0, capacity: 0)
+      expect { NDT.cache_capacity = -1 }.to raise_error(ArgumentError)
+    end
+  end
+
   context "#dup" do
     DTYPE_TEST_CASES.each do |dtype, mem|
       it "dtype: #{dtype}" do
@@ -0,0 +1,64 @@
+# Measures GC time while a large number of XND views are alive.
+#
+# WB-protected objects that are old are skipped by minor GCs. To compare the
+# typed data flags before and after a change, build both trees and pass the
+# load paths of each; every tree is measured in its own process and gets one
+# column:
+#
+#   ruby -Ilib benchmark/gc_views.rb [nviews]
+#   ruby benchmark/gc_views.rb [nviews] OLD_TREE/lib NEW_TREE/lib
+
+require 'benchmark'
+require 'rbconfig'
+
+nviews = (ARGV[0] || 200_000).to_i
+libs = ARGV[1..] || []
+
+def time_gcs(kind, n)
+  Benchmark.realtime do
+    n.times { GC.start(full_mark: kind == :major, immediate_sweep: true) }
+  end / n
+end
+
+# Returns [live views, minor ms, major ms, remembered shady objects].
+def measure(nviews)
+  require 'xnd'
+
+  base = XND.new (0...1000).to_a, type: "1000 * int64"
+  views = Array.new(nviews) { |i| base[i % 1000] }
+
+  # Promote everything to the old generation.
+  4.times { GC.start }
+
+  minor = time_gcs(:minor, 20)
+  major = time_gcs(:major, 5)
+
+  [views.size, minor * 1000, major * 1000,
+   GC.stat(:remembered_wb_unprotected_objects)]
+end
+
+if ENV["GC_VIEWS_CHILD"]
+  puts measure(nviews).join(" ")
+  exit
+end
+
+results =
+  if libs.empty?
+    [measure(nviews)]
+  else
+    libs.map do |lib|
+      out = IO.popen({ "GC_VIEWS_CHILD" => "1" },
+                     [RbConfig.ruby, "-I", lib, __FILE__, nviews.to_s], &:read)
+      out.split.map(&:to_f)
+    end
+  end
+
+def row(label, cells)
+  puts format("%-18s", label) + cells.map { |c| format("%14s", c) }.join
+end
+
+row("", libs.map { |l| File.basename(File.dirname(l)) }) unless libs.empty?
+row("live views:",        results.map { |r| r[0].to_i })
+row("minor GC (avg ms):", results.map { |r| format("%.3f", r[1]) })
+row("major GC (avg ms):", results.map { |r| format("%.3f", r[2]) })
+row("remembered shady:",  results.map { |r| r[3].to_i })
@@ -0,0 +1,140 @@
+/* BSD 3-Clause License
+ *
+ * Copyright (c) 2018, Quansight and Sameer Deshmukh
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * * Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from
+ *   this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Streaming non-cryptographic hash used for XND#hash and XND#digest.
+
+   The mixing functions are those of xxHash64. Every call to update consumes
+   its chunk eight bytes at a time, so hashing large contiguous buffers costs
+   roughly one multiply per word. The result depends on how the input is split
+   into chunks, which is fine for our purposes since two XND objects with the
+   same type are always fed to the hash in the same chunks.
+*/
+
+#include <string.h>
+#include "content_hash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t
+rotl64(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+read64(const unsigned char *p)
+{
+  uint64_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t
+read32(const unsigned char *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t
+mix_word(uint64_t h, uint64_t k)
+{
+  k *= PRIME64_2;
+  k = rotl64(k, 31);
+  k *= PRIME64_1;
+  h ^= k;
+  return rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+}
+
+void
+rb_xnd_content_hash_init(content_hash_t *state, uint64_t seed)
+{
+  state->h = seed + PRIME64_5;
+  state->len = 0;
+}
+
+/* Feed len bytes starting at data into the hash. */
+void
+rb_xnd_content_hash_update(content_hash_t *state, const void *data, size_t len)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  const unsigned char * const end = p + len;
+  uint64_t h = state->h;
+
+  while (p + 8 <= end) {
+    h = mix_word(h, read64(p));
+    p += 8;
+  }
+
+  if (p + 4 <= end) {
+    h ^= (uint64_t)read32(p) * PRIME64_1;
+    h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+
+  while (p < end) {
+    h ^= (*p) * PRIME64_5;
+    h = rotl64(h, 11) * PRIME64_1;
+    p++;
+  }
+
+  state->h = h;
+  state->len += len;
+}
+
+/* Feed a single 64-bit word (lengths, tags, markers) into the hash. */
+void
+rb_xnd_content_hash_u64(content_hash_t *state, uint64_t value)
+{
+  state->h = mix_word(state->h, value);
+  state->len += sizeof(value);
+}
+
+uint64_t
+rb_xnd_content_hash_final(const content_hash_t *state)
+{
+  uint64_t h = state->h + state->len;
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+
+  return h;
+}
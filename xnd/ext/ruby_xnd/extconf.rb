@@ -10,7 +10,10 @@ end
   have_header(header)
 end
 
-basenames = %w{float_pack_unpack gc_guard ruby_xnd}
+have_func("rb_gc_adjust_memory_usage", "ruby.h")
+have_func("rb_gc_mark_movable", "ruby.h")
+
+basenames = %w{float_pack_unpack gc_guard content_hash ruby_xnd}
 $objs = basenames.map { |b| "#{b}.o"   }
 $srcs = basenames.map { |b| "#{b}.c" }
 
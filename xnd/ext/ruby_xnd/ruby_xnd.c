@@ -83,6 +83,7 @@ xnd_ellipsis(void)
 typedef struct MemoryBlockObject {
   VALUE type;        /* type owner (ndtype) */  
   xnd_master_t *xnd; /* memblock owner */
+  size_t nbytes;     /* bytes owned by xnd, as reported to the GC */
 } MemoryBlockObject;
 
 #define GET_MBLOCK(obj, mblock_p) do {                              \
@@ -100,9 +101,20 @@ MemoryBlockObject_dmark(void *self)
 {
   MemoryBlockObject *mblock = (MemoryBlockObject*)self;
 
-  rb_gc_mark(mblock->type);
+  rb_gc_mark_movable(mblock->type);
 }
 
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+/* Update references moved by GC.compact. */
+static void
+MemoryBlockObject_dcompact(void *self)
+{
+  MemoryBlockObject *mblock = (MemoryBlockObject*)self;
+
+  mblock->type = rb_gc_location(mblock->type);
+}
+#endif
+
 static void
 MemoryBlockObject_dfree(void *self)
 {
@@ -110,13 +122,25 @@ MemoryBlockObject_dfree(void *self)
 
   xnd_del(mblock->xnd);
   mblock->xnd = NULL;
+#ifdef HAVE_RB_GC_ADJUST_MEMORY_USAGE
+  rb_gc_adjust_memory_usage(-(ssize_t)mblock->nbytes);
+#endif
   xfree(mblock);
 }
 
+/* The buffer itself is reported by the XND object that views all of it, see
+   XndObject_dsize. */
 static size_t
 MemoryBlockObject_dsize(const void *self)
 {
-  return sizeof(MemoryBlockObject);
+  const MemoryBlockObject *mblock = (const MemoryBlockObject*)self;
+  size_t size = sizeof(MemoryBlockObject);
+
+  if (mblock->xnd != NULL) {
+    size += sizeof(xnd_master_t);
+  }
+
+  return size;
 }
 
 static const rb_data_type_t MemoryBlockObject_type = {
@@ -125,10 +149,15 @@ static const rb_data_type_t MemoryBlockObject_type = {
     .dmark = MemoryBlockObject_dmark,
     .dfree = MemoryBlockObject_dfree,
     .dsize = MemoryBlockObject_dsize,
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    .dcompact = MemoryBlockObject_dcompact,
+    .reserved = {0},
+#else
     .reserved = {0,0},
+#endif
   },
   .parent = 0,
-  .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+  .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED,
 };
 
 /* Allocate a MemoryBlockObject and return a pointer to allocated memory. */
@@ -144,10 +173,168 @@ mblock_alloc(void)
 
   self->type = NULL;
   self->xnd = NULL;
+  self->nbytes = 0;
 
   return self;
 }
 
+/* Return 1 if values of type t own memory through pointers. */
+static int
+type_has_pointers(const ndt_t *t)
+{
+  int64_t i;
+
+  switch (t->tag) {
+  case FixedDim:
+    return type_has_pointers(t->FixedDim.type);
+  case VarDim:
+    return type_has_pointers(t->VarDim.type);
+  case Constr:
+    return type_has_pointers(t->Constr.type);
+  case Nominal:
+    return type_has_pointers(t->Nominal.type);
+  case Tuple:
+    for (i = 0; i < t->Tuple.shape; i++) {
+      if (type_has_pointers(t->Tuple.types[i])) {
+        return 1;
+      }
+    }
+    return 0;
+  case Record:
+    for (i = 0; i < t->Record.shape; i++) {
+      if (type_has_pointers(t->Record.types[i])) {
+        return 1;
+      }
+    }
+    return 0;
+  case Ref: case String: case Bytes:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/* Bytes allocated behind the pointers of x: string and bytes payloads and
+   the targets of references. */
+static size_t
+_XND_pointer_nbytes(const xnd_t * const x)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  const ndt_t * const t = x->type;
+  size_t size = 0;
+  int64_t i;
+
+  if (xnd_is_na(x)) {
+    return 0;
+  }
+
+  switch (t->tag) {
+  case FixedDim: {
+    for (i = 0; i < t->FixedDim.shape; i++) {
+      const xnd_t next = xnd_fixed_dim_next(x, i);
+      size += _XND_pointer_nbytes(&next);
+    }
+    return size;
+  }
+
+  case VarDim: {
+    int64_t start, step, shape;
+
+    shape = ndt_var_indices(&start, &step, t, x->index, &ctx);
+    for (i = 0; i < shape; i++) {
+      const xnd_t next = xnd_var_dim_next(x, start, step, i);
+      size += _XND_pointer_nbytes(&next);
+    }
+    ndt_context_del(&ctx);
+    return size;
+  }
+
+  case Tuple: case Record: {
+    const int64_t shape = t->tag == Tuple ? t->Tuple.shape : t->Record.shape;
+
+    for (i = 0; i < shape; i++) {
+      const xnd_t next = t->tag == Tuple ?
+        xnd_tuple_next(x, i, &ctx) : xnd_record_next(x, i, &ctx);
+      if (next.ptr == NULL) {
+        ndt_context_del(&ctx);
+        return size;
+      }
+      size += _XND_pointer_nbytes(&next);
+    }
+    return size;
+  }
+
+  case Ref: {
+    const xnd_t next = xnd_ref_next(x, &ctx);
+    if (next.ptr == NULL) {
+      ndt_context_del(&ctx);
+      return 0;
+    }
+    return (size_t)t->Ref.type->datasize + _XND_pointer_nbytes(&next);
+  }
+
+  case Constr: {
+    const xnd_t next = xnd_constr_next(x, &ctx);
+    return next.ptr == NULL ? 0 : _XND_pointer_nbytes(&next);
+  }
+
+  case Nominal: {
+    const xnd_t next = xnd_nominal_next(x, &ctx);
+    return next.ptr == NULL ? 0 : _XND_pointer_nbytes(&next);
+  }
+
+  case String: {
+    const char *s = XND_POINTER_DATA(x->ptr);
+    return s ? strlen(s) + 1 : 0;
+  }
+
+  case Bytes: {
+    return XND_BYTES_DATA(x->ptr) ? (size_t)XND_BYTES_SIZE(x->ptr) : 0;
+  }
+
+  default:
+    return 0;
+  }
+}
+
+/* Approximate number of bytes owned by the master buffer x: the data, the
+   validity bitmaps and, if walk_pointers is set, everything allocated
+   behind pointers. */
+static size_t
+xnd_master_nbytes(const xnd_master_t *x, int walk_pointers)
+{
+  const ndt_t * const t = x->master.type;
+  size_t size = (size_t)t->datasize;
+
+  if (ndt_is_optional(t) || ndt_subtree_is_optional(t)) {
+    const ndt_t * const dtype = ndt_dtype(t);
+    const int64_t nelems = dtype->datasize > 0 ? t->datasize / dtype->datasize
+                                               : t->datasize;
+    size += (size_t)(nelems + 7) / 8;
+  }
+
+  if (walk_pointers && type_has_pointers(t)) {
+    size += _XND_pointer_nbytes(&x->master);
+  }
+
+  return size;
+}
+
+/* Measure the memory owned by the mblock and report the change to the GC so
+   that large native buffers create allocation pressure. Pointer payloads
+   replaced later through XND#[]= are not re-measured. */
+static void
+mblock_account(MemoryBlockObject *mblock_p, int walk_pointers)
+{
+  const size_t nbytes = mblock_p->xnd == NULL ? 0 :
+    xnd_master_nbytes(mblock_p->xnd, walk_pointers);
+
+#ifdef HAVE_RB_GC_ADJUST_MEMORY_USAGE
+  rb_gc_adjust_memory_usage((ssize_t)nbytes - (ssize_t)mblock_p->nbytes);
+#endif
+  mblock_p->nbytes = nbytes;
+}
+
 /* Allocate a MemoryBlockObject and wrap it in a Ruby object. */
 static VALUE
 mblock_allocate(void)
@@ -163,21 +350,27 @@ mblock_empty(VALUE type)
 {
   NDT_STATIC_CONTEXT(ctx);
   MemoryBlockObject *mblock_p;
+  VALUE mblock;
   
   if (!rb_ndtypes_check_type(type)) {
     rb_raise(rb_eArgError, "require NDT object to create mblock in mblock_empty.");
   }
 
-  mblock_p = mblock_alloc();
+  mblock = mblock_allocate();
+  GET_MBLOCK(mblock, mblock_p);
+
   mblock_p->xnd = xnd_empty_from_type(
                                       rb_ndtypes_const_ndt(type),
                                       XND_OWN_EMBEDDED, &ctx);
   if (mblock_p->xnd == NULL) {
     rb_raise(rb_eValueError, "cannot create mblock object from given type.");
   }
-  mblock_p->type = type;
+  RB_OBJ_WRITE(mblock, &mblock_p->type, type);
 
-  return WRAP_MBLOCK(cRubyXND_MBlock, mblock_p);
+  /* a fresh buffer has no pointer payloads yet */
+  mblock_account(mblock_p, 0);
+
+  return mblock;
 }
 
 static VALUE
@@ -199,8 +392,9 @@ mblock_from_xnd(xnd_t *src)
 
   GET_MBLOCK(mblock, mblock_p);
 
-  mblock_p->type = type;
+  RB_OBJ_WRITE(mblock, &mblock_p->type, type);
   mblock_p->xnd = x;
+  mblock_account(mblock_p, 1);
 
   return mblock;
 }
@@ -854,6 +1048,9 @@ mblock_from_typed_value(VALUE type, VALUE data)
   mblock = mblock_empty(type);
   GET_MBLOCK(mblock, mblock_p); 
   mblock_init(&mblock_p->xnd->master, data);
+  if (type_has_pointers(mblock_p->xnd->master.type)) {
+    mblock_account(mblock_p, 1);
+  }
 
   return mblock;
 }
@@ -906,9 +1103,21 @@ XndObject_dmark(void *self)
 {
   XndObject *xnd = (XndObject*)self;
 
-  rb_gc_mark(xnd->type);
-  rb_gc_mark(xnd->mblock);
+  rb_gc_mark_movable(xnd->type);
+  rb_gc_mark_movable(xnd->mblock);
+}
+
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+/* Update references moved by GC.compact. */
+static void
+XndObject_dcompact(void *self)
+{
+  XndObject *xnd = (XndObject*)self;
+
+  xnd->type = rb_gc_location(xnd->type);
+  xnd->mblock = rb_gc_location(xnd->mblock);
 }
+#endif
 
 static void
 XndObject_dfree(void *self)
@@ -919,10 +1128,23 @@ XndObject_dfree(void *self)
   xfree(xnd);
 }
 
+/* An XND that views the whole memory block reports the size of the buffer.
+   Sub-views share it and only report themselves, so that summing over all
+   objects does not count a buffer twice. */
 static size_t
 XndObject_dsize(const void *self)
 {
-  return sizeof(XndObject);
+  const XndObject *xnd = (const XndObject*)self;
+  size_t size = sizeof(XndObject);
+
+  if (xnd->mblock) {
+    const MemoryBlockObject *mblock_p = RTYPEDDATA_DATA(xnd->mblock);
+    if (mblock_p != NULL && mblock_p->type == xnd->type) {
+      size += mblock_p->nbytes;
+    }
+  }
+
+  return size;
 }
 
 static const rb_data_type_t XndObject_type = {
@@ -931,21 +1153,27 @@ static const rb_data_type_t XndObject_type = {
     .dmark = XndObject_dmark,
     .dfree = XndObject_dfree,
     .dsize = XndObject_dsize,
+#ifdef HAVE_RB_GC_MARK_MOVABLE
+    .dcompact = XndObject_dcompact,
+    .reserved = {0},
+#else
     .reserved = {0,0},
+#endif
   },
   .parent = 0,
-  .flags = RUBY_TYPED_FREE_IMMEDIATELY,
+  .flags = RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED,
 };
 
+/* Make the XND object self (with struct xnd_p) a view of the whole mblock. */
 static void
-XND_from_mblock(XndObject *xnd_p, VALUE mblock)
+XND_from_mblock(VALUE self, XndObject *xnd_p, VALUE mblock)
 {
   MemoryBlockObject *mblock_p;
 
   GET_MBLOCK(mblock, mblock_p);
   
-  xnd_p->mblock = mblock;
-  xnd_p->type = mblock_p->type;
+  RB_OBJ_WRITE(self, &xnd_p->mblock, mblock);
+  RB_OBJ_WRITE(self, &xnd_p->type, mblock_p->type);
   xnd_p->xnd = mblock_p->xnd->master;
 }
 
@@ -979,7 +1207,7 @@ RubyXND_initialize(VALUE self, VALUE type, VALUE data)
   mblock = mblock_from_typed_value(type, data);
   GET_XND(self, xnd_p);
 
-  XND_from_mblock(xnd_p, mblock);
+  XND_from_mblock(self, xnd_p, mblock);
   rb_xnd_gc_guard_register(xnd_p, mblock);
 
 #ifdef XND_DEBUG
@@ -1420,8 +1648,8 @@ RubyXND_view_move_type(XndObject *src_p, xnd_t *x)
   view = XndObject_alloc();
   GET_XND(view, view_p);
 
-  view_p->mblock = src_p->mblock;
-  view_p->type = type;
+  RB_OBJ_WRITE(view, &view_p->mblock, src_p->mblock);
+  RB_OBJ_WRITE(view, &view_p->type, type);
   view_p->xnd = *x;
 
   rb_xnd_gc_guard_register(view_p, view_p->mblock);
@@ -1592,42 +1820,716 @@ XND_eqeq(VALUE self, VALUE other)
   }
 }
 
-/* Implement Ruby spaceship operator. */
-static VALUE
-XND_spaceship(VALUE self, VALUE other)
+/* Scalar kinds used for ordering leaves of possibly different types. */
+enum cmp_kind { CMP_SIGNED, CMP_UNSIGNED, CMP_FLOAT, CMP_OTHER };
+
+typedef struct {
+  enum cmp_kind kind;
+  int64_t i;
+  uint64_t u;
+  double d;
+} cmp_scalar_t;
+
+static int
+cmp_load_scalar(const xnd_t * const x, cmp_scalar_t *s)
+{
+  const ndt_t * const t = x->type;
+
+  switch (t->tag) {
+  case Bool: {
+    bool temp;
+    UNPACK_SINGLE(temp, x->ptr, bool, t->flags);
+    s->kind = CMP_SIGNED; s->i = temp;
+    return 0;
+  }
+  case Int8: {
+    int8_t temp;
+    UNPACK_SINGLE(temp, x->ptr, int8_t, t->flags);
+    s->kind = CMP_SIGNED; s->i = temp;
+    return 0;
+  }
+  case Int16: {
+    int16_t temp;
+    UNPACK_SINGLE(temp, x->ptr, int16_t, t->flags);
+    s->kind = CMP_SIGNED; s->i = temp;
+    return 0;
+  }
+  case Int32: {
+    int32_t temp;
+    UNPACK_SINGLE(temp, x->ptr, int32_t, t->flags);
+    s->kind = CMP_SIGNED; s->i = temp;
+    return 0;
+  }
+  case Int64: {
+    int64_t temp;
+    UNPACK_SINGLE(temp, x->ptr, int64_t, t->flags);
+    s->kind = CMP_SIGNED; s->i = temp;
+    return 0;
+  }
+  case Uint8: {
+    uint8_t temp;
+    UNPACK_SINGLE(temp, x->ptr, uint8_t, t->flags);
+    s->kind = CMP_UNSIGNED; s->u = temp;
+    return 0;
+  }
+  case Uint16: {
+    uint16_t temp;
+    UNPACK_SINGLE(temp, x->ptr, uint16_t, t->flags);
+    s->kind = CMP_UNSIGNED; s->u = temp;
+    return 0;
+  }
+  case Uint32: {
+    uint32_t temp;
+    UNPACK_SINGLE(temp, x->ptr, uint32_t, t->flags);
+    s->kind = CMP_UNSIGNED; s->u = temp;
+    return 0;
+  }
+  case Uint64: {
+    uint64_t temp;
+    UNPACK_SINGLE(temp, x->ptr, uint64_t, t->flags);
+    s->kind = CMP_UNSIGNED; s->u = temp;
+    return 0;
+  }
+  case Float32: {
+    float temp = 0.0;
+    rb_xnd_unpack_float32(&temp, (unsigned char*)x->ptr, le(t->flags));
+    s->kind = CMP_FLOAT; s->d = temp;
+    return 0;
+  }
+  case Float64: {
+    double temp = 0.0;
+    rb_xnd_unpack_float64(&temp, (unsigned char*)x->ptr, le(t->flags));
+    s->kind = CMP_FLOAT; s->d = temp;
+    return 0;
+  }
+  default:
+    s->kind = CMP_OTHER;
+    return -1;
+  }
+}
+
+#define CMP3(a, b) (((a) > (b)) - ((a) < (b)))
+#define CMP_IS_DIM(t) ((t)->tag == FixedDim || (t)->tag == VarDim)
+
+/* Order two scalars. Returns -1 if they are incomparable (NaN). */
+static int
+cmp_scalars(const cmp_scalar_t *a, const cmp_scalar_t *b, int *result)
+{
+  if (a->kind == CMP_FLOAT || b->kind == CMP_FLOAT) {
+    double l = a->kind == CMP_FLOAT ? a->d :
+               a->kind == CMP_SIGNED ? (double)a->i : (double)a->u;
+    double r = b->kind == CMP_FLOAT ? b->d :
+               b->kind == CMP_SIGNED ? (double)b->i : (double)b->u;
+
+    if (isnan(l) || isnan(r)) {
+      return -1;
+    }
+    *result = CMP3(l, r);
+    return 0;
+  }
+
+  if (a->kind == CMP_SIGNED && b->kind == CMP_SIGNED) {
+    *result = CMP3(a->i, b->i);
+  }
+  else if (a->kind == CMP_UNSIGNED && b->kind == CMP_UNSIGNED) {
+    *result = CMP3(a->u, b->u);
+  }
+  else if (a->kind == CMP_SIGNED) {
+    *result = a->i < 0 ? -1 : CMP3((uint64_t)a->i, b->u);
+  }
+  else {
+    *result = b->i < 0 ? 1 : CMP3(a->u, (uint64_t)b->i);
+  }
+
+  return 0;
+}
+
+static int
+cmp_bytes(const void *a, size_t alen, const void *b, size_t blen)
 {
-  rb_raise(rb_eNotImpError, "spaceship not implemented yet.");
+  int c = memcmp(a, b, alen < blen ? alen : blen);
 
-  return Qnil;
+  if (c != 0) {
+    return c < 0 ? -1 : 1;
+  }
+  return CMP3(alen, blen);
 }
 
-/* XND#strict_equal */
-static VALUE
-XND_strict_equal(VALUE self, VALUE other)
+/* Lexicographic comparison of x and y. Dimensions are compared element by
+   element with the shorter one ordering first on a common prefix; tuples and
+   records are compared field by field. Returns -1 if the values are not
+   comparable (mismatched kinds, NA or NaN). */
+static int
+_XND_cmp(const xnd_t * const x, const xnd_t * const y, int *result)
 {
   NDT_STATIC_CONTEXT(ctx);
-  XndObject *left_p, *right_p;
-  int r;
+  const ndt_t * const t = x->type;
+  const ndt_t * const u = y->type;
+  cmp_scalar_t a, b;
 
-  if (!XND_CHECK_TYPE(other)) {
-    rb_raise(rb_eArgError, "argument type has to be XND.");
+  if (!ndt_is_concrete(t) || !ndt_is_concrete(u)) {
+    rb_raise(rb_eTypeError, "types must be concrete for comparison.");
   }
-  
-  GET_XND(self, left_p);
-  GET_XND(other, right_p);
 
-  r = xnd_strict_equal(XND(left_p), XND(right_p), &ctx);
-  if (r < 0) {
-    seterr(&ctx);
-    raise_error();
+  if (xnd_is_na(x) || xnd_is_na(y)) {
+    return -1;
   }
 
-  if (r) {
-    return Qtrue;
+  switch (t->tag) {
+  case Ref: {
+    const xnd_t next = xnd_ref_next(x, &ctx);
+    if (next.ptr == NULL) {
+      seterr(&ctx);
+      raise_error();
+    }
+    return _XND_cmp(&next, y, result);
   }
-  else {
-    return Qfalse;
+
+  case Constr: {
+    const xnd_t next = xnd_constr_next(x, &ctx);
+    if (next.ptr == NULL) {
+      seterr(&ctx);
+      raise_error();
+    }
+    return _XND_cmp(&next, y, result);
+  }
+
+  case Nominal: {
+    const xnd_t next = xnd_nominal_next(x, &ctx);
+    if (next.ptr == NULL) {
+      seterr(&ctx);
+      raise_error();
+    }
+    return _XND_cmp(&next, y, result);
+  }
+
+  default:
+    break;
   }
+
+  switch (u->tag) {
+  case Ref: {
+    const xnd_t next = xnd_ref_next(y, &ctx);
+    if (next.ptr == NULL) {
+      seterr(&ctx);
+      raise_error();
+    }
+    return _XND_cmp(x, &next, result);
+  }
+
+  case Constr: {
+    const xnd_t next = xnd_constr_next(y, &ctx);
+    if (next.ptr == NULL) {
+      seterr(&ctx);
+      raise_error();
+    }
+    return _XND_cmp(x, &next, result);
+  }
+
+  case Nominal: {
+    const xnd_t next = xnd_nominal_next(y, &ctx);
+    if (next.ptr == NULL) {
+      seterr(&ctx);
+      raise_error();
+    }
+    return _XND_cmp(x, &next, result);
+  }
+
+  default:
+    break;
+  }
+
+  if (CMP_IS_DIM(t) || CMP_IS_DIM(u)) {
+    int64_t xstart = 0, xstep = 0, xshape;
+    int64_t ystart = 0, ystep = 0, yshape;
+    int64_t i;
+
+    if (!CMP_IS_DIM(t) || !CMP_IS_DIM(u)) {
+      return -1;
+    }
+
+    if (t->tag == VarDim) {
+      xshape = ndt_var_indices(&xstart, &xstep, t, x->index, &ctx);
+      if (xshape < 0) {
+        seterr(&ctx);
+        raise_error();
+      }
+    }
+    else {
+      xshape = t->FixedDim.shape;
+    }
+
+    if (u->tag == VarDim) {
+      yshape = ndt_var_indices(&ystart, &ystep, u, y->index, &ctx);
+      if (yshape < 0) {
+        seterr(&ctx);
+        raise_error();
+      }
+    }
+    else {
+      yshape = u->FixedDim.shape;
+    }
+
+    for (i = 0; i < xshape && i < yshape; i++) {
+      const xnd_t xnext = t->tag == VarDim ?
+        xnd_var_dim_next(x, xstart, xstep, i) : xnd_fixed_dim_next(x, i);
+      const xnd_t ynext = u->tag == VarDim ?
+        xnd_var_dim_next(y, ystart, ystep, i) : xnd_fixed_dim_next(y, i);
+
+      if (_XND_cmp(&xnext, &ynext, result) < 0) {
+        return -1;
+      }
+      if (*result != 0) {
+        return 0;
+      }
+    }
+
+    *result = CMP3(xshape, yshape);
+    return 0;
+  }
+
+  switch (t->tag) {
+  case Tuple: case Record: {
+    int64_t shape, i;
+
+    if (u->tag != t->tag) {
+      return -1;
+    }
+
+    shape = t->tag == Tuple ? t->Tuple.shape : t->Record.shape;
+    if (shape != (u->tag == Tuple ? u->Tuple.shape : u->Record.shape)) {
+      return -1;
+    }
+
+    for (i = 0; i < shape; i++) {
+      const xnd_t xnext = t->tag == Tuple ?
+        xnd_tuple_next(x, i, &ctx) : xnd_record_next(x, i, &ctx);
+      const xnd_t ynext = t->tag == Tuple ?
+        xnd_tuple_next(y, i, &ctx) : xnd_record_next(y, i, &ctx);
+
+      if (xnext.ptr == NULL || ynext.ptr == NULL) {
+        seterr(&ctx);
+        raise_error();
+      }
+
+      if (_XND_cmp(&xnext, &ynext, result) < 0) {
+        return -1;
+      }
+      if (*result != 0) {
+        return 0;
+      }
+    }
+
+    *result = 0;
+    return 0;
+  }
+
+  case String: {
+    const char *s = XND_POINTER_DATA(x->ptr);
+    const char *r = XND_POINTER_DATA(y->ptr);
+
+    if (u->tag != String) {
+      return -1;
+    }
+
+    *result = cmp_bytes(s ? s : "", s ? strlen(s) : 0,
+                        r ? r : "", r ? strlen(r) : 0);
+    return 0;
+  }
+
+  case Bytes: {
+    if (u->tag != Bytes) {
+      return -1;
+    }
+
+    *result = cmp_bytes(XND_BYTES_DATA(x->ptr), (size_t)XND_BYTES_SIZE(x->ptr),
+                        XND_BYTES_DATA(y->ptr), (size_t)XND_BYTES_SIZE(y->ptr));
+    return 0;
+  }
+
+  case FixedString: case FixedBytes: {
+    if (u->tag != t->tag) {
+      return -1;
+    }
+
+    *result = cmp_bytes(x->ptr, (size_t)t->datasize, y->ptr, (size_t)u->datasize);
+    return 0;
+  }
+
+  default:
+    break;
+  }
+
+  if (cmp_load_scalar(x, &a) < 0 || cmp_load_scalar(y, &b) < 0) {
+    return -1;
+  }
+
+  return cmp_scalars(&a, &b, result);
+}
+
+/* Implement Ruby spaceship operator. Returns nil if the objects cannot be
+   ordered, which makes Comparable and Array#sort raise as they should. */
+static VALUE
+XND_spaceship(VALUE self, VALUE other)
+{
+  XndObject *left_p, *right_p;
+  int result;
+
+  if (!XND_CHECK_TYPE(other)) {
+    return Qnil;
+  }
+
+  GET_XND(self, left_p);
+  GET_XND(other, right_p);
+
+  if (_XND_cmp(XND(left_p), XND(right_p), &result) < 0) {
+    return Qnil;
+  }
+
+  return INT2FIX(result);
+}
+
+/* XND#strict_equal */
+static VALUE
+XND_strict_equal(VALUE self, VALUE other)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  XndObject *left_p, *right_p;
+  int r;
+
+  if (!XND_CHECK_TYPE(other)) {
+    rb_raise(rb_eArgError, "argument type has to be XND.");
+  }
+  
+  GET_XND(self, left_p);
+  GET_XND(other, right_p);
+
+  r = xnd_strict_equal(XND(left_p), XND(right_p), &ctx);
+  if (r < 0) {
+    seterr(&ctx);
+    raise_error();
+  }
+
+  if (r) {
+    return Qtrue;
+  }
+  else {
+    return Qfalse;
+  }
+}
+
+/*************************** hashing ********************************/
+
+/* Marker fed into the hash in place of a missing value. */
+#define HASH_NA_MARKER 0x4e41u
+
+/* Return true if the raw bytes of a scalar of type t fully determine its
+   value. Floats are excluded since 0.0 and -0.0 compare equal. */
+static int
+hash_is_raw_dtype(const ndt_t *t)
+{
+  if (ndt_is_optional(t)) {
+    return 0;
+  }
+
+  switch (t->tag) {
+  case Bool:
+  case Int8: case Int16: case Int32: case Int64:
+  case Uint8: case Uint16: case Uint32: case Uint64:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/* If x is a C-contiguous array of raw scalars, set *ptr and *nbytes to the
+   memory block holding its data and return true. */
+static int
+hash_contiguous_block(const xnd_t *x, const char **ptr, int64_t *nbytes)
+{
+  const ndt_t *t = x->type;
+  const ndt_t *dtype;
+  int64_t n = 1;
+
+  if (t->tag != FixedDim || !ndt_is_c_contiguous(t)) {
+    return 0;
+  }
+
+  for (dtype = t; dtype->tag == FixedDim; dtype = dtype->FixedDim.type) {
+    if (ndt_is_optional(dtype)) {
+      return 0;
+    }
+    n *= dtype->FixedDim.shape;
+  }
+
+  if (!hash_is_raw_dtype(dtype)) {
+    return 0;
+  }
+
+  *ptr = x->ptr + x->index * dtype->datasize;
+  *nbytes = n * dtype->datasize;
+
+  return 1;
+}
+
+/* Feed a float into the hash, mapping -0.0 to 0.0. */
+static void
+hash_double(content_hash_t *state, double d)
+{
+  uint64_t bits;
+
+  if (d == 0.0) {
+    d = 0.0;
+  }
+
+  memcpy(&bits, &d, sizeof(bits));
+  rb_xnd_content_hash_u64(state, bits);
+}
+
+/* Feed the data of x into the hash. Contiguous blocks of integers are hashed
+   in one go, everything else is visited element by element. */
+static void
+_XND_hash(const xnd_t * const x, content_hash_t *state)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  const ndt_t * const t = x->type;
+  const char *block;
+  int64_t nbytes;
+
+  if (!ndt_is_concrete(t)) {
+    rb_raise(rb_eTypeError, "type must be concrete for hashing.");
+  }
+
+  if (xnd_is_na(x)) {
+    rb_xnd_content_hash_u64(state, HASH_NA_MARKER);
+    return;
+  }
+
+  if (hash_contiguous_block(x, &block, &nbytes)) {
+    rb_xnd_content_hash_update(state, block, (size_t)nbytes);
+    return;
+  }
+
+  switch (t->tag) {
+  case FixedDim: {
+    int64_t i;
+
+    for (i = 0; i < t->FixedDim.shape; i++) {
+      const xnd_t next = xnd_fixed_dim_next(x, i);
+      _XND_hash(&next, state);
+    }
+    return;
+  }
+
+  case VarDim: {
+    int64_t start, step, shape;
+    int64_t i;
+
+    shape = ndt_var_indices(&start, &step, t, x->index, &ctx);
+    if (shape < 0) {
+      seterr(&ctx);
+      raise_error();
+    }
+
+    rb_xnd_content_hash_u64(state, (uint64_t)shape);
+    for (i = 0; i < shape; i++) {
+      const xnd_t next = xnd_var_dim_next(x, start, step, i);
+      _XND_hash(&next, state);
+    }
+    return;
+  }
+
+  case Tuple: {
+    int64_t i;
+
+    for (i = 0; i < t->Tuple.shape; i++) {
+      const xnd_t next = xnd_tuple_next(x, i, &ctx);
+      if (next.ptr == NULL) {
+        seterr(&ctx);
+        raise_error();
+      }
+      _XND_hash(&next, state);
+    }
+    return;
+  }
+
+  case Record: {
+    int64_t i;
+
+    for (i = 0; i < t->Record.shape; i++) {
+      const xnd_t next = xnd_record_next(x, i, &ctx);
+      if (next.ptr == NULL) {
+        seterr(&ctx);
+        raise_error();
+      }
+      _XND_hash(&next, state);
+    }
+    return;
+  }
+
+  case Ref: {
+    const xnd_t next = xnd_ref_next(x, &ctx);
+    if (next.ptr == NULL) {
+      seterr(&ctx);
+      raise_error();
+    }
+
+    _XND_hash(&next, state);
+    return;
+  }
+
+  case Constr: {
+    const xnd_t next = xnd_constr_next(x, &ctx);
+    if (next.ptr == NULL) {
+      seterr(&ctx);
+      raise_error();
+    }
+
+    _XND_hash(&next, state);
+    return;
+  }
+
+  case Nominal: {
+    const xnd_t next = xnd_nominal_next(x, &ctx);
+    if (next.ptr == NULL) {
+      seterr(&ctx);
+      raise_error();
+    }
+
+    _XND_hash(&next, state);
+    return;
+  }
+
+  case Bool:
+  case Int8: case Int16: case Int32: case Int64:
+  case Uint8: case Uint16: case Uint32: case Uint64:
+  case Categorical: {
+    rb_xnd_content_hash_update(state, x->ptr, (size_t)t->datasize);
+    return;
+  }
+
+  case Float32: {
+    float temp = 0.0;
+
+    rb_xnd_unpack_float32(&temp, (unsigned char*)x->ptr, le(t->flags));
+    hash_double(state, temp);
+    return;
+  }
+
+  case Float64: {
+    double temp = 0.0;
+
+    rb_xnd_unpack_float64(&temp, (unsigned char*)x->ptr, le(t->flags));
+    hash_double(state, temp);
+    return;
+  }
+
+  case Complex64: {
+    float real = 0.0, imag = 0.0;
+
+    rb_xnd_unpack_float32(&real, (unsigned char*)x->ptr, le(t->flags));
+    rb_xnd_unpack_float32(&imag, (unsigned char*)x->ptr+4, le(t->flags));
+    hash_double(state, real);
+    hash_double(state, imag);
+    return;
+  }
+
+  case Complex128: {
+    double real = 0.0, imag = 0.0;
+
+    rb_xnd_unpack_float64(&real, (unsigned char*)x->ptr, le(t->flags));
+    rb_xnd_unpack_float64(&imag, (unsigned char*)x->ptr+8, le(t->flags));
+    hash_double(state, real);
+    hash_double(state, imag);
+    return;
+  }
+
+  case FixedString: case FixedBytes: {
+    /* unused trailing bytes are always zeroed by mblock_init(). */
+    rb_xnd_content_hash_update(state, x->ptr, (size_t)t->datasize);
+    return;
+  }
+
+  case String: {
+    const char *s = XND_POINTER_DATA(x->ptr);
+    size_t size = s ? strlen(s) : 0;
+
+    rb_xnd_content_hash_u64(state, size);
+    rb_xnd_content_hash_update(state, s, size);
+    return;
+  }
+
+  case Bytes: {
+    const uint8_t *s = XND_BYTES_DATA(x->ptr);
+    size_t size = s ? (size_t)XND_BYTES_SIZE(x->ptr) : 0;
+
+    rb_xnd_content_hash_u64(state, size);
+    rb_xnd_content_hash_update(state, s, size);
+    return;
+  }
+
+  default: {
+    rb_raise(rb_eNotImpError, "hashing is not implemented for this type.");
+  }
+  }
+}
+
+/* Compute the content hash of an XND object. The serialized type is hashed
+   first so that objects with equal bytes but different types do not collide. */
+static uint64_t
+XND_content_hash(VALUE self)
+{
+  NDT_STATIC_CONTEXT(ctx);
+  XndObject *xnd_p;
+  content_hash_t state;
+  char *bytes;
+  int64_t size;
+
+  GET_XND(self, xnd_p);
+
+  size = ndt_serialize(&bytes, XND(xnd_p)->type, &ctx);
+  if (size < 0) {
+    seterr(&ctx);
+    raise_error();
+  }
+
+  rb_xnd_content_hash_init(&state, CONTENT_HASH_SEED);
+  rb_xnd_content_hash_update(&state, bytes, (size_t)size);
+  ndt_free(bytes);
+
+  _XND_hash(XND(xnd_p), &state);
+
+  return rb_xnd_content_hash_final(&state);
+}
+
+/* Implement XND#hash. Consistent with #eql?, which is #strict_equal. */
+static VALUE
+XND_hash(VALUE self)
+{
+  return ST2FIX(XND_content_hash(self));
+}
+
+/* Implement XND#eql?. Unlike #strict_equal, returns false for non-XND objects. */
+static VALUE
+XND_eql(VALUE self, VALUE other)
+{
+  if (!XND_CHECK_TYPE(other)) {
+    return Qfalse;
+  }
+
+  return XND_strict_equal(self, other);
+}
+
+/* Implement XND#digest. Returns the content hash as a hex String that is
+   stable across processes and can be used for deduplication. */
+static VALUE
+XND_digest(VALUE self)
+{
+  char buf[17];
+
+  snprintf(buf, sizeof(buf), "%016" PRIx64, XND_content_hash(self));
+
+  return rb_usascii_str_new(buf, 16);
 }
 
 static size_t
@@ -1803,7 +2705,7 @@ XND_s_empty(VALUE klass, VALUE type)
   type = rb_ndtypes_from_object(type);
   mblock = mblock_empty(type);
 
-  XND_from_mblock(self_p, mblock);
+  XND_from_mblock(self, self_p, mblock);
   rb_xnd_gc_guard_register(self_p, mblock);
 
   return self;
@@ -1862,7 +2764,7 @@ rb_xnd_from_xnd(xnd_t *x)
   xnd = XndObject_alloc();
   GET_XND(xnd, xnd_p);
   
-  XND_from_mblock(xnd_p, mblock);
+  XND_from_mblock(xnd, xnd_p, mblock);
   rb_xnd_gc_guard_register(xnd_p, mblock);
 
   return xnd;
@@ -1883,7 +2785,7 @@ rb_xnd_empty_from_type(ndt_t *t)
   GET_XND(xnd, xnd_p);
   rb_xnd_gc_guard_register(xnd_p, mblock);
 
-  XND_from_mblock(xnd_p, mblock);
+  XND_from_mblock(xnd, xnd_p, mblock);
 
   return xnd;
 }
@@ -1934,6 +2836,9 @@ void Init_ruby_xnd(void)
   rb_define_method(cXND, "<=>", XND_spaceship, 1);
   rb_define_method(cXND, "strict_equal", XND_strict_equal, 1);
   rb_define_method(cXND, "size", XND_size, 0);
+  rb_define_method(cXND, "hash", XND_hash, 0);
+  rb_define_method(cXND, "eql?", XND_eql, 1);
+  rb_define_method(cXND, "digest", XND_digest, 0);
 
   /* iterators */
   rb_define_method(cXND, "each", XND_each, 0);
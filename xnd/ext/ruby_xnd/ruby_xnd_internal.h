@@ -51,6 +51,7 @@
 #include "ruby_xnd.h"
 #include "util.h"
 #include "float_pack_unpack.h"
+#include "content_hash.h"
 
 extern VALUE mRubyXND_GCGuard;
 
@@ -61,6 +62,11 @@ typedef struct MemoryBlockObject MemoryBlockObject;
 #include "gc_guard.h"
 
 /* macros */
+/* Ruby < 2.7 has no compaction: movable marks degrade to pinning marks. */
+#ifndef HAVE_RB_GC_MARK_MOVABLE
+#define rb_gc_mark_movable(v) rb_gc_mark(v)
+#endif
+
 #if SIZEOF_LONG == SIZEOF_VOIDP
 # define PTR2NUM(x)   (LONG2NUM((long)(x)))
 # define NUM2PTR(x)   ((void*)(NUM2ULONG(x)))
@@ -8,3 +8,35 @@ describe RubyXND::GCGuard do
     expect(gc_table.keys.size >= 1).to eq(true)
   end
 end
+
+describe "write barriers" do
+  it "marks XND objects and their views as WB-protected" do
+    require 'objspace'
+
+    x = XND.new [[1,2,3], [4,5,6]]
+    y = x[1]
+
+    [x, y, x.type].each do |obj|
+      expect(ObjectSpace.dump(obj)).to include('"wb_protected":true')
+    end
+  end
+end
+
+describe "GC.compact" do
+  it "keeps XND objects, views and their types valid when objects move" do
+    skip "GC.compact is not supported" unless GC.respond_to?(:verify_compaction_references)
+
+    data = [[1, 2, 3], [4, 5, 6]]
+    xs = Array.new(500) { XND.new data, type: "2 * 3 * int64" }
+    views = xs.map { |x| x[1] }
+    strs = Array.new(100) { |i| XND.new ["a#{i}", "b#{i}"] }
+
+    3.times do
+      GC.verify_compaction_references(toward: :empty)
+
+      expect(xs.all? { |x| x.value == data }).to eq(true)
+      expect(views.all? { |v| v.value == [4, 5, 6] && v.type == NDT.new("3 * int64") }).to eq(true)
+      expect(strs.each_with_index.all? { |s, i| s.value == ["a#{i}", "b#{i}"] }).to eq(true)
+    end
+  end
+end
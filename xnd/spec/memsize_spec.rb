@@ -0,0 +1,33 @@
+require 'spec_helper'
+require 'objspace'
+
+describe "XND memory reporting" do
+  it "reports the size of the whole buffer on the owning XND" do
+    x = XND.empty "1000000 * float64"
+
+    expect(ObjectSpace.memsize_of(x)).to be >= 8_000_000
+  end
+
+  it "counts string payloads" do
+    s = "x" * 1000
+    x = XND.new [s] * 100, type: "100 * string"
+
+    expect(ObjectSpace.memsize_of(x)).to be >= 100 * 1000
+  end
+
+  it "does not report the shared buffer on sub-views" do
+    x = XND.empty "1000 * 1000 * float64"
+    y = x[0]
+
+    expect(ObjectSpace.memsize_of(y)).to be < 8_000
+  end
+
+  it "lets the GC reclaim dead buffers" do
+    GC.start
+    before = GC.count
+
+    200.times { XND.empty "1000000 * float64" }
+
+    expect(GC.count).to be > before
+  end
+end
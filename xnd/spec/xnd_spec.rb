@@ -2905,6 +2905,111 @@ nnn            }.to raise_error(NotImplementedError)
     end
   end # context #size
 
+  context "#hash" do
+    it "returns equal hashes for strictly equal objects" do
+      x = XND.new [[1,2,3], [4,5,6]], type: "2 * 3 * int64"
+      y = XND.new [[1,2,3], [4,5,6]], type: "2 * 3 * int64"
+
+      expect(x.hash).to eq(y.hash)
+    end
+
+    it "differs when the type differs" do
+      x = XND.new [1,2,3], type: "3 * int64"
+      y = XND.new [1,2,3], type: "3 * int32"
+
+      expect(x.hash).not_to eq(y.hash)
+    end
+
+    it "follows pointers of variable length strings" do
+      x = XND.new ["foo", "bar"], type: "2 * string"
+      y = XND.new ["foo", "baz"], type: "2 * string"
+      z = XND.new ["foo", "bar"], type: "2 * string"
+
+      expect(x.hash).not_to eq(y.hash)
+      expect(x.hash).to eq(z.hash)
+    end
+
+    it "treats 0.0 and -0.0 as equal" do
+      x = XND.new [0.0, 1.5], type: "2 * float64"
+      y = XND.new [-0.0, 1.5], type: "2 * float64"
+
+      expect(x.hash).to eq(y.hash)
+    end
+
+    it "hashes missing values" do
+      x = XND.new [1, nil, 3], type: "3 * ?int64"
+      y = XND.new [1, nil, 3], type: "3 * ?int64"
+
+      expect(x.hash).to eq(y.hash)
+    end
+
+    it "can be used as a Hash key" do
+      h = {}
+      h[XND.new([1.0, 2.0])] = :a
+      h[XND.new([1.0, 2.0])] = :b
+
+      expect(h.size).to eq(1)
+      expect(h[XND.new([1.0, 2.0])]).to eq(:b)
+    end
+  end # context #hash
+
+  context "#eql?" do
+    it "returns false for non-XND objects" do
+      x = XND.new [1,2,3]
+
+      expect(x.eql?([1,2,3])).to eq(false)
+    end
+  end # context #eql?
+
+  context "#digest" do
+    it "returns a stable hex String" do
+      x = XND.new [[1,2,3], [4,5,6]], type: "2 * 3 * int64"
+      y = XND.new [[1,2,3], [4,5,6]], type: "2 * 3 * int64"
+
+      expect(x.digest).to match(/\A[0-9a-f]{16}\z/)
+      expect(x.digest).to eq(y.digest)
+    end
+  end # context #digest
+
+  context "#<=>" do
+    it "orders scalars numerically across dtypes" do
+      expect(XND.new(1, type: "int8") <=> XND.new(2.5, type: "float64")).to eq(-1)
+      expect(XND.new(3, type: "uint64") <=> XND.new(-1, type: "int64")).to eq(1)
+      expect(XND.new(7, type: "int32") <=> XND.new(7, type: "int64")).to eq(0)
+    end
+
+    it "compares arrays lexicographically" do
+      x = XND.new [1, 2, 3], type: "3 * int64"
+      y = XND.new [1, 3], type: "2 * int64"
+      z = XND.new [1, 2], type: "2 * int64"
+
+      expect(x <=> y).to eq(-1)
+      expect(x <=> z).to eq(1)
+      expect(z <=> z).to eq(0)
+    end
+
+    it "compares strings and records" do
+      expect(XND.new("abc") <=> XND.new("abd")).to eq(-1)
+
+      t = "{a: int64, b: string}"
+      expect(XND.new({'a' => 1, 'b' => "z"}, type: t) <=>
+             XND.new({'a' => 1, 'b' => "y"}, type: t)).to eq(1)
+    end
+
+    it "returns nil for incomparable values" do
+      expect(XND.new([nil, 1], type: "2 * ?int64") <=>
+             XND.new([1, 1], type: "2 * ?int64")).to be_nil
+      expect(XND.new(1) <=> XND.new("1")).to be_nil
+      expect(XND.new(1) <=> 1).to be_nil
+    end
+
+    it "supports sorting Arrays of XND" do
+      values = [3, 1, 2].map { |v| XND.new v }
+
+      expect(values.sort.map(&:value)).to eq([1, 2, 3])
+    end
+  end # context #<=>
+
   context "#each" do
     context "FixedDim" do
       it "iterates over all elements" do